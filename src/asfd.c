@@ -16,48 +16,113 @@
 
 static size_t bufmaxsize=(ASYNC_BUF_LEN*2)+32;
 
+// Upper limit for network_read_buffer_size.
+#define READBUF_MAX	(16*1024*1024)
+
+// Value of each hex digit, or -1.
+static int8_t hexval[256];
+
+static void hexval_init(void)
+{
+	int i;
+	static int done=0;
+	if(done) return;
+	for(i=0; i<256; i++) hexval[i]=-1;
+	for(i=0; i<10; i++) hexval['0'+i]=i;
+	for(i=0; i<6; i++) hexval['A'+i]=hexval['a'+i]=10+i;
+	done=1;
+}
+
 static void truncate_readbuf(struct asfd *asfd)
 {
 	asfd->readbuf[0]='\0';
+	asfd->readbufstart=0;
 	asfd->readbuflen=0;
+	asfd->rbuf_view_len=0;
 }
 
-static int asfd_alloc_buf(char **buf)
+static int asfd_alloc_buf(char **buf, size_t len)
 {
-	if(!*buf && !(*buf=(char *)calloc_w(1, bufmaxsize, __func__)))
+	// One more for the terminating nul.
+	if(!*buf && !(*buf=(char *)calloc_w(1, len+1, __func__)))
 		return -1;
 	return 0;
 }
 
+static void readbuf_consumed(struct asfd *asfd, size_t len)
+{
+	asfd->readbufstart+=len;
+	// Nothing left, so the next read can start at the beginning for free.
+	if(asfd->readbufstart==asfd->readbuflen)
+		asfd->readbufstart=asfd->readbuflen=0;
+}
+
+// The unparsed data is only moved down to the start of readbuf when that is
+// cheap, or when there is little room left after it, rather than after every
+// message. With big frames, moving a part read message down before every
+// read would cost more than the reads.
+static void readbuf_make_room(struct asfd *asfd)
+{
+	size_t left;
+	if(!asfd->readbufstart) return;
+	left=asfd->readbuflen-asfd->readbufstart;
+	if(left>asfd->readbufstart
+	  && asfd->readbufmax-asfd->readbuflen>=ASYNC_BUF_LEN)
+		return;
+	memmove(asfd->readbuf, asfd->readbuf+asfd->readbufstart, left);
+	asfd->readbufstart=0;
+	asfd->readbuflen=left;
+}
+
 static int extract_buf(struct asfd *asfd,
 	unsigned int len, unsigned int offset)
 {
-	if(!(asfd->rbuf->buf=(char *)malloc_w(len+1, __func__)))
-		return -1;
-	if(!(memcpy(asfd->rbuf->buf, asfd->readbuf+offset, len)))
+	char *cp=asfd->readbuf+asfd->readbufstart+offset;
+	if(asfd->rbuf_view)
 	{
-		logp("%s: memcpy failed in %s\n", asfd->desc, __func__);
-		return -1;
+		// Borrow the byte after the message for the nul, and put it
+		// back when the message is released.
+		asfd->rbuf_view_saved=cp[len];
+		asfd->rbuf_view_len=len+offset;
+		cp[len]='\0';
+		asfd->rbuf->buf=cp;
 	}
-	asfd->rbuf->buf[len]='\0';
-	if(!(memmove(asfd->readbuf,
-		asfd->readbuf+len+offset, asfd->readbuflen-len-offset)))
+	else
 	{
-		logp("%s: memmove failed in %s\n", asfd->desc, __func__);
-		return -1;
+		if(!(asfd->rbuf->buf=(char *)malloc_w(len+1, __func__)))
+			return -1;
+		memcpy(asfd->rbuf->buf, cp, len);
+		asfd->rbuf->buf[len]='\0';
+		readbuf_consumed(asfd, len+offset);
 	}
-	asfd->readbuflen-=len+offset;
 	asfd->rbuf->len=len;
 	return 0;
 }
 
+static void asfd_rbuf_release(struct asfd *asfd)
+{
+	if(!asfd->rbuf_view)
+	{
+		free_w(&asfd->rbuf->buf);
+		iobuf_init(asfd->rbuf);
+		return;
+	}
+	iobuf_init(asfd->rbuf);
+	if(!asfd->rbuf_view_len) return;
+	asfd->readbuf[asfd->readbufstart+asfd->rbuf_view_len]
+		=asfd->rbuf_view_saved;
+	readbuf_consumed(asfd, asfd->rbuf_view_len);
+	asfd->rbuf_view_len=0;
+}
+
 #ifdef HAVE_NCURSES_H
 static int parse_readbuf_ncurses(struct asfd *asfd)
 {
 	if(!asfd->readbuflen) return 0;
 	// This is reading ints, and will be cast back to an int when it comes
 	// to be processed later.
-	if(extract_buf(asfd, asfd->readbuflen, 0)) return -1;
+	if(extract_buf(asfd, asfd->readbuflen-asfd->readbufstart, 0))
+		return -1;
 	return 0;
 }
 #endif
@@ -71,10 +136,10 @@ static int parse_readbuf_line_buf(struct asfd *asfd)
 	{
 		// Only start from the beginning if we previously got something
 		// to extract.
-		cp=asfd->readbuf;
+		cp=asfd->readbuf+asfd->readbufstart;
 		len=0;
 	}
-	for(; len<asfd->readbuflen; cp++, len++)
+	for(; len<asfd->readbuflen-asfd->readbufstart; cp++, len++)
 	{
 		if(*cp!='\n') continue;
 		len++;
@@ -90,20 +155,50 @@ static int parse_readbuf_line_buf(struct asfd *asfd)
 	return 0;
 }
 
+static int parse_readbuf_large_frame(struct asfd *asfd)
+{
+	size_t s;
+	const uint8_t *cp=(uint8_t *)asfd->readbuf+asfd->readbufstart;
+	if(asfd->readbuflen-asfd->readbufstart<ASFD_LARGE_FRAME_HDR) return 0;
+	s=((size_t)cp[2]<<24)|((size_t)cp[3]<<16)|((size_t)cp[4]<<8)|cp[5];
+	if(s+ASFD_LARGE_FRAME_HDR>asfd->bufmax)
+	{
+		logp("%s: frame of %lu bytes is too big in %s\n",
+			asfd->desc, (unsigned long)s, __func__);
+		return -1;
+	}
+	if(asfd->readbuflen-asfd->readbufstart>=s+ASFD_LARGE_FRAME_HDR)
+	{
+		asfd->rbuf->cmd=(enum cmd)cp[0];
+		if(extract_buf(asfd, s, ASFD_LARGE_FRAME_HDR))
+			return -1;
+	}
+	return 0;
+}
+
 static int parse_readbuf_standard(struct asfd *asfd)
 {
-	enum cmd cmdtmp=CMD_ERROR;
+	int i;
+	int8_t v;
 	unsigned int s=0;
-	if(asfd->readbuflen<5) return 0;
-	if((sscanf(asfd->readbuf, "%c%04X", (char *)&cmdtmp, &s))!=2)
+	const char *cp=asfd->readbuf+asfd->readbufstart;
+	if(asfd->readbuflen-asfd->readbufstart<5) return 0;
+	if(cp[1]==ASFD_LARGE_FRAME_MARK && asfd->frame_len>ASYNC_BUF_LEN)
+		return parse_readbuf_large_frame(asfd);
+	// One byte of command, then four hex digits of length.
+	for(i=1; i<5; i++)
 	{
-		logp("%s: sscanf of '%s' failed in %s\n",
-			asfd->desc, asfd->readbuf, __func__);
-		return -1;
+		if((v=hexval[(uint8_t)cp[i]])<0)
+		{
+			logp("%s: bad header '%.5s' in %s\n",
+				asfd->desc, cp, __func__);
+			return -1;
+		}
+		s=(s<<4)|v;
 	}
-	if(asfd->readbuflen>=s+5)
+	if(asfd->readbuflen-asfd->readbufstart>=s+5)
 	{
-		asfd->rbuf->cmd=cmdtmp;
+		asfd->rbuf->cmd=(enum cmd)cp[0];
 		if(extract_buf(asfd, s, 5))
 			return -1;
 	}
@@ -113,6 +208,8 @@ static int parse_readbuf_standard(struct asfd *asfd)
 static int asfd_parse_readbuf(struct asfd *asfd)
 {
 	if(asfd->rbuf->buf) return 0;
+	// The last message has been dealt with.
+	if(asfd->rbuf_view_len) asfd_rbuf_release(asfd);
 
 	if(asfd->parse_readbuf_specific(asfd))
 	{
@@ -128,6 +225,7 @@ static int asfd_do_read_ncurses(struct asfd *asfd)
 {
 	static int i;
 	i=getch();
+	asfd->readbufstart=0;
 	asfd->readbuflen=sizeof(int);
 	memcpy(asfd->readbuf, &i, asfd->readbuflen);
 	return 0;
@@ -143,8 +241,9 @@ static int asfd_do_write_ncurses(struct asfd *asfd)
 static int asfd_do_read(struct asfd *asfd)
 {
 	ssize_t r;
-	r=read(asfd->fd,
-		asfd->readbuf+asfd->readbuflen, bufmaxsize-asfd->readbuflen);
+	readbuf_make_room(asfd);
+	r=read(asfd->fd, asfd->readbuf+asfd->readbuflen,
+		asfd->readbufmax-asfd->readbuflen);
 	if(r<0)
 	{
 		if(errno==EAGAIN || errno==EINTR)
@@ -160,6 +259,7 @@ static int asfd_do_read(struct asfd *asfd)
 		goto error;
 	}
 	asfd->readbuflen+=r;
+	if(asfd->rlshared) ratelimit_used(asfd->rlshared, r);
 	return 0;
 error:
 	truncate_readbuf(asfd);
@@ -173,15 +273,17 @@ static int asfd_do_read_ssl(struct asfd *asfd)
 
 	asfd->read_blocked_on_write=0;
 
+	readbuf_make_room(asfd);
 	ERR_clear_error();
-	r=SSL_read(asfd->ssl,
-		asfd->readbuf+asfd->readbuflen, bufmaxsize-asfd->readbuflen);
+	r=SSL_read(asfd->ssl, asfd->readbuf+asfd->readbuflen,
+		asfd->readbufmax-asfd->readbuflen);
 
 	switch((e=SSL_get_error(asfd->ssl, r)))
 	{
 		case SSL_ERROR_NONE:
 			asfd->readbuflen+=r;
 			asfd->readbuf[asfd->readbuflen]='\0';
+			if(asfd->rlshared) ratelimit_used(asfd->rlshared, r);
 			break;
 		case SSL_ERROR_ZERO_RETURN:
 			// End of data.
@@ -212,48 +314,52 @@ error:
 	return -1;
 }
 
-// Return 0 for OK to write, non-zero for not OK to write.
-static int check_ratelimit(struct asfd *asfd)
+// Microseconds until this asfd may go on reading or writing, or 0 for now.
+// The async loop leaves it out of select() until then, rather than sleeping
+// with everything else waiting behind it.
+long asfd_ratelimit_wait(struct asfd *asfd, int writing)
 {
-	float f;
-	time_t diff;
-	if(!asfd->rlstart) asfd->rlstart=time(NULL);
-	if((diff=asfd->as->now-asfd->rlstart)<0)
-	{
-		// It is possible that the clock changed. Reset ourselves.
-		asfd->as->now=asfd->rlstart;
-		asfd->rlbytes=0;
-		logp("Looks like the clock went back in time since starting. "
-			"Resetting ratelimit\n");
-		return 0;
-	}
-	if(!diff) return 0; // Need to get started somehow.
-	f=(asfd->rlbytes)/diff; // Bytes per second.
+	long wait=0;
+	long swait=0;
+	if(writing) wait=ratelimit_wait(&asfd->rl);
+	if(asfd->rlshared && (swait=ratelimit_wait(asfd->rlshared))>wait)
+		wait=swait;
+	return wait;
+}
 
-	if(f>=asfd->ratelimit)
-	{
-#ifdef HAVE_WIN32
-		// Windows Sleep is milliseconds, usleep is microseconds.
-		// Do some conversion.
-		Sleep(asfd->rlsleeptime/1000);
-#else
-		usleep(asfd->rlsleeptime);
-#endif
-		// If sleeping, increase the sleep time.
-		if((asfd->rlsleeptime*=2)>=500000) asfd->rlsleeptime=500000;
-		return 1;
-	}
-	// If not sleeping, decrease the sleep time.
-	if((asfd->rlsleeptime/=2)<=9999) asfd->rlsleeptime=10000;
-	return 0;
+static void ratelimit_sent(struct asfd *asfd, size_t w)
+{
+	ratelimit_used(&asfd->rl, w);
+	if(asfd->rlshared) ratelimit_used(asfd->rlshared, w);
+}
+
+// Like readbuf_make_room(), the rest is only moved down when that costs no
+// more than what has been written since it was last moved, so big frames do
+// not get moved over and over after each short write.
+static void writebuf_written(struct asfd *asfd, size_t w)
+{
+	size_t left;
+	asfd->writebufstart+=w;
+	left=asfd->writebuflen-asfd->writebufstart;
+	if(left>asfd->writebufstart) return;
+	memmove(asfd->writebuf, asfd->writebuf+asfd->writebufstart, left);
+	asfd->writebufstart=0;
+	asfd->writebuflen=left;
 }
 
 static int asfd_do_write(struct asfd *asfd)
 {
 	ssize_t w;
-	if(asfd->ratelimit && check_ratelimit(asfd)) return 0;
-
-	w=write(asfd->fd, asfd->writebuf, asfd->writebuflen);
+	size_t len=asfd->writebuflen-asfd->writebufstart;
+	// Plain writes can be short, so keep them to what the limit allows
+	// at once, for a smoother rate.
+	if(asfd->rl.rate && len>ratelimit_burst(&asfd->rl))
+		len=ratelimit_burst(&asfd->rl);
+	if(asfd->rlshared && asfd->rlshared->rate
+	  && len>ratelimit_burst(asfd->rlshared))
+		len=ratelimit_burst(asfd->rlshared);
+
+	w=write(asfd->fd, asfd->writebuf+asfd->writebufstart, len);
 	if(w<0)
 	{
 		if(errno==EAGAIN || errno==EINTR)
@@ -267,7 +373,7 @@ static int asfd_do_write(struct asfd *asfd)
 		logp("%s: Wrote nothing in %s\n", asfd->desc, __func__);
 		return -1;
 	}
-	if(asfd->ratelimit) asfd->rlbytes+=w;
+	ratelimit_sent(asfd, w);
 /*
 {
 char buf[100000]="";
@@ -276,8 +382,7 @@ printf("wrote %d: %s\n", w, buf);
 }
 */
 
-	memmove(asfd->writebuf, asfd->writebuf+w, asfd->writebuflen-w);
-	asfd->writebuflen-=w;
+	writebuf_written(asfd, w);
 	return 0;
 }
 
@@ -288,9 +393,9 @@ static int asfd_do_write_ssl(struct asfd *asfd)
 
 	asfd->write_blocked_on_read=0;
 
-	if(asfd->ratelimit && check_ratelimit(asfd)) return 0;
 	ERR_clear_error();
-	w=SSL_write(asfd->ssl, asfd->writebuf, asfd->writebuflen);
+	w=SSL_write(asfd->ssl, asfd->writebuf+asfd->writebufstart,
+		asfd->writebuflen-asfd->writebufstart);
 
 	switch((e=SSL_get_error(asfd->ssl, w)))
 	{
@@ -302,10 +407,8 @@ snprintf(buf, w+1, "%s", asfd->writebuf);
 printf("wrote %d: %s\n", w, buf);
 }
 */
-			if(asfd->ratelimit) asfd->rlbytes+=w;
-			memmove(asfd->writebuf,
-				asfd->writebuf+w, asfd->writebuflen-w);
-			asfd->writebuflen-=w;
+			ratelimit_sent(asfd, w);
+			writebuf_written(asfd, w);
 			break;
 		case SSL_ERROR_WANT_WRITE:
 			break;
@@ -346,17 +449,39 @@ static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
 		{
 			size_t sblen=0;
 			char sbuf[10]="";
-			if(asfd->writebuflen+6+(wbuf->len) >= bufmaxsize-1)
+			if(asfd->writebuflen+6+(wbuf->len) >= asfd->bufmax-1)
 				return APPEND_BLOCKED;
 
-			snprintf(sbuf, sizeof(sbuf), "%c%04X",
-				wbuf->cmd, (unsigned int)wbuf->len);
-			sblen=strlen(sbuf);
+			if(asfd->frame_len>ASYNC_BUF_LEN
+			  && (wbuf->cmd==CMD_APPEND || wbuf->cmd==CMD_DATA))
+			{
+				sbuf[0]=wbuf->cmd;
+				sbuf[1]=ASFD_LARGE_FRAME_MARK;
+				sbuf[2]=(wbuf->len>>24)&0xFF;
+				sbuf[3]=(wbuf->len>>16)&0xFF;
+				sbuf[4]=(wbuf->len>>8)&0xFF;
+				sbuf[5]=wbuf->len&0xFF;
+				sblen=ASFD_LARGE_FRAME_HDR;
+			}
+			else
+			{
+				if(wbuf->len>0xFFFF)
+				{
+					logp("%s: message of %lu bytes is "
+						"too big in %s\n", asfd->desc,
+						(unsigned long)wbuf->len,
+						__func__);
+					return APPEND_ERROR;
+				}
+				snprintf(sbuf, sizeof(sbuf), "%c%04X",
+					wbuf->cmd, (unsigned int)wbuf->len);
+				sblen=strlen(sbuf);
+			}
 			append_to_write_buffer(asfd, sbuf, sblen);
 			break;
 		}
 		case ASFD_STREAM_LINEBUF:
-			if(asfd->writebuflen+wbuf->len >= bufmaxsize-1)
+			if(asfd->writebuflen+wbuf->len >= asfd->bufmax-1)
 				return APPEND_BLOCKED;
 			break;
 		case ASFD_STREAM_NCURSES_STDIN:
@@ -395,6 +520,45 @@ static int asfd_set_bulk_packets(struct asfd *asfd)
 	return 0;
 }
 
+// Allow data messages of up to len bytes, using the large frame header for
+// them if len is over ASYNC_BUF_LEN. The other end has to have agreed to it.
+static int asfd_set_frame_len(struct asfd *asfd, size_t len)
+{
+	char *tmp;
+	size_t bufmax;
+	if(len<ASYNC_BUF_LEN || len>ASFD_FRAME_LEN_MAX)
+	{
+		logp("%s: frame length %lu out of range in %s\n",
+			asfd->desc, (unsigned long)len, __func__);
+		return -1;
+	}
+	if(asfd->rbuf_view_len)
+	{
+		logp("%s: cannot resize buffers under a message in %s\n",
+			asfd->desc, __func__);
+		return -1;
+	}
+	// Room for two frames, plus encryption padding, like bufmaxsize.
+	bufmax=(len*2)+32;
+	if(bufmax<bufmaxsize) bufmax=bufmaxsize;
+	if(bufmax>asfd->bufmax)
+	{
+		if(!(tmp=(char *)realloc_w(asfd->writebuf, bufmax+1, __func__)))
+			return -1;
+		asfd->writebuf=tmp;
+	}
+	if(bufmax>asfd->readbufmax)
+	{
+		if(!(tmp=(char *)realloc_w(asfd->readbuf, bufmax+1, __func__)))
+			return -1;
+		asfd->readbuf=tmp;
+		asfd->readbufmax=bufmax;
+	}
+	asfd->bufmax=bufmax;
+	asfd->frame_len=len;
+	return 0;
+}
+
 static int asfd_read(struct asfd *asfd)
 {
 	if(asfd->as->doing_estimate) return 0;
@@ -414,7 +578,7 @@ static int asfd_read_expect(struct asfd *asfd, enum cmd cmd, const char *expect)
 			asfd->rbuf->cmd, asfd->rbuf->buf);
 		ret=-1;
 	}
-	iobuf_free_content(asfd->rbuf);
+	asfd->rbuf_release(asfd);
 	return ret;
 }
 
@@ -452,7 +616,7 @@ static int asfd_simple_loop(struct asfd *asfd,
 	struct iobuf *rbuf=asfd->rbuf;
 	while(1)
 	{
-		iobuf_free_content(rbuf);
+		asfd->rbuf_release(asfd);
 		if(asfd->read(asfd)) goto error;
 		if(rbuf->cmd!=CMD_GEN)
 		{
@@ -476,10 +640,10 @@ static int asfd_simple_loop(struct asfd *asfd,
 		{
 			case ASL_CONTINUE: break;
 			case ASL_END_OK:
-				iobuf_free_content(rbuf);
+				asfd->rbuf_release(asfd);
 				return 0;
 			case ASL_END_OK_RETURN_1:
-				iobuf_free_content(rbuf);
+				asfd->rbuf_release(asfd);
 				return 1;
 			case ASL_END_ERROR:
 			default:
@@ -487,7 +651,7 @@ static int asfd_simple_loop(struct asfd *asfd,
 		}
 	}
 error:
-	iobuf_free_content(rbuf);
+	asfd->rbuf_release(asfd);
 	return -1;
 }
 
@@ -502,13 +666,19 @@ static int asfd_init(struct asfd *asfd, const char *desc,
 	asfd->streamtype=streamtype;
 	asfd->max_network_timeout=get_int(confs[OPT_NETWORK_TIMEOUT]);
 	asfd->network_timeout=asfd->max_network_timeout;
-	asfd->ratelimit=get_float(confs[OPT_RATELIMIT]);
-	asfd->rlsleeptime=10000;
+	ratelimit_init(&asfd->rl, get_float(confs[OPT_RATELIMIT]));
+	asfd->frame_len=ASYNC_BUF_LEN;
+	asfd->bufmax=bufmaxsize;
+	// The read buffer has to be able to hold the largest message.
+	asfd->readbufmax=get_int(confs[OPT_NETWORK_READ_BUFFER_SIZE]);
+	if(asfd->readbufmax<asfd->bufmax) asfd->readbufmax=asfd->bufmax;
+	if(asfd->readbufmax>READBUF_MAX) asfd->readbufmax=READBUF_MAX;
 	asfd->pid=-1;
 
 	asfd->parse_readbuf=asfd_parse_readbuf;
 	asfd->append_all_to_write_buffer=asfd_append_all_to_write_buffer;
 	asfd->set_bulk_packets=asfd_set_bulk_packets;
+	asfd->set_frame_len=asfd_set_frame_len;
 	if(asfd->ssl)
 	{
 		asfd->do_read=asfd_do_read_ssl;
@@ -528,6 +698,7 @@ static int asfd_init(struct asfd *asfd, const char *desc,
 	}
 	asfd->read=asfd_read;
 	asfd->read_expect=asfd_read_expect;
+	asfd->rbuf_release=asfd_rbuf_release;
 	asfd->simple_loop=asfd_simple_loop;
 	asfd->write=asfd_write;
 	asfd->write_str=asfd_write_str;
@@ -553,8 +724,8 @@ static int asfd_init(struct asfd *asfd, const char *desc,
 	}
 
 	if(!(asfd->rbuf=iobuf_alloc())
-	  || asfd_alloc_buf(&asfd->readbuf)
-	  || asfd_alloc_buf(&asfd->writebuf)
+	  || asfd_alloc_buf(&asfd->readbuf, asfd->readbufmax)
+	  || asfd_alloc_buf(&asfd->writebuf, asfd->bufmax)
 	  || !(asfd->desc=strdup_w(desc, __func__)))
 		return -1;
 	return 0;
@@ -566,6 +737,7 @@ struct asfd *asfd_alloc(void)
 	if(!(asfd=(struct asfd *)calloc_w(1, sizeof(struct asfd), __func__)))
 		return NULL;
 	asfd->init=asfd_init;
+	hexval_init();
 	return asfd;
 }
 
@@ -599,6 +771,8 @@ void asfd_free(struct asfd **asfd)
 {
 	if(!asfd || !*asfd) return;
 	asfd_close(*asfd);
+	// Do not try to free a message that is really part of readbuf.
+	if((*asfd)->rbuf_view && (*asfd)->rbuf) iobuf_init((*asfd)->rbuf);
 	iobuf_free(&((*asfd)->rbuf));
 	free_w(&((*asfd)->readbuf));
 	free_w(&((*asfd)->writebuf));
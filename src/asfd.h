@@ -3,6 +3,7 @@
 
 #include "burp.h"
 #include "cmd.h"
+#include "ratelimit.h"
 #include "ssl.h"
 
 // Return values for simple_loop().
@@ -38,6 +39,13 @@ enum asfd_fdtype
 	ASFD_FD_CLIENT_NCURSES_READ
 };
 
+// Data messages bigger than the standard header allows are sent with the
+// command, this mark, and then a four byte big endian length. Only used once
+// both ends have agreed on a frame_len above ASYNC_BUF_LEN.
+#define ASFD_LARGE_FRAME_MARK	'+'
+#define ASFD_LARGE_FRAME_HDR	6
+#define ASFD_FRAME_LEN_MAX	(4*1024*1024)
+
 enum append_ret
 {
 	APPEND_ERROR=-1,
@@ -57,21 +65,37 @@ struct asfd
 	int network_timeout;
 	int max_network_timeout;
 
-	float ratelimit;
-	time_t rlstart;
-	int rlsleeptime;
-	unsigned long long rlbytes;
+	// Limit on what this asfd sends, and on what the server children send
+	// and receive between them, if set.
+	struct ratelimit rl;
+	struct ratelimit *rlshared;
 
 	struct iobuf *rbuf;
 
+	// Largest chunk of file data that senders should put in a message.
+	size_t frame_len;
+	// Largest amount that can be waiting to be written, and the room that
+	// needs to be kept for reading in a whole message.
+	size_t bufmax;
+
 	int doread;
 	char *readbuf;
-	size_t readbuflen;
+	size_t readbufstart;	// Start of the data not yet parsed.
+	size_t readbuflen;	// End of the data read so far.
+	size_t readbufmax;
 	int read_blocked_on_write;
 
+	// If set, rbuf->buf points into readbuf instead of being a copy, and
+	// stays valid until rbuf_release() is called. Anything wanting to keep
+	// the message has to copy it.
+	uint8_t rbuf_view;
+	size_t rbuf_view_len;
+	char rbuf_view_saved;
+
 	int dowrite;
 	char *writebuf;
-	size_t writebuflen;
+	size_t writebufstart;	// Start of the data not yet written.
+	size_t writebuflen;	// End of the data waiting to be written.
 	int write_blocked_on_read;
 
 	struct asfd *next;
@@ -97,13 +121,22 @@ struct asfd
 		enum asfd_streamtype, struct conf **);
 	int (*parse_readbuf)(struct asfd *);
 	int (*parse_readbuf_specific)(struct asfd *);
-	enum append_ret
+	// Data messages bigger than the standard header allows are sent with the
+// command, this mark, and then a four byte big endian length. Only used once
+// both ends have agreed on a frame_len above ASYNC_BUF_LEN.
+#define ASFD_LARGE_FRAME_MARK	'+'
+#define ASFD_LARGE_FRAME_HDR	6
+#define ASFD_FRAME_LEN_MAX	(4*1024*1024)
+
+enum append_ret
 		(*append_all_to_write_buffer)(struct asfd *, struct iobuf *);
 	int (*set_bulk_packets)(struct asfd *);
+	int (*set_frame_len)(struct asfd *, size_t);
 	int (*do_read)(struct asfd *);
 	int (*do_write)(struct asfd *);
 	int (*read)(struct asfd *);
 	int (*read_expect)(struct asfd *, enum cmd, const char *);
+	void (*rbuf_release)(struct asfd *);
 	int (*simple_loop)(struct asfd *, struct conf **, void *,
 		const char *, enum asl_ret callback(struct asfd *,
 			struct conf **, void *));
@@ -115,6 +148,7 @@ struct asfd
 extern struct asfd *asfd_alloc(void);
 extern void asfd_close(struct asfd *asfd); // Maybe should be in the struct.
 extern void asfd_free(struct asfd **asfd);
+extern long asfd_ratelimit_wait(struct asfd *asfd, int writing);
 
 extern struct asfd *setup_asfd(struct async *as,
 	const char *desc, int *fd, SSL *ssl,
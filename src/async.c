@@ -29,6 +29,8 @@ static int async_io(struct async *as, int doread)
 	fd_set fsw;
 	fd_set fse;
 	int dosomething=0;
+	long wait=0;
+	long rlwait=0;
 	struct timeval tval;
 	struct asfd *asfd;
 	static int s=0;
@@ -66,6 +68,19 @@ static int async_io(struct async *as, int doread)
 		if(asfd->writebuflen && !asfd->write_blocked_on_read)
 			asfd->dowrite++; // The write buffer is not yet empty.
 
+		// Over a rate limit, so leave it alone for a while.
+		if(asfd->dowrite && (wait=asfd_ratelimit_wait(asfd, 1)))
+		{
+			asfd->dowrite=0;
+			if(!rlwait || wait<rlwait) rlwait=wait;
+		}
+		if(asfd->doread && asfd->rlshared
+		  && (wait=asfd_ratelimit_wait(asfd, 0)))
+		{
+			asfd->doread=0;
+			if(!rlwait || wait<rlwait) rlwait=wait;
+		}
+
 		if(!asfd->doread && !asfd->dowrite) continue;
 
 		add_fd_to_sets(asfd->fd, asfd->doread?&fsr:NULL,
@@ -73,7 +88,18 @@ static int async_io(struct async *as, int doread)
 
 		dosomething++;
 	}
-	if(!dosomething) goto end;
+	if(rlwait && rlwait<tval.tv_sec*1000000L+tval.tv_usec)
+	{
+		tval.tv_sec=rlwait/1000000;
+		tval.tv_usec=rlwait%1000000;
+	}
+	if(!dosomething)
+	{
+		// Only waiting for the rate limit, so there is nothing for
+		// select() to do.
+		if(rlwait) ratelimit_sleep(rlwait);
+		goto end;
+	}
 /*
 	for(asfd=as->asfd; asfd; asfd=asfd->next)
 	{
@@ -1,7 +1,16 @@
 #ifndef _ASYNC_H
 #define _ASYNC_H
 
+// Size of the standard network messages. Can be changed at build time, but
+// the standard message header only has room for lengths up to 0xFFFF, and
+// both ends need to agree. Bigger frames are negotiated at run time instead,
+// see network_frame_size.
+#ifndef ASYNC_BUF_LEN
 #define ASYNC_BUF_LEN	16000
+#endif
+#if ASYNC_BUF_LEN > 0xFF00
+#error ASYNC_BUF_LEN is too big for the standard message header
+#endif
 #define ZCHUNK		ASYNC_BUF_LEN
 
 struct async
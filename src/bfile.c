@@ -9,6 +9,22 @@ void bfile_free(BFILE **bfd)
 	free_v((void **)bfd);
 }
 
+// Write a run of zeroes out in full, for when a hole cannot be left.
+static int write_zero_chunks(BFILE *bfd, uint64_t len)
+{
+	static char zeros[65536];
+	ssize_t w;
+	size_t n;
+	while(len)
+	{
+		n=len<sizeof(zeros)?(size_t)len:sizeof(zeros);
+		if((w=bfd->write(bfd, zeros, n))<=0)
+			return -1;
+		len-=w;
+	}
+	return 0;
+}
+
 #ifdef HAVE_WIN32
 
 char *unix_name_to_win32(char *name);
@@ -416,12 +432,51 @@ static ssize_t bfile_write(BFILE *bfd, void *buf, size_t count)
 	return (ssize_t)bfd->rw_bytes;
 }
 
+static int bfile_write_zeros(BFILE *bfd, uint64_t len)
+{
+	return write_zero_chunks(bfd, len);
+}
+
 #else
 
+// Runs of zeroes shorter than this are written out when restoring, since
+// the filesystem would need to allocate the block that they are in anyway.
+#define BFILE_HOLE_MIN	4096
+
+// A file that ends in a hole needs to be extended up to the end of it.
+static int extend_over_hole(BFILE *bfd)
+{
+	off_t end;
+	if((end=lseek(bfd->fd, 0, SEEK_CUR))<0
+	  || ftruncate(bfd->fd, end))
+	{
+		logp("Could not extend %s over a hole: %s\n",
+			bfd->path?bfd->path:"file", strerror(errno));
+		return -1;
+	}
+	bfd->in_hole=0;
+	return 0;
+}
+
 static int bfile_close(BFILE *bfd, struct asfd *asfd)
 {
+	struct cntr *cntr;
 	if(!bfd || bfd->mode==BF_CLOSED) return 0;
 
+	if(bfd->in_hole && extend_over_hole(bfd))
+	{
+		close(bfd->fd);
+		bfd->mode=BF_CLOSED;
+		bfd->fd=-1;
+		free_w(&bfd->path);
+		return -1;
+	}
+	if(bfd->sparse_bytes
+	  && bfd->confs
+	  && (cntr=get_cntr(bfd->confs[OPT_CNTR])))
+		cntr_add_sparsebytes(cntr, bfd->sparse_bytes);
+	bfd->sparse_bytes=0;
+
 	if(!close(bfd->fd))
 	{
 		if(bfd->mode==BF_WRITE)
@@ -436,13 +491,31 @@ static int bfile_close(BFILE *bfd, struct asfd *asfd)
 	return -1;
 }
 
+// Holes are only looked for in regular files that have fewer blocks than
+// their size needs. For writing, the caller sets bfd->sparse before opening
+// if holes may be left.
+static void sparse_setup(BFILE *bfd)
+{
+	struct stat statp;
+	if(fstat(bfd->fd, &statp) || !S_ISREG(statp.st_mode))
+	{
+		bfd->sparse=0;
+		return;
+	}
+	if(bfd->mode==BF_READ)
+		bfd->sparse=(statp.st_blocks*512<statp.st_size);
+	bfd->offset=0;
+	bfd->data_start=0;
+	bfd->data_end=0;
+}
+
 static int bfile_open(BFILE *bfd,
 	struct asfd *asfd, const char *fname, int flags, mode_t mode)
 {
 	if(!bfd) return 0;
 	if(bfd->mode!=BF_CLOSED && bfd->close(bfd, asfd))
 		return -1;
-	if(!(bfd->fd=open(fname, flags, mode))<0)
+	if((bfd->fd=open(fname, flags, mode))<0)
 		return -1;
 	if(flags & O_CREAT || flags & O_WRONLY)
 		bfd->mode=BF_WRITE;
@@ -450,16 +523,95 @@ static int bfile_open(BFILE *bfd,
 		bfd->mode=BF_READ;
 	if(!(bfd->path=strdup_w(fname, __func__)))
 		return -1;
+	sparse_setup(bfd);
 	return 0;
 }
 
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+static ssize_t bfile_read_sparse(BFILE *bfd, void *buf, size_t count)
+{
+	ssize_t got;
+	struct stat statp;
+
+	if(bfd->offset>=bfd->data_end)
+	{
+		// Find the next data, and the hole after it.
+		if((bfd->data_start=lseek(bfd->fd,
+			bfd->offset, SEEK_DATA))<0)
+		{
+			if(errno!=ENXIO)
+			{
+				// The filesystem cannot tell us, so just
+				// read everything.
+				bfd->sparse=0;
+				if(lseek(bfd->fd, bfd->offset, SEEK_SET)<0)
+					return -1;
+				return read(bfd->fd, buf, count);
+			}
+			// Only a hole from here to the end of the file.
+			if(fstat(bfd->fd, &statp)) return -1;
+			bfd->data_start=statp.st_size;
+			if(bfd->data_start<bfd->offset)
+				bfd->data_start=bfd->offset;
+			bfd->data_end=bfd->data_start;
+		}
+		else if((bfd->data_end=lseek(bfd->fd,
+			bfd->data_start, SEEK_HOLE))<0)
+				return -1;
+	}
+
+	if(bfd->offset<bfd->data_start)
+	{
+		if((off_t)count>bfd->data_start-bfd->offset)
+			count=bfd->data_start-bfd->offset;
+		memset(buf, 0, count);
+		bfd->offset+=count;
+		bfd->sparse_bytes+=count;
+		return (ssize_t)count;
+	}
+
+	if(bfd->offset<bfd->data_end
+	  && (off_t)count>bfd->data_end-bfd->offset)
+		count=bfd->data_end-bfd->offset;
+	if((got=pread(bfd->fd, buf, count, bfd->offset))>0)
+		bfd->offset+=got;
+	return got;
+}
+#endif
+
 static ssize_t bfile_read(BFILE *bfd, void *buf, size_t count)
 {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	if(bfd->sparse)
+		return bfile_read_sparse(bfd, buf, count);
+#endif
 	return read(bfd->fd, buf, count);
 }
 
+static int bfile_write_zeros(BFILE *bfd, uint64_t len)
+{
+	if(!bfd->sparse)
+		return write_zero_chunks(bfd, len);
+	if(lseek(bfd->fd, (off_t)len, SEEK_CUR)<0)
+		return -1;
+	bfd->in_hole=1;
+	bfd->sparse_bytes+=len;
+	return 0;
+}
+
 static ssize_t bfile_write(BFILE *bfd, void *buf, size_t count)
 {
+	const char *b=(const char *)buf;
+	if(bfd->sparse
+	  && count>=BFILE_HOLE_MIN
+	  && !b[0]
+	  && !memcmp(b, b+1, count-1))
+	{
+		if(bfile_write_zeros(bfd, count))
+			return -1;
+		return (ssize_t)count;
+	}
+	bfd->in_hole=0;
 	return write(bfd->fd, buf, count);
 }
 
@@ -511,6 +663,7 @@ void bfile_setup_funcs(BFILE *bfd)
 	bfd->close=bfile_close;
 	bfd->read=bfile_read;
 	bfd->write=bfile_write;
+	bfd->write_zeros=bfile_write_zeros;
 	bfd->open_for_send=bfile_open_for_send;
 #ifdef HAVE_WIN32
 	bfd->set_win32_api=bfile_set_win32_api;
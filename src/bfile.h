@@ -29,6 +29,15 @@ struct BFILE
 	int berrno;          /* errno */
 #else
 	int fd;
+	// Sparse regular files. When reading, holes are found with SEEK_DATA
+	// and SEEK_HOLE and filled in with zeroes instead of being read. When
+	// writing, runs of zeroes are seeked over, leaving holes.
+	uint8_t sparse;
+	uint8_t in_hole;	// The last thing written was seeked over.
+	off_t offset;		// Reading only.
+	off_t data_start;	// Reading only. The data after the hole at
+	off_t data_end;		// 'offset', if there is a hole there.
+	uint64_t sparse_bytes;
 #endif
 
 	// Let us try using function pointers.
@@ -37,6 +46,7 @@ struct BFILE
 	int (*close)(BFILE *bfd, struct asfd *asfd);
 	ssize_t (*read)(BFILE *bfd, void *buf, size_t count);
 	ssize_t (*write)(BFILE *bfd, void *buf, size_t count);
+	int (*write_zeros)(BFILE *bfd, uint64_t len);
 	int (*open_for_send)(BFILE *bfd, struct asfd *asfd,
 		const char *fname, int64_t winattr,
 		int atime, struct conf **confs);
@@ -18,11 +18,32 @@ static const char *server_supports_autoupgrade(const char *feat)
 	return server_supports(feat, ":autoupgrade:");
 }
 
+// Use bigger data messages if both ends want them.
+static int set_frame_size(struct asfd *asfd, const char *feat,
+	struct conf **confs)
+{
+	int frame_size=get_int(confs[OPT_NETWORK_FRAME_SIZE]);
+	int server_frame_size=atoi(feat+strlen(":frame_size="));
+	char msg[32]="";
+
+	if(frame_size<=ASYNC_BUF_LEN) return 0;
+	if(frame_size>server_frame_size) frame_size=server_frame_size;
+	if(frame_size>ASFD_FRAME_LEN_MAX) frame_size=ASFD_FRAME_LEN_MAX;
+	if(frame_size<=ASYNC_BUF_LEN) return 0;
+	snprintf(msg, sizeof(msg), "frame_size=%d", frame_size);
+	if(asfd->write_str(asfd, CMD_GEN, msg)
+	  || asfd->set_frame_len(asfd, frame_size))
+		return -1;
+	logp("Using frame_size=%d\n", frame_size);
+	return 0;
+}
+
 int extra_comms(struct async *as, struct conf **confs,
 	enum action *action, char **incexc)
 {
 	int ret=-1;
 	char *feat=NULL;
+	const char *frame=NULL;
 	struct asfd *asfd;
 	struct iobuf *rbuf;
 	const char *orig_client=get_string(confs[OPT_ORIG_CLIENT]);
@@ -217,6 +238,76 @@ int extra_comms(struct async *as, struct conf **confs,
 #endif
 		set_e_rshash(confs[OPT_RSHASH], RSHASH_MD4);
 
+	if((frame=server_supports(feat, ":frame_size="))
+	  && set_frame_size(asfd, frame, confs))
+		goto end;
+
+	if(get_int(confs[OPT_COMPRESSION_ADAPTIVE]))
+	{
+		if(server_supports(feat, ":compression_adaptive:"))
+		{
+			if(asfd->write_str(asfd, CMD_GEN,
+				"compression_adaptive"))
+					goto end;
+		}
+		else
+		{
+			// An older server would want every changed file
+			// that was not compressed last time sent in full.
+			logp("Server does not support compression_adaptive\n");
+			set_int(confs[OPT_COMPRESSION_ADAPTIVE], 0);
+		}
+	}
+
+	if(get_int(confs[OPT_RESTORE_DEDUP]))
+	{
+#ifdef HAVE_WIN32
+		logp("restore_dedup is not supported on Windows\n");
+		set_int(confs[OPT_RESTORE_DEDUP], 0);
+#else
+		if(server_supports(feat, ":restore_dedup:"))
+		{
+			if(asfd->write_str(asfd, CMD_GEN, "restore_dedup"))
+				goto end;
+		}
+		else
+		{
+			logp("Server does not support restore_dedup\n");
+			set_int(confs[OPT_RESTORE_DEDUP], 0);
+		}
+#endif
+	}
+
+	if(get_int(confs[OPT_RESTORE_DELTA]))
+	{
+#ifdef HAVE_WIN32
+		logp("restore_delta is not supported on Windows\n");
+		set_int(confs[OPT_RESTORE_DELTA], 0);
+#else
+		if(server_supports(feat, ":restore_delta:"))
+		{
+			if(asfd->write_str(asfd, CMD_GEN, "restore_delta"))
+				goto end;
+		}
+		else
+		{
+			logp("Server does not support restore_delta\n");
+			set_int(confs[OPT_RESTORE_DELTA], 0);
+		}
+#endif
+	}
+
+	// Holes are left in restored files either way. This just saves the
+	// server from sending runs of zero blocks one at a time.
+	if(get_int(confs[OPT_RESTORE_SPARSE])
+	  && server_supports(feat, ":restore_sparse:")
+	  && asfd->write_str(asfd, CMD_GEN, "restore_sparse"))
+		goto end;
+
+	if(server_supports(feat, ":backup_queue:")
+	  && asfd->write_str(asfd, CMD_GEN, "backup_queue"))
+		goto end;
+
 	if(asfd->write_str(asfd, CMD_GEN, "extra_comms_end")
 	  || asfd->read_expect(asfd, CMD_GEN, "extra_comms_end ok"))
 	{
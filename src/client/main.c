@@ -21,7 +21,9 @@ enum cliret
 	CLIENT_COULD_NOT_CONNECT=4,
 	// This one happens after a successful certificate signing request so
 	// that it connects again straight away with the new key/certificate.
-	CLIENT_RECONNECT=100
+	CLIENT_RECONNECT=100,
+	// The server has queued the backup, and said when to come back.
+	CLIENT_BACKUP_QUEUED=101
 };
 
 struct tchk
@@ -30,6 +32,9 @@ struct tchk
 	enum cliret ret;
 };
 
+// Seconds that the server said to come back after.
+static int queue_retry=0;
+
 static enum asl_ret maybe_check_timer_func(struct asfd *asfd,
         struct conf **confs, void *param)
 {
@@ -42,6 +47,14 @@ static enum asl_ret maybe_check_timer_func(struct asfd *asfd,
 		tchk->ret=CLIENT_SERVER_TIMER_NOT_MET;
 		return ASL_END_OK;
 	}
+	else if(!strncmp_w(asfd->rbuf->buf, "backup queued:"))
+	{
+		queue_retry=atoi(asfd->rbuf->buf+strlen("backup queued:"));
+		logp("Backup queued on the server, come back in %d seconds\n",
+			queue_retry);
+		tchk->ret=CLIENT_BACKUP_QUEUED;
+		return ASL_END_OK;
+	}
         else if(!strcmp(asfd->rbuf->buf, "timer conditions met"))
         {
 		// Only happens on 'timer check only'.
@@ -117,6 +130,8 @@ static enum cliret backup_wrapper(struct asfd *asfd,
 			break;
 		case CLIENT_SERVER_TIMER_NOT_MET:
 			goto timer_not_met;
+		case CLIENT_BACKUP_QUEUED:
+			return CLIENT_BACKUP_QUEUED;
 		default:
 			goto error;
 	}
@@ -207,6 +222,8 @@ static int ssl_setup(int *rfd, SSL **ssl, SSL_CTX **ctx,
 		return -1;
 	}
 	SSL_set_bio(*ssl, sbio, sbio);
+	if(ssl_client_session_load(*ctx, *ssl, confs))
+		return -1;
 	if(SSL_connect(*ssl)<=0)
 	{
 		logp_ssl_err("SSL connect error\n");
@@ -459,6 +476,7 @@ end:
 
 int client(struct conf **confs, enum action action, int vss_restore, int json)
 {
+	int waited=0;
 	enum cliret ret=CLIENT_OK;
 	
 #ifdef HAVE_WIN32
@@ -475,6 +493,22 @@ int client(struct conf **confs, enum action action, int vss_restore, int json)
 		default:
 			break;
 	}
+
+	// Go back when the server said to, for up to backup_queue_wait
+	// seconds altogether.
+	while(ret==CLIENT_BACKUP_QUEUED)
+	{
+		if(queue_retry<=0
+		  || waited+queue_retry>get_int(confs[OPT_BACKUP_QUEUE_WAIT]))
+		{
+			ret=CLIENT_SERVER_TIMER_NOT_MET;
+			break;
+		}
+		sleep(queue_retry);
+		waited+=queue_retry;
+		logp("Re-opening connection to server\n");
+		ret=do_client(confs, action, vss_restore, json);
+	}
 	
 #ifdef HAVE_WIN32
 	// allow sleep when idle
@@ -625,6 +625,9 @@ static void update_screen_live_counter_single(struct cntr_ent *e,
 		case CMD_BYTES:
 		case CMD_BYTES_RECV:
 		case CMD_BYTES_SENT:
+		case CMD_BYTES_COMPRESSED:
+		case CMD_BYTES_NOT_COMPRESSED:
+		case CMD_BYTES_SPARSE:
 			bytes_human=bytes_to_human(e->count);
 			break;
 		default:
@@ -1,7 +1,18 @@
 #include "include.h"
 #include "../../cmd.h"
 
-static int load_signature(struct asfd *asfd,
+// How long to wait for the delta threads before looking for the next request
+// from the server again.
+#define DELTA_POLL_USEC		10000
+
+enum delta_send
+{
+	DELTA_SEND_READY=0,
+	DELTA_SEND_ROOM,
+	DELTA_SEND_ALL
+};
+
+static int read_signature(struct asfd *asfd,
 	rs_signature_t **sumset, struct conf **confs)
 {
 	rs_result r;
@@ -11,13 +22,21 @@ static int load_signature(struct asfd *asfd,
 	if((r=rs_loadsig_network_run(asfd, job, get_cntr(confs[OPT_CNTR]))))
 	{
 		rs_free_sumset(*sumset);
+		*sumset=NULL;
 		return r;
 	}
-	if((r=rs_build_hash_table(*sumset))) return r;
 	rs_job_free(job);
 	return r;
 }
 
+static int load_signature(struct asfd *asfd,
+	rs_signature_t **sumset, struct conf **confs)
+{
+	int r;
+	if((r=read_signature(asfd, sumset, confs))) return r;
+	return rs_build_hash_table(*sumset);
+}
+
 static int load_signature_and_send_delta(struct asfd *asfd,
 	BFILE *bfd, unsigned long long *bytes, unsigned long long *sentbytes,
 	struct conf **confs)
@@ -41,10 +60,10 @@ static int load_signature_and_send_delta(struct asfd *asfd,
 	}
 
 	if(!(infb=rs_filebuf_new(asfd, bfd,
-		NULL, -1, ASYNC_BUF_LEN, bfd->datalen,
+		NULL, -1, asfd->frame_len, bfd->datalen,
 		get_cntr(confs[OPT_CNTR])))
 	  || !(outfb=rs_filebuf_new(asfd, NULL,
-		NULL, asfd->fd, ASYNC_BUF_LEN, -1,
+		NULL, asfd->fd, asfd->frame_len, -1,
 		get_cntr(confs[OPT_CNTR]))))
 	{
 		logp("could not rs_filebuf_new for delta\n");
@@ -99,6 +118,149 @@ static int load_signature_and_send_delta(struct asfd *asfd,
 	return r;
 }
 
+#ifndef HAVE_WIN32
+static int send_delta_chunks(struct asfd *asfd,
+	struct delta_job *job, struct delta_chunk **chunks)
+{
+	int ret=0;
+	struct iobuf wbuf;
+	struct delta_chunk *c;
+	for(c=*chunks; c; c=c->next)
+	{
+		iobuf_set(&wbuf, CMD_APPEND, c->buf, c->len);
+		if(asfd->write(asfd, &wbuf))
+		{
+			ret=-1;
+			break;
+		}
+		job->sentbytes+=c->len;
+	}
+	delta_chunks_free(chunks);
+	return ret;
+}
+
+static int finish_delta_job(struct asfd *asfd,
+	struct delta_job *job, struct conf **confs)
+{
+	struct sbuf *sb=job->sb;
+	if(job->result!=RS_DONE)
+	{
+		logp("delta loop returned: %d\n", job->result);
+		logp("error in sig/delta for %s (%s)\n",
+			sb->path.buf, sb->protocol1->datapth.buf);
+		return 0;
+	}
+	if(write_endfile(asfd, job->bytes, job->checksum))
+		return -1;
+	cntr_add(get_cntr(confs[OPT_CNTR]), CMD_FILE_CHANGED, 1);
+	cntr_add_bytes(get_cntr(confs[OPT_CNTR]), job->bytes);
+	cntr_add_sentbytes(get_cntr(confs[OPT_CNTR]), job->sentbytes);
+	cntr_add_compbytes(get_cntr(confs[OPT_CNTR]), job->bytes,
+		sb->compression>0);
+	return 0;
+}
+
+// Send what the queued deltas have produced, in the order that they were
+// queued. Depending on 'how', either just send whatever is ready, or wait
+// until there is room to queue another, or until they have all finished.
+static int send_deltas(struct asfd *asfd, struct delta_pool *pool,
+	struct conf **confs, enum delta_send how)
+{
+	int ret;
+	int done;
+	int wait;
+	struct delta_job *job;
+	struct delta_chunk *chunks=NULL;
+
+	if(!pool) return 0;
+	while((job=delta_pool_head(pool)))
+	{
+		wait=how==DELTA_SEND_ALL
+		  || (how==DELTA_SEND_ROOM && delta_pool_full(pool));
+		done=delta_job_take(job, &chunks, wait);
+		if(!job->started)
+		{
+			struct sbuf *sb=job->sb;
+			if(asfd->write(asfd, &(sb->protocol1->datapth))
+			  || asfd->write(asfd, &sb->attr)
+			  || asfd->write(asfd, &sb->path))
+			{
+				delta_chunks_free(&chunks);
+				return -1;
+			}
+			job->started=1;
+		}
+		if(send_delta_chunks(asfd, job, &chunks))
+			return -1;
+		if(!done)
+		{
+			if(wait) continue;
+			return 0;
+		}
+		delta_pool_remove_head(pool);
+		ret=finish_delta_job(asfd, job, confs);
+		delta_job_free(&job);
+		if(ret) return -1;
+	}
+	return 0;
+}
+
+// The signature comes straight after the path, so read it now, then leave
+// the delta to one of the threads.
+static int queue_delta(struct asfd *asfd, struct sbuf *sb, BFILE **bfd,
+	struct delta_pool *pool, struct conf **confs)
+{
+	struct delta_job *job=NULL;
+
+	if(!(job=delta_job_alloc())
+	  || !(job->sb=sbuf_alloc(confs)))
+		goto error;
+	if(read_signature(asfd, &job->sumset, confs))
+	{
+		logp("error in sig/delta for %s (%s)\n",
+			sb->path.buf, sb->protocol1->datapth.buf);
+		delta_job_free(&job);
+		return 0;
+	}
+	if(send_deltas(asfd, pool, confs, DELTA_SEND_ROOM))
+		goto error;
+
+	iobuf_move(&(job->sb->protocol1->datapth), &(sb->protocol1->datapth));
+	iobuf_move(&job->sb->attr, &sb->attr);
+	iobuf_move(&job->sb->path, &sb->path);
+	job->bfd=*bfd;
+	*bfd=NULL;
+	job->chunk_len=asfd->frame_len;
+	delta_pool_add(pool, job);
+	return 0;
+error:
+	delta_job_free(&job);
+	return -1;
+}
+
+// Look for the next request from the server, while keeping the output of the
+// queued deltas moving.
+static int read_while_sending(struct asfd *asfd, struct delta_pool *pool,
+	struct conf **confs)
+{
+	while(delta_pool_pending(pool))
+	{
+		if(send_deltas(asfd, pool, confs, DELTA_SEND_READY)
+		  || asfd->as->read_quick(asfd->as))
+			return -1;
+		if(asfd->rbuf->buf) return 0;
+		delta_pool_wait(pool, DELTA_POLL_USEC);
+	}
+	return asfd->read(asfd);
+}
+#else
+static int send_deltas(struct asfd *asfd, struct delta_pool *pool,
+	struct conf **confs, enum delta_send how)
+{
+	return 0;
+}
+#endif
+
 static int send_whole_file_w(struct asfd *asfd,
 	struct sbuf *sb, const char *datapth,
 	int quick_read, unsigned long long *bytes, const char *encpassword,
@@ -115,6 +277,24 @@ static int send_whole_file_w(struct asfd *asfd,
 		  confs, bfd, extrameta, elen);
 }
 
+#ifndef HAVE_WIN32
+// Try compressing a sample from the start of the file. This is not done on
+// Windows, where the file is read through the backup API and cannot go back
+// to the start.
+static int worth_compressing(BFILE *bfd)
+{
+	int ret=1;
+	ssize_t got;
+	uint8_t *buf=NULL;
+	if(!(buf=(uint8_t *)malloc_w(COMPADAPT_SAMPLE_LEN, __func__)))
+		return 1;
+	if((got=pread(bfd->fd, buf, COMPADAPT_SAMPLE_LEN, 0))>0)
+		ret=compadapt_worthwhile(buf, (size_t)got);
+	free_v((void **)&buf);
+	return ret;
+}
+#endif
+
 static int forget_file(struct asfd *asfd, struct sbuf *sb, struct conf **confs)
 {
 	// Tell the server to forget about this
@@ -156,7 +336,7 @@ static int size_checks(struct asfd *asfd, struct sbuf *sb, struct conf **confs)
 }
 
 static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
-	BFILE *bfd, struct conf **confs)
+	BFILE *bfd, struct delta_pool *pool, struct conf **confs)
 {
 	int ret=-1;
 	int forget=0;
@@ -164,12 +344,41 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 	char *extrameta=NULL;
 	unsigned long long bytes=0;
 	int conf_compression=get_int(confs[OPT_COMPRESSION]);
+	BFILE *delta_bfd=NULL;
+	int adaptive=get_int(confs[OPT_COMPRESSION_ADAPTIVE]);
+	int delta_compression=-1;
 
 	sb->compression=conf_compression;
 
 	iobuf_copy(&sb->path, asfd->rbuf);
 	iobuf_init(asfd->rbuf);
 
+	if(adaptive && sb->protocol1->datapth.buf && sb->attr.buf)
+	{
+		// The server has put the compression of the file that the
+		// delta will be applied to in the attribs.
+		attribs_decode(sb);
+		delta_compression=sb->compression;
+	}
+
+#ifndef HAVE_WIN32
+	if(pool)
+	{
+		if(sb->path.cmd==CMD_FILE
+		  && sb->protocol1->datapth.buf)
+		{
+			// The delta will be read in a thread, so it needs a
+			// file of its own.
+			if(!(delta_bfd=bfile_alloc())) goto error;
+			bfile_init(delta_bfd, 0, confs);
+			bfd=delta_bfd;
+		}
+		// Anything else has to wait for the queued deltas to go.
+		else if(send_deltas(asfd, pool, confs, DELTA_SEND_ALL))
+			goto error;
+	}
+#endif
+
 #ifdef HAVE_WIN32
 	if(win32_lstat(sb->path.buf, &sb->statp, &sb->winattr))
 #else
@@ -177,7 +386,8 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 #endif
 	{
 		logw(asfd, confs, "Path has vanished: %s", sb->path.buf);
-		if(forget_file(asfd, sb, confs)) goto error;
+		if(send_deltas(asfd, pool, confs, DELTA_SEND_ALL)
+		  || forget_file(asfd, sb, confs)) goto error;
 		goto end;
 	}
 
@@ -185,6 +395,8 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 
 	sb->compression=in_exclude_comp(get_strlist(confs[OPT_EXCOM]),
 		sb->path.buf, conf_compression);
+	if(delta_compression>=0)
+		sb->compression=delta_compression;
 	if(attribs_encode(sb)) goto error;
 
 	if(sb->path.cmd!=CMD_METADATA
@@ -198,10 +410,23 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 
 	if(forget)
 	{
-		if(forget_file(asfd, sb, confs)) goto error;
+		if(send_deltas(asfd, pool, confs, DELTA_SEND_ALL)
+		  || forget_file(asfd, sb, confs)) goto error;
 		goto end;
 	}
 
+#ifndef HAVE_WIN32
+	if(adaptive
+	  && sb->compression>0
+	  && !sb->protocol1->datapth.buf
+	  && (sb->path.cmd==CMD_FILE || sb->path.cmd==CMD_ENC_FILE)
+	  && !worth_compressing(bfd))
+	{
+		sb->compression=0;
+		if(attribs_encode(sb)) goto error;
+	}
+#endif
+
 	if(sb->path.cmd==CMD_METADATA
 	  || sb->path.cmd==CMD_ENC_METADATA
 	  || sb->path.cmd==CMD_VSS
@@ -236,6 +461,16 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 		}
 	}
 
+#ifndef HAVE_WIN32
+	if(delta_bfd)
+	{
+		if(queue_delta(asfd, sb, &delta_bfd, pool, confs))
+			goto error;
+		// The queued job has the file now.
+		if(!delta_bfd) bfd=NULL;
+	}
+	else
+#endif
 	if(sb->path.cmd==CMD_FILE
 	  && sb->protocol1->datapth.buf)
 	{
@@ -256,6 +491,8 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 			cntr_add(get_cntr(confs[OPT_CNTR]), CMD_FILE_CHANGED, 1);
 			cntr_add_bytes(get_cntr(confs[OPT_CNTR]), bytes);
 			cntr_add_sentbytes(get_cntr(confs[OPT_CNTR]), sentbytes);
+			cntr_add_compbytes(get_cntr(confs[OPT_CNTR]), bytes,
+				sb->compression>0);
 		}
 	}
 	else
@@ -275,6 +512,8 @@ static int deal_with_data(struct asfd *asfd, struct sbuf *sb,
 			cntr_add(get_cntr(confs[OPT_CNTR]), sb->path.cmd, 1);
 			cntr_add_bytes(get_cntr(confs[OPT_CNTR]), bytes);
 			cntr_add_sentbytes(get_cntr(confs[OPT_CNTR]), bytes);
+			cntr_add_compbytes(get_cntr(confs[OPT_CNTR]), bytes,
+				sb->compression>0 && sb->path.cmd!=CMD_EFS_FILE);
 		}
 	}
 
@@ -288,15 +527,16 @@ error:
 	// different file path, or when this function
 	// exits.
 #else
-	bfd->close(bfd, asfd);
+	if(bfd) bfd->close(bfd, asfd);
 #endif
+	bfile_free(&delta_bfd);
 	sbuf_free_content(sb);
 	if(extrameta) free(extrameta);
 	return ret;
 }
 
 static int parse_rbuf(struct asfd *asfd, struct sbuf *sb,
-	BFILE *bfd, struct conf **confs)
+	BFILE *bfd, struct delta_pool *pool, struct conf **confs)
 {
 	static struct iobuf *rbuf;
 	rbuf=asfd->rbuf;
@@ -322,7 +562,7 @@ static int parse_rbuf(struct asfd *asfd, struct sbuf *sb,
 	  || rbuf->cmd==CMD_ENC_VSS_T
 	  || rbuf->cmd==CMD_EFS_FILE)
 	{
-		if(deal_with_data(asfd, sb, bfd, confs))
+		if(deal_with_data(asfd, sb, bfd, pool, confs))
 			return -1;
 	}
 	else if(rbuf->cmd==CMD_MESSAGE
@@ -348,11 +588,17 @@ static int do_backup_phase2_client(struct asfd *asfd,
 	BFILE *bfd=NULL;
 	struct sbuf *sb=NULL;
 	struct iobuf *rbuf=asfd->rbuf;
+	struct delta_pool *pool=NULL;
 
 	if(!(bfd=bfile_alloc())
 	  || !(sb=sbuf_alloc(confs)))
 		goto end;
 	bfile_init(bfd, 0, confs);
+#ifndef HAVE_WIN32
+	if(get_int(confs[OPT_DELTA_THREADS])>0
+	  && !(pool=delta_pool_alloc(get_int(confs[OPT_DELTA_THREADS]))))
+		goto end;
+#endif
 
 	if(!resume)
 	{
@@ -370,22 +616,33 @@ static int do_backup_phase2_client(struct asfd *asfd,
 	while(1)
 	{
 		iobuf_free_content(rbuf);
+#ifndef HAVE_WIN32
+		if(pool)
+		{
+			if(read_while_sending(asfd, pool, confs)) goto end;
+		}
+		else
+#endif
 		if(asfd->read(asfd)) goto end;
-		else if(!rbuf->buf) continue;
+		if(!rbuf->buf) continue;
 
 		if(rbuf->cmd==CMD_GEN && !strcmp(rbuf->buf, "backupphase2end"))
 		{
-			if(asfd->write_str(asfd, CMD_GEN, "okbackupphase2end"))
+			if(send_deltas(asfd, pool, confs, DELTA_SEND_ALL)
+			  || asfd->write_str(asfd, CMD_GEN, "okbackupphase2end"))
 				goto end;
 			ret=0;
 			break;
 		}
 
-		if(parse_rbuf(asfd, sb, bfd, confs))
+		if(parse_rbuf(asfd, sb, bfd, pool, confs))
 			goto end;
 	}
 
 end:
+#ifndef HAVE_WIN32
+	delta_pool_free(&pool);
+#endif
 	// It is possible for a bfd to still be open.
 	bfd->close(bfd, asfd);
 	bfile_free(&bfd);
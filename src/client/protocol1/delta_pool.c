@@ -0,0 +1,316 @@
+#include "include.h"
+
+#include <pthread.h>
+
+struct delta_pool
+{
+	pthread_t *tids;
+	int threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+
+	// All the queued jobs, in the order that they are to be sent. The
+	// workers take them from 'next'.
+	struct delta_job *head;
+	struct delta_job *tail;
+	struct delta_job *next;
+	int pending;
+	int max;
+};
+
+struct delta_job *delta_job_alloc(void)
+{
+	return (struct delta_job *)
+		calloc_w(1, sizeof(struct delta_job), __func__);
+}
+
+void delta_chunks_free(struct delta_chunk **chunks)
+{
+	struct delta_chunk *c;
+	struct delta_chunk *n;
+	if(!chunks) return;
+	for(c=*chunks; c; c=n)
+	{
+		n=c->next;
+		free_w(&c->buf);
+		free_v((void **)&c);
+	}
+	*chunks=NULL;
+}
+
+void delta_job_free(struct delta_job **job)
+{
+	if(!job || !*job) return;
+	sbuf_free(&(*job)->sb);
+	if((*job)->bfd)
+	{
+		(*job)->bfd->close((*job)->bfd, NULL);
+		bfile_free(&(*job)->bfd);
+	}
+	if((*job)->sumset) rs_free_sumset((*job)->sumset);
+	free_w(&(*job)->outbuf);
+	delta_chunks_free(&(*job)->chunks);
+	free_v((void **)job);
+}
+
+// Called by rs_job_drive() in the worker, with the output buffer that it
+// has filled so far. Hand it over to the main thread as a chunk, waiting if
+// too many are already queued.
+static rs_result drain_to_chunks(rs_job_t *rsjob,
+	rs_buffers_t *buf, void *opaque)
+{
+	size_t len;
+	struct delta_chunk *c;
+	struct delta_job *job=(struct delta_job *)opaque;
+	struct delta_pool *pool=job->pool;
+
+	if(buf->next_out && (len=buf->next_out-job->outbuf)>0)
+	{
+		if(!(c=(struct delta_chunk *)
+			calloc_w(1, sizeof(struct delta_chunk), __func__)))
+				return RS_MEM_ERROR;
+		c->buf=job->outbuf;
+		c->len=len;
+		if(!(job->outbuf=(char *)malloc_w(job->chunk_len, __func__)))
+		{
+			job->outbuf=c->buf;
+			free_v((void **)&c);
+			return RS_MEM_ERROR;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		while(job->nchunks>=DELTA_JOB_CHUNKS_MAX && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if(pool->stop)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			free_w(&c->buf);
+			free_v((void **)&c);
+			return RS_IO_ERROR;
+		}
+		if(job->last) job->last->next=c;
+		else job->chunks=c;
+		job->last=c;
+		job->nchunks++;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	buf->next_out=job->outbuf;
+	buf->avail_out=job->chunk_len;
+	return RS_DONE;
+}
+
+static rs_result run_job(struct delta_job *job)
+{
+	rs_result r=RS_IO_ERROR;
+	rs_job_t *rsjob=NULL;
+	rs_filebuf_t *infb=NULL;
+	rs_buffers_t rsbuf;
+	memset(&rsbuf, 0, sizeof(rsbuf));
+
+	if((r=rs_build_hash_table(job->sumset)))
+		return r;
+	if(!(rsjob=rs_delta_begin(job->sumset)))
+	{
+		logp("could not start delta job.\n");
+		return RS_IO_ERROR;
+	}
+	if(!(job->outbuf=(char *)malloc_w(job->chunk_len, __func__))
+	  || !(infb=rs_filebuf_new(NULL, job->bfd, NULL, -1,
+		job->chunk_len, job->bfd->datalen, NULL)))
+	{
+		logp("could not rs_filebuf_new for delta\n");
+		r=RS_MEM_ERROR;
+		goto end;
+	}
+
+	r=rs_job_drive(rsjob, &rsbuf,
+		rs_infilebuf_fill, infb, drain_to_chunks, job);
+	if(r==RS_DONE)
+	{
+		job->bytes=infb->bytes;
+		if(!MD5_Final(job->checksum, &(infb->md5)))
+		{
+			logp("MD5_Final() failed\n");
+			r=RS_IO_ERROR;
+		}
+	}
+end:
+	rs_filebuf_free(&infb);
+	rs_job_free(rsjob);
+	return r;
+}
+
+static void *delta_worker(void *arg)
+{
+	struct delta_job *job;
+	struct delta_pool *pool=(struct delta_pool *)arg;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1)
+	{
+		if(pool->stop) break;
+		if(!(job=pool->next))
+		{
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		pool->next=job->next;
+		job->state=DELTA_BUSY;
+		pthread_mutex_unlock(&pool->lock);
+
+		job->result=run_job(job);
+
+		pthread_mutex_lock(&pool->lock);
+		job->state=DELTA_DONE;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct delta_pool *delta_pool_alloc(int threads)
+{
+	int i;
+	struct delta_pool *pool;
+
+	if(!(pool=(struct delta_pool *)
+		calloc_w(1, sizeof(struct delta_pool), __func__)))
+			return NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	// Queue a few more than there are threads, so that the workers have
+	// something to go on with while the front of the queue is sent.
+	pool->max=threads*2;
+	if(!(pool->tids=(pthread_t *)
+		calloc_w(threads, sizeof(pthread_t), __func__)))
+			goto error;
+	for(i=0; i<threads; i++)
+	{
+		if(pthread_create(&pool->tids[i], NULL, delta_worker, pool))
+		{
+			logp("Could not create delta thread: %s\n",
+				strerror(errno));
+			goto error;
+		}
+		pool->threads++;
+	}
+	return pool;
+error:
+	delta_pool_free(&pool);
+	return NULL;
+}
+
+void delta_pool_free(struct delta_pool **pool)
+{
+	int i;
+	struct delta_job *job;
+	if(!pool || !*pool) return;
+
+	pthread_mutex_lock(&(*pool)->lock);
+	(*pool)->stop=1;
+	pthread_cond_broadcast(&(*pool)->cond);
+	pthread_mutex_unlock(&(*pool)->lock);
+	for(i=0; i<(*pool)->threads; i++)
+		pthread_join((*pool)->tids[i], NULL);
+
+	while((job=(*pool)->head))
+	{
+		(*pool)->head=job->next;
+		delta_job_free(&job);
+	}
+	pthread_mutex_destroy(&(*pool)->lock);
+	pthread_cond_destroy(&(*pool)->cond);
+	free_v((void **)&(*pool)->tids);
+	free_v((void **)pool);
+}
+
+void delta_pool_add(struct delta_pool *pool, struct delta_job *job)
+{
+	job->pool=pool;
+	job->state=DELTA_QUEUED;
+	job->next=NULL;
+	pthread_mutex_lock(&pool->lock);
+	if(pool->tail) pool->tail->next=job;
+	else pool->head=job;
+	pool->tail=job;
+	if(!pool->next) pool->next=job;
+	pool->pending++;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// Only the main thread changes the number pending, so it does not need the
+// lock to look at it.
+int delta_pool_pending(struct delta_pool *pool)
+{
+	return pool->pending;
+}
+
+int delta_pool_full(struct delta_pool *pool)
+{
+	return pool->pending>=pool->max;
+}
+
+struct delta_job *delta_pool_head(struct delta_pool *pool)
+{
+	return pool->head;
+}
+
+// The head job must have finished.
+void delta_pool_remove_head(struct delta_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	if(pool->head)
+	{
+		if(!(pool->head=pool->head->next))
+			pool->tail=NULL;
+		pool->pending--;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static int head_has_output(struct delta_pool *pool)
+{
+	return pool->head
+	  && (pool->head->chunks || pool->head->state==DELTA_DONE);
+}
+
+// Wait for a while, or until there is something to send.
+void delta_pool_wait(struct delta_pool *pool, long usec)
+{
+	struct timeval now;
+	struct timespec until;
+
+	gettimeofday(&now, NULL);
+	usec+=now.tv_usec;
+	until.tv_sec=now.tv_sec+usec/1000000;
+	until.tv_nsec=(usec%1000000)*1000;
+
+	pthread_mutex_lock(&pool->lock);
+	if(!head_has_output(pool))
+		pthread_cond_timedwait(&pool->cond, &pool->lock, &until);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int delta_job_take(struct delta_job *job,
+	struct delta_chunk **chunks, int wait)
+{
+	int done;
+	struct delta_pool *pool=job->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	while(wait && !job->chunks && job->state!=DELTA_DONE)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	*chunks=job->chunks;
+	job->chunks=NULL;
+	job->last=NULL;
+	job->nchunks=0;
+	done=job->state==DELTA_DONE;
+	// Let the worker carry on.
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	return done;
+}
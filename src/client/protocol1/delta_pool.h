@@ -0,0 +1,74 @@
+#ifndef _DELTA_POOL_H
+#define _DELTA_POOL_H
+
+// Works out the librsync deltas of several changed files at once, in a pool
+// of threads. The main thread queues the files in the order that the server
+// asked for them, and sends the output from the front of the queue, so that
+// it still reaches the server in that order. A worker can only get a few
+// messages ahead of the main thread before it waits for them to be sent.
+
+#define DELTA_JOB_CHUNKS_MAX	8
+
+struct delta_chunk
+{
+	char *buf;
+	size_t len;
+	struct delta_chunk *next;
+};
+
+enum delta_state
+{
+	DELTA_QUEUED=0,
+	DELTA_BUSY,
+	DELTA_DONE
+};
+
+struct delta_job
+{
+	// Set up by the main thread before queueing.
+	struct sbuf *sb;	// Datapth, attribs and path to send first.
+	BFILE *bfd;
+	rs_signature_t *sumset;
+	size_t chunk_len;
+
+	// Filled in by the worker.
+	enum delta_state state;
+	rs_result result;
+	unsigned long long bytes;
+	uint8_t checksum[MD5_DIGEST_LENGTH];
+	char *outbuf;
+	struct delta_chunk *chunks;
+	struct delta_chunk *last;
+	int nchunks;
+
+	// Used by the main thread when sending.
+	int started;
+	unsigned long long sentbytes;
+
+	struct delta_pool *pool;
+	struct delta_job *next;
+};
+
+struct delta_pool;
+
+extern struct delta_pool *delta_pool_alloc(int threads);
+extern void delta_pool_free(struct delta_pool **pool);
+
+extern struct delta_job *delta_job_alloc(void);
+extern void delta_job_free(struct delta_job **job);
+
+extern void delta_pool_add(struct delta_pool *pool, struct delta_job *job);
+extern int delta_pool_pending(struct delta_pool *pool);
+extern int delta_pool_full(struct delta_pool *pool);
+extern struct delta_job *delta_pool_head(struct delta_pool *pool);
+extern void delta_pool_remove_head(struct delta_pool *pool);
+extern void delta_pool_wait(struct delta_pool *pool, long usec);
+
+// Take the output that the job has produced so far. If 'wait' is set, wait
+// until there is some, or the job has finished. Returns 1 once the job has
+// finished and everything has been taken.
+extern int delta_job_take(struct delta_job *job,
+	struct delta_chunk **chunks, int wait);
+extern void delta_chunks_free(struct delta_chunk **chunks);
+
+#endif
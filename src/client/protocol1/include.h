@@ -8,6 +8,7 @@
 #include "../find.h"
 
 #include "backup_phase2.h"
+#include "delta_pool.h"
 #include "include.h"
 #include "restore.h"
 
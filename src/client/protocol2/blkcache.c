@@ -0,0 +1,196 @@
+#include "include.h"
+
+struct cfile
+{
+	char *path;
+	int refs;
+};
+
+struct centry
+{
+	struct cfile *file;	// NULL if the block is in the spill file.
+	off_t offset;
+	uint32_t length;
+};
+
+struct blkcache
+{
+	// The last RESTORE_DEDUP_WINDOW blocks, by their number modulo that.
+	struct centry *entries;
+	uint64_t seq;
+
+	// The file being restored, and where the next block will go in it.
+	struct cfile *current;
+	off_t offset;
+
+	FILE *spill;
+	off_t spill_len;
+
+	// Kept open, since references often point at the same file.
+	struct cfile *rfile;
+	int rfd;
+
+	uint64_t refs;
+	uint64_t ref_bytes;
+};
+
+static void cfile_release(struct blkcache *cache, struct cfile **file)
+{
+	if(!*file) return;
+	if(--(*file)->refs<=0)
+	{
+		if(cache->rfile==*file)
+		{
+			close(cache->rfd);
+			cache->rfd=-1;
+			cache->rfile=NULL;
+		}
+		free_w(&(*file)->path);
+		free_v((void **)file);
+	}
+	*file=NULL;
+}
+
+struct blkcache *blkcache_alloc(void)
+{
+	struct blkcache *cache;
+	if(!(cache=(struct blkcache *)
+		calloc_w(1, sizeof(struct blkcache), __func__)))
+			return NULL;
+	cache->rfd=-1;
+	if(!(cache->entries=(struct centry *)calloc_w(RESTORE_DEDUP_WINDOW,
+		sizeof(struct centry), __func__)))
+			goto error;
+	return cache;
+error:
+	blkcache_free(&cache);
+	return NULL;
+}
+
+void blkcache_free(struct blkcache **cache)
+{
+	uint64_t i;
+	if(!cache || !*cache) return;
+	if((*cache)->refs)
+		logp("Restored %" PRIu64 " blocks from references,"
+			" saving %" PRIu64 " bytes\n",
+			(*cache)->refs, (*cache)->ref_bytes);
+	if((*cache)->entries)
+	{
+		for(i=0; i<RESTORE_DEDUP_WINDOW; i++)
+			cfile_release(*cache, &(*cache)->entries[i].file);
+		free_v((void **)&(*cache)->entries);
+	}
+	cfile_release(*cache, &(*cache)->current);
+	if((*cache)->rfd>=0) close((*cache)->rfd);
+	if((*cache)->spill) fclose((*cache)->spill);
+	free_v((void **)cache);
+}
+
+int blkcache_set_file(struct blkcache *cache, const char *path)
+{
+	cfile_release(cache, &cache->current);
+	cache->offset=0;
+	if(!path) return 0;
+	if(!(cache->current=(struct cfile *)
+		calloc_w(1, sizeof(struct cfile), __func__))
+	  || !(cache->current->path=strdup_w(path, __func__)))
+	{
+		free_v((void **)&cache->current);
+		return -1;
+	}
+	cache->current->refs=1;
+	return 0;
+}
+
+static int spill(struct blkcache *cache, struct centry *e, struct blk *blk)
+{
+	if(!cache->spill && !(cache->spill=tmpfile()))
+	{
+		logp("Could not open temporary file in %s: %s\n",
+			__func__, strerror(errno));
+		return -1;
+	}
+	if(pwrite(fileno(cache->spill), blk->data, blk->length,
+		cache->spill_len)!=(ssize_t)blk->length)
+	{
+		logp("Could not write to temporary file in %s: %s\n",
+			__func__, strerror(errno));
+		return -1;
+	}
+	e->offset=cache->spill_len;
+	cache->spill_len+=blk->length;
+	return 0;
+}
+
+int blkcache_add(struct blkcache *cache, struct blk *blk, int written)
+{
+	struct centry *e=&cache->entries[cache->seq%RESTORE_DEDUP_WINDOW];
+
+	cfile_release(cache, &e->file);
+	e->length=blk->length;
+	cache->seq++;
+	if(!written || !cache->current)
+		return spill(cache, e, blk);
+	e->file=cache->current;
+	e->file->refs++;
+	e->offset=cache->offset;
+	cache->offset+=blk->length;
+	return 0;
+}
+
+void blkcache_skip(struct blkcache *cache, uint64_t len)
+{
+	cache->offset+=len;
+}
+
+static int get_fd(struct blkcache *cache, struct centry *e)
+{
+	if(!e->file) return fileno(cache->spill);
+	if(cache->rfile==e->file) return cache->rfd;
+	if(cache->rfd>=0) close(cache->rfd);
+	cache->rfile=NULL;
+	if((cache->rfd=open(e->file->path, O_RDONLY))<0)
+	{
+		logp("Could not open %s to read a repeated block: %s\n",
+			e->file->path, strerror(errno));
+		return -1;
+	}
+	cache->rfile=e->file;
+	return cache->rfd;
+}
+
+int blkcache_get(struct blkcache *cache, uint64_t seq, struct blk *blk)
+{
+	int fd;
+	ssize_t got;
+	struct centry *e;
+
+	if(seq>=cache->seq || cache->seq-seq>RESTORE_DEDUP_WINDOW)
+	{
+		logp("Block reference %" PRIu64 " is out of range\n", seq);
+		return -1;
+	}
+	e=&cache->entries[seq%RESTORE_DEDUP_WINDOW];
+	if((fd=get_fd(cache, e))<0
+	  || !(blk->data=(char *)malloc_w(e->length+1, __func__)))
+		return -1;
+	blk->length=e->length;
+	if((got=pread(fd, blk->data, e->length, e->offset))>=0
+	  && (uint32_t)got<e->length && e->file)
+	{
+		// With restore_sparse, the file being restored may end in a
+		// hole that it has not been extended over yet.
+		memset(blk->data+got, 0, e->length-got);
+		got=e->length;
+	}
+	if(got!=(ssize_t)e->length)
+	{
+		logp("Could not read back repeated block %" PRIu64 "\n", seq);
+		free_w(&blk->data);
+		return -1;
+	}
+	cache->refs++;
+	cache->ref_bytes+=e->length;
+	return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef _BLKCACHE_H
+#define _BLKCACHE_H
+
+// Used by restore_dedup. Remembers where each block that came over the
+// network during a restore was written, numbered in the order that they
+// arrived, so that the server can send a number instead of a block that it
+// has sent before. Blocks are read back from the restored files. Blocks that
+// could not go into a readable file are kept in a temporary file instead.
+
+struct blkcache;
+
+extern struct blkcache *blkcache_alloc(void);
+extern void blkcache_free(struct blkcache **cache);
+// Call after starting to restore an entry. 'path' is the file that its data
+// will be written to, or NULL if the data cannot be read back from there.
+extern int blkcache_set_file(struct blkcache *cache, const char *path);
+// Call for each block that came over the network, after the attempt to
+// write it. 'written' is 1 if it went into the file at the current position.
+extern int blkcache_add(struct blkcache *cache, struct blk *blk, int written);
+// Call for a run of zero bytes that was written to the file.
+extern void blkcache_skip(struct blkcache *cache, uint64_t len);
+// Fill in the data of block number 'seq'.
+extern int blkcache_get(struct blkcache *cache, uint64_t seq,
+	struct blk *blk);
+
+#endif
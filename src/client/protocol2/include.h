@@ -4,6 +4,9 @@
 #include "../include.h"
 
 #include "backup_phase2.h"
+#include "blkcache.h"
 #include "restore.h"
+#include "restore_delta.h"
+#include "restore_pool.h"
 
 #endif
@@ -0,0 +1,309 @@
+#include "include.h"
+#include "../../cmd.h"
+#include "../../base64.h"
+#include "../../protocol2/rabin/rabin.h"
+#include "../../protocol2/rabin/rconf.h"
+
+// A signature sent by the server. 'length' gets set when the block is found
+// in the old copy of the file, at 'offset'.
+struct dsig
+{
+	uint64_t fingerprint;
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+	uint64_t offset;
+	uint32_t length;
+	uint32_t next;	// The next one in the same bucket, plus one.
+};
+
+struct rdelta
+{
+	struct dsig *sigs;
+	uint64_t len;
+	uint64_t alloc;
+	// Signatures by fingerprint. A plain array of chains rather than a
+	// uthash table, because a disk image can have millions of blocks.
+	uint32_t *buckets;
+	uint64_t nbuckets;
+	int fd;		// The old copy of the file.
+	int requested;
+	char *buf;
+
+	uint64_t files;
+	uint64_t blks;
+	uint64_t reused;
+};
+
+struct rdelta *rdelta_alloc(void)
+{
+	struct rdelta *rdelta;
+	if(!(rdelta=(struct rdelta *)calloc_w(1, sizeof(struct rdelta),
+		__func__)))
+			return NULL;
+	rdelta->fd=-1;
+	if(!(rdelta->buf=(char *)malloc_w(RABIN_MAX, __func__)))
+		rdelta_free(&rdelta);
+	return rdelta;
+}
+
+void rdelta_reset(struct rdelta *rdelta)
+{
+	if(rdelta->len) rdelta->files++;
+	rdelta->blks+=rdelta->len;
+	rdelta->len=0;
+	rdelta->requested=0;
+	free_v((void **)&rdelta->buckets);
+	rdelta->nbuckets=0;
+	close_fd(&rdelta->fd);
+}
+
+void rdelta_free(struct rdelta **rdelta)
+{
+	if(!rdelta || !*rdelta) return;
+	rdelta_reset(*rdelta);
+	if((*rdelta)->files)
+		logp("Reused %" PRIu64 " of %" PRIu64 " blocks"
+			" of %" PRIu64 " files checked with restore_delta\n",
+			(*rdelta)->reused, (*rdelta)->blks, (*rdelta)->files);
+	free_v((void **)&(*rdelta)->sigs);
+	free_w(&(*rdelta)->buf);
+	free_v((void **)rdelta);
+}
+
+static int add_sig(struct rdelta *rdelta, struct iobuf *rbuf)
+{
+	struct blk blk;
+	struct dsig *d;
+
+	if(split_sig(rbuf, &blk)) return -1;
+	if(rdelta->len>=rdelta->alloc)
+	{
+		uint64_t alloc=rdelta->alloc?rdelta->alloc*2:1024;
+		struct dsig *tmp;
+		if(rdelta->len>=UINT32_MAX-1)
+		{
+			logp("Too many signatures for restore_delta\n");
+			return -1;
+		}
+		if(!(tmp=(struct dsig *)realloc_w(rdelta->sigs,
+			alloc*sizeof(struct dsig), __func__)))
+				return -1;
+		rdelta->sigs=tmp;
+		rdelta->alloc=alloc;
+	}
+	d=&rdelta->sigs[rdelta->len++];
+	d->fingerprint=blk.fingerprint;
+	memcpy(d->md5sum, blk.md5sum, MD5_DIGEST_LENGTH);
+	d->offset=0;
+	d->length=0;
+	d->next=0;
+	return 0;
+}
+
+int rdelta_read_sigs(struct rdelta *rdelta, struct asfd *asfd)
+{
+	int ret=-1;
+	struct iobuf *rbuf=asfd->rbuf;
+
+	while(1)
+	{
+		iobuf_free_content(rbuf);
+		if(asfd->read(asfd)) goto end;
+		switch(rbuf->cmd)
+		{
+			case CMD_SIG:
+				if(add_sig(rdelta, rbuf)) goto end;
+				continue;
+			case CMD_GEN:
+				if(!strcmp(rbuf->buf, "sigs_end"))
+				{
+					ret=0;
+					goto end;
+				}
+				// Fall through.
+			default:
+				iobuf_log_unexpected(rbuf, __func__);
+				goto end;
+		}
+	}
+end:
+	iobuf_free_content(rbuf);
+	return ret;
+}
+
+static uint64_t bucket_of(struct rdelta *rdelta, uint64_t fingerprint)
+{
+	// The low bits of a fingerprint are not well mixed.
+	return (fingerprint*0x9E3779B97F4A7C15ULL)>>32 & (rdelta->nbuckets-1);
+}
+
+static int build_buckets(struct rdelta *rdelta)
+{
+	uint64_t i;
+	uint64_t b;
+
+	rdelta->nbuckets=1024;
+	while(rdelta->nbuckets<rdelta->len) rdelta->nbuckets<<=1;
+	if(!(rdelta->buckets=(uint32_t *)calloc_w(rdelta->nbuckets,
+		sizeof(uint32_t), __func__)))
+			return -1;
+	for(i=0; i<rdelta->len; i++)
+	{
+		b=bucket_of(rdelta, rdelta->sigs[i].fingerprint);
+		rdelta->sigs[i].next=rdelta->buckets[b];
+		rdelta->buckets[b]=i+1;
+	}
+	return 0;
+}
+
+static int match_blk(struct blk *blk, uint64_t offset, void *param)
+{
+	uint32_t i;
+	int got_md5=0;
+	struct dsig *d;
+	struct rdelta *rdelta=(struct rdelta *)param;
+
+	for(i=rdelta->buckets[bucket_of(rdelta, blk->fingerprint)];
+		i; i=d->next)
+	{
+		d=&rdelta->sigs[i-1];
+		if(d->length || d->fingerprint!=blk->fingerprint)
+			continue;
+		if(!got_md5)
+		{
+			if(blk_md5_update(blk)) return -1;
+			got_md5=1;
+		}
+		if(memcmp(d->md5sum, blk->md5sum, MD5_DIGEST_LENGTH))
+			continue;
+		d->offset=offset;
+		d->length=blk->length;
+		rdelta->reused++;
+	}
+	return 0;
+}
+
+static void forget_matches(struct rdelta *rdelta)
+{
+	uint64_t i;
+	for(i=0; i<rdelta->len; i++)
+	{
+		if(!rdelta->sigs[i].length) continue;
+		rdelta->sigs[i].length=0;
+		rdelta->reused--;
+	}
+}
+
+int64_t rdelta_match(struct rdelta *rdelta, const char *path)
+{
+	int fd=-1;
+	uint64_t i;
+	int64_t found=0;
+	struct stat statp;
+
+	if(!rdelta->len
+	  || lstat(path, &statp)
+	  || !S_ISREG(statp.st_mode))
+		return 0;
+	if((fd=open(path, O_RDONLY))<0)
+	{
+		logp("Could not open %s for restore_delta: %s\n",
+			path, strerror(errno));
+		return 0;
+	}
+	if(build_buckets(rdelta)
+	  || blks_generate_fd(fd, match_blk, rdelta))
+	{
+		close_fd(&fd);
+		return -1;
+	}
+	for(i=0; i<rdelta->len; i++)
+		if(rdelta->sigs[i].length) found++;
+	if(!found)
+	{
+		close_fd(&fd);
+		return 0;
+	}
+
+	// Keep the old copy open to read from, and get it out of the way of
+	// the new one. Opening the new one in its place would otherwise
+	// truncate it.
+	if(unlink(path))
+	{
+		logp("Could not unlink %s for restore_delta: %s\n",
+			path, strerror(errno));
+		forget_matches(rdelta);
+		close_fd(&fd);
+		return 0;
+	}
+	rdelta->fd=fd;
+	return found;
+}
+
+int rdelta_request(struct rdelta *rdelta, struct asfd *asfd, int want)
+{
+	uint64_t i;
+	char req[32]="";
+
+	for(i=0; want && i<rdelta->len; i++)
+	{
+		if(rdelta->sigs[i].length) continue;
+		req[to_base64(i, req)]=0;
+		if(asfd->write_str(asfd, CMD_DATA_REQ, req)) return -1;
+	}
+	rdelta->requested=want;
+	return asfd->write_str(asfd, CMD_GEN, "requests_end");
+}
+
+static int write_buf(BFILE *bfd, char *buf, size_t len)
+{
+	int w;
+	if(bfd->mode==BF_CLOSED) return 0;
+	if((w=bfd->write(bfd, buf, len))<=0)
+	{
+		logp("%s(): error when appending %lu: %d\n",
+			__func__, (unsigned long)len, w);
+		return -1;
+	}
+	return 0;
+}
+
+int rdelta_write(struct rdelta *rdelta, struct asfd *asfd, BFILE *bfd)
+{
+	int ret=-1;
+	uint64_t i;
+	struct dsig *d;
+	struct iobuf *rbuf=asfd->rbuf;
+
+	for(i=0; i<rdelta->len; i++)
+	{
+		d=&rdelta->sigs[i];
+		if(d->length)
+		{
+			if(pread(rdelta->fd, rdelta->buf, d->length,
+				d->offset)!=(ssize_t)d->length)
+			{
+				logp("Short read from old copy of %s\n",
+					bfd->path?bfd->path:"file");
+				goto end;
+			}
+			if(write_buf(bfd, rdelta->buf, d->length))
+				goto end;
+			continue;
+		}
+		if(!rdelta->requested) continue;
+
+		iobuf_free_content(rbuf);
+		if(asfd->read(asfd)) goto end;
+		if(rbuf->cmd!=CMD_DATA)
+		{
+			iobuf_log_unexpected(rbuf, __func__);
+			goto end;
+		}
+		if(write_buf(bfd, rbuf->buf, rbuf->len))
+			goto end;
+	}
+	ret=0;
+end:
+	iobuf_free_content(rbuf);
+	return ret;
+}
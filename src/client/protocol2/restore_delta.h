@@ -0,0 +1,28 @@
+#ifndef _RESTORE_DELTA_H
+#define _RESTORE_DELTA_H
+
+// Used by restore_delta. Before the server sends the data of a large file, it
+// sends the signatures of its blocks. The copy of the file that is already
+// at the restore location is cut into blocks in the same way as a backup
+// does, and only the blocks that are not found in it are asked for. The file
+// is then put together from the old copy and the blocks that arrive.
+
+struct rdelta;
+
+extern struct rdelta *rdelta_alloc(void);
+extern void rdelta_free(struct rdelta **rdelta);
+// Read the signatures that the server sends, up to the end marker.
+extern int rdelta_read_sigs(struct rdelta *rdelta, struct asfd *asfd);
+// Look for the blocks in the existing file at 'path', if there is one.
+// Returns the number found, or -1 on error.
+extern int64_t rdelta_match(struct rdelta *rdelta, const char *path);
+// Ask for the blocks that were not found, or for none of them if 'want' is 0.
+extern int rdelta_request(struct rdelta *rdelta, struct asfd *asfd, int want);
+// Write out the blocks in order to 'bfd', taking those that were found from
+// the old copy, and reading the rest from the server. If 'bfd' is not open,
+// the blocks from the server are read and thrown away.
+extern int rdelta_write(struct rdelta *rdelta, struct asfd *asfd, BFILE *bfd);
+// Forget the file.
+extern void rdelta_reset(struct rdelta *rdelta);
+
+#endif
@@ -0,0 +1,458 @@
+#include "include.h"
+#include "../../cmd.h"
+
+#include <pthread.h>
+
+struct rpool_chunk
+{
+	char *buf;	// NULL for a run of zeroes.
+	uint64_t len;
+	struct rpool_chunk *next;
+};
+
+enum rpool_state
+{
+	RPOOL_QUEUED=0,
+	RPOOL_BUSY,
+	RPOOL_DONE
+};
+
+struct rpool_job
+{
+	// Set up by the main thread.
+	char *path;
+	struct stat statp;
+	uint64_t winattr;
+	int sparse;
+	struct rpool_chunk *chunks;
+	struct rpool_chunk *last;
+	uint64_t bytes;
+	int ended;
+
+	// Filled in by the worker.
+	enum rpool_state state;
+	int open_errno;
+	int write_errno;
+	uint64_t sparse_bytes;
+
+	struct rpool_job *next;
+};
+
+struct rpool_dir
+{
+	char *path;
+	struct stat statp;
+	uint64_t winattr;
+	struct rpool_dir *next;
+};
+
+struct restore_pool
+{
+	pthread_t *tids;
+	int threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+
+	// All the queued files, in the order that they came. The workers take
+	// them from 'next'.
+	struct rpool_job *head;
+	struct rpool_job *tail;
+	struct rpool_job *next;
+	int pending;
+	int max;
+	// The file that data is arriving for.
+	struct rpool_job *current;
+
+	// Directories waiting for their attributes, in the order that they
+	// came.
+	struct rpool_dir *dirs;
+	struct rpool_dir *dirs_last;
+	int ndirs;
+
+	struct conf **confs;
+};
+
+static void chunks_free(struct rpool_chunk **chunks)
+{
+	struct rpool_chunk *c;
+	struct rpool_chunk *n;
+	for(c=*chunks; c; c=n)
+	{
+		n=c->next;
+		free_w(&c->buf);
+		free_v((void **)&c);
+	}
+	*chunks=NULL;
+}
+
+static void job_free(struct rpool_job **job)
+{
+	if(!job || !*job) return;
+	free_w(&(*job)->path);
+	chunks_free(&(*job)->chunks);
+	free_v((void **)job);
+}
+
+static int write_chunk(BFILE *bfd, struct rpool_chunk *c)
+{
+	ssize_t w;
+	char *buf=c->buf;
+	uint64_t len=c->len;
+
+	if(!buf) return bfd->write_zeros(bfd, len);
+	while(len)
+	{
+		if((w=bfd->write(bfd, buf, len))<=0)
+			return -1;
+		buf+=w;
+		len-=w;
+	}
+	return 0;
+}
+
+static void run_job(struct restore_pool *pool, struct rpool_job *job)
+{
+	int ended=0;
+	BFILE bfd;
+	struct rpool_chunk *c;
+	struct rpool_chunk *chunks;
+
+	// No confs, so that the worker does not touch the counters. The main
+	// thread adds things up when the file is finished.
+	bfile_init(&bfd, job->winattr, NULL);
+	bfd.sparse=job->sparse;
+	if(bfd.open(&bfd, NULL, job->path,
+		O_WRONLY|O_BINARY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR))
+			job->open_errno=errno?errno:EIO;
+	else
+		memcpy(&bfd.statp, &job->statp, sizeof(struct stat));
+
+	while(!ended)
+	{
+		pthread_mutex_lock(&pool->lock);
+		while(!job->chunks && !job->ended && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		chunks=job->chunks;
+		job->chunks=NULL;
+		job->last=NULL;
+		job->bytes=0;
+		ended=job->ended || pool->stop;
+		// Let the main thread queue more.
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+
+		for(c=chunks; c; c=c->next)
+		{
+			if(bfd.mode==BF_CLOSED || job->write_errno)
+				break;
+			if(write_chunk(&bfd, c))
+				job->write_errno=errno?errno:EIO;
+		}
+		chunks_free(&chunks);
+	}
+
+	job->sparse_bytes=bfd.sparse_bytes;
+	bfd.sparse_bytes=0;
+	// This sets the attributes too.
+	if(bfd.close(&bfd, NULL) && !job->write_errno)
+		job->write_errno=errno?errno:EIO;
+}
+
+static void *restore_worker(void *arg)
+{
+	struct rpool_job *job;
+	struct restore_pool *pool=(struct restore_pool *)arg;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1)
+	{
+		if(pool->stop) break;
+		if(!(job=pool->next))
+		{
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		pool->next=job->next;
+		job->state=RPOOL_BUSY;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_job(pool, job);
+
+		pthread_mutex_lock(&pool->lock);
+		job->state=RPOOL_DONE;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct restore_pool *restore_pool_alloc(int threads, struct conf **confs)
+{
+	int i;
+	struct restore_pool *pool;
+
+	if(!(pool=(struct restore_pool *)
+		calloc_w(1, sizeof(struct restore_pool), __func__)))
+			return NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->confs=confs;
+	// Small files go through quickly, so keep plenty of them queued.
+	pool->max=threads*4;
+	if(!(pool->tids=(pthread_t *)
+		calloc_w(threads, sizeof(pthread_t), __func__)))
+			goto error;
+	for(i=0; i<threads; i++)
+	{
+		if(pthread_create(&pool->tids[i], NULL, restore_worker, pool))
+		{
+			logp("Could not create restore thread: %s\n",
+				strerror(errno));
+			goto error;
+		}
+		pool->threads++;
+	}
+	return pool;
+error:
+	restore_pool_free(&pool);
+	return NULL;
+}
+
+void restore_pool_free(struct restore_pool **pool)
+{
+	int i;
+	struct rpool_job *job;
+	struct rpool_dir *d;
+	if(!pool || !*pool) return;
+
+	pthread_mutex_lock(&(*pool)->lock);
+	(*pool)->stop=1;
+	pthread_cond_broadcast(&(*pool)->cond);
+	pthread_mutex_unlock(&(*pool)->lock);
+	for(i=0; i<(*pool)->threads; i++)
+		pthread_join((*pool)->tids[i], NULL);
+
+	while((job=(*pool)->head))
+	{
+		(*pool)->head=job->next;
+		job_free(&job);
+	}
+	while((d=(*pool)->dirs))
+	{
+		(*pool)->dirs=d->next;
+		free_w(&d->path);
+		free_v((void **)&d);
+	}
+	pthread_mutex_destroy(&(*pool)->lock);
+	pthread_cond_destroy(&(*pool)->cond);
+	free_v((void **)&(*pool)->tids);
+	free_v((void **)pool);
+}
+
+// Count a file that a worker has finished, and pass on any problems.
+static int job_finish(struct restore_pool *pool,
+	struct asfd *asfd, struct rpool_job *job)
+{
+	struct cntr *cntr=get_cntr(pool->confs[OPT_CNTR]);
+
+	if(job->open_errno)
+	{
+		logw(asfd, pool->confs, "Could not open for writing %s: %s\n",
+			job->path, strerror(job->open_errno));
+		return 0;
+	}
+	if(job->sparse_bytes && cntr)
+		cntr_add_sparsebytes(cntr, job->sparse_bytes);
+	if(job->write_errno)
+	{
+		logp("Error when writing %s: %s\n",
+			job->path, strerror(job->write_errno));
+		asfd->write_str(asfd, CMD_ERROR, "write failed");
+		return -1;
+	}
+	cntr_add(cntr, CMD_FILE, 1);
+	return 0;
+}
+
+// Take the finished files off the front of the queue. If 'wait' is set,
+// wait for all of them to finish.
+static int reap(struct restore_pool *pool, struct asfd *asfd, int wait)
+{
+	int ret;
+	struct rpool_job *job;
+
+	while(1)
+	{
+		pthread_mutex_lock(&pool->lock);
+		while(wait && pool->head && pool->head->state!=RPOOL_DONE)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		job=pool->head;
+		if(!job || job->state!=RPOOL_DONE)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			return 0;
+		}
+		if(!(pool->head=job->next))
+			pool->tail=NULL;
+		pool->pending--;
+		pthread_mutex_unlock(&pool->lock);
+
+		ret=job_finish(pool, asfd, job);
+		job_free(&job);
+		if(ret) return -1;
+	}
+}
+
+static int wait_for_room(struct restore_pool *pool, struct asfd *asfd)
+{
+	while(1)
+	{
+		if(reap(pool, asfd, 0)) return -1;
+		if(pool->pending<pool->max) return 0;
+		pthread_mutex_lock(&pool->lock);
+		if(pool->head->state!=RPOOL_DONE)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+void restore_pool_file_end(struct restore_pool *pool)
+{
+	if(!pool->current) return;
+	pthread_mutex_lock(&pool->lock);
+	pool->current->ended=1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	pool->current=NULL;
+}
+
+int restore_pool_file(struct restore_pool *pool, struct asfd *asfd,
+	struct sbuf *sb, const char *fullpath)
+{
+	char *rpath=NULL;
+	struct rpool_job *job;
+
+	restore_pool_file_end(pool);
+	if(wait_for_room(pool, asfd)) return -1;
+
+	// Parent directories are made here rather than in the workers, so
+	// that they do not race each other to make them.
+	if(build_path(fullpath, "", &rpath, NULL))
+	{
+		// Carry on with other files.
+		logp("build path failed: %s\n", fullpath);
+		return 0;
+	}
+	if(!(job=(struct rpool_job *)
+		calloc_w(1, sizeof(struct rpool_job), __func__)))
+	{
+		free_w(&rpath);
+		return -1;
+	}
+	job->path=rpath;
+	memcpy(&job->statp, &sb->statp, sizeof(struct stat));
+	job->winattr=sb->winattr;
+	job->sparse=get_int(pool->confs[OPT_RESTORE_SPARSE]);
+	job->state=RPOOL_QUEUED;
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->tail) pool->tail->next=job;
+	else pool->head=job;
+	pool->tail=job;
+	if(!pool->next) pool->next=job;
+	pool->pending++;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool->current=job;
+	return 0;
+}
+
+int restore_pool_busy(struct restore_pool *pool)
+{
+	return pool->current!=NULL;
+}
+
+int restore_pool_data(struct restore_pool *pool, char *data, uint64_t len)
+{
+	struct rpool_chunk *c;
+	struct rpool_job *job=pool->current;
+
+	if(!(c=(struct rpool_chunk *)
+		calloc_w(1, sizeof(struct rpool_chunk), __func__)))
+	{
+		free_w(&data);
+		return -1;
+	}
+	c->buf=data;
+	c->len=len;
+
+	pthread_mutex_lock(&pool->lock);
+	// Every file before this one has had all of its data, so a worker
+	// will get round to this one.
+	while(job->bytes>=RESTORE_POOL_JOB_BYTES)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	if(job->last) job->last->next=c;
+	else job->chunks=c;
+	job->last=c;
+	if(data) job->bytes+=len;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+int restore_pool_dir(struct restore_pool *pool, struct asfd *asfd,
+	struct sbuf *sb, const char *fullpath)
+{
+	char *rpath=NULL;
+	struct rpool_dir *d;
+
+	restore_pool_file_end(pool);
+	if(build_path(fullpath, "", &rpath, NULL))
+	{
+		logp("build path failed: %s\n", fullpath);
+		return 0;
+	}
+	if(!is_dir_lstat(rpath) && mkdir(rpath, 0777))
+	{
+		logp("mkdir error: %s\n", strerror(errno));
+		free_w(&rpath);
+		return 0;
+	}
+	if(!(d=(struct rpool_dir *)
+		calloc_w(1, sizeof(struct rpool_dir), __func__)))
+	{
+		free_w(&rpath);
+		return -1;
+	}
+	d->path=rpath;
+	memcpy(&d->statp, &sb->statp, sizeof(struct stat));
+	d->winattr=sb->winattr;
+	if(pool->dirs_last) pool->dirs_last->next=d;
+	else pool->dirs=d;
+	pool->dirs_last=d;
+	cntr_add(get_cntr(pool->confs[OPT_CNTR]), sb->path.cmd, 1);
+
+	if(++pool->ndirs>=RESTORE_POOL_DIRS_MAX)
+		return restore_pool_drain(pool, asfd);
+	return 0;
+}
+
+int restore_pool_drain(struct restore_pool *pool, struct asfd *asfd)
+{
+	struct rpool_dir *d;
+
+	restore_pool_file_end(pool);
+	if(reap(pool, asfd, 1)) return -1;
+	while((d=pool->dirs))
+	{
+		pool->dirs=d->next;
+		attribs_set(asfd, d->path, &d->statp, d->winattr, pool->confs);
+		free_w(&d->path);
+		free_v((void **)&d);
+	}
+	pool->dirs_last=NULL;
+	pool->ndirs=0;
+	return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef _RESTORE_POOL_H
+#define _RESTORE_POOL_H
+
+// Used by restore_threads. Regular files are handed over to a pool of
+// threads that create them, write their blocks and set their attributes,
+// while the main thread carries on reading the restore stream. A file's
+// blocks are queued on it as they arrive, up to RESTORE_POOL_JOB_BYTES at a
+// time. The attributes of directories are only set once everything queued
+// before them has been written, since writing into a directory changes its
+// times.
+
+#define RESTORE_POOL_JOB_BYTES	0x400000
+#define RESTORE_POOL_DIRS_MAX	1024
+
+struct restore_pool;
+
+extern struct restore_pool *restore_pool_alloc(int threads,
+	struct conf **confs);
+extern void restore_pool_free(struct restore_pool **pool);
+
+// Queue the file that the data that follows belongs to. Finishes off the
+// one before it. Waits if too many files are already queued.
+extern int restore_pool_file(struct restore_pool *pool, struct asfd *asfd,
+	struct sbuf *sb, const char *fullpath);
+// Returns 1 if data is being taken for a file.
+extern int restore_pool_busy(struct restore_pool *pool);
+// Queue data for the current file. 'data' is taken over. A NULL 'data'
+// stands for a run of 'len' zero bytes.
+extern int restore_pool_data(struct restore_pool *pool,
+	char *data, uint64_t len);
+// The current file has no more data.
+extern void restore_pool_file_end(struct restore_pool *pool);
+// Make the directory now, and set its attributes later.
+extern int restore_pool_dir(struct restore_pool *pool, struct asfd *asfd,
+	struct sbuf *sb, const char *fullpath);
+// Wait for everything queued to be written, then set the attributes of the
+// directories.
+extern int restore_pool_drain(struct restore_pool *pool, struct asfd *asfd);
+
+#endif
@@ -1,7 +1,10 @@
 #include "include.h"
 #include "../cmd.h"
 #include "protocol1/restore.h"
+#include "protocol2/blkcache.h"
 #include "protocol2/restore.h"
+#include "protocol2/restore_delta.h"
+#include "protocol2/restore_pool.h"
 
 // FIX THIS: it only works with protocol1.
 int restore_interrupt(struct asfd *asfd,
@@ -132,6 +135,9 @@ enum ofr_e open_for_restore(struct asfd *asfd, BFILE *bfd, const char *path,
 	bfile_init(bfd, sb->winattr, confs);
 #ifdef HAVE_WIN32
 	bfd->set_win32_api(bfd, vss_restore);
+#else
+	bfd->sparse=get_int(confs[OPT_RESTORE_SPARSE])
+	  && S_ISREG(sb->statp.st_mode);
 #endif
 	if(S_ISDIR(sb->statp.st_mode))
 	{
@@ -442,6 +448,58 @@ static int write_data(struct asfd *asfd, BFILE *bfd, struct blk *blk)
 	return 0;
 }
 
+static int write_zeros(struct asfd *asfd, BFILE *bfd, uint64_t len)
+{
+	if(bfd->mode==BF_CLOSED)
+		logp("Got data without an open file\n");
+	else if(bfd->write_zeros(bfd, len))
+	{
+		logp("%s(): error when appending %" PRIu64 " zeroes\n",
+			__func__, len);
+		asfd->write_str(asfd, CMD_ERROR, "write failed");
+		return -1;
+	}
+	return 0;
+}
+
+#ifndef HAVE_WIN32
+// Return the path that the data of the entry is being written to, if the
+// blocks can be read back from it later for restore_dedup.
+static const char *blkcache_path(BFILE *bfd,
+	struct sbuf *sb, const char *fullpath)
+{
+	if(bfd->mode==BF_CLOSED
+	  || !bfd->path
+	  || strcmp(bfd->path, fullpath)
+	  || !S_ISREG(sb->statp.st_mode))
+		return NULL;
+	if(geteuid() && !(sb->statp.st_mode & S_IRUSR))
+		return NULL;
+	return bfd->path;
+}
+
+// The server has sent the signatures of the blocks of the file. Work out
+// which blocks are already in the existing copy, if there is one, and get
+// the rest from the server.
+static int restore_delta(struct asfd *asfd, struct rdelta *rdelta,
+	struct sbuf *sb, const char *fullpath, enum action act,
+	BFILE *bfd, int vss_restore, struct conf **confs)
+{
+	int ret=-1;
+	if(rdelta_read_sigs(rdelta, asfd)
+	  || rdelta_match(rdelta, fullpath)<0
+	  || rdelta_request(rdelta, asfd, 1)
+	  || restore_switch_protocol2(asfd, sb, fullpath, act,
+		bfd, vss_restore, confs)
+	  || rdelta_write(rdelta, asfd, bfd))
+		goto end;
+	ret=0;
+end:
+	rdelta_reset(rdelta);
+	return ret;
+}
+#endif
+
 #define RESTORE_STREAM	"restore_stream"
 #define RESTORE_SPOOL	"restore_spool"
 
@@ -532,6 +590,11 @@ int do_restore_client(struct asfd *asfd,
 	char *fullpath=NULL;
 	char *style=NULL;
 	char *datpath=NULL;
+#ifndef HAVE_WIN32
+	struct blkcache *cache=NULL;
+	struct rdelta *rdelta=NULL;
+	struct restore_pool *pool=NULL;
+#endif
 	enum protocol protocol=get_e_protocol(confs[OPT_PROTOCOL]);
 	const char *backup=get_string(confs[OPT_BACKUP]);
 	const char *regex=get_string(confs[OPT_REGEX]);
@@ -562,6 +625,33 @@ int do_restore_client(struct asfd *asfd,
 	else
 		logp("Streaming restore direct\n");
 
+#ifndef HAVE_WIN32
+	if(protocol==PROTO_2
+	  && act==ACTION_RESTORE
+	  && !datpath
+	  && get_int(confs[OPT_RESTORE_DEDUP])
+	  && !(cache=blkcache_alloc()))
+		goto error;
+	if(protocol==PROTO_2
+	  && act==ACTION_RESTORE
+	  && !datpath
+	  && get_int(confs[OPT_RESTORE_DELTA])
+	  && !(rdelta=rdelta_alloc()))
+		goto error;
+	if(protocol==PROTO_2
+	  && act==ACTION_RESTORE
+	  && get_int(confs[OPT_RESTORE_THREADS])>0)
+	{
+		// The blocks that references point at might not have been
+		// written yet.
+		if(cache)
+			logp("restore_threads is not used with restore_dedup\n");
+		else if(!(pool=restore_pool_alloc(
+			get_int(confs[OPT_RESTORE_THREADS]), confs)))
+				goto error;
+	}
+#endif
+
 	printf("\n");
 
 //	if(get_int(confs[OPT_SEND_CLIENT_CNTR]) && cntr_recv(confs))
@@ -576,31 +666,118 @@ int do_restore_client(struct asfd *asfd,
 
 	while(1)
 	{
+#ifndef HAVE_WIN32
+		if(sb->flags & SBUF_RESTORE_DELTA)
+		{
+			// The entry was skipped, but the server still needs
+			// to be told that it should not send any blocks.
+			if(!rdelta)
+			{
+				logp("Got restore_delta without asking for it\n");
+				goto error;
+			}
+			if(rdelta_read_sigs(rdelta, asfd)
+			  || rdelta_request(rdelta, asfd, 0))
+				goto error;
+			rdelta_reset(rdelta);
+		}
+#endif
 		sbuf_free_content(sb);
 
 		switch(sbuf_fill_w(sb, asfd, blk, datpath, confs))
 		{
 			case 0: break;
-			case 1: if(asfd->write_str(asfd, CMD_GEN,
-				"restoreend_ok")) goto error;
+			case 1:
+#ifndef HAVE_WIN32
+				if(pool && restore_pool_drain(pool, asfd))
+					goto error;
+#endif
+				if(asfd->write_str(asfd, CMD_GEN,
+					"restoreend_ok")) goto error;
 				goto end; // It was OK.
 			default:
 			case -1: goto error;
 		}
 
+		if(protocol==PROTO_2 && blk->got==BLK_GOT)
+		{
+			// A reference to a block that was sent before.
+#ifndef HAVE_WIN32
+			if(cache && blkcache_get(cache, blk->index, blk))
+				goto error;
+#endif
+			if(!blk->data)
+			{
+				logp("Got a block reference without restore_dedup\n");
+				goto error;
+			}
+		}
+
+		if(protocol==PROTO_2 && blk->got==BLK_ZERO)
+		{
+			// A run of zero bytes, with restore_sparse.
+			int wret=0;
+			if(act==ACTION_RESTORE)
+			{
+#ifndef HAVE_WIN32
+				if(pool && restore_pool_busy(pool))
+					wret=restore_pool_data(pool,
+						NULL, blk->index);
+				else
+#endif
+				wret=write_zeros(asfd, bfd, blk->index);
+#ifndef HAVE_WIN32
+				if(cache)
+					blkcache_skip(cache, blk->index);
+#endif
+			}
+			blk->got=BLK_INCOMING;
+			if(wret) goto error;
+			continue;
+		}
+
 		if(protocol==PROTO_2 && blk->data)
 		{
-			int wret;
+			int wret=0;
 			if(act==ACTION_VERIFY)
 				cntr_add(get_cntr(confs[OPT_CNTR]), CMD_DATA, 1);
+#ifndef HAVE_WIN32
+			else if(pool && restore_pool_busy(pool))
+			{
+				// The pool takes the data over. Spooled data
+				// is not ours to give away.
+				char *data=blk->data;
+				if(datpath
+				  && (data=(char *)malloc_w(blk->length,
+					__func__)))
+						memcpy(data, blk->data,
+							blk->length);
+				blk->data=NULL;
+				wret=data?restore_pool_data(pool, data,
+					blk->length):-1;
+			}
+#endif
 			else
+			{
 				wret=write_data(asfd, bfd, blk);
+#ifndef HAVE_WIN32
+				if(!wret && cache && blk->got!=BLK_GOT)
+					wret=blkcache_add(cache, blk,
+						bfd->mode!=BF_CLOSED);
+#endif
+			}
+			blk->got=BLK_INCOMING;
 			if(!datpath) free(blk->data);
 			blk->data=NULL;
 			if(wret) goto error;
 			continue;
 		}
 
+#ifndef HAVE_WIN32
+		// Anything other than data means that the file is finished.
+		if(pool) restore_pool_file_end(pool);
+#endif
+
 		switch(sb->path.cmd)
 		{
 			case CMD_DIRECTORY:
@@ -671,11 +848,27 @@ int do_restore_client(struct asfd *asfd,
 		{
 			// These are the same in both protocol1 and protocol2.
 			case CMD_DIRECTORY:
+#ifndef HAVE_WIN32
+				if(pool)
+				{
+					if(restore_pool_dir(pool,
+						asfd, sb, fullpath))
+							goto error;
+					continue;
+				}
+#endif
 				if(restore_dir(asfd, sb, fullpath, act, confs))
 					goto error;
 				continue;
 			case CMD_SOFT_LINK:
 			case CMD_HARD_LINK:
+#ifndef HAVE_WIN32
+				// The file to link to has to be there first.
+				if(pool
+				  && sb->path.cmd==CMD_HARD_LINK
+				  && restore_pool_drain(pool, asfd))
+					goto error;
+#endif
 				if(restore_link(asfd, sb, fullpath, act, confs))
 					goto error;
 				continue;
@@ -689,9 +882,34 @@ int do_restore_client(struct asfd *asfd,
 
 		if(protocol==PROTO_2)
 		{
+#ifndef HAVE_WIN32
+			if(rdelta && (sb->flags & SBUF_RESTORE_DELTA))
+			{
+				sb->flags&=~SBUF_RESTORE_DELTA;
+				if(restore_delta(asfd, rdelta, sb, fullpath,
+					act, bfd, vss_restore, confs))
+						goto error;
+				continue;
+			}
+			if(pool
+			  && sb->path.cmd==CMD_FILE
+			  && S_ISREG(sb->statp.st_mode))
+			{
+				if(bfd->close(bfd, asfd)
+				  || restore_pool_file(pool, asfd,
+					sb, fullpath))
+						goto error;
+				continue;
+			}
+#endif
 			if(restore_switch_protocol2(asfd, sb, fullpath, act,
 				bfd, vss_restore, confs))
 					goto error;
+#ifndef HAVE_WIN32
+			if(cache && blkcache_set_file(cache,
+				blkcache_path(bfd, sb, fullpath)))
+					goto error;
+#endif
 		}
 		else
 		{
@@ -715,6 +933,11 @@ error:
 	else logp("ret: %d\n", ret);
 
 	sbuf_free(&sb);
+#ifndef HAVE_WIN32
+	restore_pool_free(&pool);
+	blkcache_free(&cache);
+	rdelta_free(&rdelta);
+#endif
 	free_w(&style);
 	if(datpath)
 	{
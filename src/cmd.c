@@ -18,6 +18,10 @@ static char *cmd_to_text(enum cmd cmd)
 			snprintf(buf, len, "Request for block of data"); break;
 		case CMD_DATA:
 			snprintf(buf, len, "Block data"); break;
+		case CMD_DATA_REF:
+			snprintf(buf, len, "Block data reference"); break;
+		case CMD_DATA_ZERO:
+			snprintf(buf, len, "Run of zero bytes"); break;
 		case CMD_WRAP_UP:
 			snprintf(buf, len, "Control packet"); break;
 		case CMD_FILE:
@@ -77,6 +81,12 @@ static char *cmd_to_text(enum cmd cmd)
 			snprintf(buf, len, "Bytes received"); break;
 		case CMD_BYTES_SENT:
 			snprintf(buf, len, "Bytes sent"); break;
+		case CMD_BYTES_COMPRESSED:
+			snprintf(buf, len, "Bytes compressed"); break;
+		case CMD_BYTES_NOT_COMPRESSED:
+			snprintf(buf, len, "Bytes not compressed"); break;
+		case CMD_BYTES_SPARSE:
+			snprintf(buf, len, "Bytes in holes"); break;
 
 		// Legacy.
 		case CMD_DATAPTH:
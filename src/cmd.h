@@ -15,6 +15,9 @@ enum cmd
 	CMD_SIG		='S',	/* Signature of a block */
 	CMD_DATA_REQ	='D',	/* Request for block data */
 	CMD_DATA	='B',	/* Block data */
+	CMD_DATA_REF	='K',	/* Block data that was already sent during
+				   this restore */
+	CMD_DATA_ZERO	='h',	/* A run of zero bytes in block data */
 	CMD_WRAP_UP	='W',	/* Control packet - client can free blocks up
 				   to the given index. */
 
@@ -59,6 +62,9 @@ enum cmd
 	CMD_BYTES	='O',
 	CMD_BYTES_RECV	='P',
 	CMD_BYTES_SENT	='Q',
+	CMD_BYTES_COMPRESSED='C',
+	CMD_BYTES_NOT_COMPRESSED='N',
+	CMD_BYTES_SPARSE='H',
 	CMD_TIMESTAMP_END='E',
 
 // Legacy stuff
@@ -11,8 +11,9 @@
 static void cntr_ent_free(struct cntr_ent *cntr_ent)
 {
 	if(!cntr_ent) return;
-	if(cntr_ent->field) free(cntr_ent->field);
-	if(cntr_ent->label) free(cntr_ent->label);
+	free_w(&cntr_ent->field);
+	free_w(&cntr_ent->label);
+	free_v((void **)&cntr_ent);
 }
 
 struct cntr *cntr_alloc(void)
@@ -93,6 +94,13 @@ int cntr_init(struct cntr *cntr, const char *cname)
 		CMD_BYTES_SENT, "bytes_sent", "Bytes sent")
 	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
 		CMD_BYTES_RECV, "bytes_received", "Bytes received")
+	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
+		CMD_BYTES_SPARSE, "bytes_sparse", "Bytes in holes")
+	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
+		CMD_BYTES_NOT_COMPRESSED, "bytes_not_compressed",
+		"Bytes not compressed")
+	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
+		CMD_BYTES_COMPRESSED, "bytes_compressed", "Bytes compressed")
 	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
 		CMD_BYTES, "bytes", "Bytes")
 	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
@@ -160,6 +168,7 @@ void cntr_free(struct cntr **cntr)
 	}
 	(*cntr)->list=NULL;
 	free_w(&(*cntr)->str);
+	free_w(&(*cntr)->cname);
 	free_v((void **)cntr);
 }
 
@@ -362,6 +371,18 @@ void cntr_add_recvbytes(struct cntr *c, unsigned long long bytes)
 	incr_count_val(c, CMD_BYTES_RECV, bytes);
 }
 
+void cntr_add_compbytes(struct cntr *c, unsigned long long bytes,
+	int compressed)
+{
+	incr_count_val(c, compressed?
+		CMD_BYTES_COMPRESSED:CMD_BYTES_NOT_COMPRESSED, bytes);
+}
+
+void cntr_add_sparsebytes(struct cntr *c, unsigned long long bytes)
+{
+	incr_count_val(c, CMD_BYTES_SPARSE, bytes);
+}
+
 static void quint_print(struct cntr_ent *ent, enum action act)
 {
 	unsigned long long a;
@@ -435,12 +456,29 @@ static void bottom_part(struct cntr *c, enum action act)
 		logc("      Bytes in backup:   % 11llu", l);
 		logc("%s\n", bytes_to_human(l));
 	}
+	if((act==ACTION_BACKUP
+	  || act==ACTION_BACKUP_TIMED)
+	  && (get_count(e, CMD_BYTES_COMPRESSED)
+	    || get_count(e, CMD_BYTES_NOT_COMPRESSED)))
+	{
+		l=get_count(e, CMD_BYTES_COMPRESSED);
+		logc("     Bytes compressed:   % 11llu", l);
+		logc("%s\n", bytes_to_human(l));
+		l=get_count(e, CMD_BYTES_NOT_COMPRESSED);
+		logc(" Bytes not compressed:   % 11llu", l);
+		logc("%s\n", bytes_to_human(l));
+	}
 	if(act==ACTION_RESTORE)
 	{
 		l=get_count(e, CMD_BYTES);
 		logc("      Bytes attempted:   % 11llu", l);
 		logc("%s\n", bytes_to_human(l));
 	}
+	if((l=get_count(e, CMD_BYTES_SPARSE)))
+	{
+		logc("       Bytes in holes:   % 11llu", l);
+		logc("%s\n", bytes_to_human(l));
+	}
 	if(act==ACTION_VERIFY)
 	{
 		l=get_count(e, CMD_BYTES);
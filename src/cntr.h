@@ -92,6 +92,9 @@ extern void cntr_add_deleted(struct cntr *c, char ch);
 extern void cntr_add_bytes(struct cntr *c, unsigned long long bytes);
 extern void cntr_add_sentbytes(struct cntr *c, unsigned long long bytes);
 extern void cntr_add_recvbytes(struct cntr *c, unsigned long long bytes);
+extern void cntr_add_compbytes(struct cntr *c, unsigned long long bytes,
+	int compressed);
+extern void cntr_add_sparsebytes(struct cntr *c, unsigned long long bytes);
 
 extern void cntr_add_phase1(struct cntr *c,
 	char ch, int print);
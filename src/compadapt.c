@@ -0,0 +1,92 @@
+#include "include.h"
+#include "compadapt.h"
+
+// Anything shorter than this is cheap to compress whatever it is.
+#define COMPADAPT_SAMPLE_MIN	4096
+// Percentage of the sample that the compressed version has to come in under.
+#define COMPADAPT_RATIO		95
+// How many chunks to time before thinking about changing the level.
+#define COMPADAPT_CHECK_CHUNKS	8
+
+int compadapt_worthwhile(const uint8_t *buf, size_t len)
+{
+	int ret=1;
+	uLong outlen;
+	z_stream strm;
+	uint8_t *out=NULL;
+
+	if(len<COMPADAPT_SAMPLE_MIN) return 1;
+
+	memset(&strm, 0, sizeof(strm));
+	// The fastest level is enough to tell the difference.
+	if(deflateInit(&strm, 1)!=Z_OK) return 1;
+	outlen=deflateBound(&strm, len);
+	if(!(out=(uint8_t *)malloc_w(outlen, __func__)))
+		goto end;
+	strm.next_in=(Bytef *)buf;
+	strm.avail_in=len;
+	strm.next_out=out;
+	strm.avail_out=outlen;
+	if(deflate(&strm, Z_FINISH)!=Z_STREAM_END)
+		goto end;
+	ret=strm.total_out*100<(uLong)len*COMPADAPT_RATIO;
+end:
+	deflateEnd(&strm);
+	free_v((void **)&out);
+	return ret;
+}
+
+void compadapt_init(struct compadapt *ca, int level)
+{
+	memset(ca, 0, sizeof(struct compadapt));
+	ca->max=level;
+	ca->level=level;
+	ca->applied=level;
+}
+
+int compadapt_update(struct compadapt *ca, double ztime, double wtime)
+{
+	int level=ca->level;
+	ca->ztime+=ztime;
+	ca->wtime+=wtime;
+	if(++ca->chunks<COMPADAPT_CHECK_CHUNKS) return 0;
+
+	if(ca->ztime>ca->wtime)
+	{
+		// The network is waiting for the compression.
+		if(level>1) level--;
+	}
+	else if(ca->ztime*2<ca->wtime)
+	{
+		// The compression is waiting for the network, so it may as
+		// well work harder.
+		if(level<ca->max) level++;
+	}
+	ca->chunks=0;
+	ca->ztime=0;
+	ca->wtime=0;
+	if(level==ca->level) return 0;
+	ca->level=level;
+	return 1;
+}
+
+void compadapt_apply(struct compadapt *ca, z_stream *strm)
+{
+	uInt avail_in;
+	if(ca->applied==ca->level) return;
+	// Newer zlib refuses to switch while there is input left over, so
+	// hold the input back until the switch is done. If the flush did not
+	// fit, try again next time.
+	avail_in=strm->avail_in;
+	strm->avail_in=0;
+	if(deflateParams(strm, ca->level, Z_DEFAULT_STRATEGY)==Z_OK)
+		ca->applied=ca->level;
+	strm->avail_in=avail_in;
+}
+
+double compadapt_now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
@@ -0,0 +1,42 @@
+#ifndef _COMPADAPT_H
+#define _COMPADAPT_H
+
+#include "burp.h"
+
+#include <zlib.h>
+
+// Adaptive compression.
+// Before a file is sent whole, a sample from the start of it is trial
+// compressed, and the file is sent without compression if the sample does not
+// shrink much. Media, archives and encrypted files usually do not.
+// While a file is being compressed, the time taken by deflate is compared
+// with the time taken to get the output onto the network. If compressing is
+// the slower of the two, the level is dropped, and if the network is holding
+// things up, it is raised again, up to the configured level.
+
+#define COMPADAPT_SAMPLE_LEN	65536
+
+struct compadapt
+{
+	int max;	// The configured level.
+	int level;	// The level to use from now on.
+	int applied;	// The level that the z_stream is using.
+	int chunks;
+	double ztime;	// Seconds spent compressing, since the last check.
+	double wtime;	// Seconds spent sending, since the last check.
+};
+
+// Returns 1 if the sample is worth compressing, 0 if it is not.
+extern int compadapt_worthwhile(const uint8_t *buf, size_t len);
+
+extern void compadapt_init(struct compadapt *ca, int level);
+// Add the time taken to compress and to send one chunk. Returns 1 when the
+// level ought to change.
+extern int compadapt_update(struct compadapt *ca, double ztime, double wtime);
+// Call just before deflate(), with the output buffer set up. If the level has
+// changed, the stream is switched over to it. Anything that had to be flushed
+// first goes into the output buffer.
+extern void compadapt_apply(struct compadapt *ca, z_stream *strm);
+extern double compadapt_now(void);
+
+#endif
@@ -414,10 +414,18 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_str(c[o], 0, 0, "ssl_ciphers");
 	case OPT_SSL_COMPRESSION:
 	  return sc_int(c[o], 5, 0, "ssl_compression");
+	case OPT_SSL_SESSION_CACHE:
+	  return sc_str(c[o], 0, 0, "ssl_session_cache");
 	case OPT_RATELIMIT:
 	  return sc_flt(c[o], 0, 0, "ratelimit");
+	case OPT_SERVER_RATELIMIT:
+	  return sc_flt(c[o], 0, 0, "server_ratelimit");
 	case OPT_NETWORK_TIMEOUT:
 	  return sc_int(c[o], 60*60*2, 0, "network_timeout");
+	case OPT_NETWORK_READ_BUFFER_SIZE:
+	  return sc_int(c[o], 0, 0, "network_read_buffer_size");
+	case OPT_NETWORK_FRAME_SIZE:
+	  return sc_int(c[o], 0, 0, "network_frame_size");
 	case OPT_CLIENT_IS_WINDOWS:
 	  return sc_int(c[o], 0, 0, "client_is_windows");
 	case OPT_PEER_VERSION:
@@ -432,10 +440,20 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_str(c[o], 0, 0, "status_port");
 	case OPT_SSL_DHFILE:
 	  return sc_str(c[o], 0, 0, "ssl_dhfile");
+	case OPT_SSL_SESSION_TIMEOUT:
+	  return sc_int(c[o], 60*60*2, 0, "ssl_session_timeout");
 	case OPT_MAX_CHILDREN:
 	  return sc_int(c[o], 5, 0, "max_children");
 	case OPT_MAX_STATUS_CHILDREN:
 	  return sc_int(c[o], 5, 0, "max_status_children");
+	case OPT_PREFORK:
+	  return sc_int(c[o], 0, 0, "prefork");
+	case OPT_MAX_BACKUPS:
+	  return sc_int(c[o], 0, 0, "max_backups");
+	case OPT_MAX_PHASE4:
+	  return sc_int(c[o], 0, 0, "max_phase4");
+	case OPT_BACKUP_QUEUE_RETRY:
+	  return sc_int(c[o], 60*10, 0, "backup_queue_retry");
 	case OPT_CLIENT_LOCKDIR:
 	  return sc_str(c[o], 0, 0, "client_lockdir");
 	case OPT_UMASK:
@@ -474,6 +492,20 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_str(c[o], 0, 0, "ca_csr_dir");
 	case OPT_RANDOMISE:
 	  return sc_int(c[o], 0, 0, "randomise");
+	case OPT_DELTA_THREADS:
+	  return sc_int(c[o], 0, 0, "delta_threads");
+	case OPT_COMPRESSION_ADAPTIVE:
+	  return sc_int(c[o], 0, 0, "compression_adaptive");
+	case OPT_RESTORE_DEDUP:
+	  return sc_int(c[o], 0, 0, "restore_dedup");
+	case OPT_RESTORE_DELTA:
+	  return sc_int(c[o], 0, 0, "restore_delta");
+	case OPT_RESTORE_SPARSE:
+	  return sc_int(c[o], 0, 0, "restore_sparse");
+	case OPT_RESTORE_THREADS:
+	  return sc_int(c[o], 0, 0, "restore_threads");
+	case OPT_BACKUP_QUEUE_WAIT:
+	  return sc_int(c[o], 0, 0, "backup_queue_wait");
 	case OPT_BACKUP:
 	  return sc_str(c[o], 0, CONF_FLAG_INCEXC_RESTORE, "backup");
 	case OPT_BACKUP2:
@@ -520,6 +552,8 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_int(c[o], 1, 0, "restore_script_reserved_args");
 	case OPT_SEND_CLIENT_CNTR:
 	  return sc_int(c[o], 0, 0, "send_client_cntr");
+	case OPT_BACKUP_QUEUE:
+	  return sc_int(c[o], 0, 0, "backup_queue");
 	case OPT_RESTORE_CLIENT:
 	  return sc_str(c[o], 0, 0, "");
 	case OPT_RESTORE_PATH:
@@ -575,6 +609,9 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_MONITOR_BROWSE_CACHE:
 	  return sc_int(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "monitor_browse_cache");
+	case OPT_MONITOR_BROWSE_CACHE_MEMORY:
+	  return sc_szt(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "monitor_browse_cache_memory");
 	case OPT_S_SCRIPT_PRE:
 	  return sc_str(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "server_script_pre");
@@ -617,6 +654,9 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_COMPRESSION:
 	  return sc_int(c[o], 9,
 		CONF_FLAG_CC_OVERRIDE, "compression");
+	case OPT_COMPRESSION_THREADS:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "compression_threads");
 	case OPT_VERSION_WARN:
 	  return sc_int(c[o], 1,
 		CONF_FLAG_CC_OVERRIDE, "version_warn");
@@ -659,6 +699,8 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_DEDUP_GROUP:
 	  return sc_str(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "dedup_group");
+	case OPT_CHAMP_FRESHNESS:
+	  return sc_int(c[o], 0, 0, "champ_freshness");
 	case OPT_CLIENT_CAN_DELETE:
 	  return sc_int(c[o], 1,
 		CONF_FLAG_CC_OVERRIDE, "client_can_delete");
@@ -933,6 +975,49 @@ int confs_init(struct conf **confs)
 	return 0;
 }
 
+// Copy every value, apart from the counters, from 'src' into 'dst', which
+// should have been through confs_init().
+int confs_copy(struct conf **dst, struct conf **src)
+{
+	int i=0;
+	struct strlist *s;
+	for(i=0; i<OPT_MAX; i++)
+	{
+		struct conf *d=dst[i];
+		d->flags=src[i]->flags;
+		switch(src[i]->conf_type)
+		{
+			case CT_STRING:
+				if(set_string(d, get_string(src[i])))
+					return -1;
+				break;
+			case CT_STRLIST:
+				set_strlist(d, NULL);
+				// Keep the order, even of sorted lists.
+				for(s=get_strlist(src[i]); s; s=s->next)
+					if(strlist_add(&d->data.sl,
+						s->path, s->flag))
+							return -1;
+				break;
+			case CT_CNTR:
+				break;
+			case CT_UINT:
+			case CT_FLOAT:
+			case CT_MODE_T:
+			case CT_SSIZE_T:
+			case CT_E_BURP_MODE:
+			case CT_E_PROTOCOL:
+			case CT_E_RECOVERY_METHOD:
+			case CT_E_RSHASH:
+				d->data=src[i]->data;
+				break;
+		}
+	}
+	strlist_compile_regexes(get_strlist(dst[OPT_INCREG]));
+	strlist_compile_regexes(get_strlist(dst[OPT_EXCREG]));
+	return 0;
+}
+
 int confs_dump(struct conf **confs, int flags)
 {
 	int i=0;
@@ -89,10 +89,14 @@ enum conf_opt
 	OPT_SSL_PEER_CN,
 	OPT_SSL_CIPHERS,
 	OPT_SSL_COMPRESSION,
+	OPT_SSL_SESSION_CACHE,
 	OPT_USER,
 	OPT_GROUP,
 	OPT_RATELIMIT,
+	OPT_SERVER_RATELIMIT,
 	OPT_NETWORK_TIMEOUT,
+	OPT_NETWORK_READ_BUFFER_SIZE,
+	OPT_NETWORK_FRAME_SIZE,
 	OPT_CLIENT_IS_WINDOWS,
 	OPT_PEER_VERSION,
 	OPT_PROTOCOL,
@@ -108,8 +112,13 @@ enum conf_opt
 	OPT_TIMESTAMP_FORMAT,
 	OPT_CLIENTCONFDIR,
 	OPT_SSL_DHFILE,
+	OPT_SSL_SESSION_TIMEOUT,
 	OPT_MAX_CHILDREN,
 	OPT_MAX_STATUS_CHILDREN,
+	OPT_PREFORK,
+	OPT_MAX_BACKUPS,
+	OPT_MAX_PHASE4,
+	OPT_BACKUP_QUEUE_RETRY,
 	OPT_CLIENT_LOCKDIR,
 	OPT_UMASK,
 	OPT_MAX_HARDLINKS,
@@ -125,6 +134,7 @@ enum conf_opt
 	OPT_MANUAL_DELETE,
 	OPT_MONITOR_LOGFILE, // An ncurses client option, from command line.
 	OPT_MONITOR_BROWSE_CACHE,
+	OPT_MONITOR_BROWSE_CACHE_MEMORY,
 
 	// Client options.
 	OPT_CNAME, // set on the server when client connects
@@ -136,6 +146,13 @@ enum conf_opt
 	OPT_AUTOUPGRADE_DIR, // also a server option
 	OPT_CA_CSR_DIR,
 	OPT_RANDOMISE,
+	OPT_DELTA_THREADS,
+	OPT_COMPRESSION_ADAPTIVE,
+	OPT_RESTORE_DEDUP,
+	OPT_RESTORE_DELTA,
+	OPT_RESTORE_SPARSE,
+	OPT_RESTORE_THREADS,
+	OPT_BACKUP_QUEUE_WAIT,
 
 	// This block of client stuff is all to do with what files to backup.
 	OPT_STARTDIR,
@@ -220,6 +237,7 @@ enum conf_opt
 	OPT_LIBRSYNC,
 
 	OPT_COMPRESSION,
+	OPT_COMPRESSION_THREADS,
 	OPT_VERSION_WARN,
 	OPT_PATH_LENGTH_WARN,
 	OPT_HARD_QUOTA,
@@ -240,6 +258,7 @@ enum conf_opt
 	OPT_RESTORE_CLIENTS,
 
 	OPT_DEDUP_GROUP,
+	OPT_CHAMP_FRESHNESS,
 
 	OPT_CLIENT_CAN_DELETE,
 	OPT_CLIENT_CAN_DIFF,
@@ -253,6 +272,10 @@ enum conf_opt
 	// counters on resume/verify/restore.
 	OPT_SEND_CLIENT_CNTR,
 
+	// Set on the server when the client can be told that its backup is
+	// queued, and when to come back.
+	OPT_BACKUP_QUEUE,
+
 	// Set on the server to the restore client name (the one that you
 	// connected with) when the client has switched to a different set of
 	// client backups.
@@ -280,6 +303,7 @@ extern void conf_free_content(struct conf *c);
 extern void confs_free_content(struct conf **confs);
 extern void confs_null(struct conf **confs);
 extern void confs_memcpy(struct conf **dst, struct conf **src);
+extern int confs_copy(struct conf **dst, struct conf **src);
 
 extern void free_incexcs(struct conf **confs);
 extern int conf_set(struct conf **confs, const char *field, const char *value);
@@ -254,6 +254,21 @@ static int get_compression(const char *v)
 	return -1;
 }
 
+static int get_ratelimit(struct conf *c, const char *v)
+{
+	float f=0;
+	f=atof(v);
+	// User is specifying Mega bits per second.
+	// Need to convert to bytes per second.
+	f=(f*1024*1024)/8;
+	if(!f)
+	{
+		logp("%s should be greater than zero\n", c->field);
+		return -1;
+	}
+	return set_float(c, f);
+}
+
 static int load_conf_field_and_value(struct conf **c,
 	const char *f, // field
 	const char *v, // value
@@ -273,19 +288,9 @@ static int load_conf_field_and_value(struct conf **c,
 		set_int(c[OPT_SSL_COMPRESSION], compression);
 	}
 	else if(!strcmp(f, "ratelimit"))
-	{
-		float f=0;
-		f=atof(v);
-		// User is specifying Mega bits per second.
-		// Need to convert to bytes per second.
-		f=(f*1024*1024)/8;
-		if(!f)
-		{
-			logp("ratelimit should be greater than zero\n");
-			return -1;
-		}
-		set_float(c[OPT_RATELIMIT], f);
-	}
+		return get_ratelimit(c[OPT_RATELIMIT], v);
+	else if(!strcmp(f, "server_ratelimit"))
+		return get_ratelimit(c[OPT_SERVER_RATELIMIT], v);
 	else
 	{
 		int i=0;
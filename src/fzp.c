@@ -3,6 +3,18 @@
 #include "fsops.h"
 #include "fzp.h"
 #include "log.h"
+#ifndef HAVE_WIN32
+#include "pgz.h"
+#endif
+
+// When above one, files opened for writing with fzp_gzopen() are compressed
+// with this many threads.
+static int gz_threads=0;
+
+void fzp_set_gz_threads(int threads)
+{
+	gz_threads=threads;
+}
 
 static struct fzp *fzp_alloc(void)
 {
@@ -37,6 +49,19 @@ static struct fzp *fzp_do_open(const char *path, const char *mode,
 			if(!(fzp->zp=gzopen_file(path, mode)))
 				goto error;
 			return fzp;
+#ifndef HAVE_WIN32
+		case FZP_PARALLEL:
+		{
+			// The mode looks like "wb9", as for gzopen().
+			int level=Z_DEFAULT_COMPRESSION;
+			const char *cp;
+			for(cp=mode; *cp; cp++)
+				if(isdigit(*cp)) level=*cp-'0';
+			if(!(fzp->pz=pgz_open(path, level, gz_threads)))
+				goto error;
+			return fzp;
+		}
+#endif
 		default:
 			unknown_type(fzp, __func__);
 			goto error;
@@ -53,6 +78,10 @@ struct fzp *fzp_open(const char *path, const char *mode)
 
 struct fzp *fzp_gzopen(const char *path, const char *mode)
 {
+#ifndef HAVE_WIN32
+	if(gz_threads>1 && *mode=='w')
+		return fzp_do_open(path, mode, FZP_PARALLEL);
+#endif
 	return fzp_do_open(path, mode, FZP_COMPRESSED);
 }
 
@@ -68,6 +97,11 @@ int fzp_close(struct fzp **fzp)
 		case FZP_COMPRESSED:
 			ret=gzclose_fp(&((*fzp)->zp));
 			break;
+#ifndef HAVE_WIN32
+		case FZP_PARALLEL:
+			ret=pgz_close(&((*fzp)->pz));
+			break;
+#endif
 		default:
 			unknown_type(*fzp, __func__);
 			break;
@@ -98,6 +132,10 @@ size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb)
 			return fwrite(ptr, 1, nmemb, fzp->fp);
 		case FZP_COMPRESSED:
 			return gzwrite(fzp->zp, ptr, (unsigned)nmemb);
+#ifndef HAVE_WIN32
+		case FZP_PARALLEL:
+			return pgz_write(fzp->pz, ptr, nmemb);
+#endif
 		default:
 			unknown_type(fzp, __func__);
 			return 0;
@@ -139,7 +177,10 @@ int fzp_seek(struct fzp *fzp, off_t offset, int whence)
 		case FZP_FILE:
 			return fseeko(fzp->fp, offset, whence);
 		case FZP_COMPRESSED:
-			return gzseek(fzp->zp, offset, whence);
+			// gzseek returns the resulting offset, rather than
+			// zero like fseeko.
+			if(gzseek(fzp->zp, offset, whence)<0) return -1;
+			return 0;
 		default:
 			unknown_type(fzp, __func__);
 			return -1;
@@ -154,6 +195,10 @@ off_t fzp_tell(struct fzp *fzp)
 			return ftello(fzp->fp);
 		case FZP_COMPRESSED:
 			return gztell(fzp->zp);
+#ifndef HAVE_WIN32
+		case FZP_PARALLEL:
+			return pgz_tell(fzp->pz);
+#endif
 		default:
 			unknown_type(fzp, __func__);
 			return -1;
@@ -176,6 +221,11 @@ int fzp_printf(struct fzp *fzp, const char *format, ...)
 		case FZP_COMPRESSED:
 			ret=gzprintf(fzp->zp, "%s", buf);
 			break;
+#ifndef HAVE_WIN32
+		case FZP_PARALLEL:
+			ret=(int)pgz_write(fzp->pz, buf, strlen(buf));
+			break;
+#endif
 		default:
 			unknown_type(fzp, __func__);
 			break;
@@ -3,10 +3,13 @@
 
 #include <zlib.h>
 
+struct pgz;
+
 enum fzp_type
 {
 	FZP_FILE=0,
-	FZP_COMPRESSED
+	FZP_COMPRESSED,
+	FZP_PARALLEL	// Compressed by several threads - write only.
 };
 
 struct fzp
@@ -16,12 +19,14 @@ struct fzp
 	{
 		FILE *fp;
 		gzFile zp;
+		struct pgz *pz;
 	};
 };
 
 extern struct fzp *fzp_open(const char *path, const char *mode);
 extern struct fzp *fzp_gzopen(const char *path, const char *mode);
 extern int fzp_close(struct fzp **fzp);
+extern void fzp_set_gz_threads(int threads);
 
 extern size_t fzp_read(struct fzp *fzp, void *ptr, size_t nmemb);
 extern size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb);
@@ -68,24 +68,43 @@ int send_whole_file_gz(struct asfd *asfd,
 	unsigned have;
 	z_stream strm;
 	int flush=Z_NO_FLUSH;
-	uint8_t in[ZCHUNK];
-	uint8_t out[ZCHUNK];
+	uint8_t *in=NULL;
+	uint8_t *out=NULL;
+	// Fill whole messages, however big the other end has agreed to.
+	size_t chunk=asfd->frame_len;
 
 	struct iobuf wbuf;
 
+	struct compadapt ca;
+	int adapt=compression && get_int(confs[OPT_COMPRESSION_ADAPTIVE]);
+	double ztime=0;
+	double t=0;
+
 //logp("send_whole_file_gz: %s%s\n", fname, extrameta?" (meta)":"");
 
+	if(!(in=(uint8_t *)malloc_w(chunk, __func__))
+	  || !(out=(uint8_t *)malloc_w(chunk, __func__)))
+	{
+		free_v((void **)&in);
+		return -1;
+	}
+
 	/* allocate deflate state */
 	strm.zalloc = Z_NULL;
 	strm.zfree = Z_NULL;
 	strm.opaque = Z_NULL;
 	if((zret=deflateInit2(&strm, compression, Z_DEFLATED, (15+16),
 		8, Z_DEFAULT_STRATEGY))!=Z_OK)
-			return -1;
+	{
+		free_v((void **)&in);
+		free_v((void **)&out);
+		return -1;
+	}
+	compadapt_init(&ca, compression);
 
 	do
 	{
-		strm.avail_in=fread(in, 1, ZCHUNK, fp);
+		strm.avail_in=fread(in, 1, chunk, fp);
 		if(!compression && !strm.avail_in) break;
 
 		*bytes+=strm.avail_in;
@@ -101,16 +120,22 @@ int send_whole_file_gz(struct asfd *asfd,
 		{
 			if(compression)
 			{
-				strm.avail_out=ZCHUNK;
+				strm.avail_out=chunk;
 				strm.next_out=out;
+				if(adapt)
+				{
+					compadapt_apply(&ca, &strm);
+					t=compadapt_now();
+				}
 				zret=deflate(&strm, flush);
+				if(adapt) ztime=compadapt_now()-t;
 				if(zret==Z_STREAM_ERROR)
 				{
 					logp("z_stream_error\n");
 					ret=-1;
 					break;
 				}
-				have=ZCHUNK-strm.avail_out;
+				have=chunk-strm.avail_out;
 			}
 			else
 			{
@@ -121,11 +146,14 @@ int send_whole_file_gz(struct asfd *asfd,
 			wbuf.cmd=CMD_APPEND;
 			wbuf.buf=(char *)out;
 			wbuf.len=have;
+			if(adapt) t=compadapt_now();
 			if(asfd->write(asfd, &wbuf))
 			{
 				ret=-1;
 				break;
 			}
+			if(adapt) compadapt_update(&ca,
+				ztime, compadapt_now()-t);
 			if(quick_read && datapth)
 			{
 				int qr;
@@ -165,6 +193,8 @@ int send_whole_file_gz(struct asfd *asfd,
 
 cleanup:
 	deflateEnd(&strm);
+	free_v((void **)&in);
+	free_v((void **)&out);
 
 	if(!ret)
 	{
@@ -10,6 +10,7 @@
 #include "burp.h"
 #include "burpconfig.h"
 #include "cntr.h"
+#include "compadapt.h"
 #include "conf.h"
 #include "conffile.h"
 #include "cstat.h"
@@ -23,6 +24,7 @@
 #include "log.h"
 #include "msg.h"
 #include "prepend.h"
+#include "ratelimit.h"
 #include "regexp.h"
 #include "run_script.h"
 #include "sbuf.h"
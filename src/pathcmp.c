@@ -46,3 +46,12 @@ int pathcmp(const char *a, const char *b)
 	if( *x && !*y) return 1; // x is longer
 	return -1; // y is longer
 }
+
+// Return 1 if 'path' sorts after 'dir' and everything underneath it, which
+// means that a reader going through a sorted manifest can stop looking for
+// entries in 'dir'.
+int is_past_subdir(const char *dir, const char *path)
+{
+	if(!dir || !*dir || !path) return 0;
+	return pathcmp(path, dir)>0 && !is_subdir(dir, path);
+}
@@ -3,5 +3,6 @@
 
 extern int is_subdir(const char *dir, const char *sub);
 extern int pathcmp(const char *a, const char *b);
+extern int is_past_subdir(const char *dir, const char *path);
 
 #endif
@@ -0,0 +1,362 @@
+#include "burp.h"
+#include "alloc.h"
+#include "fsops.h"
+#include "log.h"
+#include "pgz.h"
+
+#include <pthread.h>
+
+// Room for deflate to expand incompressible input, plus the sync flush
+// marker on the end of each block.
+#define PGZ_OUT_LEN	(compressBound(PGZ_BLOCK_LEN)+64)
+
+enum pgz_state
+{
+	PGZ_EMPTY=0,
+	PGZ_READY,
+	PGZ_BUSY,
+	PGZ_DONE
+};
+
+struct pgz_block
+{
+	enum pgz_state state;
+	int last;
+	int error;
+	unsigned char *in;
+	size_t inlen;
+	unsigned char *dict;
+	size_t dictlen;
+	unsigned char *out;
+	size_t outlen;
+	uLong crc;
+};
+
+struct pgz
+{
+	FILE *fp;
+	char *path;
+	int level;
+	int error;
+
+	pthread_t *tids;
+	int threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+
+	// Ring of blocks. The writer fills the block at 'head', and writes
+	// out finished blocks from 'tail', in order.
+	struct pgz_block *blocks;
+	int nblocks;
+	int head;
+	int tail;
+	int pending;
+
+	// The end of the input so far, used to prime the next block.
+	unsigned char dict[PGZ_DICT_LEN];
+	size_t dictlen;
+
+	uLong crc;
+	uint64_t total_in;
+};
+
+static int deflate_block(int level, struct pgz_block *b)
+{
+	int zret;
+	int ret=-1;
+	z_stream strm;
+
+	memset(&strm, 0, sizeof(strm));
+	// Negative window bits for raw deflate - the gzip header and trailer
+	// are written separately.
+	if(deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS,
+		8, Z_DEFAULT_STRATEGY)!=Z_OK)
+			return -1;
+	if(b->dictlen
+	  && deflateSetDictionary(&strm, b->dict, b->dictlen)!=Z_OK)
+		goto end;
+
+	strm.next_in=b->in;
+	strm.avail_in=b->inlen;
+	strm.next_out=b->out;
+	strm.avail_out=PGZ_OUT_LEN;
+
+	// Only the last block sets the final bit. The others end on a byte
+	// boundary, so that they can be joined together.
+	zret=deflate(&strm, b->last?Z_FINISH:Z_SYNC_FLUSH);
+	if(b->last && zret!=Z_STREAM_END) goto end;
+	if(!b->last && (zret!=Z_OK || strm.avail_in || !strm.avail_out))
+		goto end;
+
+	b->outlen=strm.next_out-b->out;
+	b->crc=crc32(crc32(0L, Z_NULL, 0), b->in, b->inlen);
+	ret=0;
+end:
+	deflateEnd(&strm);
+	return ret;
+}
+
+static struct pgz_block *find_ready(struct pgz *pgz)
+{
+	int i;
+	struct pgz_block *b;
+	// Oldest first, so that the writer is not kept waiting.
+	for(i=0; i<pgz->nblocks; i++)
+	{
+		b=&pgz->blocks[(pgz->tail+i)%pgz->nblocks];
+		if(b->state==PGZ_READY) return b;
+	}
+	return NULL;
+}
+
+static void *pgz_worker(void *arg)
+{
+	struct pgz_block *b;
+	struct pgz *pgz=(struct pgz *)arg;
+
+	pthread_mutex_lock(&pgz->lock);
+	while(1)
+	{
+		if(!(b=find_ready(pgz)))
+		{
+			if(pgz->stop) break;
+			pthread_cond_wait(&pgz->cond, &pgz->lock);
+			continue;
+		}
+		b->state=PGZ_BUSY;
+		pthread_mutex_unlock(&pgz->lock);
+
+		b->error=deflate_block(pgz->level, b);
+
+		pthread_mutex_lock(&pgz->lock);
+		b->state=PGZ_DONE;
+		pthread_cond_broadcast(&pgz->cond);
+	}
+	pthread_mutex_unlock(&pgz->lock);
+	return NULL;
+}
+
+static int write_all(struct pgz *pgz, const void *buf, size_t len)
+{
+	if(fwrite(buf, 1, len, pgz->fp)==len) return 0;
+	logp("Short write to %s: %s\n", pgz->path, strerror(errno));
+	return -1;
+}
+
+static int write_le32(struct pgz *pgz, uint32_t v)
+{
+	unsigned char buf[4];
+	buf[0]=v&0xff;
+	buf[1]=(v>>8)&0xff;
+	buf[2]=(v>>16)&0xff;
+	buf[3]=(v>>24)&0xff;
+	return write_all(pgz, buf, sizeof(buf));
+}
+
+// Wait for the oldest block to be compressed, then write it out.
+static int drain_one(struct pgz *pgz)
+{
+	struct pgz_block *b=&pgz->blocks[pgz->tail];
+
+	pthread_mutex_lock(&pgz->lock);
+	while(b->state!=PGZ_DONE)
+		pthread_cond_wait(&pgz->cond, &pgz->lock);
+	pthread_mutex_unlock(&pgz->lock);
+
+	if(b->error)
+	{
+		logp("Could not deflate block for %s\n", pgz->path);
+		return -1;
+	}
+	if(write_all(pgz, b->out, b->outlen)) return -1;
+	pgz->crc=crc32_combine(pgz->crc, b->crc, b->inlen);
+
+	b->state=PGZ_EMPTY;
+	b->inlen=0;
+	pgz->tail=(pgz->tail+1)%pgz->nblocks;
+	pgz->pending--;
+	return 0;
+}
+
+static int submit(struct pgz *pgz, int last)
+{
+	struct pgz_block *b=&pgz->blocks[pgz->head];
+
+	b->last=last;
+	memcpy(b->dict, pgz->dict, pgz->dictlen);
+	b->dictlen=pgz->dictlen;
+
+	// Keep the last 32KB of input for the next block.
+	if(b->inlen>=PGZ_DICT_LEN)
+	{
+		memcpy(pgz->dict, b->in+b->inlen-PGZ_DICT_LEN, PGZ_DICT_LEN);
+		pgz->dictlen=PGZ_DICT_LEN;
+	}
+	else
+	{
+		size_t keep=PGZ_DICT_LEN-b->inlen;
+		if(keep>pgz->dictlen) keep=pgz->dictlen;
+		memmove(pgz->dict, pgz->dict+pgz->dictlen-keep, keep);
+		memcpy(pgz->dict+keep, b->in, b->inlen);
+		pgz->dictlen=keep+b->inlen;
+	}
+
+	pthread_mutex_lock(&pgz->lock);
+	b->state=PGZ_READY;
+	pthread_cond_broadcast(&pgz->cond);
+	pthread_mutex_unlock(&pgz->lock);
+
+	pgz->head=(pgz->head+1)%pgz->nblocks;
+	// Make sure the block at head is free to be filled.
+	if(++pgz->pending==pgz->nblocks)
+		return drain_one(pgz);
+	return 0;
+}
+
+static void stop_threads(struct pgz *pgz)
+{
+	int i;
+	pthread_mutex_lock(&pgz->lock);
+	pgz->stop=1;
+	pthread_cond_broadcast(&pgz->cond);
+	pthread_mutex_unlock(&pgz->lock);
+	for(i=0; i<pgz->threads; i++)
+		pthread_join(pgz->tids[i], NULL);
+	pgz->threads=0;
+}
+
+static void pgz_free(struct pgz **pgz)
+{
+	int i;
+	if(!pgz || !*pgz) return;
+	stop_threads(*pgz);
+	if((*pgz)->blocks)
+	{
+		for(i=0; i<(*pgz)->nblocks; i++)
+		{
+			free_v((void **)&(*pgz)->blocks[i].in);
+			free_v((void **)&(*pgz)->blocks[i].dict);
+			free_v((void **)&(*pgz)->blocks[i].out);
+		}
+		free_v((void **)&(*pgz)->blocks);
+	}
+	free_v((void **)&(*pgz)->tids);
+	free_w(&(*pgz)->path);
+	close_fp(&(*pgz)->fp);
+	pthread_cond_destroy(&(*pgz)->cond);
+	pthread_mutex_destroy(&(*pgz)->lock);
+	free_v((void **)pgz);
+}
+
+struct pgz *pgz_open(const char *path, int level, int threads)
+{
+	int i;
+	struct pgz *pgz=NULL;
+	// Magic, deflate, no flags, no mtime, no extra flags, unix.
+	static const unsigned char header[10]={
+		0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+	};
+
+	if(threads<1) threads=1;
+	if(!(pgz=(struct pgz *)calloc_w(1, sizeof(struct pgz), __func__)))
+		return NULL;
+	pthread_mutex_init(&pgz->lock, NULL);
+	pthread_cond_init(&pgz->cond, NULL);
+	pgz->level=level;
+	pgz->crc=crc32(0L, Z_NULL, 0);
+	// Two blocks per thread, so that the threads have something to do
+	// while the writer is waiting on the oldest block.
+	pgz->nblocks=threads*2;
+
+	if(!(pgz->path=strdup_w(path, __func__))
+	  || !(pgz->blocks=(struct pgz_block *)calloc_w(pgz->nblocks,
+		sizeof(struct pgz_block), __func__))
+	  || !(pgz->tids=(pthread_t *)calloc_w(threads,
+		sizeof(pthread_t), __func__)))
+			goto error;
+	for(i=0; i<pgz->nblocks; i++)
+	{
+		struct pgz_block *b=&pgz->blocks[i];
+		if(!(b->in=(unsigned char *)malloc_w(PGZ_BLOCK_LEN, __func__))
+		  || !(b->dict=(unsigned char *)
+			malloc_w(PGZ_DICT_LEN, __func__))
+		  || !(b->out=(unsigned char *)
+			malloc_w(PGZ_OUT_LEN, __func__)))
+				goto error;
+	}
+
+	if(!(pgz->fp=open_file(path, "wb"))
+	  || write_all(pgz, header, sizeof(header)))
+		goto error;
+
+	for(i=0; i<threads; i++)
+	{
+		if(pthread_create(&pgz->tids[i], NULL, pgz_worker, pgz))
+		{
+			logp("Could not create compression thread: %s\n",
+				strerror(errno));
+			goto error;
+		}
+		pgz->threads++;
+	}
+	return pgz;
+error:
+	pgz_free(&pgz);
+	return NULL;
+}
+
+size_t pgz_write(struct pgz *pgz, const void *ptr, size_t nmemb)
+{
+	size_t len;
+	size_t done=0;
+	struct pgz_block *b;
+
+	if(pgz->error) return 0;
+	while(done<nmemb)
+	{
+		b=&pgz->blocks[pgz->head];
+		len=PGZ_BLOCK_LEN-b->inlen;
+		if(len>nmemb-done) len=nmemb-done;
+		memcpy(b->in+b->inlen, (const char *)ptr+done, len);
+		b->inlen+=len;
+		done+=len;
+		pgz->total_in+=len;
+		if(b->inlen==PGZ_BLOCK_LEN && submit(pgz, 0))
+		{
+			pgz->error=1;
+			break;
+		}
+	}
+	return done;
+}
+
+off_t pgz_tell(struct pgz *pgz)
+{
+	return (off_t)pgz->total_in;
+}
+
+int pgz_close(struct pgz **pgz)
+{
+	int ret=-1;
+	struct pgz *p;
+	if(!pgz || !*pgz) return 0;
+	p=*pgz;
+
+	if(p->error || submit(p, 1 /* last */)) goto end;
+	while(p->pending)
+		if(drain_one(p)) goto end;
+	if(write_le32(p, (uint32_t)p->crc)
+	  || write_le32(p, (uint32_t)(p->total_in&0xffffffff)))
+		goto end;
+	// This can give an error when out of space.
+	if(close_fp(&p->fp))
+	{
+		logp("Error closing %s: %s\n", p->path, strerror(errno));
+		goto end;
+	}
+	ret=0;
+end:
+	pgz_free(pgz);
+	return ret;
+}
@@ -0,0 +1,24 @@
+#ifndef _PGZ_H
+#define _PGZ_H
+
+#include <zlib.h>
+
+// Parallel gzip writer.
+// The input is cut into fixed size blocks that are deflated independently by
+// a pool of threads, each block being primed with the last 32KB of the block
+// before it, so the ratio stays close to that of a single stream. The blocks
+// are written out in order with sync flushes between them, so the result is
+// one ordinary gzip member that zlib (and gunzip) can read.
+
+#define PGZ_BLOCK_LEN	131072
+#define PGZ_DICT_LEN	32768
+
+struct pgz;
+
+extern struct pgz *pgz_open(const char *path, int level, int threads);
+extern int pgz_close(struct pgz **pgz);
+
+extern size_t pgz_write(struct pgz *pgz, const void *ptr, size_t nmemb);
+extern off_t pgz_tell(struct pgz *pgz);
+
+#endif
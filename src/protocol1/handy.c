@@ -107,11 +107,18 @@ int send_whole_file_gzl(struct asfd *asfd,
 	int have;
 	z_stream strm;
 	int flush=Z_NO_FLUSH;
-	uint8_t in[ZCHUNK];
-	uint8_t out[ZCHUNK];
+	uint8_t *in=NULL;
+	uint8_t *out=NULL;
+	// Fill whole messages, however big the other end has agreed to.
+	size_t chunk=asfd->frame_len;
 
 	int eoutlen;
-	uint8_t eoutbuf[ZCHUNK+EVP_MAX_BLOCK_LENGTH];
+	uint8_t *eoutbuf=NULL;
+
+	struct compadapt ca;
+	int adapt=compression && get_int(confs[OPT_COMPRESSION_ADAPTIVE]);
+	double ztime=0;
+	double t=0;
 
 	EVP_CIPHER_CTX *enc_ctx=NULL;
 #ifdef HAVE_WIN32
@@ -146,13 +153,23 @@ int send_whole_file_gzl(struct asfd *asfd,
 	{
 		return -1;
 	}
+	compadapt_init(&ca, compression);
+
+	if(!(in=(uint8_t *)malloc_w(chunk, __func__))
+	  || !(out=(uint8_t *)malloc_w(chunk, __func__))
+	  || !(eoutbuf=(uint8_t *)malloc_w(chunk+EVP_MAX_BLOCK_LENGTH,
+		__func__)))
+	{
+		ret=-1;
+		goto cleanup;
+	}
 
 	do
 	{
 		if(metadata)
 		{
-			if(metalen>ZCHUNK)
-				strm.avail_in=ZCHUNK;
+			if(metalen>chunk)
+				strm.avail_in=chunk;
 			else
 				strm.avail_in=metalen;
 			memcpy(in, metadata, strm.avail_in);
@@ -169,13 +186,13 @@ int send_whole_file_gzl(struct asfd *asfd,
 				if(datalen<=0) strm.avail_in=0;
 				else strm.avail_in=
 					(uint32_t)bfd->read(bfd, in,
-						min((size_t)ZCHUNK, datalen));
+						min(chunk, datalen));
 				datalen-=strm.avail_in;
 			}
 			else
 #endif
 				strm.avail_in=
-					(uint32_t)bfd->read(bfd, in, ZCHUNK);
+					(uint32_t)bfd->read(bfd, in, chunk);
 		}
 		if(!compression && !strm.avail_in) break;
 
@@ -207,16 +224,22 @@ int send_whole_file_gzl(struct asfd *asfd,
 		{
 			if(compression)
 			{
-				strm.avail_out = ZCHUNK;
+				strm.avail_out = chunk;
 				strm.next_out = out;
+				if(adapt)
+				{
+					compadapt_apply(&ca, &strm);
+					t=compadapt_now();
+				}
 				zret = deflate(&strm, flush); /* no bad return value */
+				if(adapt) ztime=compadapt_now()-t;
 				if(zret==Z_STREAM_ERROR) /* state not clobbered */
 				{
 					logp("z_stream_error\n");
 					ret=-1;
 					break;
 				}
-				have = ZCHUNK-strm.avail_out;
+				have = chunk-strm.avail_out;
 			}
 			else
 			{
@@ -224,6 +247,7 @@ int send_whole_file_gzl(struct asfd *asfd,
 				memcpy(out, in, have);
 			}
 
+			if(adapt) t=compadapt_now();
 			if(enc_ctx)
 			{
 				if(do_encryption(asfd, enc_ctx, out, have,
@@ -242,6 +266,8 @@ int send_whole_file_gzl(struct asfd *asfd,
 					break;
 				}
 			}
+			if(adapt) compadapt_update(&ca,
+				ztime, compadapt_now()-t);
 			if(quick_read && datapth)
 			{
 				int qr;
@@ -300,6 +326,9 @@ int send_whole_file_gzl(struct asfd *asfd,
 
 cleanup:
 	deflateEnd(&strm);
+	free_v((void **)&in);
+	free_v((void **)&out);
+	free_v((void **)&eoutbuf);
 
 	if(enc_ctx)
 	{
@@ -369,7 +398,8 @@ int send_whole_filel(struct asfd *asfd,
 	int ret=0;
 	size_t s=0;
 	MD5_CTX md5;
-	char buf[4096]="";
+	char *buf=NULL;
+	size_t chunk=asfd->frame_len;
 
 	if(!MD5_Init(&md5))
 	{
@@ -388,7 +418,7 @@ int send_whole_filel(struct asfd *asfd,
 		// Send metadata in chunks, rather than all at once.
 		while(metalen>0)
 		{
-			if(metalen>ZCHUNK) s=ZCHUNK;
+			if(metalen>chunk) s=chunk;
 			else s=metalen;
 
 			if(!MD5_Update(&md5, metadata, s))
@@ -432,6 +462,10 @@ int send_whole_filel(struct asfd *asfd,
 		}
 #endif
 
+		if(!ret && cmd!=CMD_EFS_FILE
+		  && !(buf=(char *)malloc_w(chunk, __func__)))
+			ret=-1;
+
 		if(!ret && cmd!=CMD_EFS_FILE)
 		{
 #ifdef HAVE_WIN32
@@ -445,13 +479,13 @@ int send_whole_filel(struct asfd *asfd,
 			if(do_known_byte_count)
 			{
 				s=(uint32_t)bfd->read(bfd,
-					buf, min((size_t)4096, datalen));
+					buf, min(chunk, datalen));
 				datalen-=s;
 			}
 			else
 			{
 #endif
-				s=(uint32_t)bfd->read(bfd, buf, 4096);
+				s=(uint32_t)bfd->read(bfd, buf, chunk);
 #ifdef HAVE_WIN32
 			}
 #endif
@@ -491,6 +525,7 @@ int send_whole_filel(struct asfd *asfd,
 		  }
 		}
 	}
+	free_w(&buf);
 	if(!ret)
 	{
 		uint8_t checksum[MD5_DIGEST_LENGTH];
@@ -110,6 +110,12 @@ static DWORD WINAPI read_efs(PBYTE pbData, PVOID pvCallbackContext, PULONG ulLen
 		switch(rbuf->cmd)
 		{
 			case CMD_APPEND:
+				if(rbuf->len>*ulLength)
+				{
+					logp("EFS message of %lu bytes is too big\n", (unsigned long)rbuf->len);
+					iobuf_free_content(rbuf);
+					return ERROR_FUNCTION_FAILED;
+				}
 				memcpy(pbData, rbuf->buf, rbuf->len);
 				*ulLength=(ULONG)rbuf->len;
 				(*(mybuf->sent))+=rbuf->len;
@@ -166,8 +172,10 @@ int transfer_gzfile_inl(struct asfd *asfd,
 	int ret=-1;
 	uint8_t out[ZCHUNK];
 	int doutlen=0;
-	//uint8_t doutbuf[1000+EVP_MAX_BLOCK_LENGTH];
-	uint8_t doutbuf[ZCHUNK-EVP_MAX_BLOCK_LENGTH];
+	// Messages can be up to the frame length plus the encryption padding
+	// that the sender added, and decrypting can add another block.
+	size_t doutmax=asfd->frame_len+EVP_MAX_BLOCK_LENGTH;
+	uint8_t *doutbuf=NULL;
 	struct iobuf *rbuf=asfd->rbuf;
 
 	z_stream zstrm;
@@ -202,8 +210,16 @@ int transfer_gzfile_inl(struct asfd *asfd,
 		return -1;
 	}
 
-	if(encpassword && !(enc_ctx=enc_setup(0, encpassword)))
+	if(encpassword
+	  && (!(enc_ctx=enc_setup(0, encpassword))
+		|| !(doutbuf=(uint8_t *)malloc_w(doutmax+EVP_MAX_BLOCK_LENGTH,
+			__func__))))
 	{
+		if(enc_ctx)
+		{
+			EVP_CIPHER_CTX_cleanup(enc_ctx);
+			free(enc_ctx);
+		}
 		inflateEnd(&zstrm);
 		return -1;
 	}
@@ -218,6 +234,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 				EVP_CIPHER_CTX_cleanup(enc_ctx);
 				free(enc_ctx);
 			}
+			free_v((void **)&doutbuf);
 			inflateEnd(&zstrm);
 			return -1;
 		}
@@ -248,6 +265,12 @@ int transfer_gzfile_inl(struct asfd *asfd,
 */
 					// If doing decryption, it needs
 					// to be done before uncompressing.
+					if(enc_ctx && rbuf->len>doutmax)
+					{
+						logp("Encrypted message of %lu bytes is too big\n", (unsigned long)rbuf->len);
+						quit++; ret=-1;
+						break;
+					}
 					if(enc_ctx)
 					{
 					  // updating our checksum needs to
@@ -352,6 +375,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 		EVP_CIPHER_CTX_cleanup(enc_ctx);
 		free(enc_ctx);
 	}
+	free_v((void **)&doutbuf);
 
 	iobuf_free_content(rbuf);
 	if(ret) logp("transfer file returning: %d\n", ret);
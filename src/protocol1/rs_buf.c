@@ -152,6 +152,14 @@ rs_result rs_infilebuf_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
 		{
 			//logp("got '%c' in fd infilebuf: %d\n",
 			//	CMD_APPEND, rbuf->len);
+			if(rbuf->len>fb->buf_len)
+			{
+				logp("%c of %lu bytes is too big for %s\n",
+					CMD_APPEND, (unsigned long)rbuf->len,
+					__func__);
+				iobuf_free_content(rbuf);
+				return RS_IO_ERROR;
+			}
 			memcpy(fb->buf, rbuf->buf, rbuf->len);
 			len=rbuf->len;
 			iobuf_free_content(rbuf);
@@ -469,7 +477,7 @@ rs_result rs_loadsig_network_run(struct asfd *asfd,
 	rs_filebuf_t *in_fb=NULL;
 
 	if(!(in_fb=rs_filebuf_new(asfd, NULL,
-		NULL, asfd->fd, ASYNC_BUF_LEN, -1, cntr)))
+		NULL, asfd->fd, asfd->frame_len, -1, cntr)))
 	{
 		result=RS_MEM_ERROR;
 		goto end;
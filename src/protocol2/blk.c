@@ -79,6 +79,14 @@ int blk_is_zero_length(struct blk *blk)
 	  && !memcmp(blk->md5sum, md5sum_of_empty_string, MD5_DIGEST_LENGTH);
 }
 
+// Whether the data of the block is all zeroes.
+int blk_is_zero(struct blk *blk)
+{
+	if(!blk->data || !blk->length || blk->fingerprint) return 0;
+	return !blk->data[0]
+	  && !memcmp(blk->data, blk->data+1, blk->length-1);
+}
+
 int blk_verify(struct blk *blk, struct conf **confs)
 {
 	uint8_t md5sum[MD5_DIGEST_LENGTH];
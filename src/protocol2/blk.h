@@ -20,11 +20,19 @@
 #define CHECKSUM_LEN		FINGERPRINT_LEN+MD5_DIGEST_LENGTH
 #define SAVE_PATH_LEN		8 // This is set in hexmap.h.
 
+// With restore_dedup, a block that was sent in the last this many blocks of a
+// restore stream is sent again as a reference instead of as data.
+#define RESTORE_DEDUP_WINDOW	0x40000
+// With restore_delta, files at least this big have their signatures sent
+// ahead of their data.
+#define RESTORE_DELTA_MIN_SIZE	0x100000
+
 enum blk_got
 {
 	BLK_INCOMING=0,
 	BLK_NOT_GOT,
-	BLK_GOT
+	BLK_GOT,
+	BLK_ZERO	// Restore only. A run of 'index' zero bytes.
 };
 
 typedef struct blk blk_t;
@@ -51,6 +59,7 @@ extern void blk_free(struct blk **blk);
 extern int blk_md5_update(struct blk *blk);
 extern void blk_print_alloc_stats(void);
 extern int blk_is_zero_length(struct blk *blk);
+extern int blk_is_zero(struct blk *blk);
 extern int blk_verify(struct blk *blk, struct conf **confs);
 
 #endif
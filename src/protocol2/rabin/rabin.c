@@ -20,29 +20,32 @@ int blks_generate_init(void)
 }
 
 // This is where the magic happens.
-// Return 1 for got a block, 0 for no block got.
-static int blk_read(void)
+// Add a byte to the block and to the sliding window. Return 1 if the block
+// ends with it.
+static inline int blk_roll(struct win *w, struct blk *b, char c)
 {
-	char c;
-
-	for(; gcp<gbuf_end; gcp++)
-	{
-		c=*gcp;
+	b->fingerprint = (b->fingerprint * rconf.prime) + c;
+	w->checksum    = (w->checksum    * rconf.prime) + c
+			 - (w->data[w->pos] * rconf.multiplier);
+	w->data[w->pos] = c;
 
-		blk->fingerprint = (blk->fingerprint * rconf.prime) + c;
-		win->checksum    = (win->checksum    * rconf.prime) + c
-				   - (win->data[win->pos] * rconf.multiplier);
-		win->data[win->pos] = c;
+	w->pos++;
+	if(b->data) b->data[b->length] = c;
+	b->length++;
 
-		win->pos++;
-		if(blk->data) blk->data[blk->length] = c;
-		blk->length++;
+	if(w->pos == rconf.win_size) w->pos=0;
 
-		if(win->pos == rconf.win_size) win->pos=0;
+	return b->length >= rconf.blk_min
+	  && (b->length == rconf.blk_max
+	   || (w->checksum % rconf.blk_avg) == rconf.prime);
+}
 
-		if( blk->length >= rconf.blk_min
-		 && (blk->length == rconf.blk_max
-		  || (win->checksum % rconf.blk_avg) == rconf.prime))
+// Return 1 for got a block, 0 for no block got.
+static int blk_read(void)
+{
+	for(; gcp<gbuf_end; gcp++)
+	{
+		if(blk_roll(win, blk, *gcp))
 		{
 			gcp++;
 			return 1;
@@ -140,6 +143,56 @@ int blks_generate(struct asfd *asfd, struct conf **confs,
 	return 0;
 }
 
+// The client uses this for restore_delta, to find the blocks in a file that
+// it already has. The file is cut up in the same way as in blks_generate(),
+// and each block is handed to 'callback' along with its offset in the file.
+// The block data is only valid during the callback.
+int blks_generate_fd(int fd,
+	int callback(struct blk *blk, uint64_t offset, void *param),
+	void *param)
+{
+	int ret=-1;
+	char *cp;
+	char *buf=NULL;
+	ssize_t bytes;
+	size_t buflen;
+	uint64_t offset=0;
+	struct win *w=NULL;
+	struct blk *b=NULL;
+
+	rconf_init(&rconf);
+	// Read a few blocks worth at a time.
+	buflen=rconf.blk_max*8;
+	if(!(w=win_alloc(&rconf))
+	  || !(b=blk_alloc_with_data(rconf.blk_max))
+	  || !(buf=(char *)malloc_w(buflen, __func__)))
+		goto end;
+
+	while((bytes=read(fd, buf, buflen))>0)
+	{
+		for(cp=buf; cp<buf+bytes; cp++)
+		{
+			if(!blk_roll(w, b, *cp)) continue;
+			if(callback(b, offset, param)) goto end;
+			offset+=b->length;
+			b->length=0;
+			b->fingerprint=0;
+		}
+	}
+	if(bytes<0)
+	{
+		logp("read error in %s: %s\n", __func__, strerror(errno));
+		goto end;
+	}
+	if(b->length && callback(b, offset, param)) goto end;
+	ret=0;
+end:
+	blk_free(&b);
+	win_free(w);
+	free_w(&buf);
+	return ret;
+}
+
 // The server uses this for verification.
 int blk_read_verify(struct blk *blk_to_verify, struct conf **confs)
 {
@@ -6,6 +6,9 @@
 extern int blks_generate_init(void);
 extern int blks_generate(struct asfd *asfd, struct conf **confs,
 	struct sbuf *sb, struct blist *blist);
+extern int blks_generate_fd(int fd,
+	int callback(struct blk *blk, uint64_t offset, void *param),
+	void *param);
 extern int blk_read_verify(struct blk *blk_to_verify, struct conf **confs);
 
 #endif
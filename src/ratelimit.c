@@ -0,0 +1,143 @@
+#include "include.h"
+#include "ratelimit.h"
+
+#ifndef HAVE_WIN32
+#include <sys/mman.h>
+#endif
+
+// A tenth of a second's worth, so that the traffic comes out smooth rather
+// than as a burst at the start of every second.
+#define RATELIMIT_BURST_DIV	10
+#define RATELIMIT_BURST_MIN	512
+
+// The lock is only held for a few sums. If it stays taken for this long, the
+// holder was probably killed part way through, so carry on regardless.
+#define RATELIMIT_LOCK_TRIES	10000000
+
+static struct ratelimit *shared=NULL;
+
+static void rl_lock(struct ratelimit *rl)
+{
+	long tries=0;
+	while(__sync_lock_test_and_set(&rl->lock, 1))
+		if(++tries>RATELIMIT_LOCK_TRIES) break;
+}
+
+static void rl_unlock(struct ratelimit *rl)
+{
+	__sync_lock_release(&rl->lock);
+}
+
+static void set_rate(struct ratelimit *rl, float rate)
+{
+	rl->rate=rate;
+	rl->burst=rate/RATELIMIT_BURST_DIV;
+	if(rl->burst<RATELIMIT_BURST_MIN) rl->burst=RATELIMIT_BURST_MIN;
+	if(rl->tokens>rl->burst) rl->tokens=rl->burst;
+}
+
+void ratelimit_init(struct ratelimit *rl, float rate)
+{
+	memset(rl, 0, sizeof(struct ratelimit));
+	set_rate(rl, rate);
+	rl->tokens=rl->burst;
+	gettimeofday(&rl->last, NULL);
+}
+
+void ratelimit_set_rate(struct ratelimit *rl, float rate)
+{
+	if(!rl) return;
+	rl_lock(rl);
+	set_rate(rl, rate);
+	rl_unlock(rl);
+}
+
+size_t ratelimit_burst(struct ratelimit *rl)
+{
+	return (size_t)rl->burst;
+}
+
+// Must have the lock.
+static void refill(struct ratelimit *rl)
+{
+	double elapsed;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	elapsed=(now.tv_sec-rl->last.tv_sec)
+		+(now.tv_usec-rl->last.tv_usec)/1000000.0;
+	rl->last=now;
+	// If the clock went back, just start again from now.
+	if(elapsed<=0) return;
+	rl->tokens+=elapsed*rl->rate;
+	if(rl->tokens>rl->burst) rl->tokens=rl->burst;
+}
+
+long ratelimit_wait(struct ratelimit *rl)
+{
+	long usec=0;
+	if(!rl->rate) return 0;
+	rl_lock(rl);
+	refill(rl);
+	// Wait until there is a bit more than nothing, so that the sends do
+	// not become tiny.
+	if(rl->tokens<rl->burst/4)
+		usec=(long)((rl->burst/4-rl->tokens)*1000000/rl->rate)+1;
+	rl_unlock(rl);
+	return usec;
+}
+
+void ratelimit_used(struct ratelimit *rl, size_t bytes)
+{
+	if(!rl->rate) return;
+	rl_lock(rl);
+	rl->tokens-=bytes;
+	rl_unlock(rl);
+}
+
+void ratelimit_sleep(long usec)
+{
+#ifdef HAVE_WIN32
+	// Windows Sleep is milliseconds, usleep is microseconds.
+	Sleep(usec/1000?usec/1000:1);
+#else
+	usleep(usec);
+#endif
+}
+
+#ifdef HAVE_WIN32
+int ratelimit_shared_init(float rate)
+{
+	return 0;
+}
+
+void ratelimit_shared_free(void)
+{
+}
+#else
+int ratelimit_shared_init(float rate)
+{
+	void *p;
+	ratelimit_shared_free();
+	if((p=mmap(NULL, sizeof(struct ratelimit), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0))==MAP_FAILED)
+	{
+		logp("Could not map shared ratelimit: %s\n", strerror(errno));
+		return -1;
+	}
+	shared=(struct ratelimit *)p;
+	ratelimit_init(shared, rate);
+	return 0;
+}
+
+void ratelimit_shared_free(void)
+{
+	if(!shared) return;
+	munmap(shared, sizeof(struct ratelimit));
+	shared=NULL;
+}
+#endif
+
+struct ratelimit *ratelimit_shared(void)
+{
+	return shared;
+}
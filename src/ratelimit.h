@@ -0,0 +1,37 @@
+#ifndef _RATELIMIT_H
+#define _RATELIMIT_H
+
+#include "burp.h"
+
+// Token bucket. Allowance for 'rate' bytes a second is added continuously,
+// up to a tenth of a second's worth, and each transfer takes its size out.
+// The allowance can go negative, because a transfer is only charged once it
+// has happened, and then nothing more is allowed until it has refilled.
+// The server keeps one bucket in shared memory, mapped before forking, that
+// all the children take from, so that their total can be capped too.
+
+struct ratelimit
+{
+	// Only used when the bucket is shared between processes.
+	volatile int lock;
+	float rate;		// Bytes per second.
+	double burst;
+	double tokens;
+	struct timeval last;
+};
+
+extern void ratelimit_init(struct ratelimit *rl, float rate);
+extern void ratelimit_set_rate(struct ratelimit *rl, float rate);
+extern size_t ratelimit_burst(struct ratelimit *rl);
+
+// Microseconds until something may be sent, or 0 for now.
+extern long ratelimit_wait(struct ratelimit *rl);
+extern void ratelimit_used(struct ratelimit *rl, size_t bytes);
+
+extern void ratelimit_sleep(long usec);
+
+extern int ratelimit_shared_init(float rate);
+extern void ratelimit_shared_free(void);
+extern struct ratelimit *ratelimit_shared(void);
+
+#endif
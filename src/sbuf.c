@@ -300,6 +300,19 @@ int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 				blk->length=rbuf->len;
 				rbuf->buf=NULL;
 				return 0;
+			case CMD_DATA_REF:
+				// The same as a block that was sent earlier
+				// in the restore. Client only.
+				if(!blk) break;
+				blk->got=BLK_GOT;
+				blk->index=strtoull(rbuf->buf, NULL, 16);
+				return 0;
+			case CMD_DATA_ZERO:
+				// A run of zero bytes. Client only.
+				if(!blk) break;
+				blk->got=BLK_ZERO;
+				blk->index=strtoull(rbuf->buf, NULL, 16);
+				return 0;
 			case CMD_MESSAGE:
 			case CMD_WARNING:
 				log_recvd(rbuf, confs, 1);
@@ -312,6 +325,12 @@ int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 					ret=1;
 					goto end;
 				}
+				else if(!strcmp(rbuf->buf, "restore_delta"))
+				{
+					// Comes just before the entry that
+					// it is about. Client only.
+					sb->flags|=SBUF_RESTORE_DELTA;
+				}
 				else
 				{
 					iobuf_log_unexpected(rbuf,
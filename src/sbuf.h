@@ -17,6 +17,8 @@
 #define SBUF_NEED_LINK			0x10
 #define SBUF_NEED_DATA			0x20
 #define SBUF_HEADER_WRITTEN_TO_MANIFEST	0x40
+// On restore, the server is going to send signatures before the data.
+#define SBUF_RESTORE_DELTA		0x80
 
 typedef struct sbuf sbuf_t;
 
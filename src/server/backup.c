@@ -104,18 +104,24 @@ static int backup_phase3_server(struct sdirs *sdirs, struct conf **cconfs,
 
 static int backup_phase4_server(struct sdirs *sdirs, struct conf **cconfs)
 {
+	int ret;
 	if(get_int(cconfs[OPT_BREAKPOINT])==4)
 		return breakpoint(cconfs, __func__);
 
 	set_logfp(NULL, cconfs);
+	backup_queue_phase4_begin();
 	// Phase4 will open logfp again (in case it is resuming).
 	switch(get_e_protocol(cconfs[OPT_PROTOCOL]))
 	{
 		case PROTO_1:
-			return backup_phase4_server_protocol1(sdirs, cconfs);
+			ret=backup_phase4_server_protocol1(sdirs, cconfs);
+			break;
 		default:
-			return backup_phase4_server_protocol2(sdirs, cconfs);
+			ret=backup_phase4_server_protocol2(sdirs, cconfs);
+			break;
 	}
+	backup_queue_phase4_end();
+	return ret;
 }
 
 static void log_rshash(struct conf **confs)
@@ -142,6 +148,13 @@ static int do_backup_server(struct async *as, struct sdirs *sdirs,
 		  || open_log(asfd, sdirs, cconfs))
 			goto error;
 		log_rshash(cconfs);
+
+		if(protocol==PROTO_2
+		  && !(chfd=champ_chooser_connect(as, sdirs, cconfs)))
+		{
+			logp("problem connecting to champ chooser\n");
+			goto error;
+		}
 	}
 	else
 	{
@@ -252,6 +265,58 @@ end:
 	return ret;
 }
 
+static int run_timer(struct asfd *asfd, struct sdirs *sdirs,
+	struct conf **cconfs)
+{
+	int a=0;
+	const char *args[12];
+
+	// Save forking a shell on every timed connection when the rules are
+	// simple enough to work out here.
+	if(!get_string(cconfs[OPT_TIMER_SCRIPT]))
+		return timer_check(sdirs, cconfs, time(NULL));
+
+	args[a++]=get_string(cconfs[OPT_TIMER_SCRIPT]);
+	args[a++]=get_string(cconfs[OPT_CNAME]);
+	args[a++]=sdirs->current;
+	args[a++]=sdirs->client;
+	args[a++]="reserved1";
+	args[a++]="reserved2";
+	args[a++]=NULL;
+	return run_script(asfd, args,
+		get_strlist(cconfs[OPT_TIMER_ARG]),
+		cconfs,
+		1 /* wait */,
+		1 /* use logp */,
+		0 /* no log_remote */);
+}
+
+// A 'backup' file in the storage directory asks for a backup straight away,
+// so it does not wait in the queue. The timer removes it.
+static int manual_backup_requested(struct sdirs *sdirs)
+{
+	int ret;
+	char *path=NULL;
+	struct stat statp;
+	if(!(path=prepend_s(sdirs->client, "backup")))
+		return -1;
+	ret=!lstat(path, &statp);
+	free_w(&path);
+	return ret;
+}
+
+// Clients that do not know about the queue get the same answer as when the
+// timer turns them down.
+static int backup_queued(struct asfd *asfd, struct conf **cconfs)
+{
+	char msg[32]="";
+	if(!get_int(cconfs[OPT_BACKUP_QUEUE]))
+		return asfd->write_str(asfd,
+			CMD_GEN, "timer conditions not met");
+	snprintf(msg, sizeof(msg), "backup queued:%d", backup_queue_retry());
+	return asfd->write_str(asfd, CMD_GEN, msg);
+}
+
 int run_backup(struct async *as, struct sdirs *sdirs, struct conf **cconfs,
 	const char *incexc, int *timer_ret, int resume)
 {
@@ -273,25 +338,13 @@ int run_backup(struct async *as, struct sdirs *sdirs, struct conf **cconfs,
 
 	if(!strncmp_w(rbuf->buf, "backupphase1timed"))
 	{
-		int a=0;
-		const char *args[12];
+		int manual;
 		int checkonly=!strncmp_w(rbuf->buf, "backupphase1timedcheck");
 		if(checkonly) logp("Client asked for a timer check only.\n");
 
-		args[a++]=get_string(cconfs[OPT_TIMER_SCRIPT]);
-		args[a++]=cname;
-		args[a++]=sdirs->current;
-		args[a++]=sdirs->client;
-		args[a++]="reserved1";
-		args[a++]="reserved2";
-		args[a++]=NULL;
-		if((*timer_ret=run_script(asfd, args,
-		  get_strlist(cconfs[OPT_TIMER_ARG]),
-		  cconfs,
-		  1 /* wait */,
-		  1 /* use logp */,
-		  0 /* no log_remote */
-		))<0)
+		if((manual=manual_backup_requested(sdirs))<0)
+			return -1;
+		if((*timer_ret=run_timer(asfd, sdirs, cconfs))<0)
 		{
 			logp("Error running timer script for %s\n",
 				cname);
@@ -312,6 +365,17 @@ int run_backup(struct async *as, struct sdirs *sdirs, struct conf **cconfs,
 			return asfd->write_str(asfd,
 				CMD_GEN, "timer conditions met");
 		}
+		switch(backup_queue_admit(sdirs, cconfs, manual))
+		{
+			case 1:
+				break;
+			case 0:
+				// Counts as turned down by the timer.
+				*timer_ret=1;
+				return backup_queued(asfd, cconfs);
+			default:
+				return -1;
+		}
 		logp("Running backup of %s\n", cname);
 	}
 	else if(!get_int(cconfs[OPT_CLIENT_CAN_FORCE_BACKUP]))
@@ -320,6 +384,8 @@ int run_backup(struct async *as, struct sdirs *sdirs, struct conf **cconfs,
 		return asfd->write_str(asfd,
 			CMD_GEN, "Forced backup is not allowed");
 	}
+	else if(backup_queue_admit(sdirs, cconfs, 1 /* force */)<0)
+		return -1;
 
 	snprintf(okstr, sizeof(okstr), "%s:%d",
 		resume?"resume":"ok", get_int(cconfs[OPT_COMPRESSION]));
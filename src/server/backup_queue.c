@@ -0,0 +1,387 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../conf.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "sdirs.h"
+#include "backup_queue.h"
+
+#ifdef HAVE_WIN32
+#include <yajl/yajl_tree.h>
+#else
+#include "../yajl/api/yajl_tree.h"
+#endif
+
+#include <sys/mman.h>
+
+// The lock is only held for a look through the table. If it stays taken for
+// this long, the holder was probably killed part way through, so carry on
+// regardless.
+#define BACKUP_QUEUE_LOCK_TRIES		10000000
+// How often to look for a free phase4 place.
+#define BACKUP_QUEUE_PHASE4_POLL	5
+// Give waiting clients this much longer than twice backup_queue_retry to
+// come back.
+#define BACKUP_QUEUE_GRACE		60
+// Nobody writes backup_stats files this big.
+#define BACKUP_QUEUE_STATS_MAX		(1024*1024)
+
+// An entry is free if it has neither a pid nor an 'asked' time. A waiting
+// client has an 'asked' time and no pid. A running backup has a pid.
+struct bq_ent
+{
+	pid_t pid;
+	int running;
+	int phase4;
+	time_t asked;
+	// When the client's data would date from, if a backup started now:
+	// the end of its last good backup, less how long that one took.
+	time_t since;
+	char cname[BACKUP_QUEUE_NAME_LEN];
+	char dedup_group[BACKUP_QUEUE_NAME_LEN];
+};
+
+struct bq
+{
+	volatile int lock;
+	int max_backups;
+	int max_phase4;
+	int retry;
+	struct bq_ent ent[BACKUP_QUEUE_ENT_MAX];
+};
+
+static struct bq *bq=NULL;
+
+static void bq_lock(void)
+{
+	long tries=0;
+	while(__sync_lock_test_and_set(&bq->lock, 1))
+		if(++tries>BACKUP_QUEUE_LOCK_TRIES) break;
+}
+
+static void bq_unlock(void)
+{
+	__sync_lock_release(&bq->lock);
+}
+
+static void ent_clear(struct bq_ent *e)
+{
+	memset(e, 0, sizeof(struct bq_ent));
+}
+
+// Must have the lock.
+static void tidy(time_t now)
+{
+	int i;
+	struct bq_ent *e;
+	for(i=0; i<BACKUP_QUEUE_ENT_MAX; i++)
+	{
+		e=&bq->ent[i];
+		if(e->pid)
+		{
+			// In case the main server has not reaped it yet.
+			if(kill(e->pid, 0) && errno==ESRCH)
+				ent_clear(e);
+		}
+		else if(e->asked
+		  && e->asked+bq->retry*2+BACKUP_QUEUE_GRACE<now)
+			ent_clear(e);
+	}
+}
+
+static struct bq_ent *find_pid(pid_t pid)
+{
+	int i;
+	for(i=0; i<BACKUP_QUEUE_ENT_MAX; i++)
+		if(bq->ent[i].pid==pid)
+			return &bq->ent[i];
+	return NULL;
+}
+
+static struct bq_ent *find_waiting(const char *cname)
+{
+	int i;
+	struct bq_ent *e;
+	for(i=0; i<BACKUP_QUEUE_ENT_MAX; i++)
+	{
+		e=&bq->ent[i];
+		if(!e->pid && e->asked && !strcmp(e->cname, cname))
+			return e;
+	}
+	return NULL;
+}
+
+static struct bq_ent *find_free(void)
+{
+	int i;
+	struct bq_ent *e;
+	for(i=0; i<BACKUP_QUEUE_ENT_MAX; i++)
+	{
+		e=&bq->ent[i];
+		if(!e->pid && !e->asked)
+			return e;
+	}
+	return NULL;
+}
+
+static int count_running(const char *dedup_group)
+{
+	int i;
+	int count=0;
+	struct bq_ent *e;
+	for(i=0; i<BACKUP_QUEUE_ENT_MAX; i++)
+	{
+		e=&bq->ent[i];
+		if(!e->running) continue;
+		if(dedup_group && strcmp(e->dedup_group, dedup_group))
+			continue;
+		count++;
+	}
+	return count;
+}
+
+static int count_phase4(void)
+{
+	int i;
+	int count=0;
+	for(i=0; i<BACKUP_QUEUE_ENT_MAX; i++)
+		if(bq->ent[i].phase4) count++;
+	return count;
+}
+
+static int ahead_of(struct bq_ent *me)
+{
+	int i;
+	int ahead=0;
+	int group_running;
+	struct bq_ent *e;
+	int my_group_running=count_running(me->dedup_group);
+	for(i=0; i<BACKUP_QUEUE_ENT_MAX; i++)
+	{
+		e=&bq->ent[i];
+		if(e==me || e->pid || !e->asked) continue;
+		group_running=count_running(e->dedup_group);
+		if(group_running<my_group_running
+		  || (group_running==my_group_running && e->since<me->since))
+			ahead++;
+	}
+	return ahead;
+}
+
+int backup_queue_previous(struct sdirs *sdirs, time_t *last, time_t *took)
+{
+	int ret=-1;
+	size_t i;
+	FILE *fp=NULL;
+	char *buf=NULL;
+	char *path=NULL;
+	time_t start=0;
+	time_t end=0;
+	struct stat statp;
+	yajl_val tree=NULL;
+	yajl_val counters=NULL;
+	const char *counters_path[]={"counters", NULL};
+	const char *name_path[]={"name", NULL};
+	const char *count_path[]={"count", NULL};
+
+	*last=0;
+	*took=0;
+	if(!(path=prepend_s(sdirs->current, "backup_stats")))
+		goto end;
+	if(lstat(path, &statp)
+	  || !S_ISREG(statp.st_mode)
+	  || statp.st_size>BACKUP_QUEUE_STATS_MAX)
+	{
+		ret=0;
+		goto end;
+	}
+	if(!(buf=(char *)malloc_w(statp.st_size+1, __func__)))
+		goto end;
+	if(!(fp=fopen(path, "rb"))
+	  || fread(buf, 1, statp.st_size, fp)!=(size_t)statp.st_size)
+	{
+		logp("Could not read %s\n", path);
+		ret=0;
+		goto end;
+	}
+	buf[statp.st_size]='\0';
+	if(!(tree=yajl_tree_parse(buf, NULL, 0))
+	  || !(counters=yajl_tree_get(tree, counters_path, yajl_t_array)))
+	{
+		logp("Could not parse %s\n", path);
+		ret=0;
+		goto end;
+	}
+	for(i=0; i<YAJL_GET_ARRAY(counters)->len; i++)
+	{
+		const char *name;
+		yajl_val count;
+		yajl_val c=YAJL_GET_ARRAY(counters)->values[i];
+		if(!(name=YAJL_GET_STRING(yajl_tree_get(c,
+			name_path, yajl_t_string)))
+		  || !(count=yajl_tree_get(c, count_path, yajl_t_number))
+		  || !YAJL_IS_INTEGER(count))
+			continue;
+		if(!strcmp(name, "time_start"))
+			start=(time_t)YAJL_GET_INTEGER(count);
+		else if(!strcmp(name, "time_end"))
+			end=(time_t)YAJL_GET_INTEGER(count);
+	}
+	*last=end;
+	if(start && start<=end)
+		*took=end-start;
+	ret=0;
+end:
+	if(fp) fclose(fp);
+	if(tree) yajl_tree_free(tree);
+	free_w(&buf);
+	free_w(&path);
+	return ret;
+}
+
+int backup_queue_admit(struct sdirs *sdirs, struct conf **cconfs, int force)
+{
+	int ret=0;
+	int ahead=0;
+	int places;
+	time_t last;
+	time_t took;
+	struct bq_ent *me;
+	struct bq_ent mine;
+	time_t now=time(NULL);
+	const char *cname=get_string(cconfs[OPT_CNAME]);
+	const char *dedup_group=get_string(cconfs[OPT_DEDUP_GROUP]);
+
+	if(!bq || !bq->max_backups)
+		return 1;
+	if(backup_queue_previous(sdirs, &last, &took))
+		return -1;
+
+	bq_lock();
+	tidy(now);
+	if(!(me=find_waiting(cname))
+	  && !(me=find_free()))
+	{
+		// The table is full, so this client cannot be remembered.
+		me=&mine;
+		ent_clear(me);
+	}
+	snprintf(me->cname, sizeof(me->cname), "%s", cname);
+	snprintf(me->dedup_group, sizeof(me->dedup_group), "%s",
+		dedup_group?dedup_group:"");
+	me->asked=now;
+	me->since=last-took;
+	places=bq->max_backups-count_running(NULL);
+	if(!force) ahead=ahead_of(me);
+	if(force || ahead<places)
+	{
+		me->pid=getpid();
+		me->running=1;
+		me->asked=0;
+		ret=1;
+	}
+	bq_unlock();
+
+	if(ret)
+		logp("Backup place taken, %d were free\n", places);
+	else
+		logp("Backup of %s queued behind %d, with %d free places\n",
+			cname, ahead, places>0?places:0);
+	return ret;
+}
+
+int backup_queue_retry(void)
+{
+	return bq?bq->retry:0;
+}
+
+void backup_queue_release(pid_t pid)
+{
+	struct bq_ent *e;
+	if(!bq || !pid) return;
+	bq_lock();
+	while((e=find_pid(pid)))
+		ent_clear(e);
+	bq_unlock();
+}
+
+void backup_queue_phase4_begin(void)
+{
+	int got;
+	int logged=0;
+	struct bq_ent *e;
+	pid_t pid=getpid();
+
+	if(!bq) return;
+	while(1)
+	{
+		got=0;
+		bq_lock();
+		tidy(time(NULL));
+		if(!bq->max_phase4)
+			got=1;
+		else if(count_phase4()<bq->max_phase4)
+		{
+			if((e=find_pid(pid))
+			  || (e=find_free()))
+			{
+				e->pid=pid;
+				e->phase4=1;
+			}
+			got=1;
+		}
+		bq_unlock();
+		if(got) break;
+		if(!logged++)
+			logp("Waiting for one of the %d phase4 places\n",
+				bq->max_phase4);
+		sleep(BACKUP_QUEUE_PHASE4_POLL);
+	}
+}
+
+void backup_queue_phase4_end(void)
+{
+	struct bq_ent *e;
+	if(!bq) return;
+	bq_lock();
+	if((e=find_pid(getpid())))
+	{
+		e->phase4=0;
+		if(!e->running) ent_clear(e);
+	}
+	bq_unlock();
+}
+
+void backup_queue_set_limits(struct conf **confs)
+{
+	if(!bq) return;
+	bq_lock();
+	bq->max_backups=get_int(confs[OPT_MAX_BACKUPS]);
+	bq->max_phase4=get_int(confs[OPT_MAX_PHASE4]);
+	bq->retry=get_int(confs[OPT_BACKUP_QUEUE_RETRY]);
+	bq_unlock();
+}
+
+int backup_queue_init(struct conf **confs)
+{
+	void *p;
+	backup_queue_free();
+	if((p=mmap(NULL, sizeof(struct bq), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0))==MAP_FAILED)
+	{
+		logp("Could not map shared backup queue: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	bq=(struct bq *)p;
+	memset(bq, 0, sizeof(struct bq));
+	backup_queue_set_limits(confs);
+	return 0;
+}
+
+void backup_queue_free(void)
+{
+	if(!bq) return;
+	munmap(bq, sizeof(struct bq));
+	bq=NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef _BACKUP_QUEUE_H
+#define _BACKUP_QUEUE_H
+
+#include "sdirs.h"
+
+// Decides which timed backups go ahead when max_backups are already running,
+// and keeps the number of backups in phase4 down to max_phase4.
+// The main server process maps a table before forking, which all the children
+// share. A child with a timed backup to do either takes a place in it, or
+// leaves its client's details there and tells the client to come back later.
+// The places go first to clients in dedup groups that have the fewest backups
+// running, then to the clients whose last good backup is the oldest, counting
+// on from how long that backup took. Clients that do not come back within
+// twice backup_queue_retry drop out of the queue.
+
+#define BACKUP_QUEUE_ENT_MAX	1024
+#define BACKUP_QUEUE_NAME_LEN	256
+
+extern int backup_queue_init(struct conf **confs);
+extern void backup_queue_free(void);
+extern void backup_queue_set_limits(struct conf **confs);
+
+// Returns 1 if the backup can go ahead, 0 if the client should come back in
+// backup_queue_retry() seconds, or -1 on error. With 'force', the backup
+// always goes ahead, but still takes a place.
+extern int backup_queue_admit(struct sdirs *sdirs, struct conf **cconfs,
+	int force);
+extern int backup_queue_retry(void);
+// Called by the main server when it reaps a child.
+extern void backup_queue_release(pid_t pid);
+
+// Waits for a phase4 place.
+extern void backup_queue_phase4_begin(void);
+extern void backup_queue_phase4_end(void);
+
+// Gets the end time of the last good backup, and how long it took, from its
+// backup_stats. Both are 0 if there is no such backup.
+extern int backup_queue_previous(struct sdirs *sdirs, time_t *last,
+	time_t *took);
+
+#endif
@@ -1,7 +1,9 @@
 #include "include.h"
 #include "../cmd.h"
+#include "monitor/cntr_shm.h"
 
 static struct asfd *wasfd=NULL;
+static struct cntr_shm_slot *shm_slot=NULL;
 
 int write_status(enum cntr_status cntr_status,
 	const char *path, struct conf **confs)
@@ -11,9 +13,21 @@ int write_status(enum cntr_status cntr_status,
 	static time_t lasttime=0;
 	static size_t l=0;
 	static struct iobuf *wbuf=NULL;
+	static enum cntr_status last_status=CNTR_STATUS_UNSET;
 
 	if(!wasfd) return 0;
 
+	// If we have a shared memory slot, the status server reads the
+	// counters straight out of it, so the pipe is only needed to tell it
+	// about state transitions.
+	if(shm_slot)
+	{
+		cntr_shm_write(shm_slot, get_cntr(confs[OPT_CNTR]), cntr_status);
+		if(cntr_status==last_status && !l) return 0;
+		last_status=cntr_status;
+		lasttime=0;
+	}
+
 	// Only update every 2 seconds.
 	now=time(NULL);
 	diff=now-lasttime;
@@ -104,11 +118,13 @@ end:
 }
 
 int child(struct async *as,
-	int status_wfd, struct conf **confs, struct conf **cconfs)
+	int status_wfd, struct conf **confs, struct conf **cconfs,
+	int *reusable)
 {
 	int ret=-1;
 	int srestore=0;
 	int timer_ret=0;
+	int changed_user=0;
 	char *incexc=NULL;
 	struct asfd *asfd;
 	const char *confs_user=get_string(confs[OPT_USER]);
@@ -149,6 +165,11 @@ int child(struct async *as,
 			goto end;
 		}
 	}
+	// There is no going back from a switch to a user of the client's own.
+	if((cconfs_user && (!confs_user || strcmp(confs_user, cconfs_user)))
+	  || (cconfs_group
+		&& (!confs_group || strcmp(confs_group, cconfs_group))))
+			changed_user=1;
 
 	if(as->asfd->read(as->asfd)) goto end;
 
@@ -160,6 +181,8 @@ int child(struct async *as,
 		goto end;
 	}
 
+	if(wasfd) shm_slot=cntr_shm_claim(get_cntr(cconfs[OPT_CNTR]));
+
 	ret=0;
 
 	// FIX THIS: Make the script components part of a struct, and just
@@ -182,6 +205,16 @@ int child(struct async *as,
 			get_int(cconfs[OPT_S_SCRIPT_POST_NOTIFY]),
 			cconfs, ret, timer_ret);
 
+	// A timed backup that was turned down does next to nothing, which is
+	// the case that is worth taking more connections after. Anything else
+	// may have left its mark on the process.
+	if(!ret && timer_ret>0 && !changed_user)
+		*reusable=1;
 end:
+	if(shm_slot)
+	{
+		cntr_shm_release(getpid());
+		shm_slot=NULL;
+	}
 	return ret;
 }
@@ -6,7 +6,9 @@
 extern int write_status(enum cntr_status cntr_status,
 	const char *path, struct conf **confs);
 
+// Sets 'reusable' if the connection left nothing behind that would stop a
+// prefork worker from taking another one.
 extern int child(struct async *as, int status_wfd,
-	struct conf **confs, struct conf **cconfs);
+	struct conf **confs, struct conf **cconfs, int *reusable);
 
 #endif
@@ -2,33 +2,33 @@
 
 static int compress(const char *src, const char *dst, struct conf **cconfs)
 {
-	int res;
-	int got;
+	size_t res;
+	size_t got;
 	FILE *mp=NULL;
-	gzFile zp=NULL;
+	struct fzp *zp=NULL;
 	char buf[ZCHUNK];
 
 	if(!(mp=open_file(src, "rb"))
-	  || !(zp=gzopen_file(dst, comp_level(cconfs))))
+	  || !(zp=fzp_gzopen(dst, comp_level(cconfs))))
 	{
 		close_fp(&mp);
-		gzclose_fp(&zp);
+		fzp_close(&zp);
 		return -1;
 	}
 	while((got=fread(buf, 1, sizeof(buf), mp))>0)
 	{
-		res=gzwrite(zp, buf, got);
+		res=fzp_write(zp, buf, got);
 		if(res!=got)
 		{
-			logp("compressing %s - read %d but wrote %d\n",
-				src, got, res);
+			logp("compressing %s - read %lu but wrote %lu\n",
+				src, (unsigned long)got, (unsigned long)res);
 			close_fp(&mp);
-			gzclose_fp(&zp);
+			fzp_close(&zp);
 			return -1;
 		}
 	}
 	close_fp(&mp);
-	return gzclose_fp(&zp); // this can give an error when out of space
+	return fzp_close(&zp); // this can give an error when out of space
 }
 
 int compress_file(const char *src, const char *dst, struct conf **cconfs)
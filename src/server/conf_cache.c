@@ -0,0 +1,61 @@
+#include "include.h"
+#include "conf_cache.h"
+
+struct conf_cache
+{
+	struct conf **confs;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+};
+
+struct conf_cache *conf_cache_alloc(void)
+{
+	return (struct conf_cache *)
+		calloc_w(1, sizeof(struct conf_cache), __func__);
+}
+
+void conf_cache_free(struct conf_cache **cache)
+{
+	if(!cache || !*cache) return;
+	confs_free(&(*cache)->confs);
+	free_v((void **)cache);
+}
+
+static int unchanged(struct conf_cache *cache, struct stat *statp)
+{
+	return cache->confs
+	  && cache->dev==statp->st_dev
+	  && cache->ino==statp->st_ino
+	  && cache->size==statp->st_size
+	  && cache->mtime==statp->st_mtime;
+}
+
+int conf_cache_load(struct conf_cache *cache, const char *path,
+	struct conf **confs)
+{
+	struct stat statp;
+
+	if(stat(path, &statp))
+	{
+		logp("could not stat %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if(!unchanged(cache, &statp))
+	{
+		confs_free(&cache->confs);
+		if(!(cache->confs=confs_alloc())
+		  || confs_init(cache->confs)
+		  || conf_load_global_only(path, cache->confs))
+		{
+			confs_free(&cache->confs);
+			return -1;
+		}
+		cache->dev=statp.st_dev;
+		cache->ino=statp.st_ino;
+		cache->size=statp.st_size;
+		cache->mtime=statp.st_mtime;
+	}
+	return confs_copy(confs, cache->confs);
+}
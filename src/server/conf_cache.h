@@ -0,0 +1,18 @@
+#ifndef _CONF_CACHE_H
+#define _CONF_CACHE_H
+
+// Keeps the parsed global config of a prefork worker, so that it is not read
+// and checked again for every connection. It is loaded again when the config
+// file changes. Files that it pulls in with '. ' are not looked at, so changes
+// to those need a reload of the server.
+
+struct conf_cache;
+
+extern struct conf_cache *conf_cache_alloc(void);
+extern void conf_cache_free(struct conf_cache **cache);
+// Fill 'confs', which should have been through confs_init(), with the global
+// config from 'path'.
+extern int conf_cache_load(struct conf_cache *cache, const char *path,
+	struct conf **confs);
+
+#endif
@@ -26,6 +26,7 @@ int dpth_release_and_move_to_next_in_list(struct dpth *dpth)
 	// Try to release (and unlink) the lock even if close_fp failed, just
 	// to be tidy.
 	if(close_fp(&dpth->fp)) ret=-1;
+	if(close_fp(&dpth->ifp)) ret=-1;
 	if(lock_release(dpth->head->lock)) ret=-1;
 	lock_free(&dpth->head->lock);
 
@@ -41,6 +42,7 @@ int dpth_release_all(struct dpth *dpth)
 	int ret=0;
 	if(!dpth) return 0;
 	if(dpth->fp && close_fp(&dpth->fp)) ret=-1;
+	if(dpth->ifp && close_fp(&dpth->ifp)) ret=-1;
 	while(dpth->head)
 		if(dpth_release_and_move_to_next_in_list(dpth)) ret=-1;
 	return ret;
@@ -29,6 +29,10 @@ struct dpth
 	// Currently open data file. Only one is open at a time, while many
 	// may be locked.
 	FILE *fp;
+	// Offset index for the open data file, and where in the data file
+	// the next block will go. Protocol 2 only.
+	FILE *ifp;
+	uint32_t offset;
 	// List of locked data files. 
 	struct dpth_lock *head;
 	struct dpth_lock *tail;
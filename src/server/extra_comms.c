@@ -37,6 +37,7 @@ static int send_features(struct asfd *asfd, struct conf **cconfs)
 	enum protocol protocol=get_e_protocol(cconfs[OPT_PROTOCOL]);
 	struct strlist *startdir=get_strlist(cconfs[OPT_STARTDIR]);
 	struct strlist *incglob=get_strlist(cconfs[OPT_INCGLOB]);
+	int frame_size=get_int(cconfs[OPT_NETWORK_FRAME_SIZE]);
 
 	if(append_to_feat(&feat, "extra_comms_begin ok:")
 		/* clients can autoupgrade */
@@ -98,6 +99,44 @@ static int send_features(struct asfd *asfd, struct conf **cconfs)
 		goto end;
 #endif
 
+	/* Clients can use data messages bigger than ASYNC_BUF_LEN. */
+	if(frame_size>ASYNC_BUF_LEN)
+	{
+		char f[32]="";
+		if(frame_size>ASFD_FRAME_LEN_MAX)
+			frame_size=ASFD_FRAME_LEN_MAX;
+		snprintf(f, sizeof(f), "frame_size=%d:", frame_size);
+		if(append_to_feat(&feat, f))
+			goto end;
+	}
+
+	/* Clients can decide for themselves whether to compress each file,
+	   as long as they keep to what the previous backup did for files
+	   that are sent as deltas. */
+	if(append_to_feat(&feat, "compression_adaptive:"))
+		goto end;
+
+	/* Clients can ask for blocks that they have already been sent during
+	   a protocol2 restore to be sent again as references. */
+	if(append_to_feat(&feat, "restore_dedup:"))
+		goto end;
+
+	/* Clients can ask for the signatures of large files to be sent first
+	   during a protocol2 restore, so that they only need to be sent the
+	   blocks that they do not already have. */
+	if(append_to_feat(&feat, "restore_delta:"))
+		goto end;
+
+	/* Clients can ask for runs of zero blocks to be sent as a single
+	   record during a protocol2 restore. */
+	if(append_to_feat(&feat, "restore_sparse:"))
+		goto end;
+
+	/* Clients can be told that their backup is queued, and when to come
+	   back, instead of just that the timer conditions were not met. */
+	if(append_to_feat(&feat, "backup_queue:"))
+		goto end;
+
 	//printf("feat: %s\n", feat);
 
 	if(asfd->write_str(asfd, CMD_GEN, feat))
@@ -294,6 +333,44 @@ static int extra_comms_read(struct async *as,
 			set_e_rshash(globalcs[OPT_RSHASH], RSHASH_BLAKE2);
 #endif
 		}
+		else if(!strncmp_w(rbuf->buf, "frame_size="))
+		{
+			int max=get_int(cconfs[OPT_NETWORK_FRAME_SIZE]);
+			int frame_size=atoi(rbuf->buf+strlen("frame_size="));
+			if(max>ASFD_FRAME_LEN_MAX) max=ASFD_FRAME_LEN_MAX;
+			if(frame_size<=ASYNC_BUF_LEN || frame_size>max)
+			{
+				logp("Client asked for frame_size=%d, but the server allows up to %d\n", frame_size, max);
+				goto end;
+			}
+			if(asfd->set_frame_len(asfd, frame_size))
+				goto end;
+			logp("Client has set frame_size=%d\n", frame_size);
+		}
+		else if(!strcmp(rbuf->buf, "compression_adaptive"))
+		{
+			set_int(cconfs[OPT_COMPRESSION_ADAPTIVE], 1);
+			logp("Client is using compression_adaptive\n");
+		}
+		else if(!strcmp(rbuf->buf, "restore_dedup"))
+		{
+			set_int(cconfs[OPT_RESTORE_DEDUP], 1);
+			logp("Client is using restore_dedup\n");
+		}
+		else if(!strcmp(rbuf->buf, "restore_delta"))
+		{
+			set_int(cconfs[OPT_RESTORE_DELTA], 1);
+			logp("Client is using restore_delta\n");
+		}
+		else if(!strcmp(rbuf->buf, "restore_sparse"))
+		{
+			set_int(cconfs[OPT_RESTORE_SPARSE], 1);
+			logp("Client is using restore_sparse\n");
+		}
+		else if(!strcmp(rbuf->buf, "backup_queue"))
+		{
+			set_int(cconfs[OPT_BACKUP_QUEUE], 1);
+		}
 		else if(!strncmp_w(rbuf->buf, "msg"))
 		{
 			set_int(cconfs[OPT_MESSAGE], 1);
@@ -334,6 +411,16 @@ int extra_comms(struct async *as,
 
 	if(vers_init(&vers, cconfs)) goto error;
 
+	// Only the client can turn this on, because the server has to be sure
+	// that the client will keep to the compression of the previous backup
+	// when sending deltas.
+	set_int(cconfs[OPT_COMPRESSION_ADAPTIVE], 0);
+	// Likewise, only a client that asks for it will be keeping track of
+	// the blocks that references can point at.
+	set_int(cconfs[OPT_RESTORE_DEDUP], 0);
+	set_int(cconfs[OPT_RESTORE_DELTA], 0);
+	set_int(cconfs[OPT_RESTORE_SPARSE], 0);
+
 	if(vers.cli<vers.directory_tree)
 	{
 		set_int(confs[OPT_DIRECTORY_TREE], 0);
@@ -7,6 +7,7 @@
 #include "autoupgrade.h"
 #include "backup.h"
 #include "backup_phase1.h"
+#include "backup_queue.h"
 #include "ca.h"
 #include "child.h"
 #include "compress.h"
@@ -19,5 +20,6 @@
 #include "quota.h"
 #include "restore.h"
 #include "run_action.h"
+#include "timer.h"
 
 #endif
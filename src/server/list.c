@@ -1,6 +1,7 @@
 #include "include.h"
 #include "../bu.h"
 #include "../cmd.h"
+#include "../pathcmp.h"
 #include "bu_get.h"
 
 // Want to make sure that we are listening for reads too - this will let us
@@ -131,13 +132,19 @@ static int list_manifest(struct asfd *asfd,
 
 	if(browsedir) bdlen=strlen(browsedir);
 
+	// The manifest is sorted, so skip straight to the directory being
+	// browsed.
+	if(bdlen && manio_seek_to_path(manio, browsedir)<0)
+		goto error;
+
 	while(1)
 	{
 		int show=0;
 
 		if((ars=manio_sbuf_fill(manio, asfd, sb, NULL, NULL, confs))<0)
 			goto error;
-		else if(ars>0)
+		else if(ars>0
+		  || (bdlen && is_past_subdir(browsedir, sb->path.buf)))
 		{
 			if(browsedir && *browsedir && !last_bd_match)
 				write_wrapper_str(asfd, CMD_ERROR,
@@ -1,5 +1,7 @@
 #include "include.h"
 #include "../lock.h"
+#include "conf_cache.h"
+#include "monitor/cntr_shm.h"
 #include "monitor/status_server.h"
 
 #include <netdb.h>
@@ -46,24 +48,67 @@ static void close_fds(int *fds)
 	for(int i=0; i<LISTEN_SOCKETS; i++) close_fd(&(fds[i]));
 }
 
+// Prefork workers that are running, so that they can be told to leave.
+static pid_t *workers=NULL;
+static int workers_len=0;
+
+static int workers_add(pid_t pid)
+{
+	pid_t *tmp;
+	if(!(tmp=(pid_t *)realloc_w(workers,
+		(workers_len+1)*sizeof(pid_t), __func__)))
+			return -1;
+	workers=tmp;
+	workers[workers_len++]=pid;
+	return 0;
+}
+
+static void workers_remove(pid_t pid)
+{
+	int i;
+	for(i=0; i<workers_len; i++)
+	{
+		if(workers[i]!=pid) continue;
+		workers[i]=workers[--workers_len];
+		return;
+	}
+}
+
+// Workers watch the read end of this. Nothing is ever written to it, so it
+// only becomes readable when the parent has gone away.
+static int lifeline[2]={-1, -1};
+
+// They finish off the connection that they are on, if any.
+static void workers_signal_leave(void)
+{
+	int i;
+	for(i=0; i<workers_len; i++)
+		kill(workers[i], SIGUSR2);
+}
+
 // Remove any exiting child pids from our list.
-// FIX THIS.
 static void chld_check_for_exiting(struct async *mainas)
 {
 	pid_t p;
 	int status;
 	struct asfd *asfd;
-	if((p=waitpid(-1, &status, WNOHANG))<=0) return;
 
-	// Logging a message here appeared to occasionally lock burp up on a
-	// Ubuntu server that I used to use.
-	//logp("child pid %d exited\n", p);
-	for(asfd=mainas->asfd; asfd; asfd=asfd->next)
+	// One signal can stand for several children.
+	while((p=waitpid(-1, &status, WNOHANG))>0)
 	{
-		if(p!=asfd->pid) continue;
-		mainas->asfd_remove(mainas, asfd);
-		asfd_free(&asfd);
-		break;
+		// Logging a message here appeared to occasionally lock burp
+		// up on a Ubuntu server that I used to use.
+		//logp("child pid %d exited\n", p);
+		cntr_shm_release(p);
+		backup_queue_release(p);
+		workers_remove(p);
+		for(asfd=mainas->asfd; asfd; asfd=asfd->next)
+		{
+			if(p!=asfd->pid) continue;
+			mainas->asfd_remove(mainas, asfd);
+			asfd_free(&asfd);
+			break;
+		}
 	}
 }
 
@@ -174,7 +219,8 @@ int setup_signals(int oldmax_children, int max_children,
 }
 
 static int run_child(int *cfd, SSL_CTX *ctx,
-	int status_wfd, int status_rfd, const char *conffile, int forking)
+	int status_wfd, int status_rfd, const char *conffile, int forking,
+	struct conf_cache *cache, int *reusable)
 {
 	int ret=-1;
 	int ca_ret=0;
@@ -194,9 +240,15 @@ static int run_child(int *cfd, SSL_CTX *ctx,
 
 	// Reload global config, in case things have changed. This means that
 	// the server does not need to be restarted for most conf changes.
+	// Prefork workers only load it again if the file has changed.
 	confs_init(confs);
 	confs_init(cconfs);
-	if(conf_load_global_only(conffile, confs)) goto end;
+	if(cache)
+	{
+		if(conf_cache_load(cache, conffile, confs)) goto end;
+	}
+	else if(conf_load_global_only(conffile, confs))
+		goto end;
 
 	// Hack to keep forking turned off if it was specified as off on the
 	// command line.
@@ -221,11 +273,14 @@ static int run_child(int *cfd, SSL_CTX *ctx,
 		logp_ssl_err("SSL_accept\n");
 		goto end;
 	}
+	ssl_count_handshake(ssl);
 	if(!(as=async_alloc())
 	  || as->init(as, 0)
 	  || !setup_asfd(as, "main socket",
 		cfd, ssl, ASFD_STREAM_STANDARD, ASFD_FD_CHILD_MAIN, -1, confs))
 			goto end;
+	// Everything to and from clients counts towards server_ratelimit.
+	as->asfd->rlshared=ratelimit_shared();
 
 	if(authorise_server(as->asfd, confs, cconfs)
 	  || !(cname=get_string(cconfs[OPT_CNAME])) || !*cname)
@@ -276,7 +331,7 @@ static int run_child(int *cfd, SSL_CTX *ctx,
 		ASFD_STREAM_STANDARD, ASFD_FD_CHILD_PIPE_READ, -1, cconfs))
 			goto end;
 
-	ret=child(as, status_wfd, confs, cconfs);
+	ret=child(as, status_wfd, confs, cconfs, reusable);
 end:
 	*cfd=-1;
 	async_asfd_free_all(&as); // This closes cfd for us.
@@ -343,6 +398,7 @@ static int process_incoming_client(struct asfd *asfd, SSL_CTX *ctx,
 	pid_t childpid;
 	int pipe_rfd[2];
 	int pipe_wfd[2];
+	int reusable=0;
 	socklen_t client_length=0;
 	struct sockaddr_in client_name;
 	enum asfd_fdtype fdtype=asfd->fdtype;
@@ -353,15 +409,26 @@ static int process_incoming_client(struct asfd *asfd, SSL_CTX *ctx,
 		(struct sockaddr *)&client_name, &client_length))==-1)
 	{
 		// Look out, accept will get interrupted by SIGCHLDs.
-		if(errno==EINTR) return 0;
+		// The sockets may also have been left non-blocking by
+		// prefork workers, one of which got in first.
+		if(errno==EINTR || errno==EAGAIN || errno==EWOULDBLOCK)
+			return 0;
 		logp("accept failed on %s (%d) in %s: %s\n", asfd->desc,
 			asfd->fd, __func__, strerror(errno));
 		return -1;
 	}
 	reuseaddr(cfd);
 
+	// Before forking, so that the child gets the current ticket keys.
+	if(ssl_ticket_keys_rotate(get_int(confs[OPT_SSL_SESSION_TIMEOUT])))
+	{
+		close_fd(&cfd);
+		return -1;
+	}
+
 	if(!forking)
-		return run_child(&cfd, ctx, -1, -1, conffile, forking);
+		return run_child(&cfd, ctx, -1, -1, conffile, forking,
+			NULL, &reusable);
 
 	if(chld_check_counts(confs, asfd))
 	{
@@ -417,7 +484,7 @@ static int process_incoming_client(struct asfd *asfd, SSL_CTX *ctx,
 
 			ret=run_child(&cfd, ctx, pipe_rfd[1],
 			  fdtype==ASFD_FD_SERVER_LISTEN_STATUS?pipe_wfd[0]:-1,
-			  conffile, forking);
+			  conffile, forking, NULL, &reusable);
 
 			close(pipe_rfd[1]);
 			close(pipe_wfd[0]);
@@ -469,6 +536,195 @@ static int process_incoming_client(struct asfd *asfd, SSL_CTX *ctx,
 	}
 }
 
+// A prefork worker. It takes connections from the main listening sockets
+// itself, one after another, keeping the global config loaded in between.
+// It leaves after a connection that did more than get turned down by the
+// timer, so that the parent can start a clean one in its place.
+static int run_worker(int *rfds, int lifeline_rfd, SSL_CTX *ctx,
+	int status_wfd, const char *conffile, int lifetime)
+{
+	int i;
+	int mfd;
+	int ret=0;
+	int flags;
+	int cfd=-1;
+	int wfd=-1;
+	int reusable;
+	fd_set fsr;
+	sigset_t usr2;
+	sigset_t waitmask;
+	struct conf_cache *cache=NULL;
+
+	if(!(cache=conf_cache_alloc()))
+		return -1;
+	// Only let the signal to leave in while waiting for a connection,
+	// rather than in the middle of one.
+	sigemptyset(&usr2);
+	sigaddset(&usr2, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &usr2, &waitmask);
+	sigdelset(&waitmask, SIGUSR2);
+	// Other workers are waiting on the same sockets, and may get there
+	// first.
+	for(i=0; i<LISTEN_SOCKETS && rfds[i]!=-1; i++)
+		set_non_blocking(rfds[i]);
+
+	while(!gentleshutdown && !ssl_ticket_keys_expired(lifetime))
+	{
+		mfd=lifeline_rfd;
+		FD_ZERO(&fsr);
+		FD_SET(lifeline_rfd, &fsr);
+		for(i=0; i<LISTEN_SOCKETS && rfds[i]!=-1; i++)
+		{
+			FD_SET(rfds[i], &fsr);
+			if(rfds[i]>mfd) mfd=rfds[i];
+		}
+		if(pselect(mfd+1, &fsr, NULL, NULL, NULL, &waitmask)<0)
+		{
+			if(errno==EINTR) continue;
+			logp("select error in %s: %s\n",
+				__func__, strerror(errno));
+			ret=-1;
+			goto end;
+		}
+		if(FD_ISSET(lifeline_rfd, &fsr))
+		{
+			logp("server has gone away\n");
+			goto end;
+		}
+		for(i=0; i<LISTEN_SOCKETS && rfds[i]!=-1; i++)
+		{
+			if(!FD_ISSET(rfds[i], &fsr)) continue;
+			if((cfd=accept(rfds[i], NULL, NULL))<0)
+			{
+				if(errno==EINTR
+				  || errno==EAGAIN
+				  || errno==EWOULDBLOCK
+				  || errno==ECONNABORTED)
+					continue;
+				logp("accept failed in %s: %s\n",
+					__func__, strerror(errno));
+				ret=-1;
+				goto end;
+			}
+			reuseaddr(cfd);
+			// Some systems pass on the non-blocking flag of the
+			// listening socket.
+			if((flags=fcntl(cfd, F_GETFL, 0))>=0)
+				fcntl(cfd, F_SETFL, flags & ~O_NONBLOCK);
+
+			// The child code closes the status pipe when it is
+			// done with it, so give it its own copy.
+			if((wfd=dup(status_wfd))<0)
+			{
+				logp("dup failed in %s: %s\n",
+					__func__, strerror(errno));
+				close_fd(&cfd);
+				ret=-1;
+				goto end;
+			}
+			reusable=0;
+			ret=run_child(&cfd, ctx, wfd, -1, conffile, 1,
+				cache, &reusable);
+			close_fd(&wfd);
+			close_fd(&cfd);
+			if(ret || !reusable) goto end;
+			break;
+		}
+	}
+end:
+	conf_cache_free(&cache);
+	return ret;
+}
+
+static int spawn_worker(struct async *mainas, int *rfds, SSL_CTX *ctx,
+	const char *conffile, struct conf **confs)
+{
+	int p;
+	int ret;
+	pid_t childpid;
+	int pipe_rfd[2];
+	struct sigaction sa;
+	int lifetime=get_int(confs[OPT_SSL_SESSION_TIMEOUT]);
+
+	if(pipe(pipe_rfd)<0)
+	{
+		logp("pipe failed: %s", strerror(errno));
+		return -1;
+	}
+
+	switch((childpid=fork()))
+	{
+		case -1:
+			logp("fork failed: %s\n", strerror(errno));
+			close(pipe_rfd[0]);
+			close(pipe_rfd[1]);
+			return -1;
+		case 0:
+			// Worker.
+			async_asfd_free_all(&mainas);
+			for(p=3; p<(int)FD_SETSIZE; p++)
+			{
+				int i;
+				int keep=(p==pipe_rfd[1] || p==lifeline[0]);
+				for(i=0; !keep && i<LISTEN_SOCKETS
+				  && rfds[i]!=-1; i++)
+					if(p==rfds[i]) keep=1;
+				if(!keep) close(p);
+			}
+
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_handler=SIG_DFL;
+			sigaction(SIGCHLD, &sa, NULL);
+
+			confs_free_content(confs);
+			confs_init(confs);
+
+			ret=run_worker(rfds, lifeline[0], ctx, pipe_rfd[1],
+				conffile, lifetime);
+			close(pipe_rfd[1]);
+			exit(ret);
+		default:
+			// Parent.
+			close(pipe_rfd[1]);
+			logp("forked worker: %d\n", childpid);
+			if(!setup_asfd(mainas, "pipe from worker",
+				&pipe_rfd[0], NULL,
+				ASFD_STREAM_STANDARD,
+				ASFD_FD_SERVER_PIPE_READ,
+				childpid, confs)
+			  || workers_add(childpid))
+				return -1;
+			return 0;
+	}
+}
+
+// Keep max_children workers going. They count as normal children, so any
+// left over from before a reload take up places until they leave.
+static int spawn_workers(struct async *mainas, int *rfds, SSL_CTX *ctx,
+	const char *conffile, struct conf **confs)
+{
+	int c_count=0;
+	struct asfd *a;
+
+	if(lifeline[0]<0 && pipe(lifeline)<0)
+	{
+		logp("pipe failed: %s", strerror(errno));
+		return -1;
+	}
+
+	// Before forking, so that the workers get the current ticket keys.
+	if(ssl_ticket_keys_rotate(get_int(confs[OPT_SSL_SESSION_TIMEOUT])))
+		return -1;
+
+	for(a=mainas->asfd; a; a=a->next)
+		if(a->fdtype==ASFD_FD_SERVER_PIPE_READ)
+			c_count++;
+	for(; c_count<get_int(confs[OPT_MAX_CHILDREN]); c_count++)
+		if(spawn_worker(mainas, rfds, ctx, conffile, confs))
+			return -1;
+	return 0;
+}
+
 static int daemonise(void)
 {
 	/* process ID */
@@ -593,6 +849,7 @@ static int run_server(struct conf **confs, const char *conffile,
 	int ret=-1;
 	SSL_CTX *ctx=NULL;
 	int found_normal_child=0;
+	int prefork=get_int(confs[OPT_FORK]) && get_int(confs[OPT_PREFORK]);
 	struct asfd *asfd=NULL;
 	struct asfd *scfd=NULL;
 	struct async *mainas=NULL;
@@ -611,6 +868,11 @@ static int run_server(struct conf **confs, const char *conffile,
 		logp("error loading dh params\n");
 		goto end;
 	}
+	if(ssl_server_sessions(ctx, confs))
+	{
+		logp("error setting up ssl sessions\n");
+		goto end;
+	}
 
 	if(ports_changed(oldnet->address, address)
 	  || ports_changed(oldnet->port, port))
@@ -628,7 +890,8 @@ static int run_server(struct conf **confs, const char *conffile,
 	  || mainas->init(mainas, 0))
 		goto end;
 
-	for(i=0; i<LISTEN_SOCKETS && rfds[i]!=-1; i++)
+	// With prefork, the workers take the connections themselves.
+	for(i=0; !prefork && i<LISTEN_SOCKETS && rfds[i]!=-1; i++)
 		if(!setup_asfd(mainas,
 		  "main server socket", &rfds[i], NULL,
 		  ASFD_STREAM_STANDARD, ASFD_FD_SERVER_LISTEN_MAIN, -1, confs))
@@ -641,6 +904,10 @@ static int run_server(struct conf **confs, const char *conffile,
 
 	while(!hupreload)
 	{
+		if(prefork && !gentleshutdown
+		  && spawn_workers(mainas, rfds, ctx, conffile, confs))
+			goto end;
+
 		switch(mainas->read_write(mainas))
 		{
 			case 0:
@@ -744,6 +1011,8 @@ static int run_server(struct conf **confs, const char *conffile,
 
 	ret=0;
 end:
+	// Workers would otherwise go on with the old config and sockets.
+	workers_signal_leave();
 	async_asfd_free_all(&mainas);
 	if(ctx) ssl_destroy_ctx(ctx);
 	return ret;
@@ -781,6 +1050,25 @@ int server(struct conf **confs, const char *conffile,
 
 	ssl_load_globals();
 
+	// Children inherit this mapping, so it has to exist before the first
+	// fork. It is sized at startup, so raising max_children with a reload
+	// leaves the extra children reporting through the status pipe only.
+	if(get_int(confs[OPT_FORK])
+	  && cntr_shm_init(get_int(confs[OPT_MAX_CHILDREN])))
+		goto error;
+	// Likewise the bucket for server_ratelimit. It is always mapped, so
+	// that a reload can turn the limit on or off.
+	if(ratelimit_shared_init(get_float(confs[OPT_SERVER_RATELIMIT])))
+		goto error;
+	// And the handshake counts that go with ssl_session_timeout.
+	if(get_int(confs[OPT_FORK])
+	  && ssl_stats_shared_init())
+		goto error;
+	// And the table that max_backups and max_phase4 are kept to with.
+	if(get_int(confs[OPT_FORK])
+	  && backup_queue_init(confs))
+		goto error;
+
 	while(!gentleshutdown)
 	{
 		if(run_server(confs, conffile, rfds, sfds, &oldnet))
@@ -797,6 +1085,9 @@ int server(struct conf **confs, const char *conffile,
 				get_int(confs[OPT_MAX_STATUS_CHILDREN]),
 				0)) // Not JSON output.
 					goto error;
+			ratelimit_set_rate(ratelimit_shared(),
+				get_float(confs[OPT_SERVER_RATELIMIT]));
+			backup_queue_set_limits(confs);
 		}
 		hupreload=0;
 	}
@@ -807,6 +1098,10 @@ error:
 	close_fds(rfds);
 	close_fds(sfds);
 	oldnet_free_contents(&oldnet);
+	cntr_shm_free();
+	ratelimit_shared_free();
+	ssl_stats_shared_free();
+	backup_queue_free();
 
 // FIX THIS: Have an enum for a return value, so that it is more obvious what
 // is happening, like client.c does.
@@ -1,6 +1,7 @@
 #include "include.h"
 #include "../cmd.h"
 #include "../hexmap.h"
+#include "../pathcmp.h"
 #include "protocol2/champ_chooser/include.h"
 
 #define MANIO_MODE_READ		"rb"
@@ -10,6 +11,10 @@
 #define WEAK_STR_LEN		WEAK_LEN+1
 #define MSAVE_PATH_LEN		14
 
+// Write an entry to the path index after this many paths, even if the
+// manifest file has not changed.
+#define PINDEX_INTERVAL		1024
+
 /*
 static man_off_t *man_off_alloc(void)
 {
@@ -40,7 +45,13 @@ static int manio_free_content(struct manio *manio)
 	int ret=0;
 	if(!manio) return ret;
 	if(manio_close(manio)) ret=-1;
+	if(fzp_close(&manio->pindex_fzp))
+	{
+		logp("Error closing path index in %s\n", manio->directory);
+		ret=-1;
+	}
 	man_off_free_content(&manio->offset);
+	free_w(&manio->raw);
 	free_w(&manio->base_dir);
 	free_w(&manio->directory);
 	free_w(&manio->mode);
@@ -450,6 +461,21 @@ int manio_write_sig(struct manio *manio, struct blk *blk)
 	return write_sig_msg(manio, sig_to_msg(blk, 0 /* no save_path */));
 }
 
+// The save path may be followed by more characters, so only the first
+// MSAVE_PATH_LEN are looked at.
+static void add_dindex(struct manio *manio, const char *savepathstr)
+{
+	// Ignore obvious duplicates.
+	if(!manio->hook_count
+	  || strncmp(manio->dindex_sort[manio->hook_count-1],
+		savepathstr, MSAVE_PATH_LEN))
+	{
+		// Add to list of dindexes for this manifest chunk.
+		snprintf(manio->dindex_sort[manio->dindex_count++],
+			MSAVE_PATH_LEN+1, "%.*s", MSAVE_PATH_LEN, savepathstr);
+	}
+}
+
 int manio_write_sig_and_path(struct manio *manio, struct blk *blk)
 {
 	if(manio->hook_sort && is_hook(blk->fingerprint))
@@ -460,24 +486,60 @@ int manio_write_sig_and_path(struct manio *manio, struct blk *blk)
 			blk->fingerprint);
 	}
 	if(manio->dindex_sort)
+		add_dindex(manio, bytes_to_savepathstr(blk->savepath));
+	return write_sig_msg(manio, sig_to_msg(blk, 1 /* save_path */));
+}
+
+static char *get_pindex_path(struct manio *manio)
+{
+	return prepend_s(manio->directory, "pindex");
+}
+
+// Each entry records the manifest file and the uncompressed offset within it
+// of a path, followed by the path itself.
+static int pindex_write(struct manio *manio, const char *path)
+{
+	off_t offset;
+	size_t len;
+	char *msg=NULL;
+	int ret=-1;
+
+	if((offset=fzp_tell(manio->fzp))<0)
 	{
-		char *savepathstr=bytes_to_savepathstr(blk->savepath);
-		// Ignore obvious duplicates.
-		if(!manio->hook_count
-		  || strncmp(manio->dindex_sort[manio->hook_count-1],
-			savepathstr, MSAVE_PATH_LEN))
-		{
-			// Add to list of dindexes for this manifest chunk.
-			snprintf(manio->dindex_sort[manio->dindex_count++],
-				MSAVE_PATH_LEN+1, "%s", savepathstr);
-		}
+		logp("Could not fzp_tell %s in %s(): %s\n",
+			manio->offset.fpath, __func__, strerror(errno));
+		return -1;
 	}
-	return write_sig_msg(manio, sig_to_msg(blk, 1 /* save_path */));
+	len=8+16+strlen(path);
+	if(!(msg=(char *)malloc_w(len+1, __func__)))
+		return -1;
+	// fcount has already been incremented past the file being written.
+	snprintf(msg, len+1, "%08"PRIX64"%016"PRIX64"%s",
+		manio->offset.fcount-1, (uint64_t)offset, path);
+	if(send_msg_fzp(manio->pindex_fzp, CMD_MANIFEST, msg, len))
+		goto end;
+	manio->pindex_fcount=manio->offset.fcount;
+	manio->pindex_count=0;
+	ret=0;
+end:
+	free_w(&msg);
+	return ret;
+}
+
+static int pindex_maybe_write(struct manio *manio, const char *path)
+{
+	if(manio->pindex_fzp && path
+	  && (manio->pindex_fcount!=manio->offset.fcount
+		|| ++manio->pindex_count>=PINDEX_INTERVAL))
+		return pindex_write(manio, path);
+	return 0;
 }
 
 int manio_write_sbuf(struct manio *manio, struct sbuf *sb)
 {
 	if(!manio->fzp && manio_open_next_fpath(manio)) return -1;
+	if(pindex_maybe_write(manio, sb->path.buf))
+		return -1;
 	return sbuf_to_manifest(sb, manio->fzp);
 }
 
@@ -518,6 +580,23 @@ int manio_init_write_dindex(struct manio *manio, const char *dir)
 	return 0;
 }
 
+// Only worth doing for protocol2 - the protocol1 manifest is a single
+// compressed stream, so seeking in it would still inflate everything before
+// the target.
+int manio_init_write_pindex(struct manio *manio)
+{
+	int ret=-1;
+	char *path=NULL;
+	if(!(path=get_pindex_path(manio))
+	  || build_path_w(path)
+	  || !(manio->pindex_fzp=fzp_gzopen(path, manio->mode)))
+		goto end;
+	ret=0;
+end:
+	free_w(&path);
+	return ret;
+}
+
 // Return -1 on error, 0 on OK, 1 for srcmanio finished.
 int manio_copy_entry(struct asfd *asfd, struct sbuf **csb, struct sbuf *sb,
 	struct blk **blk, struct manio *srcmanio,
@@ -572,6 +651,320 @@ int manio_forward_through_sigs(struct asfd *asfd,
 	return manio_copy_entry(asfd, csb, NULL, blk, manio, NULL, confs);
 }
 
+// Frames are passed through exactly as send_msg_fzp() wrote them:
+// "<cmd><4 hex digits of length><data>\n".
+#define RAW_HDR_LEN		5
+#define RAW_SIG_LEN		67
+
+struct raw_frame
+{
+	enum cmd cmd;
+	size_t off;		// Offset of the header in manio->raw.
+	size_t len;		// Length of the data.
+};
+
+static char *raw_data(struct manio *manio, struct raw_frame *f)
+{
+	return manio->raw+f->off+RAW_HDR_LEN;
+}
+
+static size_t raw_frame_len(struct raw_frame *f)
+{
+	return RAW_HDR_LEN+f->len+1;
+}
+
+static int raw_grow(struct manio *manio, size_t want)
+{
+	char *tmp;
+	size_t need=manio->raw_len+want;
+	if(need<=manio->raw_alloc) return 0;
+	if(need<manio->raw_alloc*2) need=manio->raw_alloc*2;
+	if(!(tmp=(char *)realloc_w(manio->raw, need, __func__)))
+		return -1;
+	manio->raw=tmp;
+	manio->raw_alloc=need;
+	return 0;
+}
+
+// Return the value of a hex digit, or -1. Lower case letters are accepted
+// only if 'lower' is set, and upper case ones only if 'upper' is set.
+static int raw_hex_digit(char c, int lower, int upper)
+{
+	if(c>='0' && c<='9') return c-'0';
+	if(upper && c>='A' && c<='F') return c-'A'+10;
+	if(lower && c>='a' && c<='f') return c-'a'+10;
+	return -1;
+}
+
+static int raw_hex_len(const char *hdr, size_t *len)
+{
+	int i;
+	int h;
+	*len=0;
+	for(i=1; i<RAW_HDR_LEN; i++)
+	{
+		if((h=raw_hex_digit(hdr[i], 1, 1))<0) return -1;
+		*len=(*len<<4)|h;
+	}
+	return 0;
+}
+
+// Append the next frame to manio->raw, moving on through the manifest files
+// as needed. Return -1 on error, 0 for a frame, 1 for end of files.
+static int raw_read_frame(struct manio *manio, struct raw_frame *f)
+{
+	size_t got;
+	char *hdr;
+
+	while(1)
+	{
+		if(!manio->fzp)
+		{
+			if(manio_open_next_fpath(manio)) return -1;
+			if(!manio->fzp) return 1; // No more files to read.
+		}
+		if(raw_grow(manio, RAW_HDR_LEN)) return -1;
+		hdr=manio->raw+manio->raw_len;
+		if((got=fzp_read(manio->fzp, hdr, RAW_HDR_LEN))==RAW_HDR_LEN)
+			break;
+		if(got) goto short_read;
+		if(manio_close(manio)) return -1;
+	}
+	if(raw_hex_len(hdr, &f->len))
+	{
+		logp("Bad frame header in %s: %.*s\n",
+			manio->offset.fpath, RAW_HDR_LEN, hdr);
+		return -1;
+	}
+	f->cmd=(enum cmd)hdr[0];
+	f->off=manio->raw_len;
+	if(raw_grow(manio, raw_frame_len(f))) return -1;
+	if(fzp_read(manio->fzp, raw_data(manio, f), f->len+1)!=f->len+1)
+		goto short_read;
+	manio->raw_len+=raw_frame_len(f);
+	return 0;
+short_read:
+	logp("Short read in %s\n", manio->offset.fpath);
+	return -1;
+}
+
+static int raw_write(struct manio *manio, const char *buf, size_t len)
+{
+	if(fzp_write(manio->fzp, buf, len)!=len)
+	{
+		logp("Unable to write to %s: %s\n",
+			manio->offset.fpath, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Check that the sig is exactly what sig_to_msg() would write for it, and
+// get the fingerprint out of it on the way.
+static int raw_sig_fingerprint(const char *msg, uint64_t *fingerprint)
+{
+	int i;
+	int h;
+	*fingerprint=0;
+	for(i=0; i<16; i++)
+	{
+		if((h=raw_hex_digit(msg[i], 0, 1))<0) return -1;
+		*fingerprint=(*fingerprint<<4)|h;
+	}
+	for(; i<48; i++)
+		if(raw_hex_digit(msg[i], 1, 0)<0) return -1;
+	// The save path, as "XXXX/XXXX/XXXX/XXXX".
+	for(; i<RAW_SIG_LEN; i++)
+	{
+		if(!((i-48+1)%5))
+		{
+			if(msg[i]!='/') return -1;
+		}
+		else if(raw_hex_digit(msg[i], 0, 1)<0)
+			return -1;
+	}
+	return 0;
+}
+
+static int raw_write_sig(struct manio *dstmanio,
+	struct manio *srcmanio, struct raw_frame *f)
+{
+	uint64_t fingerprint;
+	char *msg=raw_data(srcmanio, f);
+
+	if(f->len!=RAW_SIG_LEN || raw_sig_fingerprint(msg, &fingerprint))
+	{
+		// Not in the usual form, so go the long way round, and let
+		// that complain if needs be.
+		int ret;
+		struct blk blk;
+		struct iobuf iobuf;
+		memset(&blk, 0, sizeof(blk));
+		msg[f->len]='\0';
+		iobuf_set(&iobuf, CMD_SIG, msg, f->len);
+		ret=split_sig_from_manifest(&iobuf, &blk)
+		  || manio_write_sig_and_path(dstmanio, &blk);
+		msg[f->len]='\n';
+		return ret?-1:0;
+	}
+
+	if(dstmanio->hook_sort && is_hook(fingerprint))
+	{
+		memcpy(dstmanio->hook_sort[dstmanio->hook_count], msg, WEAK_LEN);
+		dstmanio->hook_sort[dstmanio->hook_count++][WEAK_LEN]='\0';
+	}
+	if(dstmanio->dindex_sort)
+		add_dindex(dstmanio, msg+48);
+	if(!dstmanio->fzp && manio_open_next_fpath(dstmanio)) return -1;
+	if(raw_write(dstmanio, srcmanio->raw+f->off, raw_frame_len(f)))
+		return -1;
+	return check_sig_count(dstmanio, msg);
+}
+
+// Read the path, and the link if there is one, that follow the attribs of
+// an entry. 'link' is left alone if there is not one.
+static int raw_read_entry(struct manio *manio,
+	struct raw_frame *path, struct raw_frame *link)
+{
+	if(raw_read_frame(manio, path)) goto bad;
+	if(!cmd_is_link(path->cmd)) return 0;
+	if(raw_read_frame(manio, link) || !cmd_is_link(link->cmd))
+		goto bad;
+	return 0;
+bad:
+	logp("Incomplete entry in %s\n", manio->offset.fpath);
+	return -1;
+}
+
+static int raw_cmp_limit(struct manio *manio,
+	struct raw_frame *path, struct sbuf *limit)
+{
+	int ret;
+	struct iobuf iobuf;
+	char *p=raw_data(manio, path);
+	p[path->len]='\0';
+	iobuf_set(&iobuf, path->cmd, p, path->len);
+	ret=iobuf_pathcmp(&iobuf, &limit->path);
+	p[path->len]='\n';
+	return ret;
+}
+
+static int raw_write_entry(struct manio *dstmanio, struct manio *srcmanio,
+	struct raw_frame *attr, struct raw_frame *path)
+{
+	int ret;
+	char *cp;
+	char *a=raw_data(srcmanio, attr);
+	char *p=raw_data(srcmanio, path);
+
+	if(!dstmanio->fzp && manio_open_next_fpath(dstmanio)) return -1;
+	p[path->len]='\0';
+	ret=pindex_maybe_write(dstmanio, p);
+	p[path->len]='\n';
+	if(ret) return -1;
+
+	// Same as sbuf_to_manifest(), the file index at the start of the
+	// attribs is stripped. It already has been, if the entry came from
+	// a manifest written by this, so usually all of it goes out in one.
+	if(!(cp=(char *)memchr(a, ' ', attr->len)))
+	{
+		logp("Strange attributes: %.*s\n", (int)attr->len, a);
+		return -1;
+	}
+	if(cp==a)
+		return raw_write(dstmanio, srcmanio->raw+attr->off,
+			srcmanio->raw_len-attr->off);
+	if(send_msg_fzp(dstmanio->fzp, CMD_ATTRIBS, cp, attr->len-(cp-a)))
+		return -1;
+	return raw_write(dstmanio, srcmanio->raw+path->off,
+		srcmanio->raw_len-path->off);
+}
+
+static int raw_to_iobuf(struct manio *manio,
+	struct raw_frame *f, struct iobuf *iobuf)
+{
+	char *buf;
+	iobuf_free_content(iobuf);
+	if(!(buf=(char *)malloc_w(f->len+1, __func__)))
+		return -1;
+	memcpy(buf, raw_data(manio, f), f->len);
+	buf[f->len]='\0';
+	iobuf_set(iobuf, f->cmd, buf, f->len);
+	return 0;
+}
+
+// Return -1 on error, 0 on OK, 1 for srcmanio finished.
+// Like manio_copy_entry(), but carries on through the following entries
+// until one sorts at or after 'limit', or srcmanio runs out if there is no
+// limit. Those are passed through as the bytes that were read, rather than
+// being decoded and encoded again - only the paths are looked at, and the
+// sigs enough to get the hooks and dindex. The entry that was stopped at is
+// left decoded in 'sb', as manio_sbuf_fill() would have.
+int manio_copy_entries_raw(struct sbuf **sb, struct sbuf *limit,
+	struct manio *srcmanio, struct manio *dstmanio)
+{
+	int ars;
+	struct raw_frame f;
+	struct raw_frame path;
+	struct raw_frame link;
+
+	if(!limit || !limit->path.buf) limit=NULL;
+
+	// The caller has already read the first entry.
+	if(manio_write_sbuf(dstmanio, *sb)) goto error;
+
+	while(1)
+	{
+		srcmanio->raw_len=0;
+		if((ars=raw_read_frame(srcmanio, &f))<0) goto error;
+		else if(ars>0)
+		{
+			// Finished.
+			sbuf_free(sb);
+			return 1;
+		}
+
+		switch(f.cmd)
+		{
+			case CMD_SIG:
+				if(raw_write_sig(dstmanio, srcmanio, &f))
+					goto error;
+				break;
+			case CMD_ATTRIBS:
+				if(raw_read_entry(srcmanio, &path, &link))
+					goto error;
+				if(limit && raw_cmp_limit(srcmanio,
+					&path, limit)>=0)
+				{
+					// Hand this one back.
+					iobuf_free_content(&(*sb)->link);
+					if(raw_to_iobuf(srcmanio,
+						&f, &(*sb)->attr)
+					  || raw_to_iobuf(srcmanio,
+						&path, &(*sb)->path)
+					  || (cmd_is_link(path.cmd)
+					    && raw_to_iobuf(srcmanio,
+						&link, &(*sb)->link)))
+						goto error;
+					attribs_decode(*sb);
+					return 0;
+				}
+				if(raw_write_entry(dstmanio, srcmanio,
+					&f, &path))
+						goto error;
+				break;
+			default:
+				logp("unexpected cmd in %s: %c\n",
+					srcmanio->offset.fpath, f.cmd);
+				goto error;
+		}
+	}
+
+error:
+	manio_close(srcmanio);
+	return -1;
+}
+
 static void man_off_t_memcpy(man_off_t *dst, man_off_t *src)
 {
 	memcpy(dst, src, sizeof(man_off_t));
@@ -597,6 +990,99 @@ int manio_seek(struct manio *manio, man_off_t *offset)
 	return fzp_seek(manio->fzp, manio->offset.offset, SEEK_SET);
 }
 
+static int pindex_decode(struct iobuf *iobuf,
+	uint64_t *fcount, uint64_t *offset, const char **path)
+{
+	char tmp[17]="";
+	if(iobuf->cmd!=CMD_MANIFEST || iobuf->len<8+16)
+	{
+		iobuf_log_unexpected(iobuf, __func__);
+		return -1;
+	}
+	snprintf(tmp, 8+1, "%s", iobuf->buf);
+	*fcount=strtoull(tmp, NULL, 16);
+	snprintf(tmp, 16+1, "%s", iobuf->buf+8);
+	*offset=strtoull(tmp, NULL, 16);
+	*path=iobuf->buf+8+16;
+	return 0;
+}
+
+// Use the path index, if the manifest has one, to move a manifest that is
+// open for reading to the last indexed entry that sorts at or before 'path'.
+// Since manifests are sorted with pathcmp(), everything that was skipped
+// sorts before 'path'.
+// Return -1 on error, 0 if the manifest was left where it was, 1 if it was
+// moved.
+int manio_seek_to_path(struct manio *manio, const char *path)
+{
+	int ars=0;
+	int ret=-1;
+	int found=0;
+	uint64_t fcount=0;
+	uint64_t offset=0;
+	char tmp[32]="";
+	char *pindex=NULL;
+	const char *ipath=NULL;
+	struct fzp *fzp=NULL;
+	struct sbuf *sb=NULL;
+	struct stat statp;
+	man_off_t man_off;
+
+	memset(&man_off, 0, sizeof(man_off));
+	if(manio->protocol==PROTO_1) return 0;
+
+	if(!(pindex=get_pindex_path(manio))) goto end;
+	if(lstat(pindex, &statp))
+	{
+		// Written before there were path indexes.
+		ret=0;
+		goto end;
+	}
+	if(!(fzp=fzp_gzopen(pindex, MANIO_MODE_READ))
+	  || !(sb=sbuf_alloc_protocol(manio->protocol)))
+		goto end;
+
+	while(!(ars=sbuf_fill(sb, NULL, fzp, NULL, NULL, NULL)))
+	{
+		uint64_t f;
+		uint64_t o;
+		if(pindex_decode(&sb->path, &f, &o, &ipath))
+			goto end;
+		if(pathcmp(ipath, path)>0) break;
+		fcount=f;
+		offset=o;
+		found=1;
+		sbuf_free_content(sb);
+	}
+	if(ars<0) goto end;
+	if(!found)
+	{
+		ret=0;
+		goto end;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%08"PRIX64, fcount);
+	if(!(man_off.fpath=prepend_s(manio->directory, tmp)))
+		goto end;
+	// Carry on with the file after this one when this one runs out.
+	man_off.fcount=fcount+1;
+	man_off.offset=(off_t)offset;
+	man_off_free_content(&manio->offset);
+	// manio_seek() takes ownership of fpath.
+	if(manio_seek(manio, &man_off))
+	{
+		logp("Could not seek to %08"PRIX64":%"PRIX64" in %s\n",
+			fcount, offset, manio->directory);
+		goto end;
+	}
+	ret=1;
+end:
+	fzp_close(&fzp);
+	sbuf_free(&sb);
+	free_w(&pindex);
+	return ret;
+}
+
 int manio_truncate(struct manio *manio)
 {
 	off_t pos=0;
@@ -34,7 +34,14 @@ struct manio
 	char *dindex_dir;
 	char **dindex_sort;	// Array for sorting and writing dindex.
 	int dindex_count;
+	struct fzp *pindex_fzp;	// Sparse index of paths to offsets, so that
+				// readers can seek to part of the manifest.
+	uint64_t pindex_fcount;	// File that the last index entry was for.
+	int pindex_count;	// Paths written since the last index entry.
 	enum protocol protocol;	// Whether running in protocol1/2 mode.
+	char *raw;		// When passing entries through without
+	size_t raw_len;		// decoding them, the frames that have been
+	size_t raw_alloc;	// read, as they were in the file.
 
 	man_off_t offset;
 };
@@ -49,6 +56,7 @@ extern int manio_set_mode_write(struct manio *manio);
 extern int manio_init_write_hooks(struct manio *manio,
 	const char *base_dir, const char *hook_dir, const char *rdirectory);
 extern int manio_init_write_dindex(struct manio *manio, const char *dir);
+extern int manio_init_write_pindex(struct manio *manio);
 extern void manio_set_protocol(struct manio *manio, enum protocol protocol);
 extern int manio_read_fcount(struct manio *manio);
 
@@ -67,11 +75,14 @@ extern int manio_copy_entry(struct asfd *asfd,
 	struct sbuf **csb, struct sbuf *sb,
 	struct blk **blk, struct manio *srcmanio,
 	struct manio *dstmanio, struct conf **confs);
+extern int manio_copy_entries_raw(struct sbuf **sb, struct sbuf *limit,
+	struct manio *srcmanio, struct manio *dstmanio);
 extern int manio_forward_through_sigs(struct asfd *asfd, struct sbuf **csb,
 	struct blk **blk, struct manio *manio, struct conf **confs);
 
 extern man_off_t *manio_tell(struct manio *manio);
 extern int manio_seek(struct manio *manio, man_off_t *offset);
+extern int manio_seek_to_path(struct manio *manio, const char *path);
 extern int manio_truncate(struct manio *manio);
 extern int manio_open_next_fpath(struct manio *manio);
 
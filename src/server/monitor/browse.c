@@ -1,6 +1,7 @@
 #include "include.h"
 #include "../../bu.h"
 #include "../../cmd.h"
+#include "../../pathcmp.h"
 
 static int do_browse_manifest(struct asfd *srfd,
 	struct manio *manio, struct sbuf *sb, const char *browse)
@@ -12,6 +13,8 @@ static int do_browse_manifest(struct asfd *srfd,
 	size_t blen=0;
 	char *last_bd_match=NULL;
 	if(browse) blen=strlen(browse);
+	if(blen && manio_seek_to_path(manio, browse)<0)
+		goto end;
 	while(1)
 	{
 		int r;
@@ -22,6 +25,8 @@ static int do_browse_manifest(struct asfd *srfd,
 			// ars==1 means it ended ok.
 			break;
 		}
+		if(blen && is_past_subdir(browse, sb->path.buf))
+			break;
 
 		if(sb->path.cmd!=CMD_DIRECTORY
 		  && sb->path.cmd!=CMD_FILE
@@ -60,7 +65,7 @@ static int browse_manifest_start(struct asfd *srfd, struct cstat *cstat,
 		goto end;
 	manio_set_protocol(manio, cstat->protocol);
 	if(get_int(confs[OPT_MONITOR_BROWSE_CACHE]))
-		ret=cache_load(srfd, manio, sb, cstat, bu);
+		ret=cache_load(srfd, manio, sb, cstat, bu, confs);
 	else
 		ret=do_browse_manifest(srfd, manio, sb, browse);
 end:
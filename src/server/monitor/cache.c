@@ -20,37 +20,47 @@ static void ent_free(struct ent **ent)
 	free_v((void **)ent);
 }
 
-static struct ent *ent_alloc(const char *name)
+static struct ent *ent_alloc(const char *name, size_t *mem)
 {
 	struct ent *ent;
 	if(!(ent=(struct ent *)calloc_w(1, sizeof(struct ent), __func__))
 	  || !(ent->name=strdup_w(name, __func__)))
 		goto error;
+	*mem+=sizeof(struct ent)+strlen(name)+1;
 	return ent;
 error:
 	ent_free(&ent);
 	return NULL;
 }
 
-// FIX THIS:
-// For extra kicks, could make the config option allow multiple caches -
-// eg, 'monitor_browse_cache=5', then rotate out the oldest one.
+// Each entry holds the tree of one backup. The list is kept in most
+// recently used order, and the entries at the end are dropped when there
+// are more than monitor_browse_cache of them, or when they take more than
+// monitor_browse_cache_memory bytes. The most recently used entry is always
+// kept, no matter how big it is.
+struct cache
+{
+	char *cname;
+	unsigned long bno;
+	struct ent *root;
+	size_t mem;
+	struct cache *next;
+};
 
-static struct ent *root=NULL;
-static char *cached_client=NULL;
-static unsigned long cached_bno=0;
+static struct cache *caches=NULL;
 
 static int ent_add_to_list(struct ent *ent,
-	struct sbuf *sb, const char *ent_name)
+	struct sbuf *sb, const char *ent_name, size_t *mem)
 {
 	struct ent *enew=NULL;
         if(!(ent->ents=(struct ent **)realloc_w(ent->ents,
                 (ent->count+1)*sizeof(struct ent *), __func__))
-          || !(enew=ent_alloc(ent_name)))
+          || !(enew=ent_alloc(ent_name, mem)))
         {
                 log_out_of_memory(__func__);
                 return -1;
         }
+	*mem+=sizeof(struct ent *);
 	memcpy(&enew->statp, &sb->statp, sizeof(struct stat));
 	ent->ents[ent->count]=enew;
 	ent->count++;
@@ -65,10 +75,36 @@ static void ents_free(struct ent *ent)
 	ent_free(&ent);
 }
 
-static void cache_free(void)
+static void cache_free(struct cache **cache)
+{
+	if(!cache || !*cache) return;
+	if((*cache)->root) ents_free((*cache)->root);
+	free_w(&(*cache)->cname);
+	free_v((void **)cache);
+}
+
+static void cache_trim(int max_entries, size_t max_mem)
 {
-	if(!root) return;
-	ents_free(root);
+	int count=0;
+	size_t mem=0;
+	struct cache *c;
+	struct cache *last=NULL;
+
+	for(c=caches; c; last=c, c=c->next)
+	{
+		count++;
+		mem+=c->mem;
+		if(last && (count>max_entries || (max_mem && mem>max_mem)))
+			break;
+	}
+	if(!c) return;
+	last->next=NULL;
+	while(c)
+	{
+		last=c->next;
+		cache_free(&c);
+		c=last;
+	}
 }
 
 /*
@@ -88,19 +124,23 @@ static void cache_dump(struct ent *e, int *depth)
 */
 
 int cache_load(struct asfd *srfd, struct manio *manio, struct sbuf *sb,
-	struct cstat *cstat, struct bu *bu)
+	struct cstat *cstat, struct bu *bu, struct conf **confs)
 {
 	int ret=-1;
 	int ars=0;
 //	int depth=0;
 	char *tok=NULL;
+	struct ent *root=NULL;
 	struct ent *point=NULL;
 	struct ent *p=NULL;
+	struct cache *cache=NULL;
 
 //printf("in cache load\n");
-	cache_free();
-
-	if(!(root=ent_alloc(""))) goto end;
+	if(!(cache=(struct cache *)calloc_w(1, sizeof(struct cache), __func__))
+	  || !(cache->cname=strdup_w(cstat->name, __func__))
+	  || !(root=cache->root=ent_alloc("", &cache->mem)))
+		goto end;
+	cache->bno=bu->bno;
 
 	while(1)
 	{
@@ -151,26 +191,42 @@ int cache_load(struct asfd *srfd, struct manio *manio, struct sbuf *sb,
 				// Make sure that we set the directory flag.
 				sb->statp.st_mode&=S_IFDIR;
 			}
-			if(ent_add_to_list(point, sb, tok)) goto end;
+			if(ent_add_to_list(point, sb, tok, &cache->mem))
+				goto end;
 			point=point->ents[point->count-1];
 		} while((tok=strtok(NULL, "/")));
 	}
 
-	if(!(cached_client=strdup_w(cstat->name, __func__)))
-		goto end;
-	cached_bno=bu->bno;
+	cache->next=caches;
+	caches=cache;
+	cache=NULL;
+	cache_trim(get_int(confs[OPT_MONITOR_BROWSE_CACHE]),
+		(size_t)get_ssize_t(confs[OPT_MONITOR_BROWSE_CACHE_MEMORY]));
 	ret=0;
 //	cache_dump(root, &depth);
 end:
+	cache_free(&cache);
 	return ret;
 }
 
+// If there is a tree for this backup, move it to the front of the list so
+// that cache_lookup() uses it.
 int cache_loaded(struct cstat *cstat, struct bu *bu)
 {
-	if(cached_client
-	  && !strcmp(cstat->name, cached_client)
-	  && cached_bno==bu->bno)
+	struct cache *c;
+	struct cache *last=NULL;
+	for(c=caches; c; last=c, c=c->next)
+	{
+		if(c->bno!=bu->bno || strcmp(cstat->name, c->cname))
+			continue;
+		if(last)
+		{
+			last->next=c->next;
+			c->next=caches;
+			caches=c;
+		}
 		return 1;
+	}
 	return 0;
 }
 
@@ -195,7 +251,10 @@ int cache_lookup(const char *browse)
 	int ret=-1;
 	char *tok=NULL;
 	char *copy=NULL;
-	struct ent *point=root;
+	struct ent *point;
+
+	if(!caches) return -1;
+	point=caches->root;
 
 	if(!browse || !*browse)
 	{
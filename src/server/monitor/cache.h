@@ -5,7 +5,7 @@
 
 extern int cache_loaded(struct cstat *cstat, struct bu *bu);
 extern int cache_load(struct asfd *srfd, struct manio *manio, struct sbuf *sb,
-	struct cstat *cstat, struct bu *bu);
+	struct cstat *cstat, struct bu *bu, struct conf **confs);
 extern int cache_lookup(const char *browse);
 
 #endif
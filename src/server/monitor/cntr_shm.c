@@ -0,0 +1,171 @@
+#include "include.h"
+#include "cntr_shm.h"
+
+#include <sys/mman.h>
+
+// Give up on a slot whose owner appears to be stuck mid-update, for example
+// because it was killed while writing.
+#define CNTR_SHM_READ_TRIES	1000
+
+static struct cntr_shm_slot *shm=NULL;
+static int shm_slots=0;
+
+int cntr_shm_init(int slots)
+{
+	void *p;
+	size_t len;
+
+	cntr_shm_free();
+	if(slots<=0) return 0;
+
+	len=sizeof(struct cntr_shm_slot)*slots;
+	if((p=mmap(NULL, len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0))==MAP_FAILED)
+	{
+		logp("Could not map %lu bytes of shared counters: %s\n",
+			(unsigned long)len, strerror(errno));
+		return -1;
+	}
+	shm=(struct cntr_shm_slot *)p;
+	shm_slots=slots;
+	memset(shm, 0, len);
+	return 0;
+}
+
+void cntr_shm_free(void)
+{
+	if(!shm) return;
+	munmap(shm, sizeof(struct cntr_shm_slot)*shm_slots);
+	shm=NULL;
+	shm_slots=0;
+}
+
+static void slot_begin_write(struct cntr_shm_slot *slot)
+{
+	slot->seq++;
+	__sync_synchronize();
+}
+
+static void slot_end_write(struct cntr_shm_slot *slot)
+{
+	__sync_synchronize();
+	slot->seq++;
+}
+
+// Returns NULL if there is no segment, or no free slot. The caller should
+// then carry on sending everything down the status pipe.
+struct cntr_shm_slot *cntr_shm_claim(struct cntr *cntr)
+{
+	int i;
+	pid_t pid=getpid();
+	struct cntr_shm_slot *slot;
+
+	for(i=0; i<shm_slots; i++)
+	{
+		slot=&shm[i];
+		if(!__sync_bool_compare_and_swap(&slot->pid, 0, pid))
+			continue;
+		slot_begin_write(slot);
+		snprintf(slot->cname, sizeof(slot->cname), "%s", cntr->cname);
+		slot->ent_count=0;
+		slot_end_write(slot);
+		cntr_shm_write(slot, cntr, cntr->cntr_status);
+		return slot;
+	}
+	return NULL;
+}
+
+// Called by a child on the way out, and by the main server when it reaps a
+// child, in case the child died without getting the chance.
+void cntr_shm_release(pid_t pid)
+{
+	int i;
+	for(i=0; i<shm_slots; i++)
+	{
+		if(shm[i].pid!=pid) continue;
+		slot_begin_write(&shm[i]);
+		shm[i].cname[0]='\0';
+		shm[i].ent_count=0;
+		slot_end_write(&shm[i]);
+		shm[i].pid=0;
+		return;
+	}
+}
+
+void cntr_shm_write(struct cntr_shm_slot *slot,
+	struct cntr *cntr, enum cntr_status cntr_status)
+{
+	uint8_t i=0;
+	struct cntr_ent *e;
+
+	cntr->cntr_status=cntr_status;
+	cntr->ent[(uint8_t)CMD_TIMESTAMP_END]->count=time(NULL);
+
+	slot_begin_write(slot);
+	slot->cntr_status=cntr_status;
+	for(e=cntr->list; e && i<CNTR_SHM_ENT_MAX; e=e->next, i++)
+	{
+		slot->ent[i].cmd=e->cmd;
+		slot->ent[i].count=e->count;
+		slot->ent[i].changed=e->changed;
+		slot->ent[i].same=e->same;
+		slot->ent[i].deleted=e->deleted;
+		slot->ent[i].phase1=e->phase1;
+	}
+	slot->ent_count=i;
+	slot_end_write(slot);
+}
+
+static int slot_read(struct cntr_shm_slot *slot, struct cntr_shm_slot *copy)
+{
+	int tries;
+	uint32_t seq;
+	for(tries=0; tries<CNTR_SHM_READ_TRIES; tries++)
+	{
+		if((seq=slot->seq)&1) continue;
+		__sync_synchronize();
+		memcpy(copy, (void *)slot, sizeof(struct cntr_shm_slot));
+		__sync_synchronize();
+		if(seq==slot->seq) return 0;
+	}
+	return -1;
+}
+
+static void slot_to_cntr(struct cntr_shm_slot *slot, struct cntr *cntr)
+{
+	uint8_t i;
+	struct cntr_ent *e;
+	cntr->cntr_status=slot->cntr_status;
+	for(i=0; i<slot->ent_count && i<CNTR_SHM_ENT_MAX; i++)
+	{
+		if(!(e=cntr->ent[slot->ent[i].cmd])) continue;
+		e->count=slot->ent[i].count;
+		e->changed=slot->ent[i].changed;
+		e->same=slot->ent[i].same;
+		e->deleted=slot->ent[i].deleted;
+		e->phase1=slot->ent[i].phase1;
+	}
+}
+
+// Update the counters of the clients in the list from the slots of any
+// running children.
+void cntr_shm_to_cstats(struct cstat *clist)
+{
+	int i;
+	struct cstat *cstat;
+	struct cntr_shm_slot copy;
+
+	for(i=0; i<shm_slots; i++)
+	{
+		if(!shm[i].pid
+		  || slot_read(&shm[i], &copy)
+		  || !copy.pid
+		  || !*copy.cname)
+			continue;
+		copy.cname[sizeof(copy.cname)-1]='\0';
+		if(!(cstat=cstat_get_by_name(clist, copy.cname))
+		  || !cstat->cntr)
+			continue;
+		slot_to_cntr(&copy, cstat->cntr);
+	}
+}
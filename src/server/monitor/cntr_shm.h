@@ -0,0 +1,47 @@
+#ifndef _CNTR_SHM_H
+#define _CNTR_SHM_H
+
+#include "include.h"
+
+// Live counters shared between the forked backup children and the status
+// server children. The main server process maps a fixed array of slots
+// before forking, so every child inherits the same segment. Each running
+// child owns one slot, which it updates in place. Readers use the sequence
+// number to detect a torn read (seqlock), so there is no locking between
+// processes.
+
+#define CNTR_SHM_ENT_MAX	32
+#define CNTR_SHM_CNAME_LEN	256
+
+struct cntr_shm_ent
+{
+	uint8_t cmd;
+	unsigned long long count;
+	unsigned long long changed;
+	unsigned long long same;
+	unsigned long long deleted;
+	unsigned long long phase1;
+};
+
+struct cntr_shm_slot
+{
+	// Odd while the owner is part way through an update.
+	volatile uint32_t seq;
+	volatile pid_t pid;
+	char cname[CNTR_SHM_CNAME_LEN];
+	enum cntr_status cntr_status;
+	uint8_t ent_count;
+	struct cntr_shm_ent ent[CNTR_SHM_ENT_MAX];
+};
+
+extern int cntr_shm_init(int slots);
+extern void cntr_shm_free(void);
+
+extern struct cntr_shm_slot *cntr_shm_claim(struct cntr *cntr);
+extern void cntr_shm_release(pid_t pid);
+extern void cntr_shm_write(struct cntr_shm_slot *slot,
+	struct cntr *cntr, enum cntr_status cntr_status);
+
+extern void cntr_shm_to_cstats(struct cstat *clist);
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "browse.h"
 #include "cache.h"
+#include "cntr_shm.h"
 #include "cstat.h"
 #include "json_output.h"
 #include "status_server.h"
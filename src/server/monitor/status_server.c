@@ -189,6 +189,8 @@ static int parse_client_data(struct asfd *srfd,
 			goto error;
 	}
 
+	cntr_shm_to_cstats(clist);
+
 	if(json_send(srfd, clist, cstat, bu, logfile, browse, confs))
 		goto error;
 
@@ -160,7 +160,7 @@ static int process_changed_file(struct asfd *asfd,
 		return -1;
 	}
 	if(!(p1b->protocol1->outfb=rs_filebuf_new(asfd, NULL, NULL,
-		asfd->fd, ASYNC_BUF_LEN, -1, get_cntr(cconfs[OPT_CNTR]))))
+		asfd->fd, asfd->frame_len, -1, get_cntr(cconfs[OPT_CNTR]))))
 	{
 		logp("could not rs_filebuf_new for in_outfb.\n");
 		return -1;
@@ -338,8 +338,19 @@ static int maybe_do_delta_stuff(struct asfd *asfd,
 	  && dpth_protocol1_is_compressed(cb->compression,
 	    cb->protocol1->datapth.buf))
 		oldcompressed=1;
-	if( ( oldcompressed && !compression)
-	 || (!oldcompressed &&  compression))
+	if(oldcompressed && !compression)
+		return process_new_file(sdirs, cconfs, cb, p1b, ucfp);
+	if(get_int(cconfs[OPT_COMPRESSION_ADAPTIVE])
+	  && cmd_is_filedata(p1b->path.cmd))
+	{
+		// The client may have decided that the old file was not worth
+		// compressing. It keeps to what is in the attribs that go
+		// with the signature, so that the delta can be applied to the
+		// old file as it is.
+		p1b->compression=oldcompressed?compression:0;
+		if(attribs_encode(p1b)) return -1;
+	}
+	else if(!oldcompressed && compression)
 		return process_new_file(sdirs, cconfs, cb, p1b, ucfp);
 
 	// Otherwise, do the delta stuff (if possible).
@@ -533,8 +544,15 @@ static int deal_with_receive_end_file(struct asfd *asfd, struct sdirs *sdirs,
 
 	cp=strchr(rb->protocol1->endfile.buf, ':');
 	if(rb->protocol1->endfile.buf)
-		cntr_add_bytes(get_cntr(cconfs[OPT_CNTR]),
-			strtoull(rb->protocol1->endfile.buf, NULL, 10));
+	{
+		unsigned long long bytes=
+			strtoull(rb->protocol1->endfile.buf, NULL, 10);
+		cntr_add_bytes(get_cntr(cconfs[OPT_CNTR]), bytes);
+		// The compression that the client chose is in the attribs.
+		attribs_decode(rb);
+		cntr_add_compbytes(get_cntr(cconfs[OPT_CNTR]), bytes,
+			rb->compression>0 && rb->path.cmd!=CMD_EFS_FILE);
+	}
 	if(cp)
 	{
 		// checksum stuff goes here
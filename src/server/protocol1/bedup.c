@@ -3,6 +3,7 @@
 
 #include <uthash.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #define LOCKFILE_NAME		"lockfile"
 #define BEDUP_LOCKFILE_NAME	"lockfile.bedup"
@@ -19,6 +20,7 @@ static int ccount=0;
 static struct lock *locklist=NULL;
 
 static int verbose=0;
+static int threads=1;
 
 typedef struct file file_t;
 
@@ -28,6 +30,7 @@ struct file
 	dev_t dev;
 	ino_t ino;
 	nlink_t nlink;
+	time_t mtime;
 	unsigned long full_cksum;
 	unsigned long part_cksum;
 	file_t *next;
@@ -36,7 +39,9 @@ struct file
 struct mystruct
 {
 	off_t st_size;
-	file_t *files;
+	file_t *files;		// Files that later ones get compared with.
+	file_t *pending;	// Files found by the scan, in the order found.
+	file_t *pending_tail;
 	UT_hash_handle hh;
 };
 
@@ -50,29 +55,30 @@ struct mystruct *find_key(off_t st_size)
 	return s;
 }
 
-static int add_file(struct mystruct *s, struct file *f)
+// Remember a file found by the scan. The comparisons are done once the scan
+// has finished, so that the checksums can be worked out in parallel first.
+static int add_pending(off_t st_size, struct file *f)
 {
+	struct mystruct *s;
 	struct file *newfile;
+
+	if(!(s=find_key(st_size)))
+	{
+		if(!(s=(struct mystruct *)
+			calloc_w(1, sizeof(struct mystruct), __func__)))
+				return -1;
+		s->st_size=st_size;
+//printf("HASH ADD %d\n", st_size);
+		HASH_ADD_INT(myfiles, st_size, s);
+	}
 	if(!(newfile=(struct file *)malloc_w(sizeof(struct file), __func__)))
 		return -1;
 	memcpy(newfile, f, sizeof(struct file));
 	f->path=NULL;
-	newfile->next=s->files;
-	s->files=newfile;
-	return 0;
-}
-
-static int add_key(off_t st_size, struct file *f)
-{
-	struct mystruct *s;
-
-	if(!(s=(struct mystruct *)malloc_w(sizeof(struct mystruct), __func__)))
-		return -1;
-	s->st_size=st_size;
-	s->files=NULL;
-	if(add_file(s, f)) return -1;
-//printf("HASH ADD %d\n", st_size);
-	HASH_ADD_INT(myfiles, st_size, s);
+	newfile->next=NULL;
+	if(s->pending_tail) s->pending_tail->next=newfile;
+	else s->pending=newfile;
+	s->pending_tail=newfile;
 	return 0;
 }
 
@@ -86,6 +92,13 @@ static FILE *open_file(struct file *f)
 
 #define FULL_CHUNK	4096
 
+static void readahead_hint(FILE *fp)
+{
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
 static int full_match(struct file *o, struct file *n, FILE **ofp, FILE **nfp)
 {
 	size_t ogot;
@@ -106,6 +119,8 @@ static int full_match(struct file *o, struct file *n, FILE **ofp, FILE **nfp)
 	if(*nfp) fseek(*nfp, 0, SEEK_SET);
 	else if(!(*nfp=open_file(n))) return 0;
 
+	readahead_hint(*ofp);
+	readahead_hint(*nfp);
 	while(1)
 	{
 		ogot=fread(obuf, 1, FULL_CHUNK, *ofp);
@@ -125,7 +140,7 @@ static int get_part_cksum(struct file *f, FILE **fp)
 {
 	MD5_CTX md5;
 	int got=0;
-	static char buf[PART_CHUNK];
+	char buf[PART_CHUNK];
 	unsigned char checksum[MD5_DIGEST_LENGTH+1];
 
 	if(*fp) fseek(*fp, 0, SEEK_SET);
@@ -168,7 +183,7 @@ static int get_full_cksum(struct file *f, FILE **fp)
 {
 	size_t s=0;
 	MD5_CTX md5;
-	static char buf[FULL_CHUNK];
+	char buf[FULL_CHUNK];
 	unsigned char checksum[MD5_DIGEST_LENGTH+1];
 
 	if(*fp) fseek(*fp, 0, SEEK_SET);
@@ -229,19 +244,20 @@ end:
 	return ret;
 }
 
-static void reset_old_file(struct file *oldfile, struct file *newfile,
-	struct stat *info)
+static void reset_old_file(struct file *oldfile, struct file *newfile)
 {
 	//printf("reset %s with %s %d\n", oldfile->path, newfile->path,
-	//	info->st_nlink);
-	oldfile->nlink=info->st_nlink;
+	//	newfile->nlink);
+	oldfile->nlink=newfile->nlink;
 	free_w(&oldfile->path);
 	oldfile->path=newfile->path;
 	newfile->path=NULL;
 }
 
+static void cksum_cache_update(struct file *f, off_t st_size);
+
 static int check_files(struct mystruct *find, struct file *newfile,
-	struct stat *info, const char *ext, unsigned int maxlinks)
+	const char *ext, unsigned int maxlinks)
 {
 	int found=0;
 	FILE *nfp=NULL;
@@ -314,7 +330,7 @@ static int check_files(struct mystruct *find, struct file *newfile,
 			// Just need to reset the path name and the number
 			// of links, and pretend that it was found otherwise
 			// NULL newfile will get added to the memory.
-			reset_old_file(f, newfile, info);
+			reset_old_file(f, newfile);
 			found++;
 			break;
 		}
@@ -334,7 +350,7 @@ static int check_files(struct mystruct *find, struct file *newfile,
 					// Only count bytes as saved if we
 					// removed the last link.
 					if(newfile->nlink==1)
-						savedbytes+=info->st_size;
+						savedbytes+=find->st_size;
 					break;
 				case -1:
 					// On error, replace the memory of the
@@ -342,7 +358,7 @@ static int check_files(struct mystruct *find, struct file *newfile,
 					// found. It might work better when
 					// someone later tries to link to the
 					// new one instead of the old one.
-					reset_old_file(f, newfile, info);
+					reset_old_file(f, newfile);
 					count--;
 					break;
 				default:
@@ -367,14 +383,14 @@ static int check_files(struct mystruct *find, struct file *newfile,
 				// Only count bytes as saved if we removed the
 				// last link.
 				if(newfile->nlink==1)
-					savedbytes+=info->st_size;
+					savedbytes+=find->st_size;
 			}
 		}
 		else
 		{
 			// To be able to tell how many bytes
 			// are saveable.
-			savedbytes+=info->st_size;
+			savedbytes+=find->st_size;
 		}
 
 		break;
@@ -384,12 +400,392 @@ static int check_files(struct mystruct *find, struct file *newfile,
 
 	if(found)
 	{
+		// Linking or deleting leaves the old inode of newfile behind,
+		// so only remember its checksums when it was left alone.
+		if(!makelinks && !deletedups)
+			cksum_cache_update(newfile, find->st_size);
 		free_w(&newfile->path);
+		free_v((void **)&newfile);
+		return 0;
+	}
+
+	newfile->next=find->files;
+	find->files=newfile;
+
+	return 0;
+}
+
+// Checksums remembered between runs, so that files that have not changed
+// since the last run do not need to be read again.
+#define CKSUM_CACHE_MAGIC	"burp-bedup-cksums 1\n"
+
+struct cksum_key
+{
+	uint64_t dev;
+	uint64_t ino;
+};
+
+struct cksum_rec
+{
+	struct cksum_key key;
+	uint64_t size;
+	int64_t mtime;
+	uint32_t part_cksum;
+	uint32_t full_cksum;
+};
+
+struct cksum_ent
+{
+	struct cksum_rec rec;
+	int used;
+	UT_hash_handle hh;
+};
+
+static const char *cksum_cache_path=NULL;
+static struct cksum_ent *cksum_cache=NULL;
+
+static struct cksum_ent *cksum_cache_find(struct file *f)
+{
+	struct cksum_key key;
+	struct cksum_ent *e=NULL;
+	memset(&key, 0, sizeof(key));
+	key.dev=f->dev;
+	key.ino=f->ino;
+	HASH_FIND(hh, cksum_cache, &key, sizeof(key), e);
+	return e;
+}
+
+static void cksum_cache_lookup(struct file *f, off_t st_size)
+{
+	struct cksum_ent *e;
+	if(!cksum_cache_path || !(e=cksum_cache_find(f))) return;
+	if(e->rec.size!=(uint64_t)st_size
+	  || e->rec.mtime!=(int64_t)f->mtime)
+		return;
+	f->part_cksum=e->rec.part_cksum;
+	f->full_cksum=e->rec.full_cksum;
+	e->used=1;
+}
+
+static void cksum_cache_update(struct file *f, off_t st_size)
+{
+	struct cksum_ent *e;
+	if(!cksum_cache_path || !f->part_cksum) return;
+	if(!(e=cksum_cache_find(f)))
+	{
+		if(!(e=(struct cksum_ent *)
+			calloc_w(1, sizeof(struct cksum_ent), __func__)))
+				return;
+		e->rec.key.dev=f->dev;
+		e->rec.key.ino=f->ino;
+		HASH_ADD(hh, cksum_cache, rec.key, sizeof(struct cksum_key), e);
+	}
+	e->rec.size=st_size;
+	e->rec.mtime=f->mtime;
+	e->rec.part_cksum=f->part_cksum;
+	e->rec.full_cksum=f->full_cksum;
+	e->used=1;
+}
+
+static void cksum_cache_free(void)
+{
+	struct cksum_ent *e;
+	struct cksum_ent *tmp;
+	HASH_ITER(hh, cksum_cache, e, tmp)
+	{
+		HASH_DEL(cksum_cache, e);
+		free_v((void **)&e);
+	}
+}
+
+static int cksum_cache_load(const char *path)
+{
+	FILE *fp;
+	unsigned long loaded=0;
+	struct cksum_rec rec;
+	struct cksum_ent *e;
+	char magic[sizeof(CKSUM_CACHE_MAGIC)]="";
+
+	cksum_cache_path=path;
+	if(!(fp=fopen(path, "rb")))
+	{
+		if(errno==ENOENT) return 0;
+		logp("Could not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if(fread(magic, 1, strlen(CKSUM_CACHE_MAGIC), fp)
+		!=strlen(CKSUM_CACHE_MAGIC)
+	  || strcmp(magic, CKSUM_CACHE_MAGIC))
+	{
+		logp("Ignoring %s, which is not a checksum cache\n", path);
+		fclose(fp);
 		return 0;
 	}
+	while(fread(&rec, sizeof(rec), 1, fp)==1)
+	{
+		if(!(e=(struct cksum_ent *)
+			calloc_w(1, sizeof(struct cksum_ent), __func__)))
+		{
+			fclose(fp);
+			return -1;
+		}
+		memcpy(&e->rec, &rec, sizeof(rec));
+		HASH_ADD(hh, cksum_cache, rec.key, sizeof(struct cksum_key), e);
+		loaded++;
+	}
+	fclose(fp);
+	logp("Loaded %lu checksums from %s\n", loaded, path);
+	return 0;
+}
+
+// Only the files seen on this run are kept, so that the cache does not keep
+// growing with files that have since been deleted.
+static int cksum_cache_save(void)
+{
+	int ret=-1;
+	FILE *fp=NULL;
+	char *tmppath=NULL;
+	struct cksum_ent *e;
+	struct cksum_ent *tmp;
+
+	if(!cksum_cache_path) return 0;
+	if(!(tmppath=prepend(cksum_cache_path, ".tmp")))
+	{
+		log_out_of_memory(__func__);
+		goto end;
+	}
+	if(!(fp=fopen(tmppath, "wb")))
+	{
+		logp("Could not open %s: %s\n", tmppath, strerror(errno));
+		goto end;
+	}
+	if(fwrite(CKSUM_CACHE_MAGIC, 1, strlen(CKSUM_CACHE_MAGIC), fp)
+		!=strlen(CKSUM_CACHE_MAGIC))
+			goto error;
+	HASH_ITER(hh, cksum_cache, e, tmp)
+	{
+		if(!e->used || !e->rec.part_cksum) continue;
+		if(fwrite(&e->rec, sizeof(e->rec), 1, fp)!=1)
+			goto error;
+	}
+	if(close_fp(&fp))
+		goto error;
+	if(do_rename(tmppath, cksum_cache_path))
+		goto end;
+	ret=0;
+	goto end;
+error:
+	logp("Could not write %s: %s\n", tmppath, strerror(errno));
+	close_fp(&fp);
+	unlink(tmppath);
+end:
+	free_w(&tmppath);
+	return ret;
+}
+
+// Checksums to be worked out by the thread pool.
+struct hash_jobs
+{
+	struct file **list;
+	size_t count;
+	size_t alloc;
+	size_t next;
+	int full;
+};
+
+static int hash_jobs_add(struct hash_jobs *jobs, struct file *f)
+{
+	if(jobs->count==jobs->alloc)
+	{
+		struct file **tmp;
+		size_t alloc=jobs->alloc?jobs->alloc*2:1024;
+		if(!(tmp=(struct file **)realloc_w(jobs->list,
+			alloc*sizeof(struct file *), __func__)))
+				return -1;
+		jobs->list=tmp;
+		jobs->alloc=alloc;
+	}
+	jobs->list[jobs->count++]=f;
+	return 0;
+}
+
+static void *hash_worker(void *arg)
+{
+	size_t i;
+	FILE *fp;
+	struct file *f;
+	struct hash_jobs *jobs=(struct hash_jobs *)arg;
+
+	while((i=__sync_fetch_and_add(&jobs->next, 1))<jobs->count)
+	{
+		f=jobs->list[i];
+		// Not open_file(), which logs. A file that cannot be read is
+		// left without a checksum, and gets another go when it is
+		// compared.
+		if(!(fp=fopen(f->path, "rb"))) continue;
+		if(jobs->full)
+		{
+			readahead_hint(fp);
+			get_full_cksum(f, &fp);
+		}
+		else
+			get_part_cksum(f, &fp);
+		close_fp(&fp);
+	}
+	return NULL;
+}
+
+static int run_hash_jobs(struct hash_jobs *jobs)
+{
+	int i;
+	int started=0;
+	pthread_t *tids=NULL;
+
+	if(!jobs->count) return 0;
+	if(threads>1 && !(tids=(pthread_t *)
+		calloc_w(threads-1, sizeof(pthread_t), __func__)))
+			return -1;
+	for(i=0; i<threads-1; i++)
+	{
+		if(pthread_create(&tids[i], NULL, hash_worker, jobs))
+		{
+			logp("Could not create checksum thread: %s\n",
+				strerror(errno));
+			break;
+		}
+		started++;
+	}
+	// This thread does its share too.
+	hash_worker(jobs);
+	for(i=0; i<started; i++)
+		pthread_join(tids[i], NULL);
+	free_v((void **)&tids);
+	return 0;
+}
+
+// Whether there are at least two different inodes of this size, or one new
+// one and one that was kept from a previous set of directories.
+static int group_has_candidates(struct mystruct *s)
+{
+	struct file *f;
+	struct file *first=s->files?s->files:s->pending;
+	if(!first) return 0;
+	for(f=s->pending; f; f=f->next)
+		if(f->dev!=first->dev || f->ino!=first->ino) return 1;
+	return 0;
+}
+
+static int cmp_part_cksum(const void *a, const void *b)
+{
+	const struct file *x=*(const struct file **)a;
+	const struct file *y=*(const struct file **)b;
+	if(x->dev!=y->dev) return x->dev<y->dev?-1:1;
+	if(x->part_cksum!=y->part_cksum)
+		return x->part_cksum<y->part_cksum?-1:1;
+	return 0;
+}
+
+// Add the files whose first chunk matches that of a different inode.
+static int add_full_jobs(struct hash_jobs *full, struct mystruct *s)
+{
+	int ret=-1;
+	size_t i;
+	size_t j;
+	size_t k;
+	int distinct;
+	struct file *f;
+	struct hash_jobs group;
+
+	memset(&group, 0, sizeof(group));
+	for(f=s->files; f; f=f->next)
+		if(f->path && hash_jobs_add(&group, f)) goto end;
+	for(f=s->pending; f; f=f->next)
+		if(hash_jobs_add(&group, f)) goto end;
+	qsort(group.list, group.count, sizeof(struct file *), cmp_part_cksum);
+
+	for(i=0; i<group.count; i=j)
+	{
+		distinct=0;
+		for(j=i+1; j<group.count
+		  && !cmp_part_cksum(&group.list[i], &group.list[j]); j++)
+			if(group.list[j]->ino!=group.list[i]->ino) distinct=1;
+		if(!distinct || !group.list[i]->part_cksum) continue;
+		for(k=i; k<j; k++)
+		{
+			if(group.list[k]->full_cksum) continue;
+			if(hash_jobs_add(full, group.list[k])) goto end;
+		}
+	}
+	ret=0;
+end:
+	free_v((void **)&group.list);
+	return ret;
+}
+
+// Work out the checksums that the comparisons are going to need up front,
+// using the thread pool. First those of the start of each file that is the
+// same size as another, then the full checksums of those whose start matches
+// another.
+static int hash_candidates(void)
+{
+	int ret=-1;
+	struct file *f;
+	struct mystruct *s;
+	struct mystruct *tmp;
+	struct hash_jobs part;
+	struct hash_jobs full;
+
+	memset(&part, 0, sizeof(part));
+	memset(&full, 0, sizeof(full));
+	full.full=1;
+
+	HASH_ITER(hh, myfiles, s, tmp)
+	{
+		if(!group_has_candidates(s)) continue;
+		for(f=s->files; f; f=f->next)
+			if(f->path && !f->part_cksum
+			  && hash_jobs_add(&part, f)) goto end;
+		for(f=s->pending; f; f=f->next)
+			if(!f->part_cksum
+			  && hash_jobs_add(&part, f)) goto end;
+	}
+	if(run_hash_jobs(&part)) goto end;
 
-	if(add_file(find, newfile)) return -1;
+	HASH_ITER(hh, myfiles, s, tmp)
+	{
+		if(!group_has_candidates(s)) continue;
+		if(add_full_jobs(&full, s)) goto end;
+	}
+	if(run_hash_jobs(&full)) goto end;
 
+	ret=0;
+end:
+	free_v((void **)&part.list);
+	free_v((void **)&full.list);
+	return ret;
+}
+
+// Compare the files found by the scan with the ones before them, and link or
+// delete the duplicates.
+static int dedup_pending(const char *ext, unsigned int maxlinks)
+{
+	struct file *f;
+	struct mystruct *s;
+	struct mystruct *tmp;
+
+	if(hash_candidates()) return -1;
+	HASH_ITER(hh, myfiles, s, tmp)
+	{
+		while((f=s->pending))
+		{
+			s->pending=f->next;
+			f->next=NULL;
+			if(check_files(s, f, ext, maxlinks)) return -1;
+		}
+		s->pending_tail=NULL;
+		for(f=s->files; f; f=f->next)
+			cksum_cache_update(f, s->st_size);
+	}
 	return 0;
 }
 
@@ -476,7 +872,6 @@ static int process_dir(const char *oldpath, const char *newpath,
 	struct stat info;
 	struct dirent *dirinfo=NULL;
 	struct file newfile;
-	struct mystruct *find=NULL;
 	static char working[256]="";
 	static char finishing[256]="";
 
@@ -536,22 +931,16 @@ static int process_dir(const char *oldpath, const char *newpath,
 		newfile.dev=info.st_dev;
 		newfile.ino=info.st_ino;
 		newfile.nlink=info.st_nlink;
+		newfile.mtime=info.st_mtime;
 		newfile.full_cksum=0;
 		newfile.part_cksum=0;
 		newfile.next=NULL;
 
-		if((find=find_key(info.st_size)))
-		{
-			//printf("check %d: %s\n", info.st_size, newfile.path);
-			if(check_files(find, &newfile, &info, ext, maxlinks))
-				goto end;
-		}
-		else
-		{
-			//printf("add: %s\n", newfile.path);
-			if(add_key(info.st_size, &newfile))
-				goto end;
-		}
+		cksum_cache_lookup(&newfile, info.st_size);
+
+		//printf("add: %s\n", newfile.path);
+		if(add_pending(info.st_size, &newfile))
+			goto end;
 	}
 	ret=0;
 end:
@@ -692,6 +1081,9 @@ static int iterate_over_clients(struct conf **globalcs,
 	}
 	closedir(dirp);
 
+	// Compare while the locks are still held.
+	if(!ret && dedup_pending(ext, maxlinks)) ret=-1;
+
 	locks_release_and_free(&locklist);
 
 	confs_free(&cconfs);
@@ -718,6 +1110,8 @@ static int usage(void)
 	printf("                           group, use the 'dedup_group' option in the client\n");
 	printf("                           configuration file on the server.\n");
 	printf("  -h|-?                    Print this text and exit.\n");
+	printf("  -k <path>                Remember checksums in this file between runs,\n");
+	printf("                           so that unchanged files are not read again.\n");
 	printf("  -d                       Delete any duplicate files found.\n");
 	printf("                           (non-burp mode only)\n");
 	printf("  -l                       Hard link any duplicate files found.\n");
@@ -728,6 +1122,8 @@ static int usage(void)
 	printf("                           of links possible is 32000, but space is needed\n");
 	printf("                           for the normal operation of burp.\n");
 	printf("  -n <list of directories> Non-burp mode. Deduplicate any (set of) directories.\n");
+	printf("  -t <number>              Number of threads to use for checksumming files.\n");
+	printf("                           The default is 1.\n");
 	printf("  -v                       Print duplicate paths.\n");
 	printf("  -V                       Print version and exit.\n");
 	printf("\n");
@@ -748,6 +1144,7 @@ int run_bedup(int argc, char *argv[])
 	int nonburp=0;
 	unsigned int maxlinks=DEF_MAX_LINKS;
 	char *groups=NULL;
+	char *cachefile=NULL;
 	char ext[16]="";
 	int givenconfigfile=0;
 	const char *configfile=NULL;
@@ -755,7 +1152,7 @@ int run_bedup(int argc, char *argv[])
 	configfile=get_config_path();
 	snprintf(ext, sizeof(ext), ".bedup.%d", getpid());
 
-	while((option=getopt(argc, argv, "c:dg:hlm:nvV?"))!=-1)
+	while((option=getopt(argc, argv, "c:dg:hk:lm:nt:vV?"))!=-1)
 	{
 		switch(option)
 		{
@@ -769,6 +1166,9 @@ int run_bedup(int argc, char *argv[])
 			case 'g':
 				groups=optarg;
 				break;
+			case 'k':
+				cachefile=optarg;
+				break;
 			case 'l':
 				makelinks=1;
 				break;
@@ -778,6 +1178,9 @@ int run_bedup(int argc, char *argv[])
 			case 'n':
 				nonburp=1;
 				break;
+			case 't':
+				threads=atoi(optarg);
+				break;
 			case 'V':
 				printf("%s-%s\n", prog, VERSION);
 				return 0;
@@ -838,6 +1241,13 @@ int run_bedup(int argc, char *argv[])
 		logp("The argument to -m needs to be greater than 1.\n");
 		return 1;
 	}
+	if(threads<1)
+	{
+		logp("The argument to -t needs to be greater than 0.\n");
+		return 1;
+	}
+	if(cachefile && cksum_cache_load(cachefile))
+		return 1;
 
 	if(nonburp)
 	{
@@ -854,6 +1264,7 @@ int run_bedup(int argc, char *argv[])
 				break;
 			}
 		}
+		if(!ret && dedup_pending(ext, maxlinks)) ret=1;
 	}
 	else
 	{
@@ -931,6 +1342,9 @@ int run_bedup(int argc, char *argv[])
 		strlists_free(&grouplist);
 	}
 
+	if(!ret && cksum_cache_save()) ret=1;
+	cksum_cache_free();
+
 	if(!nonburp)
 	{
 		logp("%d client storages scanned\n", ccount);
@@ -1,5 +1,4 @@
 #include "include.h"
-#include "../protocol1/resume.h"
 #include "../../base64.h"
 #include "../../cmd.h"
 #include "../../hexmap.h"
@@ -718,7 +717,7 @@ static int deal_with_read_from_chfd(struct asfd *asfd, struct asfd *chfd,
 	}
 	ret=0;
 end:
-	iobuf_free_content(chfd->rbuf);
+	chfd->rbuf_release(chfd);
 	return ret;
 }
 
@@ -776,8 +775,9 @@ int backup_phase2_server_protocol2(struct async *as, struct sdirs *sdirs,
 	// The phase1 manifest looks the same as a protocol1 one.
 	manio_set_protocol(p1manio, PROTO_1);
 
-	if(resume && do_resume(p1manio, sdirs, dpth, confs))
-                goto end;
+	if(resume && resume_protocol2(p1manio,
+		chmanio, unmanio, chfd, sdirs, confs))
+			goto end;
 
 	if(manio_closed(p1manio)
 	  && manio_open_next_fpath(p1manio))
@@ -874,7 +874,7 @@ end:
 	slist_free(&slist);
 	blist_free(&blist);
 	iobuf_free_content(asfd->rbuf);
-	iobuf_free_content(chfd->rbuf);
+	chfd->rbuf_release(chfd);
 	// Write buffer did not allocate 'buf'. 
 	if(wbuf) wbuf->buf=NULL;
 	iobuf_free(&wbuf);
@@ -20,8 +20,11 @@ int backup_phase3_server_protocol2(struct sdirs *sdirs, struct conf **confs)
 	struct manio *newmanio=NULL;
 	struct manio *chmanio=NULL;
 	struct manio *unmanio=NULL;
+	struct timeval start;
+	struct timeval end;
 
 	logp("Start phase3\n");
+	gettimeofday(&start, NULL);
 
 	if(!(newmanio=manio_alloc())
 	  || !(chmanio=manio_alloc())
@@ -33,6 +36,7 @@ int backup_phase3_server_protocol2(struct sdirs *sdirs, struct conf **confs)
 	  || manio_init_write_hooks(newmanio,
 		get_string(confs[OPT_DIRECTORY]), hooksdir, sdirs->rmanifest)
 	  || manio_init_write_dindex(newmanio, dindexdir)
+	  || manio_init_write_pindex(newmanio)
 	  || manio_init_read(chmanio, sdirs->changed)
 	  || manio_init_read(unmanio, sdirs->unchanged)
 	  || !(usb=sbuf_alloc(confs))
@@ -69,9 +73,8 @@ int backup_phase3_server_protocol2(struct sdirs *sdirs, struct conf **confs)
 
 		if((usb && usb->path.buf) && (!csb || !csb->path.buf))
 		{
-			switch(manio_copy_entry(NULL /* no async */,
-				&usb, usb,
-				&blk, unmanio, newmanio, confs))
+			switch(manio_copy_entries_raw(&usb, NULL /* no limit */,
+				unmanio, newmanio))
 			{
 				case -1: goto end;
 				case 1: finished_un++;
@@ -102,8 +105,10 @@ int backup_phase3_server_protocol2(struct sdirs *sdirs, struct conf **confs)
 		}
 		else if(pcmp<0)
 		{
-			switch(manio_copy_entry(NULL /* no async */,
-				&usb, usb, &blk, unmanio, newmanio, confs))
+			// Usually a long run of unchanged entries, which can
+			// go straight through until the next changed one.
+			switch(manio_copy_entries_raw(&usb, csb,
+				unmanio, newmanio))
 			{
 				case -1: goto end;
 				case 1: finished_un++;
@@ -135,7 +140,9 @@ int backup_phase3_server_protocol2(struct sdirs *sdirs, struct conf **confs)
 
 	ret=0;
 
-	logp("End phase3\n");
+	gettimeofday(&end, NULL);
+	logp("End phase3 (%.2fs)\n", (end.tv_sec-start.tv_sec)
+		+(end.tv_usec-start.tv_usec)/1000000.0);
 end:
 	manio_free(&newmanio);
 	manio_free(&chmanio);
@@ -5,6 +5,155 @@
 
 struct candidate **candidates=NULL;
 size_t candidates_len=0;
+uint64_t candidates_round=0;
+int candidates_freshness=0;
+
+// With champ_freshness, the overlap score of each candidate is multiplied by
+// a weight, so that a candidate from a newer backup, from the same client, or
+// that was loaded recently can win against one with somewhat more hooks in
+// common. Newer and recently loaded manifests are more likely to point at
+// data files that are still in the page cache.
+#define WEIGHT_BASE	16
+#define WEIGHT_CLIENT	2
+#define WEIGHT_HOT	2
+#define WEIGHT_AGE_MAX	4
+// A candidate that was loaded within this many rounds counts as recent.
+#define HOT_ROUNDS	32
+
+struct client_name
+{
+	char *name;
+	UT_hash_handle hh;
+};
+
+struct backup_age
+{
+	char *backup;
+	uint8_t bonus;
+	UT_hash_handle hh;
+};
+
+static struct client_name *client_names=NULL;
+static struct backup_age *backup_ages=NULL;
+
+static uint8_t age_to_bonus(time_t when, time_t now)
+{
+	time_t days;
+	if(!when) return 0;
+	days=(now-when)/(60*60*24);
+	if(days<7) return WEIGHT_AGE_MAX;
+	if(days<14) return WEIGHT_AGE_MAX/2;
+	if(days<28) return WEIGHT_AGE_MAX/4;
+	return 0;
+}
+
+static struct client_name *client_name_find(const char *name)
+{
+	struct client_name *c=NULL;
+	HASH_FIND_STR(client_names, name, c);
+	return c;
+}
+
+const char *candidates_find_client(const char *cname)
+{
+	struct client_name *c;
+	if(!cname || !(c=client_name_find(cname))) return NULL;
+	return c->name;
+}
+
+static const char *client_name_add(const char *name)
+{
+	struct client_name *c;
+	if((c=client_name_find(name))) return c->name;
+	if(!(c=(struct client_name *)
+		calloc_w(1, sizeof(struct client_name), __func__))
+	  || !(c->name=strdup_w(name, __func__)))
+	{
+		free_v((void **)&c);
+		return NULL;
+	}
+	HASH_ADD_KEYPTR(hh, client_names, c->name, strlen(c->name), c);
+	return c->name;
+}
+
+// The timestamp file in a backup directory is written when the backup starts.
+// Many candidates come from the same backup, so it is only looked at once.
+static struct backup_age *backup_age_get(const char *backup,
+	time_t now, struct conf **confs)
+{
+	struct stat statp;
+	char *path=NULL;
+	struct backup_age *b=NULL;
+
+	HASH_FIND_STR(backup_ages, backup, b);
+	if(b) return b;
+	if(!(b=(struct backup_age *)
+		calloc_w(1, sizeof(struct backup_age), __func__))
+	  || !(b->backup=strdup_w(backup, __func__))
+	  || !(path=prepend_s(get_string(confs[OPT_DIRECTORY]), backup))
+	  || astrcat(&path, "/timestamp", __func__))
+	{
+		if(b) free_w(&b->backup);
+		free_v((void **)&b);
+		free_w(&path);
+		return NULL;
+	}
+	if(!lstat(path, &statp))
+		b->bonus=age_to_bonus(statp.st_mtime, now);
+	free_w(&path);
+	HASH_ADD_KEYPTR(hh, backup_ages, b->backup, strlen(b->backup), b);
+	return b;
+}
+
+// Candidate paths look like 'dedup_group/clients/client/backup/manifest/x'.
+// Anything else just gets no bonuses.
+static int candidate_set_meta(struct candidate *candidate,
+	int fresh, struct conf **confs)
+{
+	int ret=-1;
+	char *copy=NULL;
+	char *client=NULL;
+	char *cp=NULL;
+	char *backup_end=NULL;
+	struct backup_age *b;
+
+	if(!(copy=strdup_w(candidate->path, __func__)))
+		goto end;
+	if(!(cp=strchr(copy, '/'))
+	  || strncmp(cp, "/clients/", strlen("/clients/")))
+	{
+		ret=0;
+		goto end;
+	}
+	client=cp+strlen("/clients/");
+	if(!(cp=strchr(client, '/'))
+	  || !(backup_end=strchr(cp+1, '/')))
+	{
+		ret=0;
+		goto end;
+	}
+
+	*backup_end='\0';
+	if(fresh)
+	{
+		// Part of the backup that is going on now.
+		candidate->age_bonus=WEIGHT_AGE_MAX;
+	}
+	else
+	{
+		if(!(b=backup_age_get(copy, time(NULL), confs)))
+			goto end;
+		candidate->age_bonus=b->bonus;
+	}
+
+	*cp='\0';
+	if(!(candidate->client=client_name_add(client)))
+		goto end;
+	ret=0;
+end:
+	free_w(&copy);
+	return ret;
+}
 
 struct candidate *candidate_alloc(void)
 {
@@ -64,6 +213,9 @@ int candidate_load(struct candidate *candidate,
 			if(!(candidate=candidates_add_new())) goto error;
 			candidate->path=sb->path.buf;
 			sb->path.buf=NULL;
+			if(candidates_freshness
+			  && candidate_set_meta(candidate, 0, confs))
+				goto error;
 		}
 		sbuf_free_content(sb);
 		blk->fingerprint=0;
@@ -92,12 +244,34 @@ int candidate_add_fresh(const char *path, struct conf **confs)
 	cp=path+strlen(get_string(confs[OPT_DIRECTORY]));
 	while(cp && *cp=='/') cp++;
 	if(!(candidate->path=strdup_w(cp, __func__))) return -1;
+	if(candidates_freshness
+	  && candidate_set_meta(candidate, 1, confs))
+		return -1;
 
 	return candidate_load(candidate, path, confs);
 }
 
+static unsigned int weight(struct candidate *candidate, const char *client)
+{
+	unsigned int w=WEIGHT_BASE+candidate->age_bonus;
+	if(client && candidate->client==client)
+		w+=WEIGHT_CLIENT;
+	if(candidate->last_hit
+	  && candidates_round-candidate->last_hit<=HOT_ROUNDS)
+		w+=WEIGHT_HOT;
+	return w;
+}
+
+static int better(struct candidate *a, struct candidate *b,
+	const char *client)
+{
+	if(!candidates_freshness)
+		return *(a->score)>*(b->score);
+	return *(a->score)*weight(a, client)>*(b->score)*weight(b, client);
+}
+
 struct candidate *candidates_choose_champ(struct incoming *in,
-	struct candidate *champ_last)
+	struct candidate *champ_last, const char *client)
 {
 	static uint16_t i;
 	static uint16_t s;
@@ -143,7 +317,7 @@ struct candidate *candidates_choose_champ(struct incoming *in,
 			assert(*score<=in->size);
 			if(!best
 			// Maybe should check for candidate!=best here too.
-			  || *score>*(best->score))
+			  || better(candidate, best, client))
 			{
 				best=candidate;
 /*
@@ -153,8 +327,6 @@ struct candidate *candidates_choose_champ(struct incoming *in,
 					best->score, *(best->score));
 */
 			}
-			// FIX THIS: figure out a way of giving preference to
-			// newer candidates.
 		}
 	}
 	//clock_gettime(CLOCK_MONOTONIC, &tend);
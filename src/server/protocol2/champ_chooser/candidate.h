@@ -6,10 +6,19 @@ struct candidate
 {
 	char *path;
 	uint16_t *score;
+
+	// Used when champ_freshness is set.
+	const char *client;	// Shared between all of a client's candidates.
+	uint8_t age_bonus;	// Larger for newer backups.
+	uint64_t last_hit;	// Round in which it was last loaded as a champ.
 };
 
 extern struct candidate **candidates;
 extern size_t candidates_len;
+// Counts calls to deduplicate(), so that candidates can tell whether they
+// have been loaded as champs recently.
+extern uint64_t candidates_round;
+extern int candidates_freshness;
 
 extern struct candidate *candidate_alloc(void);
 extern void candidates_set_score_pointers(struct candidate **candidates,
@@ -18,5 +27,6 @@ extern struct candidate *candidates_add_new(void);
 extern int candidate_load(struct candidate *candidate,
         const char *path, struct conf **confs);
 extern int candidate_add_fresh(const char *path, struct conf **confs);
+extern const char *candidates_find_client(const char *cname);
 extern struct candidate *candidates_choose_champ(struct incoming *in,
-	struct candidate *champ_last);
+	struct candidate *champ_last, const char *client);
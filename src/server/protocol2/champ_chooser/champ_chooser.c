@@ -8,6 +8,7 @@ int champ_chooser_init(const char *datadir, struct conf **confs)
 
 	// FIX THIS: scores is a global variable.
 	if(!scores && !(scores=scores_alloc())) goto end;
+	candidates_freshness=get_int(confs[OPT_CHAMP_FRESHNESS]);
 
 	if(!(sparse_path=prepend_s(datadir, "sparse"))) goto end;
 	if(lstat(sparse_path, &statp))
@@ -70,15 +71,22 @@ int deduplicate(struct asfd *asfd, struct conf **confs)
 	struct candidate *champ_last=NULL;
 	int count=0;
 	int blk_count=0;
+	uint64_t loaded=0;
+	const char *client=NULL;
 
 	if(!in) return 0;
 
+	candidates_round++;
+	if(candidates_freshness)
+		client=candidates_find_client(asfd->desc);
+
 	incoming_found_reset(in);
 	count=0;
-	while((champ=candidates_choose_champ(in, champ_last)))
+	while((champ=candidates_choose_champ(in, champ_last, client)))
 	{
 //		printf("Got champ: %s %d\n", champ->path, *(champ->score));
-		if(hash_load(champ->path, confs)) return -1;
+		if(hash_load(champ->path, confs, &loaded)) return -1;
+		champ->last_hit=candidates_round;
 		if(++count==CHAMPS_MAX) break;
 		champ_last=champ;
 	}
@@ -104,8 +112,13 @@ int deduplicate(struct asfd *asfd, struct conf **confs)
 //printf("after agb: %lu %d\n", blk->index, blk->got);
 	}
 
-	logp("%s: %04d/%04d - %04d/%04d\n",
-		asfd->desc, count, candidates_len, in->got, blk_count);
+	logp("%s: %04d/%04d - %04d/%04d %3d%% %" PRIu64 "KB\n",
+		asfd->desc, count, candidates_len, in->got, blk_count,
+		blk_count?in->got*100/blk_count:0, loaded/1024);
+	in->total_blks+=blk_count;
+	in->total_got+=in->got;
+	in->total_champs+=count;
+	in->total_loaded+=loaded;
 	//cntr_add_same_val(get_cntr(confs[OPT_CNTR]), CMD_DATA, in->got);
 
 	// Start the incoming array again.
@@ -117,3 +130,15 @@ int deduplicate(struct asfd *asfd, struct conf **confs)
 
 	return 0;
 }
+
+// Makes it possible to compare champ_freshness settings on real data.
+void deduplicate_log_totals(struct asfd *asfd)
+{
+	struct incoming *in=asfd->in;
+	if(!in || !in->total_blks) return;
+	logp("%s: %" PRIu64 "/%" PRIu64 " blocks found (%" PRIu64 "%%)"
+		" with %" PRIu64 " champs, %" PRIu64 "KB loaded\n",
+		asfd->desc, in->total_got, in->total_blks,
+		in->total_got*100/in->total_blks,
+		in->total_champs, in->total_loaded/1024);
+}
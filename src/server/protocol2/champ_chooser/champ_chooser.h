@@ -4,6 +4,7 @@
 extern int champ_chooser_init(const char *sparse, struct conf **confs);
 
 extern int deduplicate(struct asfd *asfd, struct conf **confs);
+extern void deduplicate_log_totals(struct asfd *asfd);
 extern int is_hook(uint64_t fingerprint);
 
 #endif
@@ -118,6 +118,8 @@ struct asfd *champ_chooser_connect(struct async *as,
 	if(chfd->write_str(chfd, CMD_GEN, champname)
 	  || chfd->read_expect(chfd, CMD_GEN, "cname ok"))
 		goto error;
+	// The replies are all dealt with straight away.
+	chfd->rbuf_view=1;
 
 	free(champname);
 	return chfd;
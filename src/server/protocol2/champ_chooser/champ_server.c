@@ -25,6 +25,9 @@ static int champ_chooser_new_client(struct async *as, struct conf **confs)
 		ASFD_STREAM_STANDARD, confs)
 	  || !(newfd->blist=blist_alloc()))
 		goto error;
+	// Nothing that the clients send needs to be kept, so save on copying
+	// it out of the read buffer.
+	newfd->rbuf_view=1;
 	as->asfd_add(as, newfd);
 
 	logp("Connected to fd %d\n", newfd->fd);
@@ -159,6 +162,7 @@ static int deal_with_client_rbuf(struct asfd *asfd, struct conf **confs)
 			//printf("Was told no more sigs\n");
 			if(deduplicate(asfd, confs)<0)
 				goto error;
+			deduplicate_log_totals(asfd);
 		}
 		else
 		{
@@ -183,10 +187,10 @@ static int deal_with_client_rbuf(struct asfd *asfd, struct conf **confs)
 		iobuf_log_unexpected(asfd->rbuf, __func__);
 		goto error;
 	}
-	iobuf_free_content(asfd->rbuf);
+	asfd->rbuf_release(asfd);
 	return 0;
 error:
-	iobuf_free_content(asfd->rbuf);
+	asfd->rbuf_release(asfd);
 	return -1;
 }
 
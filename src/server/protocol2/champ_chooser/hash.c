@@ -87,10 +87,11 @@ static int process_sig(struct blk *blk)
 	return 0;
 }
 
-int hash_load(const char *champ, struct conf **confs)
+int hash_load(const char *champ, struct conf **confs, uint64_t *bytes)
 {
 	int ret=-1;
 	char *path=NULL;
+	struct stat statp;
 	struct fzp *fzp=NULL;
 	struct sbuf *sb=NULL;
 	static struct blk *blk=NULL;
@@ -98,6 +99,7 @@ int hash_load(const char *champ, struct conf **confs)
 	if(!(path=prepend_s(get_string(confs[OPT_DIRECTORY]), champ))
 	  || !(fzp=fzp_gzopen(path, "rb")))
 		goto end;
+	if(!lstat(path, &statp)) *bytes+=statp.st_size;
 
 	if(!sb && !(sb=sbuf_alloc(confs))) goto end;
 	if(!blk && !(blk=blk_alloc())) goto end;
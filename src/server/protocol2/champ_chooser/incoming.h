@@ -10,6 +10,12 @@ struct incoming
 	uint16_t allocated;
 
 	uint16_t got;
+
+	// Running totals for the client, logged at the end.
+	uint64_t total_blks;
+	uint64_t total_got;
+	uint64_t total_champs;
+	uint64_t total_loaded;	// Bytes of champ manifests read.
 };
 
 extern struct incoming *incoming_alloc(void);
@@ -226,6 +226,21 @@ static int fwrite_buf(enum cmd cmd, const char *buf, unsigned int s, FILE *fp)
 	return 0;
 }
 
+static int fwrite_index(uint32_t offset, FILE *fp)
+{
+	uint8_t buf[DATA_FILE_INDEX_ENTRY];
+	buf[0]=(offset>>24)&0xFF;
+	buf[1]=(offset>>16)&0xFF;
+	buf[2]=(offset>>8)&0xFF;
+	buf[3]=offset&0xFF;
+	if(fwrite(buf, 1, sizeof(buf), fp)!=sizeof(buf))
+	{
+		logp("Short index write\n");
+		return -1;
+	}
+	return 0;
+}
+
 static FILE *file_open_w(const char *path, const char *mode)
 {
 	FILE *fp;
@@ -234,10 +249,11 @@ static FILE *file_open_w(const char *path, const char *mode)
 	return fp;
 }
 
-static FILE *open_data_file_for_write(struct dpth *dpth, struct blk *blk)
+static int open_data_file_for_write(struct dpth *dpth, struct blk *blk)
 {
-	FILE *fp=NULL;
+	int ret=-1;
 	char *path=NULL;
+	char *ipath=NULL;
 	char *savepathstr=NULL;
 	struct dpth_lock *head=dpth->head;
 //printf("moving for: %s\n", blk->save_path);
@@ -258,12 +274,22 @@ static FILE *open_data_file_for_write(struct dpth *dpth, struct blk *blk)
 		goto end;
 	}
 
-	if(!(path=prepend_slash(dpth->base_path, savepathstr, 14)))
+	if(!(path=prepend_slash(dpth->base_path, savepathstr, 14))
+	  || !(ipath=prepend(path, DATA_FILE_INDEX_SUFFIX))
+	  || !(dpth->fp=file_open_w(path, "wb"))
+	  || !(dpth->ifp=open_file(ipath, "wb")))
 		goto end;
-	fp=file_open_w(path, "wb");
+	dpth->offset=0;
+	ret=0;
 end:
+	if(ret)
+	{
+		close_fp(&dpth->fp);
+		close_fp(&dpth->ifp);
+	}
 	free_w(&path);
-	return fp;
+	free_w(&ipath);
+	return ret;
 }
 
 int dpth_protocol2_fwrite(struct dpth *dpth,
@@ -282,7 +308,51 @@ int dpth_protocol2_fwrite(struct dpth *dpth,
 
 	// Open the current list head if we have no fp.
 	if(!dpth->fp
-	  && !(dpth->fp=open_data_file_for_write(dpth, blk))) return -1;
+	  && open_data_file_for_write(dpth, blk)) return -1;
+
+	if(fwrite_buf(CMD_DATA, iobuf->buf, iobuf->len, dpth->fp))
+		return -1;
+	dpth->offset+=5+iobuf->len;
+	return fwrite_index(dpth->offset, dpth->ifp);
+}
 
-	return fwrite_buf(CMD_DATA, iobuf->buf, iobuf->len, dpth->fp);
+// Work out how many blocks at the start of a data file are known to be
+// complete, from its index. An interrupted backup can leave a data file with
+// fewer blocks in it than the manifests refer to.
+// Returns 0 on OK, 1 if there is no index, -1 on error.
+int dpth_protocol2_stored_blocks(const char *path, unsigned int *count)
+{
+	int ret=-1;
+	FILE *fp=NULL;
+	char *ipath=NULL;
+	struct stat statp;
+	uint8_t b[DATA_FILE_INDEX_ENTRY];
+
+	*count=0;
+	if(!(ipath=prepend(path, DATA_FILE_INDEX_SUFFIX)))
+		goto end;
+	if(!(fp=fopen(ipath, "rb")))
+	{
+		ret=1;
+		goto end;
+	}
+	if(lstat(path, &statp))
+	{
+		ret=0;
+		goto end;
+	}
+	while(fread(b, 1, sizeof(b), fp)==sizeof(b))
+	{
+		uint32_t offset=((uint32_t)b[0]<<24)
+			|((uint32_t)b[1]<<16)
+			|((uint32_t)b[2]<<8)
+			|(uint32_t)b[3];
+		if((off_t)offset>statp.st_size) break;
+		(*count)++;
+	}
+	ret=0;
+end:
+	if(fp) fclose(fp);
+	free_w(&ipath);
+	return ret;
 }
@@ -3,6 +3,13 @@
 
 #include "../dpth.h"
 
+// Each data file has an index file next to it, so that single blocks can be
+// read without going through the whole data file. For each block, it holds
+// the offset of the end of that block in the data file, as four bytes, most
+// significant first.
+#define DATA_FILE_INDEX_SUFFIX	".idx"
+#define DATA_FILE_INDEX_ENTRY	4
+
 extern int dpth_protocol2_init(struct dpth *dpth, const char *base_path,
 	int max_storage_subdirs);
 
@@ -13,4 +20,7 @@ extern char *dpth_protocol2_get_save_path(struct dpth *dpth);
 extern int dpth_protocol2_fwrite(struct dpth *dpth,
 	struct iobuf *iobuf, struct blk *blk);
 
+extern int dpth_protocol2_stored_blocks(const char *path,
+	unsigned int *count);
+
 #endif
@@ -8,5 +8,6 @@
 #include "rblk.h"
 #include "restore.h"
 #include "restore_spool.h"
+#include "resume.h"
 
 #endif
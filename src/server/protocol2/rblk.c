@@ -1,74 +1,257 @@
 #include "include.h"
 #include "../../cmd.h"
 #include "../../hexmap.h"
-
-// For retrieving stored data.
-struct rblk
-{
-	char *datpath;
-	struct iobuf readbuf[DATA_FILE_SIG_MAX];
-	unsigned int readbuflen;
-};
+#include "dpth.h"
 
 #define RBLK_MAX	10
 
-// Return 0 on OK, -1 on error, 1 when there is no more to read.
-static int read_next_data(FILE *fp, struct rblk *rblk, int ind, int r)
+// After this many blocks have been wanted from one data file, reading the
+// whole thing is likely to be cheaper than carrying on with single reads.
+#define RBLK_SINGLES_MAX	32
+
+// Header in front of each block: one byte of cmd, four hex digits of length.
+#define RBLK_HDR_LEN	5
+
+static int read_whole_file(int fd, struct rblk *rblk, const char *datpath)
 {
-	enum cmd cmd=CMD_ERROR;
-	size_t bytes;
-	unsigned int len;
-	char buf[5];
-	// FIX THIS: Check for the appropriate return value that means there
-	// is no more to read.
-	if(fread(buf, 1, 5, fp)!=5) return 1;
-	if((sscanf(buf, "%c%04X", (uint8_t *)&cmd, &len))!=2)
+	ssize_t got;
+	size_t len=0;
+	struct stat statp;
+
+	if(fstat(fd, &statp))
 	{
-		logp("sscanf failed in %s: %s\n", __func__, buf);
+		logp("Could not fstat %s: %s\n", datpath, strerror(errno));
 		return -1;
 	}
-	if(cmd!=CMD_DATA)
+	// Keep the buffer from the last data file if it is big enough, which
+	// it usually is.
+	if((size_t)statp.st_size>rblk->datamax)
 	{
-		logp("unknown cmd in %s: %c\n", __func__, cmd);
-		return -1;
+		free_w(&rblk->data);
+		rblk->datamax=0;
+		if(!(rblk->data=(char *)malloc_w(statp.st_size, __func__)))
+			return -1;
+		rblk->datamax=statp.st_size;
 	}
-	if(!(rblk[ind].readbuf[r].buf=
-		(char *)realloc_w(rblk[ind].readbuf[r].buf, len, __func__)))
-		return -1;
-	if((bytes=fread(rblk[ind].readbuf[r].buf, 1, len, fp))!=len)
+	while(len<(size_t)statp.st_size)
 	{
-		logp("Short read: %d wanted: %d\n", (int)bytes, (int)len);
-		return -1;
+		if((got=read(fd, rblk->data+len, statp.st_size-len))<0)
+		{
+			if(errno==EINTR) continue;
+			logp("Could not read %s: %s\n",
+				datpath, strerror(errno));
+			return -1;
+		}
+		if(!got) break;
+		len+=got;
 	}
-	rblk[ind].readbuf[r].len=len;
-	//printf("read: %d:%d %04X\n", r, len, r);
-
+	rblk->datalen=len;
 	return 0;
 }
 
-static int load_rblk(struct rblk *rblks, int ind, const char *datpath)
+// Point each readbuf at its block in the data.
+static int index_blocks(struct rblk *rblk, const char *datpath)
 {
-	int r;
-	FILE *dfp;
-	free_w(&rblks[ind].datpath);
-	if(!(rblks[ind].datpath=strdup_w(datpath, __func__)))
-		return -1;
-	printf("swap %d to: %s\n", ind, datpath);
+	unsigned int r;
+	unsigned int len;
+	size_t off=0;
+	char hdr[RBLK_HDR_LEN+1];
+	enum cmd cmd=CMD_ERROR;
 
-	if(!(dfp=open_file(datpath, "rb"))) return -1;
 	for(r=0; r<DATA_FILE_SIG_MAX; r++)
 	{
-		switch(read_next_data(dfp, rblks, ind, r))
+		// FIX THIS: A partial header at the end is treated as the
+		// end of the file, as before.
+		if(off+RBLK_HDR_LEN>rblk->datalen) break;
+		memcpy(hdr, rblk->data+off, RBLK_HDR_LEN);
+		hdr[RBLK_HDR_LEN]='\0';
+		if((sscanf(hdr, "%c%04X", (uint8_t *)&cmd, &len))!=2)
 		{
-			case 0: continue;
-			case 1: break;
-			case -1:
-			default:
-				return -1;
+			logp("sscanf failed in %s: %s\n", __func__, hdr);
+			return -1;
+		}
+		if(cmd!=CMD_DATA)
+		{
+			logp("unknown cmd in %s: %c\n", __func__, cmd);
+			return -1;
+		}
+		off+=RBLK_HDR_LEN;
+		if(off+len>rblk->datalen)
+		{
+			logp("Short read: %d wanted: %d in %s\n",
+				(int)(rblk->datalen-off), (int)len, datpath);
+			return -1;
 		}
+		rblk->readbuf[r].buf=rblk->data+off;
+		rblk->readbuf[r].len=len;
+		off+=len;
+	}
+	rblk->readbuflen=r;
+	return 0;
+}
+
+int rblk_load(struct rblk *rblk, const char *datpath)
+{
+	int fd;
+	int ret=-1;
+	free_w(&rblk->datpath);
+	rblk->loaded=0;
+	rblk->readbuflen=0;
+	if(!(rblk->datpath=strdup_w(datpath, __func__)))
+		return -1;
+
+	if((fd=open(datpath, O_RDONLY))<0)
+	{
+		logp("could not open %s: %s\n", datpath, strerror(errno));
+		goto end;
+	}
+	if(read_whole_file(fd, rblk, datpath)
+	  || index_blocks(rblk, datpath))
+		goto end;
+	rblk->loaded=1;
+	ret=0;
+end:
+	if(fd>=0) close(fd);
+	// Do not leave a half loaded entry around to be found by name.
+	if(ret) free_w(&rblk->datpath);
+	return ret;
+}
+
+static void rblk_reset(struct rblk *rblk)
+{
+	free_w(&rblk->datpath);
+	rblk->loaded=0;
+	rblk->readbuflen=0;
+	rblk->index_read=0;
+	rblk->indexlen=0;
+	rblk->singles=0;
+}
+
+void rblk_free_content(struct rblk *rblk)
+{
+	if(!rblk) return;
+	rblk_reset(rblk);
+	free_w(&rblk->data);
+	rblk->datalen=0;
+	rblk->datamax=0;
+	free_v((void **)&rblk->index);
+	free_w(&rblk->single);
+	rblk->singlemax=0;
+}
+
+// Returns 0 on OK, -1 on error. If there is no usable index file, indexlen
+// is left at 0.
+static int read_index(struct rblk *rblk)
+{
+	int ret=-1;
+	size_t i;
+	size_t got;
+	FILE *fp=NULL;
+	char *path=NULL;
+	uint8_t buf[DATA_FILE_SIG_MAX*DATA_FILE_INDEX_ENTRY];
+
+	rblk->index_read=1;
+	rblk->indexlen=0;
+	if(!(path=prepend(rblk->datpath, DATA_FILE_INDEX_SUFFIX)))
+		goto end;
+	// Data files from older versions have no index.
+	if(!(fp=fopen(path, "rb")))
+	{
+		ret=0;
+		goto end;
+	}
+	got=fread(buf, 1, sizeof(buf), fp)/DATA_FILE_INDEX_ENTRY;
+	if(!rblk->index
+	  && !(rblk->index=(uint32_t *)
+		malloc_w(DATA_FILE_SIG_MAX*sizeof(uint32_t), __func__)))
+			goto end;
+	for(i=0; i<got; i++)
+	{
+		uint8_t *b=buf+i*DATA_FILE_INDEX_ENTRY;
+		rblk->index[i]=((uint32_t)b[0]<<24)
+			|((uint32_t)b[1]<<16)
+			|((uint32_t)b[2]<<8)
+			|(uint32_t)b[3];
+	}
+	rblk->indexlen=got;
+	ret=0;
+end:
+	if(fp) fclose(fp);
+	free_w(&path);
+	return ret;
+}
+
+// Returns 0 when the block was read on its own, -1 on error, and 1 when the
+// whole data file ought to be loaded instead.
+static int read_single(struct rblk *rblk, unsigned int datno, struct blk *blk)
+{
+	int fd=-1;
+	int ret=-1;
+	uint32_t start;
+	uint32_t end;
+	unsigned int len;
+	size_t want;
+	char hdr[RBLK_HDR_LEN+1];
+	enum cmd cmd=CMD_ERROR;
+
+	if(rblk->singles>=RBLK_SINGLES_MAX) return 1;
+	if(!rblk->index_read && read_index(rblk)) return -1;
+	if(datno>=rblk->indexlen) return 1;
+
+	start=datno?rblk->index[datno-1]:0;
+	end=rblk->index[datno];
+	if(end<start+RBLK_HDR_LEN || end-start>RBLK_HDR_LEN+0xFFFF)
+	{
+		logp("Bad index entry %d for %s\n", datno, rblk->datpath);
+		return 1;
+	}
+	want=end-start;
+	if(want>rblk->singlemax)
+	{
+		free_w(&rblk->single);
+		rblk->singlemax=0;
+		if(!(rblk->single=(char *)malloc_w(want, __func__)))
+			return -1;
+		rblk->singlemax=want;
+	}
+
+	if((fd=open(rblk->datpath, O_RDONLY))<0)
+	{
+		logp("could not open %s: %s\n",
+			rblk->datpath, strerror(errno));
+		return -1;
 	}
-	rblks[ind].readbuflen=r;
-	fclose(dfp);
+	if(pread(fd, rblk->single, want, start)!=(ssize_t)want)
+	{
+		// Perhaps the index is out of step with the data file.
+		ret=1;
+		goto end;
+	}
+	memcpy(hdr, rblk->single, RBLK_HDR_LEN);
+	hdr[RBLK_HDR_LEN]='\0';
+	if(sscanf(hdr, "%c%04X", (uint8_t *)&cmd, &len)!=2
+	  || cmd!=CMD_DATA
+	  || len!=want-RBLK_HDR_LEN)
+	{
+		logp("Index does not match block %d in %s\n",
+			datno, rblk->datpath);
+		ret=1;
+		goto end;
+	}
+	blk->data=rblk->single+RBLK_HDR_LEN;
+	blk->length=len;
+	rblk->singles++;
+	ret=0;
+end:
+	close(fd);
+	return ret;
+}
+
+static int claim_rblk(struct rblk *rblks, int ind, const char *datpath)
+{
+	rblk_reset(&rblks[ind]);
+	if(!(rblks[ind].datpath=strdup_w(datpath, __func__)))
+		return -1;
 	return 0;
 }
 
@@ -82,7 +265,7 @@ static struct rblk *get_rblk(struct rblk *rblks, const char *datpath)
 	{
 		if(!rblks[ind].datpath)
 		{
-			if(load_rblk(rblks, ind, datpath)) return NULL;
+			if(claim_rblk(rblks, ind, datpath)) return NULL;
 			last_swap_ind=ind;
 			current_ind=ind;
 			return &rblks[current_ind];
@@ -100,7 +283,7 @@ static struct rblk *get_rblk(struct rblk *rblks, const char *datpath)
 			// Replace the oldest one.
 			ind=last_swap_ind+1;
 			if(ind==RBLK_MAX) ind=0;
-			if(load_rblk(rblks, ind, datpath)) return NULL;
+			if(claim_rblk(rblks, ind, datpath)) return NULL;
 			last_swap_ind=ind;
 			current_ind=ind;
 			return &rblks[current_ind];
@@ -140,8 +323,20 @@ int rblk_retrieve_data(const char *datpath, struct blk *blk)
 		return -1;
 	}
 
+	if(!rblk->loaded)
+	{
+		switch(read_single(rblk, datno, blk))
+		{
+			case 0: return 0;
+			case 1: break;
+			default: return -1;
+		}
+		printf("swap to: %s\n", fulldatpath);
+		if(rblk_load(rblk, fulldatpath)) return -1;
+	}
+
 //	printf("lookup: %s (%s)\n", fulldatpath, cp);
-	if(datno>rblk->readbuflen)
+	if(datno>=rblk->readbuflen)
 	{
 		logp("dat index %d is greater than readbuflen: %d\n",
 			datno, rblk->readbuflen);
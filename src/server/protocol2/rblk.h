@@ -1,6 +1,32 @@
 #ifndef _RBLK_H
 #define _RBLK_H
 
+// For retrieving stored data.
+// The first few blocks wanted from a data file are read on their own, using
+// the index file that sits next to it. If more are wanted after that, the
+// data file is read into memory in one go, and the blocks in it are indexed
+// where they lie, rather than each being copied out separately.
+struct rblk
+{
+	char *datpath;
+	uint8_t loaded;		// Whether 'data' holds the whole data file.
+	char *data;
+	size_t datalen;
+	size_t datamax;		// Allocated length of 'data'.
+	struct iobuf readbuf[DATA_FILE_SIG_MAX];
+	unsigned int readbuflen;
+
+	uint8_t index_read;
+	uint32_t *index;	// End offset of each block in the data file.
+	unsigned int indexlen;
+	unsigned int singles;	// How many blocks have been read on their own.
+	char *single;		// The last one.
+	size_t singlemax;
+};
+
+extern int rblk_load(struct rblk *rblk, const char *datpath);
+extern void rblk_free_content(struct rblk *rblk);
+
 extern int rblk_retrieve_data(const char *datpath, struct blk *blk);
 
 #endif
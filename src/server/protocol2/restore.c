@@ -3,10 +3,273 @@
 #include "champ_chooser/hash.h"
 #include "../../slist.h"
 #include "../../hexmap.h"
+#include "../../base64.h"
 #include "../../server/protocol1/restore.h"
 #include "../manio.h"
 #include "../sdirs.h"
 
+// With restore_dedup, the client remembers where it put each block that it
+// was sent, counting from the start of the stream. A block that was sent
+// recently is then sent as that number instead of as data.
+struct sent_blk
+{
+	uint64_t savepath;
+	uint64_t seq;
+	UT_hash_handle hh;
+};
+
+static struct sent_blk *sent_table=NULL;
+// Holds the last RESTORE_DEDUP_WINDOW blocks sent, so that the oldest can be
+// dropped from the table when it is reused.
+static struct sent_blk *sent_ring=NULL;
+static uint64_t sent_seq=0;
+static uint64_t refs_sent=0;
+static uint64_t refs_bytes=0;
+
+int restore_dedup_init(void)
+{
+	restore_dedup_free();
+	if(!(sent_ring=(struct sent_blk *)calloc_w(RESTORE_DEDUP_WINDOW,
+		sizeof(struct sent_blk), __func__)))
+			return -1;
+	return 0;
+}
+
+void restore_dedup_free(void)
+{
+	if(!sent_ring) return;
+	logp("Sent %" PRIu64 " of %" PRIu64 " blocks as references,"
+		" saving %" PRIu64 " bytes\n",
+		refs_sent, refs_sent+sent_seq, refs_bytes);
+	HASH_CLEAR(hh, sent_table);
+	free_v((void **)&sent_ring);
+	sent_seq=0;
+	refs_sent=0;
+	refs_bytes=0;
+}
+
+// Returns 1 if a reference was sent, 0 if the data needs to be sent.
+static int send_ref_maybe(struct asfd *asfd, struct blk *blk)
+{
+	uint64_t key;
+	char ref[32]="";
+	struct sent_blk *s=NULL;
+
+	memcpy(&key, blk->savepath, sizeof(key));
+	HASH_FIND(hh, sent_table, &key, sizeof(key), s);
+	if(s)
+	{
+		snprintf(ref, sizeof(ref), "%" PRIX64, s->seq);
+		if(asfd->write_str(asfd, CMD_DATA_REF, ref)) return -1;
+		refs_sent++;
+		refs_bytes+=blk->length;
+		return 1;
+	}
+
+	s=&sent_ring[sent_seq%RESTORE_DEDUP_WINDOW];
+	if(sent_seq>=RESTORE_DEDUP_WINDOW)
+		HASH_DEL(sent_table, s);
+	s->savepath=key;
+	s->seq=sent_seq++;
+	HASH_ADD(hh, sent_table, savepath, sizeof(s->savepath), s);
+	return 0;
+}
+
+// With restore_delta, the signatures of the blocks of a large file are sent
+// ahead of the data. The client checks them against the copy of the file that
+// it already has, and asks for the blocks that it does not have. Only those
+// are then sent. Just the save paths are kept here until then.
+struct delta_blk
+{
+	uint8_t savepath[SAVE_PATH_LEN];
+	uint8_t wanted;
+};
+
+static int delta_on=0;
+static int delta_file=0;
+static struct delta_blk *delta_blks=NULL;
+static uint64_t delta_len=0;
+static uint64_t delta_alloc=0;
+static uint64_t delta_files=0;
+static uint64_t delta_total=0;
+static uint64_t delta_sent=0;
+
+int restore_delta_init(void)
+{
+	restore_delta_free();
+	delta_on=1;
+	return 0;
+}
+
+void restore_delta_free(void)
+{
+	if(!delta_on) return;
+	logp("Sent %" PRIu64 " of %" PRIu64 " blocks"
+		" of %" PRIu64 " files checked with restore_delta\n",
+		delta_sent, delta_total, delta_files);
+	free_v((void **)&delta_blks);
+	delta_on=0;
+	delta_file=0;
+	delta_len=0;
+	delta_alloc=0;
+	delta_files=0;
+	delta_total=0;
+	delta_sent=0;
+}
+
+int restore_delta_active(void)
+{
+	return delta_file;
+}
+
+static int send_delta_sig(struct asfd *asfd, struct blk *blk)
+{
+	struct iobuf wbuf;
+	char buf[CHECKSUM_LEN];
+
+	if(delta_len>=delta_alloc)
+	{
+		uint64_t alloc=delta_alloc?delta_alloc*2:1024;
+		struct delta_blk *tmp;
+		if(!(tmp=(struct delta_blk *)realloc_w(delta_blks,
+			alloc*sizeof(struct delta_blk), __func__)))
+				return -1;
+		delta_blks=tmp;
+		delta_alloc=alloc;
+	}
+	memcpy(delta_blks[delta_len].savepath, blk->savepath, SAVE_PATH_LEN);
+	delta_blks[delta_len++].wanted=0;
+
+	// The same layout as the client uses when backing up.
+	memcpy(buf, &blk->fingerprint, FINGERPRINT_LEN);
+	memcpy(buf+FINGERPRINT_LEN, blk->md5sum, MD5_DIGEST_LENGTH);
+	iobuf_set(&wbuf, CMD_SIG, buf, CHECKSUM_LEN);
+	return asfd->write(asfd, &wbuf);
+}
+
+static int read_delta_requests(struct asfd *asfd, struct conf **confs)
+{
+	int ret=-1;
+	int64_t index;
+	struct iobuf *rbuf=asfd->rbuf;
+
+	while(1)
+	{
+		iobuf_free_content(rbuf);
+		if(asfd->read(asfd)) goto end;
+		switch(rbuf->cmd)
+		{
+			case CMD_DATA_REQ:
+				from_base64(&index, rbuf->buf);
+				if(index<0 || (uint64_t)index>=delta_len)
+				{
+					logp("Block request out of range: %"
+						PRId64 "\n", index);
+					goto end;
+				}
+				delta_blks[index].wanted=1;
+				continue;
+			case CMD_MESSAGE:
+			case CMD_WARNING:
+				log_recvd(rbuf, confs, 0);
+				continue;
+			case CMD_GEN:
+				if(!strcmp(rbuf->buf, "requests_end"))
+				{
+					ret=0;
+					goto end;
+				}
+				// Fall through.
+			default:
+				iobuf_log_unexpected(rbuf, __func__);
+				goto end;
+		}
+	}
+end:
+	iobuf_free_content(rbuf);
+	return ret;
+}
+
+// Call once all the signatures of a file have been sent. Sends the blocks
+// that the client asks for.
+static int restore_delta_end(struct asfd *asfd,
+	struct sdirs *sdirs, struct conf **confs)
+{
+	uint64_t i;
+	struct blk blk;
+	struct iobuf wbuf;
+
+	if(!delta_file) return 0;
+	delta_file=0;
+
+	if(asfd->write_str(asfd, CMD_GEN, "sigs_end")
+	  || read_delta_requests(asfd, confs))
+		return -1;
+
+	memset(&blk, 0, sizeof(blk));
+	for(i=0; i<delta_len; i++)
+	{
+		if(!delta_blks[i].wanted) continue;
+		memcpy(blk.savepath, delta_blks[i].savepath, SAVE_PATH_LEN);
+		if(rblk_retrieve_data(sdirs->data, &blk))
+		{
+			logp("Could not retrieve blk data.\n");
+			return -1;
+		}
+		iobuf_set(&wbuf, CMD_DATA, blk.data, blk.length);
+		if(asfd->write(asfd, &wbuf)) return -1;
+		delta_sent++;
+	}
+	delta_total+=delta_len;
+	delta_files++;
+	delta_len=0;
+	return 0;
+}
+
+// With restore_sparse, a run of blocks of zeroes is sent as its length once
+// it comes to an end, instead of block by block.
+static int sparse_on=0;
+static uint64_t zero_run=0;
+static uint64_t zero_runs=0;
+static uint64_t zero_bytes=0;
+
+int restore_sparse_init(void)
+{
+	restore_sparse_free();
+	sparse_on=1;
+	return 0;
+}
+
+void restore_sparse_free(void)
+{
+	if(!sparse_on) return;
+	logp("Sent %" PRIu64 " bytes of zeroes as %" PRIu64 " runs\n",
+		zero_bytes, zero_runs);
+	sparse_on=0;
+	zero_run=0;
+	zero_runs=0;
+	zero_bytes=0;
+}
+
+static int flush_zero_run(struct asfd *asfd)
+{
+	char len[32]="";
+	if(!zero_run) return 0;
+	snprintf(len, sizeof(len), "%" PRIX64, zero_run);
+	if(asfd->write_str(asfd, CMD_DATA_ZERO, len)) return -1;
+	zero_runs++;
+	zero_bytes+=zero_run;
+	zero_run=0;
+	return 0;
+}
+
+int protocol2_restore_file_end(struct asfd *asfd,
+	struct sdirs *sdirs, struct conf **confs)
+{
+	if(flush_zero_run(asfd)) return -1;
+	return restore_delta_end(asfd, sdirs, confs);
+}
+
 static int send_data(struct asfd *asfd, struct blk *blk,
 	enum action act, struct sbuf *need_data, struct conf **confs)
 {
@@ -15,6 +278,24 @@ static int send_data(struct asfd *asfd, struct blk *blk,
 	switch(act)
 	{
 		case ACTION_RESTORE:
+			if(delta_file)
+				return send_delta_sig(asfd, blk);
+			if(sparse_on && blk_is_zero(blk))
+			{
+				zero_run+=blk->length;
+				return 0;
+			}
+			if(flush_zero_run(asfd))
+				return -1;
+			if(sent_ring)
+			{
+				switch(send_ref_maybe(asfd, blk))
+				{
+					case 0: break;
+					case 1: return 0;
+					default: return -1;
+				}
+			}
 			iobuf_set(&wbuf, CMD_DATA, blk->data, blk->length);
 			if(asfd->write(asfd, &wbuf)) return -1;
 			return 0;
@@ -54,6 +335,16 @@ int restore_sbuf_protocol2(struct asfd *asfd, struct sbuf *sb, enum action act,
 	enum cntr_status cntr_status,
 	struct conf **confs, struct sbuf *need_data)
 {
+	if(delta_on
+	  && act==ACTION_RESTORE
+	  && sb->path.cmd==CMD_FILE
+	  && sb->statp.st_size>=RESTORE_DELTA_MIN_SIZE)
+	{
+		// Tell the client before it opens the file.
+		if(asfd->write_str(asfd, CMD_GEN, "restore_delta"))
+			return -1;
+		delta_file=1;
+	}
 	if(asfd->write(asfd, &sb->attr)
 	  || asfd->write(asfd, &sb->path))
 		return -1;
@@ -76,6 +367,8 @@ int restore_sbuf_protocol2(struct asfd *asfd, struct sbuf *sb, enum action act,
 			b=n;
 		}
 		sb->protocol2->bstart=sb->protocol2->bend=NULL;
+		if(flush_zero_run(asfd))
+			return -1;
 	}
 
 	switch(sb->path.cmd)
@@ -114,6 +407,7 @@ int protocol2_extra_restore_stream_bits(struct asfd *asfd, struct blk *blk,
 			return -1;
 		nblk->length=blk->length;
 		memcpy(nblk->data, blk->data, blk->length);
+		memcpy(nblk->savepath, blk->savepath, SAVE_PATH_LEN);
 		xb=slist->head;
 		if(!xb->protocol2->bstart)
 			xb->protocol2->bstart=xb->protocol2->bend=nblk;
@@ -134,5 +428,6 @@ int protocol2_extra_restore_stream_bits(struct asfd *asfd, struct blk *blk,
 		logw(asfd, cconfs, msg);
 	}
 	blk->data=NULL;
+	blk->got_save_path=0;
 	return 0;
 }
@@ -1,6 +1,20 @@
 #ifndef _RESTORE_SERVER_PROTOCOL2_H
 #define _RESTORE_SERVER_PROTOCOL2_H
 
+extern int restore_dedup_init(void);
+extern void restore_dedup_free(void);
+
+extern int restore_delta_init(void);
+extern void restore_delta_free(void);
+extern int restore_delta_active(void);
+
+extern int restore_sparse_init(void);
+extern void restore_sparse_free(void);
+
+// Call at the end of the data of each file.
+extern int protocol2_restore_file_end(struct asfd *asfd,
+	struct sdirs *sdirs, struct conf **confs);
+
 extern int protocol2_extra_restore_stream_bits(struct asfd *asfd,
 	struct blk *blk, struct slist *slist, enum action act,
 	struct sbuf *need_data, int last_ent_was_dir, struct conf **cconfs);
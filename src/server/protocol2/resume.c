@@ -0,0 +1,434 @@
+#include "include.h"
+#include "../../cmd.h"
+#include "../../hexmap.h"
+#include "../../pathcmp.h"
+#include "../../protocol2/blk.h"
+#include "../manio.h"
+#include "../sdirs.h"
+#include "dpth.h"
+
+// Resuming an interrupted protocol2 backup.
+//
+// The changed and unchanged manifests that were written before the
+// interruption are moved aside, and the entries in them that are known to be
+// complete are copied back. The last entry in the changed manifest might not
+// have got all of its blocks, so it is left out, and the phase1 scan carries
+// on from the entry after the last one that was kept.
+// Each complete changed manifest file is given to the champ chooser as a
+// dedup candidate, as it would have been if the backup had not been
+// interrupted. So are the blocks that the left out entry did get, in a
+// separate manifest, so that they do not have to be sent again.
+
+#define OLD_SUFFIX	".resume"
+#define PARTIAL_DIR	"partial"
+
+struct stored
+{
+	char datpath[16];	// "XXXX/XXXX/XXXX" of the data file.
+	int count;		// Blocks known to be in it, or -1 for no index.
+};
+
+// Return -1 on error, 0 if the block is not in the data store, 1 if it is.
+static int blk_is_stored(struct stored *stored,
+	const char *data, struct blk *blk)
+{
+	int ret;
+	unsigned int count;
+	char *path=NULL;
+	const char *savepathstr=bytes_to_savepathstr_with_sig(blk->savepath);
+
+	if(strncmp(stored->datpath, savepathstr, 14))
+	{
+		snprintf(stored->datpath, sizeof(stored->datpath),
+			"%.14s", savepathstr);
+		if(!(path=prepend_s(data, stored->datpath)))
+			return -1;
+		ret=dpth_protocol2_stored_blocks(path, &count);
+		free_w(&path);
+		switch(ret)
+		{
+			case 0: stored->count=(int)count; break;
+			// Data files from before there were indexes were
+			// finished with long ago.
+			case 1: stored->count=-1; break;
+			default:
+				stored->datpath[0]='\0';
+				return -1;
+		}
+	}
+	if(stored->count<0) return 1;
+	return strtoul(savepathstr+15, NULL, 16)<(unsigned long)stored->count;
+}
+
+// Return -1 on error, 0 for an entry, 1 for a sig, 2 for the end.
+// A manifest that was being written when the backup was interrupted may stop
+// part way through, so a read error is taken as the end, with 'damaged' set.
+static int read_next(struct manio *manio, struct sbuf *sb, struct blk *blk,
+	int *damaged, struct conf **confs)
+{
+	blk->got_save_path=0;
+	switch(manio_sbuf_fill(manio, NULL, sb, blk, NULL, confs))
+	{
+		case 0: return blk->got_save_path?1:0;
+		case 1: return 2;
+		default:
+			logp("Stopped reading %s at a damaged part\n",
+				manio->directory);
+			*damaged=1;
+			return 2;
+	}
+}
+
+static int open_old(const char *dir, struct manio **manio,
+	struct sbuf **sb, struct blk **blk, struct conf **confs)
+{
+	if(!(*manio=manio_alloc())
+	  || manio_init_read(*manio, dir)
+	  || !(*sb=sbuf_alloc(confs))
+	  || !(*blk=blk_alloc()))
+		return -1;
+	return 0;
+}
+
+static void close_old(struct manio **manio, struct sbuf **sb, struct blk **blk)
+{
+	manio_free(manio);
+	sbuf_free(sb);
+	blk_free(blk);
+}
+
+static int send_candidate(struct asfd *chfd, const char *fpath)
+{
+	struct iobuf wbuf;
+	iobuf_from_str(&wbuf, CMD_MANIFEST, (char *)fpath);
+	return chfd->write(chfd, &wbuf);
+}
+
+static int write_sig(struct manio *manio, struct blk *blk, struct asfd *chfd)
+{
+	if(manio_write_sig_and_path(manio, blk)) return -1;
+	// Have finished a manifest file, so the champ chooser can start
+	// using it.
+	if(!manio->sig_count && send_candidate(chfd, manio->offset.fpath))
+		return -1;
+	return 0;
+}
+
+// Close the file being written, so that it is safely on disk before the old
+// manifests go, and let the champ chooser have it.
+static int finish_file(struct manio *manio, struct asfd *chfd)
+{
+	int sigs=manio->sig_count;
+	if(!manio->fzp) return 0;
+	if(manio_close(manio)) return -1;
+	manio->sig_count=0;
+	if(sigs && chfd && send_candidate(chfd, manio->offset.fpath))
+		return -1;
+	return 0;
+}
+
+static int move_aside(const char *dir, char **old)
+{
+	struct stat statp;
+	if(!(*old=prepend(dir, OLD_SUFFIX))) return -1;
+	if(!lstat(*old, &statp))
+	{
+		// An earlier resume was interrupted before it finished
+		// copying, so go from the old ones again.
+		return recursive_delete(dir, NULL, 1);
+	}
+	if(lstat(dir, &statp)) return 0;
+	return do_rename(dir, *old);
+}
+
+// Find where the readable part of the unchanged manifest ends. The entry
+// that it ends in, and anything after it, cannot be trusted.
+static int unchanged_limit(const char *dir, char **limit, struct conf **confs)
+{
+	int r;
+	int ret=-1;
+	int damaged=0;
+	struct manio *manio=NULL;
+	struct sbuf *sb=NULL;
+	struct blk *blk=NULL;
+
+	if(open_old(dir, &manio, &sb, &blk, confs)) goto end;
+	while((r=read_next(manio, sb, blk, &damaged, confs))!=2)
+	{
+		if(r) continue;
+		free_w(limit);
+		if(!(*limit=strdup_w(sb->path.buf, __func__)))
+			goto end;
+	}
+	if(!damaged) free_w(limit);
+	ret=0;
+end:
+	close_old(&manio, &sb, &blk);
+	return ret;
+}
+
+// Work out how many entries at the start of the changed manifest can be
+// kept.
+static int changed_keep(const char *dir, const char *limit, const char *data,
+	uint64_t *keep, struct conf **confs)
+{
+	int r;
+	int ret=-1;
+	int damaged=0;
+	uint64_t entries=0;
+	struct manio *manio=NULL;
+	struct sbuf *sb=NULL;
+	struct blk *blk=NULL;
+	struct stored stored;
+
+	memset(&stored, 0, sizeof(stored));
+	*keep=0;
+	if(open_old(dir, &manio, &sb, &blk, confs)) goto end;
+	while((r=read_next(manio, sb, blk, &damaged, confs))!=2)
+	{
+		if(!r)
+		{
+			if(limit && pathcmp(sb->path.buf, limit)>=0)
+			{
+				// Everything before this is complete.
+				*keep=entries;
+				ret=0;
+				goto end;
+			}
+			entries++;
+			continue;
+		}
+		switch(blk_is_stored(&stored, data, blk))
+		{
+			case 1: continue;
+			case 0:
+				logp("Block %s is missing from the data store\n",
+				  bytes_to_savepathstr_with_sig(blk->savepath));
+				goto cut;
+			default: goto end;
+		}
+	}
+cut:
+	// The last entry, or the one with a missing block, has to be done
+	// again.
+	if(entries) *keep=entries-1;
+	ret=0;
+end:
+	close_old(&manio, &sb, &blk);
+	return ret;
+}
+
+static int copy_changed(const char *dir,
+	struct manio *chmanio, struct manio *pamanio,
+	uint64_t keep, const char *data, struct asfd *chfd,
+	char **last, struct conf **confs)
+{
+	int r;
+	int ret=-1;
+	int damaged=0;
+	int partial=0;
+	uint64_t entries=0;
+	struct manio *manio=NULL;
+	struct sbuf *sb=NULL;
+	struct blk *blk=NULL;
+	struct stored stored;
+
+	memset(&stored, 0, sizeof(stored));
+	if(open_old(dir, &manio, &sb, &blk, confs)) goto end;
+	while((r=read_next(manio, sb, blk, &damaged, confs))!=2)
+	{
+		if(!r)
+		{
+			if(++entries>keep+1) break;
+			if(entries==keep+1)
+			{
+				// This one will be done again. Keep the
+				// blocks that it has for the champ chooser.
+				partial=1;
+				if(manio_write_sbuf(pamanio, sb)) goto end;
+				continue;
+			}
+			if(manio_write_sbuf(chmanio, sb)) goto end;
+			cntr_add_changed(get_cntr(confs[OPT_CNTR]),
+				sb->path.cmd);
+			free_w(last);
+			if(!(*last=strdup_w(sb->path.buf, __func__)))
+				goto end;
+			continue;
+		}
+		if(!partial)
+		{
+			// Already checked.
+			if(write_sig(chmanio, blk, chfd)) goto end;
+			continue;
+		}
+		switch(blk_is_stored(&stored, data, blk))
+		{
+			case 1: break;
+			case 0: ret=0; goto end;
+			default: goto end;
+		}
+		if(write_sig(pamanio, blk, chfd)) goto end;
+	}
+	ret=0;
+end:
+	close_old(&manio, &sb, &blk);
+	return ret;
+}
+
+static int copy_unchanged(const char *dir, struct manio *unmanio,
+	const char *last, char **ulast, struct conf **confs)
+{
+	int r;
+	int ret=-1;
+	int damaged=0;
+	struct manio *manio=NULL;
+	struct sbuf *sb=NULL;
+	struct blk *blk=NULL;
+
+	if(!last) return 0;
+	if(open_old(dir, &manio, &sb, &blk, confs)) goto end;
+	while((r=read_next(manio, sb, blk, &damaged, confs))!=2)
+	{
+		if(!r)
+		{
+			if(pathcmp(sb->path.buf, last)>0) break;
+			if(manio_write_sbuf(unmanio, sb)) goto end;
+			cntr_add_same(get_cntr(confs[OPT_CNTR]), sb->path.cmd);
+			free_w(ulast);
+			if(!(*ulast=strdup_w(sb->path.buf, __func__)))
+				goto end;
+			continue;
+		}
+		if(manio_write_sig_and_path(unmanio, blk)) goto end;
+	}
+	ret=0;
+end:
+	close_old(&manio, &sb, &blk);
+	return ret;
+}
+
+// Count up the whole scan for the counters, then go back and move on to just
+// after 'last'.
+static int forward_phase1(struct manio *p1manio, const char *last,
+	struct sdirs *sdirs, struct conf **confs)
+{
+	int ars;
+	int ret=-1;
+	struct sbuf *sb=NULL;
+	struct cntr *cntr=get_cntr(confs[OPT_CNTR]);
+
+	if(!(sb=sbuf_alloc(confs))) goto end;
+	while(!(ars=manio_sbuf_fill_phase1(p1manio, NULL,
+		sb, NULL, NULL, confs)))
+	{
+		cntr_add_phase1(cntr, sb->path.cmd, 0);
+		if(sb->path.cmd==CMD_FILE
+		  || sb->path.cmd==CMD_ENC_FILE
+		  || sb->path.cmd==CMD_METADATA
+		  || sb->path.cmd==CMD_ENC_METADATA
+		  || sb->path.cmd==CMD_EFS_FILE)
+			cntr_add_val(cntr, CMD_BYTES_ESTIMATED,
+				(unsigned long long)sb->statp.st_size, 0);
+		sbuf_free_content(sb);
+	}
+	if(ars<0) goto end;
+
+	if(manio_init_read(p1manio, sdirs->phase1data))
+		goto end;
+	manio_set_protocol(p1manio, PROTO_1);
+	if(!last)
+	{
+		ret=0;
+		goto end;
+	}
+	while(1)
+	{
+		sbuf_free_content(sb);
+		if((ars=manio_sbuf_fill_phase1(p1manio, NULL,
+			sb, NULL, NULL, confs)))
+		{
+			if(ars>0)
+				logp("Did not find %s in phase1 scan\n", last);
+			goto end;
+		}
+		switch(pathcmp(sb->path.buf, last))
+		{
+			case 0:
+				logp("  phase1:    %s\n", sb->path.buf);
+				ret=0;
+				goto end;
+			case 1:
+				logp("phase1 and changed positions should match!\n");
+				goto end;
+		}
+	}
+end:
+	sbuf_free(&sb);
+	return ret;
+}
+
+int resume_protocol2(struct manio *p1manio,
+	struct manio *chmanio, struct manio *unmanio,
+	struct asfd *chfd, struct sdirs *sdirs, struct conf **confs)
+{
+	int ret=-1;
+	uint64_t keep=0;
+	char *oldch=NULL;
+	char *oldun=NULL;
+	char *partial=NULL;
+	char *limit=NULL;
+	char *last=NULL;
+	char *ulast=NULL;
+	struct manio *pamanio=NULL;
+
+	logp("Setting up resume positions...\n");
+
+	if(move_aside(sdirs->changed, &oldch)
+	  || move_aside(sdirs->unchanged, &oldun)
+	  || !(partial=prepend_s(sdirs->changed, PARTIAL_DIR))
+	  || !(pamanio=manio_alloc())
+	  || manio_init_write(pamanio, partial))
+		goto end;
+
+	if(unchanged_limit(oldun, &limit, confs)
+	  || changed_keep(oldch, limit, sdirs->data, &keep, confs)
+	  || copy_changed(oldch, chmanio, pamanio,
+		keep, sdirs->data, chfd, &last, confs)
+	  || finish_file(chmanio, chfd)
+	  || finish_file(pamanio, chfd)
+	  || copy_unchanged(oldun, unmanio, last, &ulast, confs)
+	  || finish_file(unmanio, NULL))
+		goto end;
+
+	if(last)
+	{
+		logp("  changed:   %s\n", last);
+		logp("  unchanged: %s\n", ulast?ulast:"");
+	}
+	else
+		logp("  nothing previously transferred\n");
+
+	if(forward_phase1(p1manio, last, sdirs, confs))
+		goto end;
+
+	// The copies are safely written, so the old ones can go.
+	if(recursive_delete(oldch, NULL, 1)
+	  || recursive_delete(oldun, NULL, 1))
+		goto end;
+
+	if(get_int(confs[OPT_SEND_CLIENT_CNTR])
+	  && cntr_send(get_cntr(confs[OPT_CNTR])))
+		goto end;
+
+	ret=0;
+end:
+	manio_free(&pamanio);
+	free_w(&oldch);
+	free_w(&oldun);
+	free_w(&partial);
+	free_w(&limit);
+	free_w(&last);
+	free_w(&ulast);
+	return ret;
+}
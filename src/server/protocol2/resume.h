@@ -0,0 +1,8 @@
+#ifndef _BACKUP_RESUME_PROTOCOL2_H
+#define _BACKUP_RESUME_PROTOCOL2_H
+
+extern int resume_protocol2(struct manio *p1manio,
+	struct manio *chmanio, struct manio *unmanio,
+	struct asfd *chfd, struct sdirs *sdirs, struct conf **confs);
+
+#endif
@@ -51,6 +51,35 @@ static int check_srestore(struct conf **confs, const char *path)
 	return 0;
 }
 
+// The first path in manifest order that a server initiated restore could
+// want, or NULL if it could want anything.
+static const char *srestore_first_path(struct conf **confs)
+{
+	const char *first=NULL;
+	struct strlist *l=get_strlist(confs[OPT_INCEXCDIR]);
+	for(; l; l=l->next)
+	{
+		if(!l->flag) continue;
+		if(!first || pathcmp(l->path, first)<0) first=l->path;
+	}
+	return first;
+}
+
+// Returns 1 if the manifest has gone past everything that a server initiated
+// restore could match, so that there is no point reading any further.
+static int srestore_finished(struct conf **confs, const char *path)
+{
+	struct strlist *l=get_strlist(confs[OPT_INCEXCDIR]);
+	if(!l) return 0;
+	for(; l; l=l->next)
+	{
+		if(!l->flag) continue;
+		if(pathcmp(path, l->path)<=0 || !strncmp_w(path, l->path))
+			return 0;
+	}
+	return 1;
+}
+
 int want_to_restore(int srestore, struct sbuf *sb,
 	regex_t *regex, struct conf **cconfs)
 {
@@ -143,23 +172,32 @@ static int hard_link_substitution(struct asfd *asfd,
 
 	while(1)
 	{
+		// With restore_delta, the block data is only read when the
+		// client asks for it.
 		switch(manio_sbuf_fill(manio, asfd,
-			hb, need_data->path.buf?blk:NULL, sdirs, cconfs))
+			hb, need_data->path.buf?blk:NULL,
+			restore_delta_active()?NULL:sdirs, cconfs))
 		{
 			case 0: break; // Keep going.
-			case 1: ret=0; goto end; // Finished OK.
+			case 1: // Finished OK.
+				if(!protocol2_restore_file_end(asfd,
+					sdirs, cconfs))
+						ret=0;
+				goto end;
 			default: goto end; // Error;
 		}
 
 		if(protocol==PROTO_2)
 		{
-			if(blk->data)
+			if(blk->got_save_path)
 			{
 				if(protocol2_extra_restore_stream_bits(asfd,
 					blk, slist, act, need_data,
 					last_ent_was_dir, cconfs)) goto end;
 				continue;
 			}
+			if(protocol2_restore_file_end(asfd, sdirs, cconfs))
+				goto end;
 			sbuf_free_content(need_data);
 		}
 
@@ -348,6 +386,9 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 	struct manio *manio=NULL;
 	struct blk *blk=NULL;
 	struct sbuf *need_data=NULL;
+	const char *first_path=NULL;
+	char *skipped_to=NULL;
+	int seeked=0;
 	enum protocol protocol=get_e_protocol(cconfs[OPT_PROTOCOL]);
 
 	if(protocol==PROTO_2)
@@ -356,6 +397,18 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 		  || asfd->read_expect(asfd, CMD_GEN, "restore_stream_ok")
 		  || !(blk=blk_alloc()))
                 	goto end;
+		if(act==ACTION_RESTORE
+		  && get_int(cconfs[OPT_RESTORE_DEDUP])
+		  && restore_dedup_init())
+			goto end;
+		if(act==ACTION_RESTORE
+		  && get_int(cconfs[OPT_RESTORE_DELTA])
+		  && restore_delta_init())
+			goto end;
+		if(act==ACTION_RESTORE
+		  && get_int(cconfs[OPT_RESTORE_SPARSE])
+		  && restore_sparse_init())
+			goto end;
 	}
 
 	if(!(manio=manio_alloc())
@@ -365,6 +418,11 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 		goto end;
 	manio_set_protocol(manio, protocol);
 
+	if(srestore
+	  && (first_path=srestore_first_path(cconfs))
+	  && (seeked=manio_seek_to_path(manio, first_path))<0)
+		goto end;
+
 	while(1)
 	{
 		iobuf_free_content(rbuf);
@@ -390,26 +448,61 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 				goto end;
 		}
 
+		// With restore_delta, the block data is only read when the
+		// client asks for it.
 		switch(manio_sbuf_fill(manio, asfd,
-			sb, need_data->path.buf?blk:NULL, sdirs, cconfs))
+			sb, need_data->path.buf?blk:NULL,
+			restore_delta_active()?NULL:sdirs, cconfs))
 		{
 			case 0: break; // Keep going.
-			case 1: ret=0; goto end; // Finished OK.
+			case 1: // Finished OK.
+				if(!protocol2_restore_file_end(asfd,
+					sdirs, cconfs))
+						ret=0;
+				goto end;
 			default: goto end; // Error;
 		}
 
 		if(protocol==PROTO_2)
 		{
-			if(blk->data)
+			if(blk->got_save_path)
 			{
 				if(protocol2_extra_restore_stream_bits(asfd,
 					blk, slist, act, need_data,
 					last_ent_was_dir, cconfs)) goto end;
 				continue;
 			}
+			if(protocol2_restore_file_end(asfd, sdirs, cconfs))
+				goto end;
 			sbuf_free_content(need_data);
 		}
 
+		if(srestore && srestore_finished(cconfs, sb->path.buf))
+		{
+			ret=0;
+			goto end;
+		}
+
+		if(seeked)
+		{
+			// Remember where the manifest was moved to, because
+			// hard links may point back to files before here.
+			if(!skipped_to
+			  && !(skipped_to=strdup_w(sb->path.buf, __func__)))
+				goto end;
+			if(sb->path.cmd==CMD_HARD_LINK
+			  && pathcmp(sb->link.buf, skipped_to)<0)
+			{
+				// The link target was skipped, so treat it
+				// like filedata that was not restored.
+				struct f_link **bucket=NULL;
+				if(!linkhash_search(&sb->statp, &bucket)
+				  && linkhash_add(sb->link.buf,
+					&sb->statp, bucket))
+						goto end;
+			}
+		}
+
 		if(want_to_restore(srestore, sb, regex, cconfs))
 		{
 			if(restore_ent(asfd, &sb, slist,
@@ -435,6 +528,7 @@ end:
 	sbuf_free(&need_data);
 	iobuf_free_content(rbuf);
 	manio_free(&manio);
+	free_w(&skipped_to);
 	return ret;
 }
 
@@ -479,6 +573,9 @@ static int actual_restore(struct asfd *asfd, struct bu *bu,
 end:
         slist_free(&slist);
 	linkhash_free();
+	restore_dedup_free();
+	restore_delta_free();
+	restore_sparse_free();
         return ret;
 }
 
@@ -123,6 +123,7 @@ static int recover_finishing(struct async *as,
 	as->asfd_remove(as, asfd);
 	asfd_close(asfd);
 
+	backup_queue_phase4_begin();
 	switch(get_e_protocol(cconfs[OPT_PROTOCOL]))
 	{
 		case PROTO_1:
@@ -133,6 +134,7 @@ static int recover_finishing(struct async *as,
 			r=backup_phase4_server_protocol2(sdirs, cconfs);
 			break;
 	}
+	backup_queue_phase4_end();
 	if(r)
 	{
 		logp("Problem with prior backup. Please check the client log on the server.");
@@ -192,11 +194,6 @@ static int recover_working(struct async *as,
 		recovery_method=RECOVERY_METHOD_DELETE;
 	}
 
-	// FIX THIS: Currently forcing protocol2 to delete so that the tests
-	// do not fail.
-	if(get_e_protocol(cconfs[OPT_PROTOCOL])==PROTO_2)
-		recovery_method=RECOVERY_METHOD_DELETE;
-
 	if(recovery_method==RECOVERY_METHOD_DELETE)
 	{
 		ret=working_delete(as, sdirs, cconfs);
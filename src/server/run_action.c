@@ -324,6 +324,8 @@ static int run_action_server_do(struct async *as, struct sdirs *sdirs,
 	char msg[256]="";
 	struct iobuf *rbuf=as->asfd->rbuf;
 
+	fzp_set_gz_threads(get_int(cconfs[OPT_COMPRESSION_THREADS]));
+
 	// Make sure some directories exist.
 	if(mkpath(&sdirs->current, sdirs->dedup))
 	{
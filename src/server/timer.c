@@ -0,0 +1,162 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../conf.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "../strlist.h"
+#include "sdirs.h"
+#include "timestamp.h"
+#include "timer.h"
+
+#include <fnmatch.h>
+
+// A timeband matches if it has the current day name in it, and the current
+// hour somewhere after that.
+int timer_in_timeband(struct strlist *timebands, time_t now)
+{
+	struct strlist *t;
+	char curdayhour[16]="";
+
+	strftime(curdayhour, sizeof(curdayhour), "*%a*%H*", localtime(&now));
+	for(t=timebands; t; t=t->next)
+	{
+		if(!fnmatch(curdayhour, t->path, 0))
+		{
+			logp("In timeband: %s\n", t->path);
+			return 1;
+		}
+		logp("Out of timeband: %s\n", t->path);
+	}
+	return 0;
+}
+
+int64_t timer_interval_secs(const char *interval)
+{
+	char *cp=NULL;
+	int64_t i;
+
+	if(!interval || !isdigit(*interval))
+		return -1;
+	i=strtoll(interval, &cp, 10);
+	if(!*cp || *(cp+1))
+		return -1;
+	switch(*cp)
+	{
+		case 's': return i;
+		case 'm': return i*60;
+		case 'h': return i*60*60;
+		case 'd': return i*60*60*24;
+		case 'w': return i*60*60*24*7;
+		case 'n': return i*60*60*24*30;
+		default: return -1;
+	}
+}
+
+// Returns 1 if the interval has not passed yet, 0 if it has, or if there is
+// nothing to go on.
+static int interval_not_passed(struct sdirs *sdirs, const char *cname,
+	const char *interval, time_t now)
+{
+	int ret=0;
+	struct tm tm;
+	time_t last;
+	char *cp=NULL;
+	int64_t secs;
+	struct stat statp;
+	char *path=NULL;
+	char tstmp[64]="";
+	char min_time[32]="";
+
+	if(lstat(sdirs->current, &statp))
+	{
+		logp("No prior backup of %s\n", cname);
+		goto end;
+	}
+	if(!(path=prepend_s(sdirs->current, "timestamp"))
+	  || timestamp_read(path, tstmp, sizeof(tstmp)))
+	{
+		logp("Timestamp file missing for %s.\n", cname);
+		goto end;
+	}
+	if(!interval)
+	{
+		logp("No time interval given for %s.\n", cname);
+		goto end;
+	}
+	if((secs=timer_interval_secs(interval))<0)
+	{
+		logp("interval %s not understood for %s.\n", interval, cname);
+		goto end;
+	}
+
+	// Skip the backup number at the front.
+	memset(&tm, 0, sizeof(tm));
+	if(!(cp=strchr(tstmp, ' '))
+	  || !strptime(cp+1, DEFAULT_TIMESTAMP_FORMAT, &tm))
+	{
+		logp("Could not parse timestamp '%s' for %s.\n", tstmp, cname);
+		goto end;
+	}
+	tm.tm_isdst=-1;
+	last=mktime(&tm)+secs;
+	strftime(min_time, sizeof(min_time), DEFAULT_TIMESTAMP_FORMAT,
+		localtime(&last));
+	logp("Last backup: %s\n", cp+1);
+	logp("Next after : %s (interval %s)\n", min_time, interval);
+	if(last<now)
+	{
+		logp("%s < now.\n", min_time);
+		goto end;
+	}
+	ret=1;
+end:
+	free_w(&path);
+	return ret;
+}
+
+int timer_check(struct sdirs *sdirs, struct conf **cconfs, time_t now)
+{
+	char *manual=NULL;
+	struct stat statp;
+	const char *interval=NULL;
+	struct strlist *timebands=NULL;
+	const char *cname=get_string(cconfs[OPT_CNAME]);
+	struct strlist *args=get_strlist(cconfs[OPT_TIMER_ARG]);
+
+	logp("Running built-in timer\n");
+
+	// A 'backup' file placed in the storage directory means that a backup
+	// needs to be done right now. This gives the 'server initiates a
+	// manual backup' feature.
+	if(!(manual=prepend_s(sdirs->client, "backup")))
+		return -1;
+	if(!lstat(manual, &statp))
+	{
+		logp("Found %s\n", manual);
+		logp("Do a backup of %s now\n", cname);
+		unlink(manual);
+		free_w(&manual);
+		return 0;
+	}
+	free_w(&manual);
+
+	if(args)
+	{
+		interval=args->path;
+		timebands=args->next;
+	}
+
+	// If no timebands are given, it is never time.
+	if(!timer_in_timeband(timebands, now))
+	{
+		interval_not_passed(sdirs, cname, interval, now);
+		return 1;
+	}
+	if(interval_not_passed(sdirs, cname, interval, now))
+	{
+		logp("Not yet time for a backup of %s\n", cname);
+		return 1;
+	}
+	logp("Do a backup of %s now.\n", cname);
+	return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _TIMER_SERVER_H
+#define _TIMER_SERVER_H
+
+#include "sdirs.h"
+
+// Used when timer_script is not set. Works through the timer_arg options in
+// the same way as the example timer script does: the first is the interval
+// since the last backup, like '20h', and the rest are timebands, like
+// 'Mon,Tue,Wed,19,20,21'. A 'backup' file in the client's storage directory
+// asks for a backup straight away.
+// Returns 0 if it is time for a backup, 1 if not, like the script's exit code.
+extern int timer_check(struct sdirs *sdirs, struct conf **cconfs, time_t now);
+
+// The pieces, split out for the tests.
+extern int timer_in_timeband(struct strlist *timebands, time_t now);
+extern int64_t timer_interval_secs(const char *interval);
+
+#endif
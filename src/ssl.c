@@ -1,5 +1,12 @@
 #include "include.h"
 #include "openssl/ssl.h"
+#include "openssl/hmac.h"
+#include "openssl/pem.h"
+#include "openssl/rand.h"
+
+#ifndef HAVE_WIN32
+#include <sys/mman.h>
+#endif
 
 static const char *pass=NULL;
 
@@ -115,6 +122,241 @@ void ssl_destroy_ctx(SSL_CTX *ctx)
 	SSL_CTX_free(ctx);
 }
 
+// Session tickets, so that a client that reconnects, for example to ask
+// whether the timer says it is time to back up, can skip the full handshake.
+// The keys are made in the parent server process, and each child that it
+// forks inherits them, so a ticket given out by one child is good with any
+// other. They are replaced once they are ssl_session_timeout seconds old, and
+// the ones before are kept for decrypting, so a ticket never goes bad before
+// the session does.
+struct ticket_key
+{
+	uint8_t name[16];
+	uint8_t aes[32];
+	uint8_t hmac[32];
+};
+
+static struct ticket_key ticket_keys[2];
+static time_t ticket_keys_made=0;
+
+// Handshake counts, added to by the children. Shared like the counters in
+// cntr_shm.c, so that the parent can log them.
+struct ssl_stats
+{
+	uint64_t full;
+	uint64_t resumed;
+};
+
+static struct ssl_stats *stats=NULL;
+
+static int ticket_key_cb(SSL *ssl, uint8_t *name, uint8_t *iv,
+	EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+{
+	int i;
+	struct ticket_key *k;
+	const EVP_CIPHER *cipher=EVP_aes_256_cbc();
+
+	if(enc)
+	{
+		k=&ticket_keys[0];
+		if(RAND_bytes(iv, EVP_CIPHER_iv_length(cipher))<=0)
+			return -1;
+		memcpy(name, k->name, sizeof(k->name));
+		if(!EVP_EncryptInit_ex(ectx, cipher, NULL, k->aes, iv)
+		  || !HMAC_Init_ex(hctx, k->hmac, sizeof(k->hmac),
+			EVP_sha256(), NULL))
+				return -1;
+		return 1;
+	}
+	for(i=0; i<2; i++)
+	{
+		k=&ticket_keys[i];
+		if(memcmp(name, k->name, sizeof(k->name)))
+			continue;
+		if(!HMAC_Init_ex(hctx, k->hmac, sizeof(k->hmac),
+			EVP_sha256(), NULL)
+		  || !EVP_DecryptInit_ex(ectx, cipher, NULL, k->aes, iv))
+			return -1;
+		// Give out a new ticket in place of one made with the old key.
+		return i?2:1;
+	}
+	// Unknown key, so do a full handshake.
+	return 0;
+}
+
+static void log_stats(time_t secs)
+{
+	uint64_t full;
+	uint64_t resumed;
+	if(!stats) return;
+	full=__sync_lock_test_and_set(&stats->full, 0);
+	resumed=__sync_lock_test_and_set(&stats->resumed, 0);
+	if(!full && !resumed) return;
+	logp("SSL handshakes in the last %lds: %" PRIu64 " resumed, %" PRIu64
+		" full\n", (long)secs, resumed, full);
+}
+
+int ssl_ticket_keys_rotate(int lifetime)
+{
+	time_t now=time(NULL);
+
+	if(lifetime<=0
+	  || (ticket_keys_made && now-ticket_keys_made<lifetime))
+		return 0;
+	if(ticket_keys_made)
+	{
+		log_stats(now-ticket_keys_made);
+		ticket_keys[1]=ticket_keys[0];
+	}
+	if(RAND_bytes((uint8_t *)&ticket_keys[0],
+		sizeof(struct ticket_key))<=0)
+	{
+		logp_ssl_err("Could not make session ticket keys\n");
+		return -1;
+	}
+	if(!ticket_keys_made)
+		ticket_keys[1]=ticket_keys[0];
+	ticket_keys_made=now;
+	return 0;
+}
+
+// Prefork workers cannot replace the keys themselves, because the others
+// would not know the new ones. They leave once the keys are due for
+// replacing, and the parent starts new ones after it has replaced them.
+int ssl_ticket_keys_expired(int lifetime)
+{
+	return lifetime>0
+	  && ticket_keys_made
+	  && time(NULL)-ticket_keys_made>=lifetime;
+}
+
+int ssl_server_sessions(SSL_CTX *ctx, struct conf **confs)
+{
+	int lifetime=get_int(confs[OPT_SSL_SESSION_TIMEOUT]);
+	static const char sid_ctx[]="burp";
+
+	// Each child would only ever fill its own copy of a session cache,
+	// so leave it all to the tickets.
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	if(lifetime<=0)
+	{
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		return 0;
+	}
+	// Resuming is refused without this, since peers are verified.
+	SSL_CTX_set_session_id_context(ctx,
+		(const uint8_t *)sid_ctx, sizeof(sid_ctx)-1);
+	SSL_CTX_set_timeout(ctx, lifetime);
+	SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_cb);
+	return ssl_ticket_keys_rotate(lifetime);
+}
+
+void ssl_count_handshake(SSL *ssl)
+{
+	if(!stats) return;
+	if(SSL_session_reused(ssl))
+		__sync_fetch_and_add(&stats->resumed, 1);
+	else
+		__sync_fetch_and_add(&stats->full, 1);
+}
+
+#ifdef HAVE_WIN32
+int ssl_stats_shared_init(void)
+{
+	return 0;
+}
+
+void ssl_stats_shared_free(void)
+{
+}
+#else
+int ssl_stats_shared_init(void)
+{
+	void *p;
+	ssl_stats_shared_free();
+	if((p=mmap(NULL, sizeof(struct ssl_stats), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0))==MAP_FAILED)
+	{
+		logp("Could not map shared ssl stats: %s\n", strerror(errno));
+		return -1;
+	}
+	stats=(struct ssl_stats *)p;
+	return 0;
+}
+
+void ssl_stats_shared_free(void)
+{
+	if(!stats) return;
+	munmap(stats, sizeof(struct ssl_stats));
+	stats=NULL;
+}
+#endif
+
+// The client end. The session is kept in the ssl_session_cache file between
+// runs. With TLS 1.3, the server sends its ticket after the handshake, so the
+// file gets written whenever a new session turns up rather than straight
+// after connecting.
+static char *session_cache=NULL;
+
+static int new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	int fd=-1;
+	FILE *fp=NULL;
+	char *tmp=NULL;
+
+	if(!session_cache
+	  || !(tmp=prepend(session_cache, ".tmp")))
+		return 0;
+	// The file holds the session secret, so keep it private.
+	if((fd=open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600))<0
+	  || !(fp=fdopen(fd, "w")))
+	{
+		logp("Could not open %s: %s\n", tmp, strerror(errno));
+		close_fd(&fd);
+		goto end;
+	}
+	if(!PEM_write_SSL_SESSION(fp, sess))
+	{
+		logp_ssl_err("Could not write %s\n", tmp);
+		close_fp(&fp);
+		unlink(tmp);
+		goto end;
+	}
+	if(close_fp(&fp) || do_rename(tmp, session_cache))
+		unlink(tmp);
+end:
+	free_w(&tmp);
+	// Not keeping a reference to it.
+	return 0;
+}
+
+int ssl_client_session_load(SSL_CTX *ctx, SSL *ssl, struct conf **confs)
+{
+	FILE *fp=NULL;
+	SSL_SESSION *sess=NULL;
+	const char *path=get_string(confs[OPT_SSL_SESSION_CACHE]);
+
+	free_w(&session_cache);
+	if(!path)
+		return 0;
+	if(!(session_cache=strdup_w(path, __func__)))
+		return -1;
+	SSL_CTX_set_session_cache_mode(ctx,
+		SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+
+	if(!(fp=fopen(session_cache, "r")))
+		return 0;
+	sess=PEM_read_SSL_SESSION(fp, NULL, NULL, NULL);
+	close_fp(&fp);
+	// A bad or stale session just means a full handshake.
+	if(sess && !SSL_set_session(ssl, sess))
+		logp_ssl_err("Could not use session from %s\n",
+			session_cache);
+	if(sess) SSL_SESSION_free(sess);
+	return 0;
+}
+
 #ifndef HAVE_WIN32
 static void sanitise(char *buf)
 {
@@ -224,6 +466,8 @@ int ssl_check_cert(SSL *ssl, struct conf **confs)
 	SSL_CIPHER_description(SSL_get_current_cipher(ssl),
 		tmpbuf, sizeof(tmpbuf));
 	logp("SSL is using cipher: %s\n", tmpbuf);
+	if(SSL_session_reused(ssl))
+		logp("SSL session resumed\n");
 	if(!(peer=SSL_get_peer_certificate(ssl)))
 	{
 		logp("Could not get peer certificate.\n");
@@ -10,4 +10,13 @@ extern int ssl_load_dh_params(SSL_CTX *ctx, struct conf **confs);
 extern void ssl_load_globals(void);
 extern int ssl_check_cert(SSL *ssl, struct conf **confs);
 
+extern int ssl_server_sessions(SSL_CTX *ctx, struct conf **confs);
+extern int ssl_ticket_keys_rotate(int lifetime);
+extern int ssl_ticket_keys_expired(int lifetime);
+extern void ssl_count_handshake(SSL *ssl);
+extern int ssl_stats_shared_init(void);
+extern void ssl_stats_shared_free(void);
+extern int ssl_client_session_load(SSL_CTX *ctx, SSL *ssl,
+	struct conf **confs);
+
 #endif
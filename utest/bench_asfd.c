@@ -0,0 +1,114 @@
+// Measures how many messages a second get through the asfd read path.
+// Usage: bench_asfd [message length] [number of messages]
+// A child process writes the messages down a pipe, and they are read back
+// as asfd->read() would, with a copy of each one, then as views into the
+// read buffer, then again with a bigger read buffer.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/burp.h"
+#include "../src/alloc.h"
+#include "../src/asfd.h"
+#include "../src/conf.h"
+#include "../src/iobuf.h"
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static void writer(int fd, size_t len, long count)
+{
+	long i;
+	size_t off;
+	size_t batch;
+	char *buf;
+	// Put lots of messages in each write, so that the writer is not what
+	// is being measured.
+	batch=65536/(len+5)+1;
+	if(!(buf=(char *)malloc(batch*(len+5)))) _exit(1);
+	for(off=0; off<batch*(len+5); off+=len+5)
+	{
+		snprintf(buf+off, 6, "%c%04X", CMD_SIG, (unsigned int)len);
+		memset(buf+off+5, 'x', len);
+	}
+	for(i=0; i<count; i+=batch)
+	{
+		size_t n=count-i<(long)batch?count-i:batch;
+		if(write(fd, buf, n*(len+5))!=(ssize_t)(n*(len+5))) _exit(1);
+	}
+	free(buf);
+	_exit(0);
+}
+
+static int bench(const char *what, size_t len, long count,
+	int readbufsize, int view)
+{
+	int ret=-1;
+	long got=0;
+	int fds[2];
+	pid_t pid;
+	double start;
+	struct asfd *asfd=NULL;
+	struct conf **confs=NULL;
+
+	if(pipe(fds) || (pid=fork())<0) return -1;
+	if(!pid)
+	{
+		close(fds[0]);
+		writer(fds[1], len, count);
+	}
+	close(fds[1]);
+
+	if(!(confs=confs_alloc())
+	  || confs_init(confs)
+	  || set_int(confs[OPT_NETWORK_READ_BUFFER_SIZE], readbufsize)
+	  || !(asfd=asfd_alloc())
+	  || asfd->init(asfd, "bench", NULL, fds[0], NULL,
+		ASFD_STREAM_STANDARD, confs))
+			goto end;
+	asfd->rbuf_view=view;
+
+	start=now();
+	while(got<count)
+	{
+		// What asfd->read() does, less the select().
+		if(asfd->parse_readbuf(asfd)) goto end;
+		if(!asfd->rbuf->buf)
+		{
+			if(asfd->do_read(asfd)) goto end;
+			continue;
+		}
+		if(asfd->rbuf->len!=len) goto end;
+		asfd->rbuf_release(asfd);
+		got++;
+	}
+	printf("%-22s %10.0f messages/s\n", what, count/(now()-start));
+	ret=0;
+end:
+	waitpid(pid, NULL, 0);
+	asfd_free(&asfd);
+	confs_free(&confs);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t len=argc>1?atoi(argv[1]):64;
+	long count=argc>2?atol(argv[2]):2000000;
+
+	printf("%ld messages of %lu bytes\n", count, (unsigned long)len);
+	if(bench("copy", len, count, 0, 0)
+	  || bench("view", len, count, 0, 1)
+	  || bench("view, 1MB buffer", len, count, 1024*1024, 1))
+	{
+		fprintf(stderr, "benchmark failed\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,157 @@
+// Measures file data throughput over a loopback TCP connection with the
+// standard message size and with bigger negotiated frames.
+// Usage: bench_frames [megabytes]
+// A child process sends the data as CMD_APPEND messages through one asfd,
+// and it is read back through another, as asfd->read() would.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "../src/burp.h"
+#include "../src/alloc.h"
+#include "../src/asfd.h"
+#include "../src/async.h"
+#include "../src/conf.h"
+#include "../src/iobuf.h"
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static struct asfd *setup(struct conf ***confs, int fd, size_t frame_len)
+{
+	struct asfd *asfd=NULL;
+	if(!(*confs=confs_alloc())
+	  || confs_init(*confs)
+	  || !(asfd=asfd_alloc())
+	  || asfd->init(asfd, "bench", NULL, fd, NULL,
+		ASFD_STREAM_STANDARD, *confs)
+	  || (frame_len>ASYNC_BUF_LEN && asfd->set_frame_len(asfd, frame_len)))
+		return NULL;
+	return asfd;
+}
+
+static void sender(int fd, size_t frame_len, unsigned long long total)
+{
+	char *buf;
+	struct iobuf wbuf;
+	struct asfd *asfd;
+	struct conf **confs=NULL;
+
+	if(!(asfd=setup(&confs, fd, frame_len))
+	  || !(buf=(char *)malloc(frame_len)))
+		_exit(1);
+	memset(buf, 'x', frame_len);
+	while(total)
+	{
+		size_t len=total<frame_len?total:frame_len;
+		iobuf_set(&wbuf, CMD_APPEND, buf, len);
+		while(wbuf.len)
+		{
+			if(asfd->append_all_to_write_buffer(asfd, &wbuf)
+				==APPEND_ERROR)
+					_exit(1);
+			while(asfd->writebuflen)
+				if(asfd->do_write(asfd)) _exit(1);
+		}
+		total-=len;
+	}
+	_exit(0);
+}
+
+static int listen_loopback(struct sockaddr_in *addr)
+{
+	int fd;
+	socklen_t len=sizeof(*addr);
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family=AF_INET;
+	addr->sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	if((fd=socket(AF_INET, SOCK_STREAM, 0))<0) return -1;
+	if(bind(fd, (struct sockaddr *)addr, sizeof(*addr))
+	  || listen(fd, 1)
+	  || getsockname(fd, (struct sockaddr *)addr, &len))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int bench(size_t frame_len, unsigned long long total)
+{
+	int ret=-1;
+	int lfd;
+	int fd;
+	pid_t pid;
+	double start;
+	unsigned long long got=0;
+	unsigned long long msgs=0;
+	struct sockaddr_in addr;
+	struct asfd *asfd=NULL;
+	struct conf **confs=NULL;
+
+	if((lfd=listen_loopback(&addr))<0
+	  || (pid=fork())<0)
+		return -1;
+	if(!pid)
+	{
+		close(lfd);
+		if((fd=socket(AF_INET, SOCK_STREAM, 0))<0
+		  || connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+			_exit(1);
+		sender(fd, frame_len, total);
+	}
+	fd=accept(lfd, NULL, NULL);
+	close(lfd);
+	if(fd<0 || !(asfd=setup(&confs, fd, frame_len)))
+		goto end;
+
+	start=now();
+	while(got<total)
+	{
+		if(asfd->parse_readbuf(asfd)) goto end;
+		if(!asfd->rbuf->buf)
+		{
+			if(asfd->do_read(asfd)) goto end;
+			continue;
+		}
+		if(asfd->rbuf->cmd!=CMD_APPEND) goto end;
+		got+=asfd->rbuf->len;
+		msgs++;
+		asfd->rbuf_release(asfd);
+	}
+	printf("frame %8lu  %8.1f MB/s  %8llu messages\n",
+		(unsigned long)frame_len, total/1048576.0/(now()-start), msgs);
+	ret=0;
+end:
+	waitpid(pid, NULL, 0);
+	asfd_free(&asfd);
+	confs_free(&confs);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long total=(argc>1?atol(argv[1]):1024)*1024*1024ULL;
+	size_t frames[]={ASYNC_BUF_LEN, 65536, 262144, 1048576, 0};
+	size_t *f;
+
+	printf("%llu MB over loopback\n", total/1048576);
+	for(f=frames; *f; f++)
+	{
+		if(bench(*f, total))
+		{
+			fprintf(stderr, "benchmark failed\n");
+			return 1;
+		}
+	}
+	return 0;
+}
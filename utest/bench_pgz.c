@@ -0,0 +1,136 @@
+// Compares the single stream gzip writer with the parallel one.
+// Usage: bench_pgz [input file] [level] [max threads]
+// Without an input file, 64MB of manifest-like text is generated.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "../src/pgz.h"
+
+#define OUT	"bench_pgz.gz"
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static unsigned char *generate(size_t len)
+{
+	size_t i=0;
+	unsigned char *data;
+	if(!(data=(unsigned char *)malloc(len))) return NULL;
+	while(i<len)
+	{
+		char line[128];
+		int n=snprintf(line, sizeof(line),
+			"r0040ABC%08lX\nf0020/home/user/dir%04lu/file%06lu\n",
+			(unsigned long)rand(), (unsigned long)(i/65536)%10000,
+			(unsigned long)i%1000000);
+		if(i+n>len) n=len-i;
+		memcpy(data+i, line, n);
+		i+=n;
+	}
+	return data;
+}
+
+static unsigned char *load(const char *path, size_t *len)
+{
+	FILE *fp;
+	struct stat statp;
+	unsigned char *data;
+	if(stat(path, &statp) || !(fp=fopen(path, "rb"))) return NULL;
+	*len=statp.st_size;
+	if(!(data=(unsigned char *)malloc(*len))
+	  || fread(data, 1, *len, fp)!=*len)
+	{
+		fclose(fp);
+		free(data);
+		return NULL;
+	}
+	fclose(fp);
+	return data;
+}
+
+static off_t out_size(void)
+{
+	struct stat statp;
+	if(stat(OUT, &statp)) return 0;
+	return statp.st_size;
+}
+
+static void report(const char *what, size_t len, double took)
+{
+	off_t out=out_size();
+	printf("%-12s %8.1f MB/s  ratio %5.3f  %.3fs\n", what,
+		len/1048576.0/took, len?(double)out/len:0.0, took);
+}
+
+static int bench_gz(unsigned char *data, size_t len, int level)
+{
+	gzFile zp;
+	size_t off;
+	char mode[8];
+	double start=now();
+	snprintf(mode, sizeof(mode), "wb%d", level);
+	if(!(zp=gzopen(OUT, mode))) return -1;
+	for(off=0; off<len; off+=65536)
+	{
+		unsigned w=len-off<65536?len-off:65536;
+		if(gzwrite(zp, data+off, w)!=(int)w) return -1;
+	}
+	if(gzclose(zp)!=Z_OK) return -1;
+	report("gzip", len, now()-start);
+	return 0;
+}
+
+static int bench_pgz(unsigned char *data, size_t len, int level, int threads)
+{
+	size_t off;
+	char what[32];
+	struct pgz *pgz;
+	double start=now();
+	if(!(pgz=pgz_open(OUT, level, threads))) return -1;
+	for(off=0; off<len; off+=65536)
+	{
+		size_t w=len-off<65536?len-off:65536;
+		if(pgz_write(pgz, data+off, w)!=w) return -1;
+	}
+	if(pgz_close(&pgz)) return -1;
+	snprintf(what, sizeof(what), "pgz x%d", threads);
+	report(what, len, now()-start);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int t;
+	int ret=1;
+	size_t len=64*1024*1024;
+	int level=argc>2?atoi(argv[2]):9;
+	int max_threads=argc>3?atoi(argv[3]):sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned char *data;
+
+	if(argc>1) data=load(argv[1], &len);
+	else data=generate(len);
+	if(!data)
+	{
+		fprintf(stderr, "could not get input data\n");
+		return 1;
+	}
+	printf("%lu bytes, level %d\n", (unsigned long)len, level);
+
+	if(bench_gz(data, len, level)) goto end;
+	for(t=1; t<=max_threads; t*=2)
+		if(bench_pgz(data, len, level, t)) goto end;
+	ret=0;
+end:
+	if(ret) fprintf(stderr, "benchmark failed\n");
+	unlink(OUT);
+	free(data);
+	return ret;
+}
@@ -0,0 +1,113 @@
+// Compares what each connection costs the server in getting its global
+// config, the way that it is done when forking a child for each connection,
+// with the way that a prefork worker does it.
+// Usage: bench_prefork [server config file] [number of connections]
+// A forked child reads and checks the config file from scratch. A worker
+// only looks at whether the file has changed, and copies what it loaded
+// before. The real server has a bigger address space than this, so forking
+// costs it more than it does here.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/burp.h"
+#include "../src/alloc.h"
+#include "../src/conf.h"
+#include "../src/conffile.h"
+#include "../src/server/conf_cache.h"
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static int load_global(const char *path)
+{
+	int ret=-1;
+	struct conf **confs=NULL;
+	if((confs=confs_alloc())
+	  && !confs_init(confs)
+	  && !conf_load_global_only(path, confs))
+		ret=0;
+	confs_free(&confs);
+	return ret;
+}
+
+static int bench_fork(const char *path, long count)
+{
+	long i;
+	pid_t pid;
+	int status;
+	double start=now();
+	for(i=0; i<count; i++)
+	{
+		switch((pid=fork()))
+		{
+			case -1:
+				return -1;
+			case 0:
+				_exit(load_global(path)?1:0);
+			default:
+				if(waitpid(pid, &status, 0)<0
+				  || !WIFEXITED(status)
+				  || WEXITSTATUS(status))
+					return -1;
+		}
+	}
+	printf("fork per connection: %8.0f connections/s\n",
+		count/(now()-start));
+	return 0;
+}
+
+static int bench_worker(const char *path, long count)
+{
+	long i;
+	int ret=-1;
+	double start=now();
+	struct conf **confs=NULL;
+	struct conf_cache *cache=NULL;
+	if(!(cache=conf_cache_alloc()))
+		return -1;
+	for(i=0; i<count; i++)
+	{
+		if(!(confs=confs_alloc())
+		  || confs_init(confs)
+		  || conf_cache_load(cache, path, confs))
+			goto end;
+		confs_free(&confs);
+	}
+	printf("prefork worker:      %8.0f connections/s\n",
+		count/(now()-start));
+	ret=0;
+end:
+	confs_free(&confs);
+	conf_cache_free(&cache);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path="../configs/server/burp.conf";
+	long count=2000;
+	if(argc>1) path=argv[1];
+	if(argc>2) count=atol(argv[2]);
+
+	// Make sure that it loads, and get it into the page cache.
+	if(load_global(path))
+	{
+		fprintf(stderr, "Could not load %s\n", path);
+		return 1;
+	}
+	printf("%s, %ld connections\n", path, count);
+	if(bench_fork(path, count)
+	  || bench_worker(path, count))
+	{
+		fprintf(stderr, "bench failed\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,149 @@
+// Compares loading protocol2 data files block by block, the way that the
+// server used to, with loading each one in a single read.
+// Usage: bench_rblk [number of data files] [passes]
+// Each generated data file holds the full 4096 blocks, of up to 16KB each.
+// The files are read back from the page cache, so this measures the system
+// call and allocation overhead, rather than the disk.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "../src/alloc.h"
+#include "../src/cmd.h"
+#include "../src/iobuf.h"
+#include "../src/protocol2/blk.h"
+#include "../src/server/protocol2/rblk.h"
+
+#define DIR	"bench_rblk_data"
+#define BLKMAX	16384
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static void data_path(char *buf, size_t len, int i)
+{
+	snprintf(buf, len, "%s/%04X", DIR, i);
+}
+
+static int generate(int files, size_t *total)
+{
+	int i;
+	int b;
+	FILE *fp;
+	char path[64];
+	char buf[BLKMAX];
+	for(b=0; b<BLKMAX; b++) buf[b]=rand();
+	if(mkdir(DIR, 0777) && errno!=EEXIST) return -1;
+	*total=0;
+	for(i=0; i<files; i++)
+	{
+		data_path(path, sizeof(path), i);
+		if(!(fp=fopen(path, "wb"))) return -1;
+		for(b=0; b<DATA_FILE_SIG_MAX; b++)
+		{
+			// Roughly the spread of block sizes that the client
+			// produces.
+			unsigned int len=1024+rand()%(BLKMAX-1024);
+			fprintf(fp, "%c%04X", CMD_DATA, len);
+			if(fwrite(buf, 1, len, fp)!=len) return -1;
+			*total+=5+len;
+		}
+		if(fclose(fp)) return -1;
+	}
+	return 0;
+}
+
+// The old way, with a separately allocated buffer for each block.
+static int load_per_block(struct iobuf *readbuf, const char *path)
+{
+	int r;
+	FILE *fp;
+	char hdr[6]="";
+	unsigned int len;
+	char cmd;
+	if(!(fp=fopen(path, "rb"))) return -1;
+	for(r=0; r<DATA_FILE_SIG_MAX; r++)
+	{
+		if(fread(hdr, 1, 5, fp)!=5) break;
+		if(sscanf(hdr, "%c%04X", &cmd, &len)!=2
+		  || !(readbuf[r].buf=(char *)realloc(readbuf[r].buf, len))
+		  || fread(readbuf[r].buf, 1, len, fp)!=len)
+		{
+			fclose(fp);
+			return -1;
+		}
+		readbuf[r].len=len;
+	}
+	fclose(fp);
+	return 0;
+}
+
+static void report(const char *what, int loads, size_t bytes, double took)
+{
+	printf("%-10s %8.1f files/s  %8.1f MB/s  %.3fs\n", what,
+		loads/took, bytes/1048576.0/took, took);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int p;
+	int ret=1;
+	size_t total=0;
+	char path[64];
+	int files=argc>1?atoi(argv[1]):16;
+	int passes=argc>2?atoi(argv[2]):8;
+	double start;
+	struct rblk rblk;
+	struct iobuf *readbuf=NULL;
+
+	memset(&rblk, 0, sizeof(rblk));
+	if(files<1 || passes<1
+	  || !(readbuf=(struct iobuf *)
+		calloc(DATA_FILE_SIG_MAX, sizeof(struct iobuf))))
+			goto end;
+	if(generate(files, &total))
+	{
+		fprintf(stderr, "could not generate data files\n");
+		goto end;
+	}
+	printf("%d data files, %.1f MB, %d passes\n",
+		files, total/1048576.0, passes);
+
+	start=now();
+	for(p=0; p<passes; p++) for(i=0; i<files; i++)
+	{
+		data_path(path, sizeof(path), i);
+		if(load_per_block(readbuf, path)) goto end;
+	}
+	report("per block", files*passes, total*passes, now()-start);
+
+	start=now();
+	for(p=0; p<passes; p++) for(i=0; i<files; i++)
+	{
+		data_path(path, sizeof(path), i);
+		if(rblk_load(&rblk, path)) goto end;
+	}
+	report("whole file", files*passes, total*passes, now()-start);
+	ret=0;
+end:
+	if(ret) fprintf(stderr, "benchmark failed\n");
+	for(i=0; i<files; i++)
+	{
+		data_path(path, sizeof(path), i);
+		unlink(path);
+	}
+	rmdir(DIR);
+	rblk_free_content(&rblk);
+	if(readbuf) for(i=0; i<DATA_FILE_SIG_MAX; i++)
+		free(readbuf[i].buf);
+	free(readbuf);
+	return ret;
+}
@@ -0,0 +1,143 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/client/protocol2/blkcache.h"
+
+#define FILEA		"utest_blkcache_a"
+#define FILEB		"utest_blkcache_b"
+
+static void block_data(char *buf, unsigned int i, unsigned int len)
+{
+	unsigned int j;
+	for(j=0; j<len; j++) buf[j]=(char)(i*7+j);
+}
+
+// Write a block to 'fp', the way that the restore does, and tell the cache.
+static void add_block(struct blkcache *cache, FILE *fp,
+	unsigned int i, unsigned int len)
+{
+	struct blk blk;
+	char buf[256];
+	memset(&blk, 0, sizeof(blk));
+	block_data(buf, i, len);
+	blk.data=buf;
+	blk.length=len;
+	if(fp)
+	{
+		fail_unless(fwrite(buf, 1, len, fp)==len);
+		fail_unless(!fflush(fp));
+	}
+	fail_unless(!blkcache_add(cache, &blk, fp!=NULL));
+}
+
+static void assert_get(struct blkcache *cache, uint64_t seq,
+	unsigned int i, unsigned int len)
+{
+	struct blk blk;
+	char buf[256];
+	memset(&blk, 0, sizeof(blk));
+	block_data(buf, i, len);
+	fail_unless(!blkcache_get(cache, seq, &blk));
+	fail_unless(blk.length==len);
+	fail_unless(!memcmp(blk.data, buf, len));
+	free_w(&blk.data);
+}
+
+static void tear_down(struct blkcache **cache)
+{
+	blkcache_free(cache);
+	fail_unless(*cache==NULL);
+	unlink(FILEA);
+	unlink(FILEB);
+	fail_unless(free_count==alloc_count);
+}
+
+START_TEST(test_blkcache_files)
+{
+	FILE *fp;
+	struct blkcache *cache;
+	alloc_counters_reset();
+	fail_unless((cache=blkcache_alloc())!=NULL);
+
+	fail_unless((fp=fopen(FILEA, "wb"))!=NULL);
+	fail_unless(!blkcache_set_file(cache, FILEA));
+	add_block(cache, fp, 0, 100);
+	add_block(cache, fp, 1, 200);
+	// Can read back from the file that is still being written.
+	assert_get(cache, 1, 1, 200);
+	fail_unless(!fclose(fp));
+
+	fail_unless((fp=fopen(FILEB, "wb"))!=NULL);
+	fail_unless(!blkcache_set_file(cache, FILEB));
+	add_block(cache, fp, 2, 50);
+	fail_unless(!fclose(fp));
+
+	assert_get(cache, 0, 0, 100);
+	assert_get(cache, 2, 2, 50);
+	assert_get(cache, 1, 1, 200);
+	tear_down(&cache);
+}
+END_TEST
+
+START_TEST(test_blkcache_spill)
+{
+	struct blkcache *cache;
+	alloc_counters_reset();
+	fail_unless((cache=blkcache_alloc())!=NULL);
+
+	// No file to read back from.
+	fail_unless(!blkcache_set_file(cache, NULL));
+	add_block(cache, NULL, 0, 10);
+	add_block(cache, NULL, 1, 0);
+	add_block(cache, NULL, 2, 255);
+	assert_get(cache, 2, 2, 255);
+	assert_get(cache, 1, 1, 0);
+	assert_get(cache, 0, 0, 10);
+	tear_down(&cache);
+}
+END_TEST
+
+START_TEST(test_blkcache_out_of_range)
+{
+	uint64_t i;
+	struct blk blk;
+	struct blkcache *cache;
+	alloc_counters_reset();
+	memset(&blk, 0, sizeof(blk));
+	fail_unless((cache=blkcache_alloc())!=NULL);
+
+	fail_unless(blkcache_get(cache, 0, &blk)==-1);
+	for(i=0; i<RESTORE_DEDUP_WINDOW+1; i++)
+		add_block(cache, NULL, i, 1);
+	// The first one has gone out of the window.
+	fail_unless(blkcache_get(cache, 0, &blk)==-1);
+	fail_unless(blkcache_get(cache, RESTORE_DEDUP_WINDOW+1, &blk)==-1);
+	fail_unless(blk.data==NULL);
+	assert_get(cache, 1, 1, 1);
+	assert_get(cache, RESTORE_DEDUP_WINDOW, RESTORE_DEDUP_WINDOW, 1);
+	tear_down(&cache);
+}
+END_TEST
+
+Suite *suite_client_protocol2_blkcache(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_protocol2_blkcache");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_blkcache_files);
+	tcase_add_test(tc_core, test_blkcache_spill);
+	tcase_add_test(tc_core, test_blkcache_out_of_range);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
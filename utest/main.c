@@ -9,15 +9,25 @@ int main(void)
 
 	sr=srunner_create(NULL);
 	srunner_add_suite(sr, suite_alloc());
+	srunner_add_suite(sr, suite_asfd());
 	srunner_add_suite(sr, suite_base64());
+	srunner_add_suite(sr, suite_client_protocol2_blkcache());
 	srunner_add_suite(sr, suite_cmd());
+	srunner_add_suite(sr, suite_compadapt());
 	srunner_add_suite(sr, suite_conf());
 	srunner_add_suite(sr, suite_conffile());
 	srunner_add_suite(sr, suite_hexmap());
 	srunner_add_suite(sr, suite_pathcmp());
+	srunner_add_suite(sr, suite_pgz());
+	srunner_add_suite(sr, suite_ratelimit());
+	srunner_add_suite(sr, suite_server_backup_queue());
+	srunner_add_suite(sr, suite_server_conf_cache());
 	srunner_add_suite(sr, suite_server_sdirs());
+	srunner_add_suite(sr, suite_server_timer());
+	srunner_add_suite(sr, suite_server_monitor_cntr_shm());
 	srunner_add_suite(sr, suite_server_protocol1_dpth());
 	srunner_add_suite(sr, suite_server_protocol1_fdirs());
+	srunner_add_suite(sr, suite_server_protocol2_rblk());
 	// Do these last, as they have slight delays.
 	srunner_add_suite(sr, suite_server_protocol2_dpth());
 	srunner_add_suite(sr, suite_lock());
@@ -12,6 +12,7 @@ void logp(const char *fmt, ...)
 */
 }
 void logc(const char *fmt, ...) { }
+void logp_ssl_err(const char *fmt, ...) { }
 void log_oom_w(const char *func, const char *orig_func) { }
 void log_out_of_memory(const char *function) { }
 void log_recvd(struct iobuf *, struct conf **, int) { }
@@ -20,6 +21,8 @@ const char *time_taken(time_t d) { return ""; }
 const char *progname(void) { return "utest"; }
 size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb) { return 0; }
 int fzp_printf(struct fzp *fzp, const char *format, ...) { return 0; }
+int set_blocking(int fd) { return 0; }
+int set_non_blocking(int fd) { return 0; }
 
 int blk_read_verify(struct blk *blk_to_verify, struct conf **confs)
 	{ return 0; }
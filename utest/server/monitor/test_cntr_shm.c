@@ -0,0 +1,121 @@
+#include <check.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/cmd.h"
+#include "../../../src/cntr.h"
+#include "../../../src/cstat.h"
+#include "../../../src/server/monitor/cntr_shm.h"
+
+static struct cstat *setup(const char *cname)
+{
+	struct cstat *cstat;
+	fail_unless((cstat=cstat_alloc())!=NULL);
+	fail_unless(!cstat_init(cstat, cname, NULL));
+	return cstat;
+}
+
+static void tear_down(struct cstat **cstat)
+{
+	cstat_free(cstat);
+	cntr_shm_free();
+	fail_unless(free_count==alloc_count);
+}
+
+static void child_writes(const char *cname, unsigned long long files,
+	int release)
+{
+	struct cntr *cntr;
+	struct cntr_shm_slot *slot;
+	if(!(cntr=cntr_alloc()) || cntr_init(cntr, cname)) exit(1);
+	if(!(slot=cntr_shm_claim(cntr))) exit(1);
+	cntr->ent[(uint8_t)CMD_FILE]->count=files;
+	cntr->ent[(uint8_t)CMD_FILE]->changed=files+1;
+	cntr_shm_write(slot, cntr, CNTR_STATUS_BACKUP);
+	if(release) cntr_shm_release(getpid());
+	exit(0);
+}
+
+static void run_child(const char *cname, unsigned long long files,
+	int release)
+{
+	int status;
+	pid_t pid;
+	switch((pid=fork()))
+	{
+		case -1: fail_unless(0==1); break;
+		case 0: child_writes(cname, files, release);
+		default: break;
+	}
+	fail_unless(waitpid(pid, &status, 0)==pid);
+	fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+}
+
+START_TEST(test_cntr_shm_read_from_child)
+{
+	struct cstat *cstat=setup("utestclient");
+	fail_unless(!cntr_shm_init(2));
+	run_child("utestclient", 1234, 0);
+	cntr_shm_to_cstats(cstat);
+	fail_unless(cstat->cntr->cntr_status==CNTR_STATUS_BACKUP);
+	fail_unless(cstat->cntr->ent[(uint8_t)CMD_FILE]->count==1234);
+	fail_unless(cstat->cntr->ent[(uint8_t)CMD_FILE]->changed==1235);
+	tear_down(&cstat);
+}
+END_TEST
+
+START_TEST(test_cntr_shm_other_client)
+{
+	struct cstat *cstat=setup("utestclient");
+	fail_unless(!cntr_shm_init(2));
+	run_child("someoneelse", 1234, 0);
+	cntr_shm_to_cstats(cstat);
+	fail_unless(cstat->cntr->cntr_status==CNTR_STATUS_UNSET);
+	fail_unless(cstat->cntr->ent[(uint8_t)CMD_FILE]->count==0);
+	tear_down(&cstat);
+}
+END_TEST
+
+START_TEST(test_cntr_shm_released)
+{
+	struct cstat *cstat=setup("utestclient");
+	fail_unless(!cntr_shm_init(1));
+	run_child("utestclient", 1234, 1);
+	// The slot was given back, so another child can have it.
+	run_child("utestclient", 99, 0);
+	cntr_shm_to_cstats(cstat);
+	fail_unless(cstat->cntr->ent[(uint8_t)CMD_FILE]->count==99);
+	tear_down(&cstat);
+}
+END_TEST
+
+START_TEST(test_cntr_shm_no_slots)
+{
+	struct cntr *cntr;
+	fail_unless(!cntr_shm_init(0));
+	fail_unless((cntr=cntr_alloc())!=NULL);
+	fail_unless(!cntr_init(cntr, "utestclient"));
+	fail_unless(cntr_shm_claim(cntr)==NULL);
+	cntr_free(&cntr);
+	cntr_shm_free();
+}
+END_TEST
+
+Suite *suite_server_monitor_cntr_shm(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_monitor_cntr_shm");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_cntr_shm_read_from_child);
+	tcase_add_test(tc_core, test_cntr_shm_other_client);
+	tcase_add_test(tc_core, test_cntr_shm_released);
+	tcase_add_test(tc_core, test_cntr_shm_no_slots);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -120,6 +120,39 @@ START_TEST(test_simple_lock)
 }
 END_TEST
 
+START_TEST(test_index)
+{
+	int i;
+	FILE *fp;
+	struct dpth *dpth;
+	const char *savepath;
+	uint8_t buf[DATA_FILE_INDEX_ENTRY*4];
+	dpth=setup();
+	fail_unless(dpth_protocol2_init(dpth,
+		lockpath, MAX_STORAGE_SUBDIRS)==0);
+	for(i=0; i<3; i++)
+	{
+		savepath=dpth_protocol2_mk(dpth);
+		fail_unless(write_to_dpth(dpth, savepath)==0);
+		fail_unless(dpth_protocol2_incr_sig(dpth)==0);
+	}
+	fail_unless(dpth_release_all(dpth)==0);
+
+	// Each "abc" block takes 8 bytes with its header.
+	fail_unless((fp=fopen(
+		"utest_dpth/0000/0000/0000" DATA_FILE_INDEX_SUFFIX, "rb"))!=NULL);
+	fail_unless(fread(buf, 1, sizeof(buf), fp)==DATA_FILE_INDEX_ENTRY*3);
+	fclose(fp);
+	for(i=0; i<3; i++)
+	{
+		uint8_t *b=buf+i*DATA_FILE_INDEX_ENTRY;
+		fail_unless(!b[0] && !b[1] && !b[2]);
+		fail_unless(b[3]==8*(i+1));
+	}
+	tear_down(&dpth);
+}
+END_TEST
+
 struct incr_data
 {
         uint16_t prim;
@@ -260,6 +293,7 @@ Suite *suite_server_protocol2_dpth(void)
 
 	tcase_add_test(tc_core, test_simple_lock);
 	tcase_add_test(tc_core, test_incr_sig);
+	tcase_add_test(tc_core, test_index);
 	tcase_add_test(tc_core, test_init);
 	suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,269 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/cmd.h"
+#include "../../../src/fsops.h"
+#include "../../../src/hexmap.h"
+#include "../../../src/iobuf.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/server/protocol2/dpth.h"
+#include "../../../src/server/protocol2/rblk.h"
+
+#define DATPATH		"utest_rblk_data"
+#define DATADIR		"utest_rblk"
+
+static void block_data(char *buf, unsigned int i, unsigned int len)
+{
+	unsigned int j;
+	for(j=0; j<len; j++) buf[j]=(char)(i+j);
+}
+
+enum index_type
+{
+	INDEX_NONE=0,
+	INDEX_OK,
+	INDEX_SHORT,
+	INDEX_BAD
+};
+
+static void write_index_entry(FILE *ifp, uint32_t offset)
+{
+	uint8_t b[DATA_FILE_INDEX_ENTRY];
+	b[0]=offset>>24;
+	b[1]=offset>>16;
+	b[2]=offset>>8;
+	b[3]=offset;
+	fail_unless(fwrite(b, 1, sizeof(b), ifp)==sizeof(b));
+}
+
+// Write a data file with 'count' blocks in it, in the same format as the
+// server does, and maybe an index for it.
+static void write_data_file_at(const char *path, unsigned int count,
+	char cmd, int truncate, enum index_type index_type)
+{
+	FILE *fp;
+	FILE *ifp=NULL;
+	unsigned int i;
+	uint32_t offset=0;
+	char buf[512];
+	char ipath[256];
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	if(index_type!=INDEX_NONE)
+	{
+		snprintf(ipath, sizeof(ipath), "%s%s",
+			path, DATA_FILE_INDEX_SUFFIX);
+		fail_unless((ifp=fopen(ipath, "wb"))!=NULL);
+	}
+	for(i=0; i<count; i++)
+	{
+		unsigned int len=1+i%sizeof(buf);
+		block_data(buf, i, len);
+		fprintf(fp, "%c%04X", cmd, len);
+		if(truncate && i==count-1) len/=2;
+		fail_unless(fwrite(buf, 1, len, fp)==len);
+		offset+=5+len;
+		switch(index_type)
+		{
+			case INDEX_SHORT:
+				if(i>=count/2) break;
+				// Fall through.
+			case INDEX_OK:
+				write_index_entry(ifp, offset);
+				break;
+			case INDEX_BAD:
+				write_index_entry(ifp, offset+3);
+				break;
+			default:
+				break;
+		}
+	}
+	fail_unless(!fclose(fp));
+	if(ifp) fail_unless(!fclose(ifp));
+}
+
+static void write_data_file(unsigned int count, char cmd, int truncate)
+{
+	write_data_file_at(DATPATH, count, cmd, truncate, INDEX_NONE);
+}
+
+static void assert_blocks(struct rblk *rblk, unsigned int count)
+{
+	unsigned int i;
+	char buf[512];
+	fail_unless(rblk->readbuflen==count);
+	for(i=0; i<count; i++)
+	{
+		unsigned int len=1+i%sizeof(buf);
+		block_data(buf, i, len);
+		fail_unless(rblk->readbuf[i].len==len);
+		fail_unless(!memcmp(rblk->readbuf[i].buf, buf, len));
+	}
+}
+
+static void tear_down(struct rblk *rblk)
+{
+	rblk_free_content(rblk);
+	unlink(DATPATH);
+	fail_unless(free_count==alloc_count);
+}
+
+START_TEST(test_rblk_load)
+{
+	struct rblk rblk;
+	memset(&rblk, 0, sizeof(rblk));
+	write_data_file(1000, CMD_DATA, 0);
+	fail_unless(!rblk_load(&rblk, DATPATH));
+	fail_unless(!strcmp(rblk.datpath, DATPATH));
+	assert_blocks(&rblk, 1000);
+
+	// A smaller file goes into the same buffer.
+	write_data_file(10, CMD_DATA, 0);
+	fail_unless(!rblk_load(&rblk, DATPATH));
+	assert_blocks(&rblk, 10);
+	tear_down(&rblk);
+}
+END_TEST
+
+START_TEST(test_rblk_load_full)
+{
+	struct rblk rblk;
+	memset(&rblk, 0, sizeof(rblk));
+	write_data_file(DATA_FILE_SIG_MAX, CMD_DATA, 0);
+	fail_unless(!rblk_load(&rblk, DATPATH));
+	assert_blocks(&rblk, DATA_FILE_SIG_MAX);
+	tear_down(&rblk);
+}
+END_TEST
+
+START_TEST(test_rblk_load_empty)
+{
+	struct rblk rblk;
+	memset(&rblk, 0, sizeof(rblk));
+	write_data_file(0, CMD_DATA, 0);
+	fail_unless(!rblk_load(&rblk, DATPATH));
+	assert_blocks(&rblk, 0);
+	tear_down(&rblk);
+}
+END_TEST
+
+START_TEST(test_rblk_load_short)
+{
+	struct rblk rblk;
+	memset(&rblk, 0, sizeof(rblk));
+	write_data_file(100, CMD_DATA, 1);
+	fail_unless(rblk_load(&rblk, DATPATH)==-1);
+	fail_unless(rblk.datpath==NULL);
+	tear_down(&rblk);
+}
+END_TEST
+
+START_TEST(test_rblk_load_bad_cmd)
+{
+	struct rblk rblk;
+	memset(&rblk, 0, sizeof(rblk));
+	write_data_file(100, CMD_FILE, 0);
+	fail_unless(rblk_load(&rblk, DATPATH)==-1);
+	tear_down(&rblk);
+}
+END_TEST
+
+START_TEST(test_rblk_load_missing)
+{
+	struct rblk rblk;
+	memset(&rblk, 0, sizeof(rblk));
+	unlink(DATPATH);
+	fail_unless(rblk_load(&rblk, DATPATH)==-1);
+	tear_down(&rblk);
+}
+END_TEST
+
+static void assert_retrieve(const char *savepathstr, unsigned int i)
+{
+	struct blk blk;
+	char buf[512];
+	unsigned int len=1+i%sizeof(buf);
+	memset(&blk, 0, sizeof(blk));
+	savepathstr_to_bytes(savepathstr, blk.savepath);
+	block_data(buf, i, len);
+	fail_unless(!rblk_retrieve_data(DATADIR, &blk));
+	fail_unless(blk.length==len);
+	fail_unless(!memcmp(blk.data, buf, len));
+}
+
+static void retrieve_from(const char *datafile, enum index_type index_type)
+{
+	unsigned int i;
+	char path[256];
+	char savepathstr[32];
+	hexmap_init();
+	snprintf(path, sizeof(path), DATADIR "/%s", datafile);
+	fail_unless(!build_path_w(path));
+	write_data_file_at(path, 1000, CMD_DATA, 0, index_type);
+
+	// A few blocks, out of order, then enough to make it load the whole
+	// data file.
+	snprintf(savepathstr, sizeof(savepathstr), "%s/0005", datafile);
+	assert_retrieve(savepathstr, 5);
+	snprintf(savepathstr, sizeof(savepathstr), "%s/0000", datafile);
+	assert_retrieve(savepathstr, 0);
+	for(i=999; i>=900; i--)
+	{
+		snprintf(savepathstr, sizeof(savepathstr),
+			"%s/%04X", datafile, i);
+		assert_retrieve(savepathstr, i);
+	}
+	fail_unless(!recursive_delete(DATADIR, "", 1));
+}
+
+START_TEST(test_rblk_retrieve_index)
+{
+	retrieve_from("0000/0000/0001", INDEX_OK);
+}
+END_TEST
+
+START_TEST(test_rblk_retrieve_no_index)
+{
+	retrieve_from("0000/0000/0002", INDEX_NONE);
+}
+END_TEST
+
+START_TEST(test_rblk_retrieve_short_index)
+{
+	retrieve_from("0000/0000/0003", INDEX_SHORT);
+}
+END_TEST
+
+START_TEST(test_rblk_retrieve_bad_index)
+{
+	retrieve_from("0000/0000/0004", INDEX_BAD);
+}
+END_TEST
+
+Suite *suite_server_protocol2_rblk(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_rblk");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_rblk_load);
+	tcase_add_test(tc_core, test_rblk_load_full);
+	tcase_add_test(tc_core, test_rblk_load_empty);
+	tcase_add_test(tc_core, test_rblk_load_short);
+	tcase_add_test(tc_core, test_rblk_load_bad_cmd);
+	tcase_add_test(tc_core, test_rblk_load_missing);
+	tcase_add_test(tc_core, test_rblk_retrieve_index);
+	tcase_add_test(tc_core, test_rblk_retrieve_no_index);
+	tcase_add_test(tc_core, test_rblk_retrieve_short_index);
+	tcase_add_test(tc_core, test_rblk_retrieve_bad_index);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,144 @@
+#include <check.h>
+#include <stdio.h>
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/conffile.h"
+#include "../../src/fsops.h"
+#include "../../src/server/sdirs.h"
+#include "../../src/server/backup_queue.h"
+
+#define BASE		"utest_backup_queue"
+
+static void write_stats(const char *dir, int start, int end)
+{
+	FILE *fp;
+	char path[256];
+	fail_unless(!mkdir(dir, 0777));
+	snprintf(path, sizeof(path), "%s/backup_stats", dir);
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	fprintf(fp, "{\"counters\":[{\"name\":\"time_start\",\"type\":\"b\","
+		"\"count\":%d},{\"name\":\"bytes\",\"type\":\"x\","
+		"\"count\":12345},{\"name\":\"time_end\",\"type\":\"E\","
+		"\"count\":%d}]}\n", start, end);
+	fail_unless(!fclose(fp));
+}
+
+static struct conf **setup_confs(const char *cname, const char *dedup_group)
+{
+	struct conf **confs;
+	confs=confs_alloc();
+	confs_init(confs);
+	fail_unless(!conf_load_global_only_buf(MIN_SERVER_CONF
+		"max_backups=1\n", confs));
+	fail_unless(!set_string(confs[OPT_CNAME], cname));
+	fail_unless(!set_string(confs[OPT_DEDUP_GROUP], dedup_group));
+	return confs;
+}
+
+static void setup_sdirs(struct sdirs *sdirs, const char *current)
+{
+	memset(sdirs, 0, sizeof(struct sdirs));
+	sdirs->current=(char *)current;
+}
+
+START_TEST(test_backup_queue_previous)
+{
+	time_t last;
+	time_t took;
+	struct sdirs sdirs;
+	fail_unless(recursive_delete(BASE, "", 1)==0);
+	fail_unless(!mkdir(BASE, 0777));
+
+	setup_sdirs(&sdirs, BASE "/none");
+	fail_unless(!backup_queue_previous(&sdirs, &last, &took));
+	fail_unless(last==0 && took==0);
+
+	write_stats(BASE "/current", 1000, 1600);
+	setup_sdirs(&sdirs, BASE "/current");
+	fail_unless(!backup_queue_previous(&sdirs, &last, &took));
+	fail_unless(last==1600);
+	fail_unless(took==600);
+
+	fail_unless(recursive_delete(BASE, "", 1)==0);
+	fail_unless(free_count==alloc_count);
+}
+END_TEST
+
+START_TEST(test_backup_queue_admit)
+{
+	struct sdirs never;
+	struct sdirs big;
+	struct sdirs small;
+	struct conf **a=setup_confs("a", "g1");
+	struct conf **b=setup_confs("b", "g1");
+	struct conf **c=setup_confs("c", "g2");
+	fail_unless(recursive_delete(BASE, "", 1)==0);
+	fail_unless(!mkdir(BASE, 0777));
+	// 'b' finished at the same time as 'c', but took longer.
+	write_stats(BASE "/b", 1000, 5000);
+	write_stats(BASE "/c", 4000, 5000);
+	setup_sdirs(&never, BASE "/a");
+	setup_sdirs(&big, BASE "/b");
+	setup_sdirs(&small, BASE "/c");
+
+	// Nothing is held back without a queue.
+	fail_unless(backup_queue_admit(&small, c, 0)==1);
+	fail_unless(!backup_queue_init(a));
+
+	// With a free place and nobody waiting, the first one goes.
+	fail_unless(backup_queue_admit(&small, c, 0)==1);
+	// Now it is full.
+	fail_unless(backup_queue_admit(&big, b, 0)==0);
+	fail_unless(backup_queue_admit(&never, a, 0)==0);
+	fail_unless(backup_queue_retry()==600);
+	// Forced backups still go.
+	fail_unless(backup_queue_admit(&big, b, 1)==1);
+	backup_queue_release(getpid());
+
+	// The one that has never had a backup goes first, then the one that
+	// took longer.
+	fail_unless(backup_queue_admit(&big, b, 0)==0);
+	fail_unless(backup_queue_admit(&small, c, 0)==0);
+	fail_unless(backup_queue_admit(&never, a, 0)==1);
+	fail_unless(backup_queue_admit(&big, b, 0)==0);
+	backup_queue_release(getpid());
+	fail_unless(backup_queue_admit(&small, c, 0)==0);
+	fail_unless(backup_queue_admit(&big, b, 0)==1);
+	backup_queue_release(getpid());
+
+	// A client in a dedup group with nothing running goes before one in
+	// a group that has something running.
+	fail_unless(!set_int(a[OPT_MAX_BACKUPS], 2));
+	backup_queue_set_limits(a);
+	fail_unless(backup_queue_admit(&never, a, 1)==1);
+	fail_unless(backup_queue_admit(&big, b, 0)==0);
+	fail_unless(backup_queue_admit(&small, c, 0)==1);
+
+	backup_queue_phase4_begin();
+	backup_queue_phase4_end();
+
+	backup_queue_free();
+	confs_free(&a);
+	confs_free(&b);
+	confs_free(&c);
+	fail_unless(recursive_delete(BASE, "", 1)==0);
+	fail_unless(free_count==alloc_count);
+}
+END_TEST
+
+Suite *suite_server_backup_queue(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_backup_queue");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_backup_queue_previous);
+	tcase_add_test(tc_core, test_backup_queue_admit);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
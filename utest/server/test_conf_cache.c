@@ -0,0 +1,80 @@
+#include <check.h>
+#include <stdio.h>
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/strlist.h"
+#include "../../src/server/conf_cache.h"
+
+#define PATH	"utest_conf_cache"
+
+static void write_conf(const char *extra)
+{
+	FILE *fp;
+	fail_unless((fp=fopen(PATH, "wb"))!=NULL);
+	fprintf(fp, "%s%s", MIN_SERVER_CONF, extra);
+	fail_unless(!fclose(fp));
+}
+
+static struct conf **load(struct conf_cache *cache)
+{
+	struct conf **confs;
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	fail_unless(!conf_cache_load(cache, PATH, confs));
+	return confs;
+}
+
+START_TEST(test_conf_cache)
+{
+	struct conf **confs;
+	struct conf_cache *cache;
+	fail_unless((cache=conf_cache_alloc())!=NULL);
+
+	write_conf("max_children=7\nexclude=/a\nexclude=/b\n");
+	confs=load(cache);
+	fail_unless(get_int(confs[OPT_MAX_CHILDREN])==7);
+	fail_unless(!strcmp(get_string(confs[OPT_DIRECTORY]), "/a/directory"));
+	fail_unless(!strcmp(get_strlist(confs[OPT_EXCLUDE])->path, "/a"));
+	fail_unless(!strcmp(get_strlist(confs[OPT_EXCLUDE])->next->path, "/b"));
+	// Changing a copy leaves the cached one alone.
+	set_int(confs[OPT_MAX_CHILDREN], 3);
+	confs_free(&confs);
+	confs=load(cache);
+	fail_unless(get_int(confs[OPT_MAX_CHILDREN])==7);
+	confs_free(&confs);
+
+	// A changed file is read again.
+	write_conf("max_children=12\n");
+	confs=load(cache);
+	fail_unless(get_int(confs[OPT_MAX_CHILDREN])==12);
+	fail_unless(!get_strlist(confs[OPT_EXCLUDE]));
+	confs_free(&confs);
+
+	// A broken one is an error.
+	write_conf("hard_quota=1x\n");
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	fail_unless(conf_cache_load(cache, PATH, confs)==-1);
+	confs_free(&confs);
+
+	conf_cache_free(&cache);
+	fail_unless(!unlink(PATH));
+	fail_unless(free_count==alloc_count);
+}
+END_TEST
+
+Suite *suite_server_conf_cache(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_conf_cache");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_conf_cache);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,131 @@
+#include <check.h>
+#include <stdio.h>
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/conffile.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/strlist.h"
+#include "../../src/server/sdirs.h"
+#include "../../src/server/timer.h"
+#include "../../src/server/timestamp.h"
+
+#define BASE		"utest_timer"
+#define CLIENT		BASE "/utestclient"
+#define BACKUP		"0000001 2015-03-02 01:00:00"
+
+// Monday 2nd March 2015, local time.
+static time_t mon(int hour)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year=115;
+	tm.tm_mon=2;
+	tm.tm_mday=2;
+	tm.tm_hour=hour;
+	tm.tm_isdst=-1;
+	return mktime(&tm);
+}
+
+#define DAY	(60*60*24)
+
+START_TEST(test_timer_interval_secs)
+{
+	fail_unless(timer_interval_secs("30s")==30);
+	fail_unless(timer_interval_secs("5m")==5*60);
+	fail_unless(timer_interval_secs("20h")==20*60*60);
+	fail_unless(timer_interval_secs("2d")==2*DAY);
+	fail_unless(timer_interval_secs("1w")==7*DAY);
+	fail_unless(timer_interval_secs("1n")==30*DAY);
+	fail_unless(timer_interval_secs("20")==-1);
+	fail_unless(timer_interval_secs("h")==-1);
+	fail_unless(timer_interval_secs("20x")==-1);
+	fail_unless(timer_interval_secs("20hours")==-1);
+	fail_unless(timer_interval_secs(NULL)==-1);
+}
+END_TEST
+
+START_TEST(test_timer_in_timeband)
+{
+	struct strlist *t=NULL;
+	fail_unless(!timer_in_timeband(NULL, mon(3)));
+	fail_unless(!strlist_add(&t, "Sat,Sun,00,01,02,03", 0));
+	fail_unless(!timer_in_timeband(t, mon(3)));
+	fail_unless(!strlist_add(&t, "Mon,Tue,04,05", 0));
+	fail_unless(!timer_in_timeband(t, mon(3)));
+	fail_unless(timer_in_timeband(t, mon(5)));
+	// The hour has to come after the day.
+	strlists_free(&t);
+	fail_unless(!strlist_add(&t, "03,Mon", 0));
+	fail_unless(!timer_in_timeband(t, mon(3)));
+	strlists_free(&t);
+}
+END_TEST
+
+static struct conf **setup_confs(void)
+{
+	struct conf **confs;
+	confs=confs_alloc();
+	confs_init(confs);
+	fail_unless(!conf_load_global_only_buf(MIN_SERVER_CONF
+		"directory=" BASE "\n"
+		"timer_arg=20h\n"
+		"timer_arg=Mon,Tue,00,01,02,03,04,05\n", confs));
+	set_string(confs[OPT_CNAME], "utestclient");
+	set_e_protocol(confs[OPT_PROTOCOL], PROTO_1);
+	return confs;
+}
+
+START_TEST(test_timer_check)
+{
+	struct sdirs *sdirs;
+	struct conf **confs;
+	confs=setup_confs();
+	fail_unless(recursive_delete(BASE, "", 1)==0);
+	fail_unless((sdirs=sdirs_alloc())!=NULL);
+	fail_unless(sdirs_init(sdirs, confs)==0);
+	fail_unless(!mkdir(BASE, 0777));
+	fail_unless(!mkdir(CLIENT, 0777));
+
+	// No backup yet, so only the timeband matters.
+	fail_unless(timer_check(sdirs, confs, mon(3))==0);
+	fail_unless(timer_check(sdirs, confs, mon(12))==1);
+
+	fail_unless(!mkdir(CLIENT "/" BACKUP, 0777));
+	fail_unless(!symlink(BACKUP, sdirs->current));
+	fail_unless(!timestamp_write(CLIENT "/" BACKUP "/timestamp", BACKUP));
+
+	// Two hours after the last one is too soon, a day later is fine.
+	fail_unless(timer_check(sdirs, confs, mon(3))==1);
+	fail_unless(timer_check(sdirs, confs, mon(3)+DAY)==0);
+	fail_unless(timer_check(sdirs, confs, mon(12)+DAY)==1);
+
+	// The 'backup' file gets one regardless, and then goes.
+	fail_unless(!timestamp_write(CLIENT "/backup", "x"));
+	fail_unless(timer_check(sdirs, confs, mon(12))==0);
+	fail_unless(timer_check(sdirs, confs, mon(12))==1);
+
+	sdirs_free(&sdirs);
+	confs_free(&confs);
+	fail_unless(recursive_delete(BASE, "", 1)==0);
+	fail_unless(free_count==alloc_count);
+}
+END_TEST
+
+Suite *suite_server_timer(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_timer");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_timer_interval_secs);
+	tcase_add_test(tc_core, test_timer_in_timeband);
+	tcase_add_test(tc_core, test_timer_check);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -20,16 +20,26 @@
 extern int sub_ntests;
 
 Suite *suite_alloc(void);
+Suite *suite_asfd(void);
 Suite *suite_base64(void);
+Suite *suite_client_protocol2_blkcache(void);
 Suite *suite_cmd(void);
+Suite *suite_compadapt(void);
 Suite *suite_conf(void);
 Suite *suite_conffile(void);
 Suite *suite_hexmap(void);
 Suite *suite_lock(void);
 Suite *suite_pathcmp(void);
+Suite *suite_pgz(void);
+Suite *suite_ratelimit(void);
+Suite *suite_server_backup_queue(void);
+Suite *suite_server_conf_cache(void);
 Suite *suite_server_sdirs(void);
+Suite *suite_server_timer(void);
+Suite *suite_server_monitor_cntr_shm(void);
 Suite *suite_server_protocol1_dpth(void);
 Suite *suite_server_protocol1_fdirs(void);
 Suite *suite_server_protocol2_dpth(void);
+Suite *suite_server_protocol2_rblk(void);
 
 #endif
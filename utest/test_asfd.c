@@ -0,0 +1,289 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/asfd.h"
+#include "../src/async.h"
+#include "../src/conf.h"
+#include "../src/iobuf.h"
+
+static struct asfd *setup(struct conf ***confs, int fd,
+	size_t readbufsize, int view)
+{
+	struct asfd *asfd;
+	fail_unless((*confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(*confs));
+	fail_unless(!set_int((*confs)[OPT_NETWORK_READ_BUFFER_SIZE],
+		readbufsize));
+	fail_unless((asfd=asfd_alloc())!=NULL);
+	fail_unless(!asfd->init(asfd, "test", NULL, fd, NULL,
+		ASFD_STREAM_STANDARD, *confs));
+	asfd->rbuf_view=view;
+	return asfd;
+}
+
+static void tear_down(struct asfd **asfd, struct conf ***confs)
+{
+	// iobuf_free() does not free anything, so do it here.
+	struct iobuf *rbuf=(*asfd)->rbuf;
+	asfd_free(asfd);
+	free_v((void **)&rbuf);
+	confs_free(confs);
+	fail_unless(free_count==alloc_count);
+}
+
+static void write_msg(int fd, char cmd, const char *buf, size_t len)
+{
+	char head[6];
+	snprintf(head, sizeof(head), "%c%04X", cmd, (unsigned int)len);
+	fail_unless(write(fd, head, 5)==5);
+	fail_unless(write(fd, buf, len)==(ssize_t)len);
+}
+
+// What the async loop would do, without needing select().
+static int next_msg(struct asfd *asfd)
+{
+	if(asfd->parse_readbuf(asfd)) return -1;
+	while(!asfd->rbuf->buf)
+		if(asfd->do_read(asfd) || asfd->parse_readbuf(asfd))
+			return -1;
+	return 0;
+}
+
+static void run_messages(size_t readbufsize, int view)
+{
+	int i;
+	int fds[2];
+	pid_t pid;
+	char buf[8000];
+	struct asfd *asfd;
+	struct conf **confs;
+
+	fail_unless(!pipe(fds));
+	// More than fits in the pipe, so write from another process. The reads
+	// end part way through messages, and the unparsed part gets moved down.
+	fail_unless((pid=fork())>=0);
+	if(!pid)
+	{
+		close(fds[0]);
+		for(i=0; i<40; i++)
+		{
+			memset(buf, 'a'+i%26, sizeof(buf));
+			write_msg(fds[1], CMD_DATA, buf, 1000+i*170);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	asfd=setup(&confs, fds[0], readbufsize, view);
+
+	for(i=0; i<40; i++)
+	{
+		fail_unless(!next_msg(asfd));
+		fail_unless(asfd->rbuf->cmd==CMD_DATA);
+		fail_unless(asfd->rbuf->len==(size_t)(1000+i*170));
+		fail_unless(asfd->rbuf->buf[0]=='a'+i%26);
+		fail_unless(asfd->rbuf->buf[asfd->rbuf->len-1]=='a'+i%26);
+		fail_unless(asfd->rbuf->buf[asfd->rbuf->len]=='\0');
+		asfd->rbuf_release(asfd);
+	}
+	fail_unless(asfd->readbufstart==asfd->readbuflen);
+
+	fail_unless(waitpid(pid, NULL, 0)==pid);
+	tear_down(&asfd, &confs);
+}
+
+START_TEST(test_asfd_copy)
+{
+	run_messages(0, 0);
+}
+END_TEST
+
+START_TEST(test_asfd_view)
+{
+	run_messages(0, 1);
+}
+END_TEST
+
+START_TEST(test_asfd_view_big_buffer)
+{
+	run_messages(1024*1024, 1);
+}
+END_TEST
+
+START_TEST(test_asfd_view_keeps_next_message)
+{
+	int fds[2];
+	struct asfd *asfd;
+	struct conf **confs;
+
+	fail_unless(!pipe(fds));
+	asfd=setup(&confs, fds[0], 0, 1);
+	write_msg(fds[1], CMD_GEN, "one", 3);
+	write_msg(fds[1], CMD_GEN, "two", 3);
+
+	fail_unless(!next_msg(asfd));
+	// The nul on the end of the view is where the next header starts.
+	fail_unless(!strcmp(asfd->rbuf->buf, "one"));
+	asfd->rbuf_release(asfd);
+	fail_unless(!next_msg(asfd));
+	fail_unless(asfd->rbuf->cmd==CMD_GEN);
+	fail_unless(!strcmp(asfd->rbuf->buf, "two"));
+	asfd->rbuf_release(asfd);
+
+	close(fds[1]);
+	tear_down(&asfd, &confs);
+}
+END_TEST
+
+START_TEST(test_asfd_bad_header)
+{
+	int fds[2];
+	struct asfd *asfd;
+	struct conf **confs;
+
+	fail_unless(!pipe(fds));
+	asfd=setup(&confs, fds[0], 0, 0);
+	fail_unless(write(fds[1], "c00G1x", 6)==6);
+	fail_unless(next_msg(asfd)==-1);
+
+	close(fds[1]);
+	tear_down(&asfd, &confs);
+}
+END_TEST
+
+static void write_all(struct asfd *asfd, enum cmd cmd,
+	const char *buf, size_t len)
+{
+	struct iobuf wbuf;
+	iobuf_set(&wbuf, cmd, (char *)buf, len);
+	while(wbuf.len)
+	{
+		fail_unless(asfd->append_all_to_write_buffer(asfd, &wbuf)
+			!=APPEND_ERROR);
+		while(asfd->writebuflen)
+			fail_unless(!asfd->do_write(asfd));
+	}
+}
+
+START_TEST(test_asfd_large_frames)
+{
+	int fds[2];
+	pid_t pid;
+	size_t len=300000;
+	char *buf;
+	struct asfd *asfd;
+	struct conf **confs;
+
+	fail_unless(!pipe(fds));
+	fail_unless((buf=(char *)malloc(len))!=NULL);
+	memset(buf, 'z', len);
+	buf[len-1]='y';
+	fail_unless((pid=fork())>=0);
+	if(!pid)
+	{
+		close(fds[0]);
+		asfd=setup(&confs, fds[1], 0, 0);
+		fail_unless(!asfd->set_frame_len(asfd, len));
+		write_all(asfd, CMD_APPEND, buf, len);
+		// Other commands still get the standard header.
+		write_all(asfd, CMD_GEN, "small", 5);
+		write_all(asfd, CMD_DATA, buf, 1000);
+		_exit(0);
+	}
+	close(fds[1]);
+	asfd=setup(&confs, fds[0], 0, 1);
+	fail_unless(!asfd->set_frame_len(asfd, len));
+
+	fail_unless(!next_msg(asfd));
+	fail_unless(asfd->rbuf->cmd==CMD_APPEND);
+	fail_unless(asfd->rbuf->len==len);
+	fail_unless(!memcmp(asfd->rbuf->buf, buf, len));
+	asfd->rbuf_release(asfd);
+	fail_unless(!next_msg(asfd));
+	fail_unless(asfd->rbuf->cmd==CMD_GEN);
+	fail_unless(!strcmp(asfd->rbuf->buf, "small"));
+	asfd->rbuf_release(asfd);
+	fail_unless(!next_msg(asfd));
+	fail_unless(asfd->rbuf->cmd==CMD_DATA);
+	fail_unless(asfd->rbuf->len==1000);
+	asfd->rbuf_release(asfd);
+
+	fail_unless(waitpid(pid, NULL, 0)==pid);
+	free(buf);
+	tear_down(&asfd, &confs);
+}
+END_TEST
+
+static void bad_large_frame(size_t frame_len, const char *head)
+{
+	int fds[2];
+	struct asfd *asfd;
+	struct conf **confs;
+
+	fail_unless(!pipe(fds));
+	asfd=setup(&confs, fds[0], 0, 0);
+	if(frame_len) fail_unless(!asfd->set_frame_len(asfd, frame_len));
+	fail_unless(write(fds[1], head, 6)==6);
+	fail_unless(next_msg(asfd)==-1);
+
+	close(fds[1]);
+	tear_down(&asfd, &confs);
+}
+
+START_TEST(test_asfd_large_frame_not_agreed)
+{
+	bad_large_frame(0, "a+\x00\x00\x01\x00");
+}
+END_TEST
+
+START_TEST(test_asfd_large_frame_too_big)
+{
+	bad_large_frame(100000, "a+\x00\x10\x00\x00");
+}
+END_TEST
+
+START_TEST(test_asfd_frame_len_range)
+{
+	int fds[2];
+	struct asfd *asfd;
+	struct conf **confs;
+
+	fail_unless(!pipe(fds));
+	asfd=setup(&confs, fds[0], 0, 0);
+	fail_unless(asfd->frame_len==ASYNC_BUF_LEN);
+	fail_unless(asfd->set_frame_len(asfd, ASYNC_BUF_LEN-1)==-1);
+	fail_unless(asfd->set_frame_len(asfd, ASFD_FRAME_LEN_MAX+1)==-1);
+	fail_unless(!asfd->set_frame_len(asfd, ASFD_FRAME_LEN_MAX));
+	fail_unless(asfd->readbufmax>=ASFD_FRAME_LEN_MAX*2);
+
+	close(fds[1]);
+	tear_down(&asfd, &confs);
+}
+END_TEST
+
+Suite *suite_asfd(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("asfd");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_asfd_copy);
+	tcase_add_test(tc_core, test_asfd_view);
+	tcase_add_test(tc_core, test_asfd_view_big_buffer);
+	tcase_add_test(tc_core, test_asfd_view_keeps_next_message);
+	tcase_add_test(tc_core, test_asfd_bad_header);
+	tcase_add_test(tc_core, test_asfd_large_frames);
+	tcase_add_test(tc_core, test_asfd_large_frame_not_agreed);
+	tcase_add_test(tc_core, test_asfd_large_frame_too_big);
+	tcase_add_test(tc_core, test_asfd_frame_len_range);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
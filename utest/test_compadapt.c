@@ -0,0 +1,131 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/compadapt.h"
+
+#define LEN	COMPADAPT_SAMPLE_LEN
+
+START_TEST(test_compadapt_text)
+{
+	size_t i;
+	uint8_t buf[LEN];
+	for(i=0; i<LEN; i++) buf[i]="/some/path/to/a/file\n"[i%21];
+	fail_unless(compadapt_worthwhile(buf, LEN)==1);
+}
+END_TEST
+
+START_TEST(test_compadapt_random)
+{
+	size_t i;
+	uint8_t buf[LEN];
+	unsigned int seed=1;
+	for(i=0; i<LEN; i++)
+	{
+		seed=seed*1103515245+12345;
+		buf[i]=(seed>>16)&0xff;
+	}
+	fail_unless(compadapt_worthwhile(buf, LEN)==0);
+	// Too little to bother deciding.
+	fail_unless(compadapt_worthwhile(buf, 100)==1);
+}
+END_TEST
+
+START_TEST(test_compadapt_levels)
+{
+	int i;
+	struct compadapt ca;
+	compadapt_init(&ca, 9);
+
+	// Compressing is slower than sending, so the level comes down, but
+	// only after a few chunks, and never below 1.
+	for(i=0; i<7; i++)
+		fail_unless(!compadapt_update(&ca, 0.02, 0.01));
+	fail_unless(compadapt_update(&ca, 0.02, 0.01)==1);
+	fail_unless(ca.level==8);
+	for(i=0; i<8*20; i++)
+		compadapt_update(&ca, 0.02, 0.01);
+	fail_unless(ca.level==1);
+
+	// About even, so it stays where it is.
+	for(i=0; i<8*4; i++)
+		fail_unless(!compadapt_update(&ca, 0.01, 0.015));
+	fail_unless(ca.level==1);
+
+	// The network is the slow part, so it goes back up, but no further
+	// than it started.
+	for(i=0; i<8*20; i++)
+		compadapt_update(&ca, 0.01, 0.05);
+	fail_unless(ca.level==9);
+}
+END_TEST
+
+START_TEST(test_compadapt_apply)
+{
+	size_t i;
+	size_t got;
+	z_stream strm;
+	z_stream back;
+	struct compadapt ca;
+	uint8_t in[LEN];
+	uint8_t out[LEN*3];
+	uint8_t check[LEN*3];
+
+	for(i=0; i<LEN; i++) in[i]="/some/path/to/a/file\n"[i%21]+i/4096;
+
+	memset(&strm, 0, sizeof(strm));
+	fail_unless(deflateInit2(&strm, 9, Z_DEFLATED, 15+16, 8,
+		Z_DEFAULT_STRATEGY)==Z_OK);
+	compadapt_init(&ca, 9);
+	strm.next_out=out;
+	strm.avail_out=sizeof(out);
+
+	// Change the level part way through each of three lots of input.
+	for(i=0; i<3; i++)
+	{
+		strm.next_in=in;
+		strm.avail_in=LEN;
+		ca.level=i%2?9:1;
+		compadapt_apply(&ca, &strm);
+		fail_unless(ca.applied==ca.level);
+		fail_unless(strm.avail_in==LEN);
+		fail_unless(deflate(&strm, i==2?Z_FINISH:Z_NO_FLUSH)!=
+			Z_STREAM_ERROR);
+		fail_unless(!strm.avail_in);
+	}
+	got=sizeof(out)-strm.avail_out;
+	fail_unless(deflateEnd(&strm)==Z_OK);
+
+	memset(&back, 0, sizeof(back));
+	fail_unless(inflateInit2(&back, 15+16)==Z_OK);
+	back.next_in=out;
+	back.avail_in=got;
+	back.next_out=check;
+	back.avail_out=sizeof(check);
+	fail_unless(inflate(&back, Z_FINISH)==Z_STREAM_END);
+	fail_unless(back.total_out==LEN*3);
+	for(i=0; i<3; i++)
+		fail_unless(!memcmp(check+i*LEN, in, LEN));
+	inflateEnd(&back);
+}
+END_TEST
+
+Suite *suite_compadapt(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("compadapt");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_compadapt_text);
+	tcase_add_test(tc_core, test_compadapt_random);
+	tcase_add_test(tc_core, test_compadapt_levels);
+	tcase_add_test(tc_core, test_compadapt_apply);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
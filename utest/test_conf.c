@@ -28,6 +28,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_SSL_PEER_CN:
 		case OPT_SSL_CIPHERS:
 		case OPT_SSL_DHFILE:
+		case OPT_SSL_SESSION_CACHE:
 		case OPT_CA_CONF:
 		case OPT_CA_NAME:
 		case OPT_CA_SERVER_NAME:
@@ -77,10 +78,23 @@ static void check_default(struct conf **c, enum conf_opt o)
 			fail_unless(get_string(c[o])==NULL);
 			break;
 		case OPT_RATELIMIT:
+		case OPT_SERVER_RATELIMIT:
 			fail_unless(get_float(c[o])==0);
 			break;
 		case OPT_CLIENT_IS_WINDOWS:
 		case OPT_RANDOMISE:
+		case OPT_DELTA_THREADS:
+		case OPT_COMPRESSION_ADAPTIVE:
+		case OPT_RESTORE_DEDUP:
+		case OPT_RESTORE_DELTA:
+		case OPT_RESTORE_SPARSE:
+		case OPT_RESTORE_THREADS:
+		case OPT_PREFORK:
+		case OPT_MAX_BACKUPS:
+		case OPT_MAX_PHASE4:
+		case OPT_BACKUP_QUEUE_WAIT:
+		case OPT_BACKUP_QUEUE:
+		case OPT_CHAMP_FRESHNESS:
 		case OPT_B_SCRIPT_POST_RUN_ON_FAIL:
 		case OPT_R_SCRIPT_POST_RUN_ON_FAIL:
 		case OPT_SEND_CLIENT_CNTR:
@@ -93,6 +107,9 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_S_SCRIPT_POST_NOTIFY:
 		case OPT_S_SCRIPT_NOTIFY:
 		case OPT_HARDLINKED_ARCHIVE:
+		case OPT_COMPRESSION_THREADS:
+		case OPT_NETWORK_READ_BUFFER_SIZE:
+		case OPT_NETWORK_FRAME_SIZE:
         	case OPT_N_SUCCESS_WARNINGS_ONLY:
         	case OPT_N_SUCCESS_CHANGES_ONLY:
 		case OPT_CROSS_ALL_FILESYSTEMS:
@@ -127,6 +144,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 			fail_unless(get_int(c[o])==1);
 			break;
 		case OPT_NETWORK_TIMEOUT:
+		case OPT_SSL_SESSION_TIMEOUT:
 			fail_unless(get_int(c[o])==60*60*2);
 			break;
 		case OPT_SSL_COMPRESSION:
@@ -143,6 +161,9 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_MAX_HARDLINKS:
 			fail_unless(get_int(c[o])==10000);
 			break;
+		case OPT_BACKUP_QUEUE_RETRY:
+			fail_unless(get_int(c[o])==60*10);
+			break;
 		case OPT_UMASK:
 			fail_unless(get_mode_t(c[o])==0022);
 			break;
@@ -182,6 +203,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 			break;
 		case OPT_HARD_QUOTA:
 		case OPT_SOFT_QUOTA:
+		case OPT_MONITOR_BROWSE_CACHE_MEMORY:
 		case OPT_MIN_FILE_SIZE:
 		case OPT_MAX_FILE_SIZE:
 			fail_unless(get_ssize_t(c[o])==0);
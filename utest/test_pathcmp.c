@@ -66,6 +66,31 @@ START_TEST(test_is_subdir)
 }
 END_TEST
 
+static struct data d[] = {
+	{ 0,		NULL,		NULL },
+	{ 0,		"",		"/a" },
+	{ 0,		"/a/b",		NULL },
+	{ 0,		"/a/b",		"/a" },
+	{ 0,		"/a/b",		"/a/a/z" },
+	{ 0,		"/a/b",		"/a/b" },
+	{ 0,		"/a/b",		"/a/b/c" },
+	{ 0,		"/a/b",		"/a/b/c/d" },
+	{ 1,		"/a/b",		"/a/b!" },
+	{ 1,		"/a/b",		"/a/bc" },
+	{ 1,		"/a/b",		"/a/c" },
+	{ 0,		"/a/b/",	"/a/b/c" },
+	{ 1,		"/a/b/",	"/a/c" },
+	{ 0,		"/",		"/a/b" },
+	{ 0,		"C:",		"C:/Program Files" },
+	{ 1,		"C:",		"D:/" },
+};
+
+START_TEST(test_is_past_subdir)
+{
+	FOREACH(d) fail_unless(is_past_subdir(d[i].a, d[i].b)==d[i].expected);
+}
+END_TEST
+
 Suite *suite_pathcmp(void)
 {
 	Suite *s;
@@ -77,6 +102,7 @@ Suite *suite_pathcmp(void)
 
 	tcase_add_test(tc_core, test_pathcmp);
 	tcase_add_test(tc_core, test_is_subdir);
+	tcase_add_test(tc_core, test_is_past_subdir);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,114 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/pgz.h"
+
+#define PATH	"utest_pgz.gz"
+
+// Text with some repetition, so that the blocks actually compress and refer
+// back to the dictionary.
+static unsigned char *make_data(size_t len)
+{
+	size_t i;
+	unsigned char *data;
+	unsigned int seed=1;
+	fail_unless((data=(unsigned char *)malloc(len+1))!=NULL);
+	for(i=0; i<len; i++)
+	{
+		seed=seed*1103515245+12345;
+		if(i%64<48) data[i]="/some/path/to/a/file\n"[i%21];
+		else data[i]=(seed>>16)&0xff;
+	}
+	return data;
+}
+
+static void write_and_check(size_t len, int threads, size_t chunk)
+{
+	size_t off;
+	size_t got;
+	gzFile zp;
+	struct pgz *pgz;
+	unsigned char *data;
+	unsigned char *back;
+
+	data=make_data(len);
+	fail_unless((back=(unsigned char *)malloc(len+1))!=NULL);
+
+	fail_unless((pgz=pgz_open(PATH, 9, threads))!=NULL);
+	for(off=0; off<len; off+=chunk)
+	{
+		size_t w=len-off<chunk?len-off:chunk;
+		fail_unless(pgz_write(pgz, data+off, w)==w);
+	}
+	fail_unless(pgz_tell(pgz)==(off_t)len);
+	fail_unless(!pgz_close(&pgz));
+	fail_unless(pgz==NULL);
+
+	// zlib checks the crc and length in the trailer.
+	fail_unless((zp=gzopen(PATH, "rb"))!=NULL);
+	got=gzread(zp, back, len+1);
+	fail_unless(got==len);
+	fail_unless(gzeof(zp));
+	fail_unless(gzclose(zp)==Z_OK);
+	fail_unless(!memcmp(data, back, len));
+
+	free(data);
+	free(back);
+	unlink(PATH);
+	fail_unless(free_count==alloc_count);
+}
+
+START_TEST(test_pgz_empty)
+{
+	write_and_check(0, 2, 1);
+}
+END_TEST
+
+START_TEST(test_pgz_small)
+{
+	write_and_check(100, 2, 7);
+}
+END_TEST
+
+START_TEST(test_pgz_one_block)
+{
+	write_and_check(PGZ_BLOCK_LEN, 2, 4096);
+}
+END_TEST
+
+START_TEST(test_pgz_one_thread)
+{
+	write_and_check(PGZ_BLOCK_LEN*3+17, 1, 65536);
+}
+END_TEST
+
+START_TEST(test_pgz_many_blocks)
+{
+	// More blocks than the ring holds, so that it wraps around.
+	write_and_check(PGZ_BLOCK_LEN*20+12345, 4, 100000);
+}
+END_TEST
+
+Suite *suite_pgz(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("pgz");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_pgz_empty);
+	tcase_add_test(tc_core, test_pgz_small);
+	tcase_add_test(tc_core, test_pgz_one_block);
+	tcase_add_test(tc_core, test_pgz_one_thread);
+	tcase_add_test(tc_core, test_pgz_many_blocks);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,103 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/ratelimit.h"
+
+// 1MB a second, so a tenth of a second's burst is 104857 bytes.
+#define RATE	(1024*1024)
+
+START_TEST(test_ratelimit_off)
+{
+	struct ratelimit rl;
+	ratelimit_init(&rl, 0);
+	ratelimit_used(&rl, 100000000);
+	fail_unless(!ratelimit_wait(&rl));
+}
+END_TEST
+
+START_TEST(test_ratelimit_burst)
+{
+	struct ratelimit rl;
+	ratelimit_init(&rl, RATE);
+	fail_unless(ratelimit_burst(&rl)==RATE/10);
+	// Starts off with a full allowance.
+	fail_unless(!ratelimit_wait(&rl));
+	ratelimit_used(&rl, RATE/20);
+	fail_unless(!ratelimit_wait(&rl));
+}
+END_TEST
+
+START_TEST(test_ratelimit_debt)
+{
+	long wait;
+	struct ratelimit rl;
+	ratelimit_init(&rl, RATE);
+	// A second over the allowance means about a second to wait.
+	ratelimit_used(&rl, RATE/10+RATE);
+	wait=ratelimit_wait(&rl);
+	fail_unless(wait>900000 && wait<=1100000);
+}
+END_TEST
+
+START_TEST(test_ratelimit_refills)
+{
+	long wait;
+	struct ratelimit rl;
+	ratelimit_init(&rl, RATE);
+	ratelimit_used(&rl, RATE/10);
+	fail_unless((wait=ratelimit_wait(&rl))>0);
+	fail_unless(wait<=30000);
+	ratelimit_sleep(wait);
+	fail_unless(!ratelimit_wait(&rl));
+}
+END_TEST
+
+START_TEST(test_ratelimit_shared)
+{
+	int status;
+	pid_t pid;
+	struct ratelimit *shared;
+	fail_unless(!ratelimit_shared_init(RATE));
+	fail_unless((shared=ratelimit_shared())!=NULL);
+	fail_unless(!ratelimit_wait(shared));
+	// What a child uses comes out of the same allowance.
+	switch((pid=fork()))
+	{
+		case -1: fail_unless(0==1); break;
+		case 0:
+			ratelimit_used(ratelimit_shared(), RATE);
+			_exit(0);
+		default: break;
+	}
+	fail_unless(waitpid(pid, &status, 0)==pid);
+	fail_unless(WIFEXITED(status) && !WEXITSTATUS(status));
+	fail_unless(ratelimit_wait(shared)>800000);
+	// Turning it off lets everything through straight away.
+	ratelimit_set_rate(shared, 0);
+	fail_unless(!ratelimit_wait(shared));
+	ratelimit_shared_free();
+	fail_unless(ratelimit_shared()==NULL);
+}
+END_TEST
+
+Suite *suite_ratelimit(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("ratelimit");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_ratelimit_off);
+	tcase_add_test(tc_core, test_ratelimit_burst);
+	tcase_add_test(tc_core, test_ratelimit_debt);
+	tcase_add_test(tc_core, test_ratelimit_refills);
+	tcase_add_test(tc_core, test_ratelimit_shared);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}